@@ -0,0 +1,436 @@
+#ifndef CAN_CODEC_H
+#define CAN_CODEC_H
+
+/*
+ * Fixed-point CAN frame layouts shared by the REF board (Core-STM32F4-fw)
+ * and the stepper drivers (Ctrl-Step-Driver-STM32F1-fw).
+ *
+ * Motor side units, same as the float commands:
+ *   position  int24, 1/65536 turn      -> +-128 turn, 0.0055 deg
+ *   velocity  int16, 1/1024 turn/s     -> +-32 turn/s
+ *   current   int16, mA
+ *
+ * Byte 0 of every compact frame is a status byte, its upper nibble carries
+ * CAN_CODEC_VERSION. A receiver ignores frames of a version it doesn't know.
+ *
+ *   0x0B  Set Position with Velocity-Limit   Core -> Driver
+ *         [0] status  [1..3] position  [4..5] velocity limit  [6..7] 0
+ *   0x25  State                              Driver -> Core (also a request)
+ *         [0] status  [1..3] position  [4..5] velocity  [6..7] current
+ *   0x26  State, same layout as 0x25         Driver -> Core, unrequested
+ *         every period set by 0x1C, each node in its own slot of the period
+ *
+ *   0x0C  Trajectory Clock                   Core -> Driver, usually to node 0
+ *         [0] status  [1..4] clock, uint32  [5..7] 0
+ *         sets the driver's trajectory clock, which counts 20kHz ticks
+ *   0x0D  Trajectory Point                   Core -> Driver
+ *         [0] status  [1..3] position  [4..5] velocity  [6..7] time
+ *         time is the low 16 bits of the clock the point is due at, within
+ *         CAN_TRAJECTORY_MAX_LEAD ticks ahead. CAN_TRAJECTORY_FLUSH drops the
+ *         queued points first, CAN_STATUS_NEED_ACK asks for a 0x28 reply
+ *   0x28  Trajectory Buffer                  Driver -> Core (also a request)
+ *         [0] status  [1] free points  [2..3] rejected points  [4..7] clock
+ *
+ *   0x1E  Start DCE Auto-Tune                Core -> Driver
+ *         excites the joint in place for a fraction of a second, the driver
+ *         stores the gains it finds
+ *   0x29  DCE Auto-Tune                      Driver -> Core (also a request)
+ *         [0] item  [1] CAN_DCE_TUNE_* state, then for the item asked for:
+ *         CAN_DCE_TUNE_INERTIA~BANDWIDTH  [2..5] float
+ *         CAN_DCE_TUNE_GAINS              [2..3] kp  [4..5] ki  [6..7] kd, uint16
+ *
+ *   0x10  Set Collision Detection            Core -> Driver
+ *         [0] threshold, sigma/4, 0 disables  [1] trip time, ms
+ *         [2..3] follow error floor, steps  [4] store to EEPROM, 0 or 1
+ *         [5..6] current floor, mA  [7] 0, all unsigned. Frames with
+ *         anything else in [4] or [7] are dropped
+ *   0x2A  Collision                          Driver -> Core, unrequested
+ *         [0] status  [1..3] position  [4..5] follow error deviation, steps
+ *         [6..7] current deviation, mA. Sent once as the driver trips and
+ *         stalls, the Core stops the other joints
+ *
+ *   0x70  Heartbeat                          Driver -> all, every CAN_HEARTBEAT_PERIOD_MS
+ *         [0..5] serial number  [6] stored node ID, 0 if none  [7] 0
+ *         sent with the node ID being claimed, see the Core's interface_can.cpp
+ *
+ * Group setpoints are broadcast to node 0 and have no room for a version:
+ *   0x08/0x09  three signed 21-bit positions (1/8192 turn, +-128 turn) for
+ *              joints 1~3/4~6, bit 63 of 0x09 requests a 0x25 state reply
+ *   0x0A       six unsigned 10-bit velocity limits (1/64 turn/s)
+ *
+ * Multi-byte fields are little-endian, the group fields are packed LSB first.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define CAN_CODEC_VERSION           1
+
+#define CAN_POSITION_BITS           24
+#define CAN_POSITION_FRAC_BITS      16
+#define CAN_VELOCITY_BITS           16
+#define CAN_VELOCITY_FRAC_BITS      10
+#define CAN_CURRENT_BITS            16
+
+#define CAN_GROUP_POSITION_BITS     21
+#define CAN_GROUP_POSITION_FRAC_BITS 13
+#define CAN_GROUP_VELOCITY_BITS     10
+#define CAN_GROUP_VELOCITY_FRAC_BITS 6
+#define CAN_GROUP_JOINTS_PER_FRAME  3
+
+#define CAN_STATUS_FINISHED         (1U << 0)
+#define CAN_STATUS_ENABLED          (1U << 1)
+#define CAN_STATUS_STALLED          (1U << 2)
+#define CAN_STATUS_NEED_ACK         (1U << 3)   // Setpoints only: reply with a state frame
+#define CAN_TRAJECTORY_FLUSH        (1U << 0)   // Trajectory points only: drop the queued ones
+#define CAN_STATUS_FLAGS_MASK       0x0FU
+#define CAN_STATUS_VERSION_SHIFT    4
+
+#define CAN_CMD_HEARTBEAT           0x70
+#define CAN_NODE_ID_COUNT           16      // 4-bit node IDs, 0 addresses every node
+#define CAN_NODE_ID_DYNAMIC_FIRST   8       // Drivers without a stored ID pick from 8~15
+#define CAN_HEARTBEAT_PERIOD_MS     250
+#define CAN_NODE_ID_WINDOW_MS       1000    // "Within the last second" of the negotiation rules
+
+#define CAN_TRAJECTORY_CLOCK_HZ     20000
+#define CAN_TRAJECTORY_MAX_LEAD     32767   // ticks, what the 16-bit point time can reach
+
+#define CAN_DCE_TUNE_IDLE           0
+#define CAN_DCE_TUNE_RUNNING        1
+#define CAN_DCE_TUNE_ANALYZING      2
+#define CAN_DCE_TUNE_DONE           3
+#define CAN_DCE_TUNE_FAILED         4
+#define CAN_DCE_TUNE_INERTIA        0x00    // mA per turn/s^2, motor side
+#define CAN_DCE_TUNE_STIFFNESS      0x01    // mA per turn
+#define CAN_DCE_TUNE_DAMPING        0x02    // mA per turn/s
+#define CAN_DCE_TUNE_DELAY          0x03    // s
+#define CAN_DCE_TUNE_BANDWIDTH      0x04    // Hz, of the tuned position loop
+#define CAN_DCE_TUNE_GAINS          0x10
+
+typedef struct
+{
+    int32_t position;   // Fixed-point, CAN_POSITION_FRAC_BITS
+    int32_t velocity;   // Fixed-point, CAN_VELOCITY_FRAC_BITS
+    uint8_t flags;      // CAN_STATUS_*
+} CanSetPoint_t;
+
+typedef struct
+{
+    int32_t position;   // Fixed-point, CAN_POSITION_FRAC_BITS
+    int32_t velocity;   // Fixed-point, CAN_VELOCITY_FRAC_BITS
+    int32_t current;    // mA
+    uint8_t flags;      // CAN_STATUS_*
+} CanState_t;
+
+
+typedef struct
+{
+    int32_t position;   // Fixed-point, CAN_POSITION_FRAC_BITS
+    int32_t velocity;   // Fixed-point, CAN_VELOCITY_FRAC_BITS
+    uint16_t time;      // Low 16 bits of the trajectory clock
+    uint8_t flags;      // CAN_TRAJECTORY_FLUSH, CAN_STATUS_NEED_ACK
+} CanTrajectoryPoint_t;
+
+typedef struct
+{
+    uint8_t freePoints;
+    uint16_t rejectedPoints;
+    uint32_t clock;
+    uint8_t flags;      // CAN_STATUS_*
+} CanTrajectoryStatus_t;
+
+typedef struct
+{
+    uint8_t threshold;      // sigma/4, 0 disables
+    uint8_t tripTime;       // ms
+    uint16_t errorFloor;    // steps
+    uint16_t currentFloor;  // mA
+    bool store;
+} CanCollisionConfig_t;
+
+typedef struct
+{
+    int32_t position;           // Fixed-point, CAN_POSITION_FRAC_BITS
+    int32_t errorDeviation;     // steps
+    int32_t currentDeviation;   // mA
+    uint8_t flags;              // CAN_STATUS_*
+} CanCollision_t;
+
+typedef struct
+{
+    int32_t mul;        // fixed = steps * mul >> shift, see CanMakeStepScale()
+    uint8_t shift;
+} CanStepScale_t;
+
+
+/*---------------------------------- Conversions --------------------------------------*/
+
+static inline int32_t CanSaturate(int64_t _val, uint8_t _bits)
+{
+    int64_t max = ((int64_t) 1 << (_bits - 1)) - 1;
+    if (_val > max) return (int32_t) max;
+    if (_val < -max - 1) return (int32_t) (-max - 1);
+    return (int32_t) _val;
+}
+
+// @brief Float turns (or turn/s) to a rounded, saturated fixed-point value.
+static inline int32_t CanTurnsToFixed(float _turns, uint8_t _fracBits, uint8_t _bits)
+{
+    float scaled = _turns * (float) (1L << _fracBits);
+    return CanSaturate((int64_t) (scaled < 0 ? scaled - 0.5f : scaled + 0.5f), _bits);
+}
+
+static inline float CanFixedToTurns(int32_t _fixed, uint8_t _fracBits)
+{
+    return (float) _fixed / (float) (1L << _fracBits);
+}
+
+// @brief Works out steps to fixed-point as a multiply and a shift, once, so
+// CanStepsToFixed() needs no 64-bit division in the driver's control tick.
+static inline CanStepScale_t CanMakeStepScale(int32_t _stepsPerTurn, uint8_t _fracBits)
+{
+    // As many extra fraction bits as keep mul below 2^30
+    CanStepScale_t scale = {0, 0};
+    while (_fracBits + scale.shift < 62 &&
+           ((int64_t) 1 << (_fracBits + scale.shift + 1)) / _stepsPerTurn < ((int64_t) 1 << 30))
+        scale.shift++;
+    int64_t num = (int64_t) 1 << (_fracBits + scale.shift);
+    scale.mul = (int32_t) ((num + _stepsPerTurn / 2) / _stepsPerTurn);
+    return scale;
+}
+
+// @brief Integer-only versions for the driver, which counts in steps.
+// Rounds to the nearest fixed-point value.
+static inline int32_t CanStepsToFixed(int32_t _steps, const CanStepScale_t* _scale, uint8_t _bits)
+{
+    int64_t scaled = (int64_t) _steps * _scale->mul;
+    if (_scale->shift > 0)
+        scaled = (scaled + ((int64_t) 1 << (_scale->shift - 1))) >> _scale->shift;
+    return CanSaturate(scaled, _bits);
+}
+
+static inline int32_t CanFixedToSteps(int32_t _fixed, int32_t _stepsPerTurn, uint8_t _fracBits)
+{
+    return (int32_t) (((int64_t) _fixed * _stepsPerTurn) / ((int64_t) 1 << _fracBits));
+}
+
+
+/*------------------------------------ Fields -----------------------------------------*/
+
+static inline void CanPutInt(uint8_t* _data, int32_t _val, uint8_t _bytes)
+{
+    for (uint8_t i = 0; i < _bytes; i++)
+        _data[i] = (uint8_t) ((uint32_t) _val >> (8 * i));
+}
+
+static inline int32_t CanGetInt(const uint8_t* _data, uint8_t _bytes)
+{
+    uint32_t raw = 0;
+    for (uint8_t i = 0; i < _bytes; i++)
+        raw |= (uint32_t) _data[i] << (8 * i);
+    // Sign extend
+    uint8_t shift = 32 - 8 * _bytes;
+    return (int32_t) (raw << shift) >> shift;
+}
+
+static inline uint8_t CanStatusByte(uint8_t _flags)
+{
+    return (uint8_t) ((CAN_CODEC_VERSION << CAN_STATUS_VERSION_SHIFT) | (_flags & CAN_STATUS_FLAGS_MASK));
+}
+
+static inline bool CanStatusVersionOk(uint8_t _status)
+{
+    return (_status >> CAN_STATUS_VERSION_SHIFT) == CAN_CODEC_VERSION;
+}
+
+// @brief Packs/extracts field _index of width _bits from a whole 8-byte frame.
+static inline void CanSetField(uint8_t* _data, uint8_t _index, uint8_t _bits, uint32_t _val)
+{
+    uint64_t raw;
+    memcpy(&raw, _data, sizeof(raw));
+    uint64_t mask = (((uint64_t) 1 << _bits) - 1) << (_index * _bits);
+    raw = (raw & ~mask) | (((uint64_t) _val << (_index * _bits)) & mask);
+    memcpy(_data, &raw, sizeof(raw));
+}
+
+static inline uint32_t CanGetField(const uint8_t* _data, uint8_t _index, uint8_t _bits)
+{
+    uint64_t raw;
+    memcpy(&raw, _data, sizeof(raw));
+    return (uint32_t) (raw >> (_index * _bits)) & (uint32_t) (((uint64_t) 1 << _bits) - 1);
+}
+
+static inline int32_t CanGetSignedField(const uint8_t* _data, uint8_t _index, uint8_t _bits)
+{
+    int32_t val = (int32_t) CanGetField(_data, _index, _bits);
+    if (val & (1L << (_bits - 1)))
+        val -= (1L << _bits);
+    return val;
+}
+
+
+/*------------------------------------ Frames -----------------------------------------*/
+
+static inline void CanPackSetPoint(uint8_t* _data, const CanSetPoint_t* _sp)
+{
+    _data[0] = CanStatusByte(_sp->flags);
+    CanPutInt(_data + 1, _sp->position, 3);
+    CanPutInt(_data + 4, _sp->velocity, 2);
+    _data[6] = 0;
+    _data[7] = 0;
+}
+
+static inline bool CanUnpackSetPoint(const uint8_t* _data, CanSetPoint_t* _sp)
+{
+    if (!CanStatusVersionOk(_data[0]))
+        return false;
+    _sp->flags = _data[0] & CAN_STATUS_FLAGS_MASK;
+    _sp->position = CanGetInt(_data + 1, 3);
+    _sp->velocity = CanGetInt(_data + 4, 2);
+    return true;
+}
+
+static inline void CanPackState(uint8_t* _data, const CanState_t* _state)
+{
+    _data[0] = CanStatusByte(_state->flags);
+    CanPutInt(_data + 1, _state->position, 3);
+    CanPutInt(_data + 4, _state->velocity, 2);
+    CanPutInt(_data + 6, _state->current, 2);
+}
+
+static inline bool CanUnpackState(const uint8_t* _data, CanState_t* _state)
+{
+    if (!CanStatusVersionOk(_data[0]))
+        return false;
+    _state->flags = _data[0] & CAN_STATUS_FLAGS_MASK;
+    _state->position = CanGetInt(_data + 1, 3);
+    _state->velocity = CanGetInt(_data + 4, 2);
+    _state->current = CanGetInt(_data + 6, 2);
+    return true;
+}
+
+static inline void CanPackTrajectoryPoint(uint8_t* _data, const CanTrajectoryPoint_t* _point)
+{
+    _data[0] = CanStatusByte(_point->flags);
+    CanPutInt(_data + 1, _point->position, 3);
+    CanPutInt(_data + 4, _point->velocity, 2);
+    CanPutInt(_data + 6, _point->time, 2);
+}
+
+static inline bool CanUnpackTrajectoryPoint(const uint8_t* _data, CanTrajectoryPoint_t* _point)
+{
+    if (!CanStatusVersionOk(_data[0]))
+        return false;
+    _point->flags = _data[0] & CAN_STATUS_FLAGS_MASK;
+    _point->position = CanGetInt(_data + 1, 3);
+    _point->velocity = CanGetInt(_data + 4, 2);
+    _point->time = (uint16_t) CanGetInt(_data + 6, 2);
+    return true;
+}
+
+static inline void CanPackTrajectoryClock(uint8_t* _data, uint32_t _clock)
+{
+    _data[0] = CanStatusByte(0);
+    CanPutInt(_data + 1, (int32_t) _clock, 4);
+    _data[5] = _data[6] = _data[7] = 0;
+}
+
+static inline bool CanUnpackTrajectoryClock(const uint8_t* _data, uint32_t* _clock)
+{
+    if (!CanStatusVersionOk(_data[0]))
+        return false;
+    *_clock = (uint32_t) CanGetInt(_data + 1, 4);
+    return true;
+}
+
+static inline void CanPackTrajectoryStatus(uint8_t* _data, const CanTrajectoryStatus_t* _status)
+{
+    _data[0] = CanStatusByte(_status->flags);
+    _data[1] = _status->freePoints;
+    CanPutInt(_data + 2, _status->rejectedPoints, 2);
+    CanPutInt(_data + 4, (int32_t) _status->clock, 4);
+}
+
+static inline bool CanUnpackTrajectoryStatus(const uint8_t* _data, CanTrajectoryStatus_t* _status)
+{
+    if (!CanStatusVersionOk(_data[0]))
+        return false;
+    _status->flags = _data[0] & CAN_STATUS_FLAGS_MASK;
+    _status->freePoints = _data[1];
+    _status->rejectedPoints = (uint16_t) CanGetInt(_data + 2, 2);
+    _status->clock = (uint32_t) CanGetInt(_data + 4, 4);
+    return true;
+}
+
+static inline void CanPackCollisionConfig(uint8_t* _data, const CanCollisionConfig_t* _config)
+{
+    _data[0] = _config->threshold;
+    _data[1] = _config->tripTime;
+    CanPutInt(_data + 2, _config->errorFloor, 2);
+    _data[4] = _config->store ? 1 : 0;
+    CanPutInt(_data + 5, _config->currentFloor, 2);
+    _data[7] = 0;
+}
+
+static inline bool CanUnpackCollisionConfig(const uint8_t* _data, CanCollisionConfig_t* _config)
+{
+    if (_data[4] > 1 || _data[7] != 0)
+        return false;
+    _config->threshold = _data[0];
+    _config->tripTime = _data[1];
+    _config->errorFloor = (uint16_t) CanGetInt(_data + 2, 2);
+    _config->store = _data[4] != 0;
+    _config->currentFloor = (uint16_t) CanGetInt(_data + 5, 2);
+    return true;
+}
+
+static inline void CanPackCollision(uint8_t* _data, const CanCollision_t* _collision)
+{
+    _data[0] = CanStatusByte(_collision->flags);
+    CanPutInt(_data + 1, _collision->position, 3);
+    CanPutInt(_data + 4, CanSaturate(_collision->errorDeviation, 16), 2);
+    CanPutInt(_data + 6, CanSaturate(_collision->currentDeviation, 16), 2);
+}
+
+static inline bool CanUnpackCollision(const uint8_t* _data, CanCollision_t* _collision)
+{
+    if (!CanStatusVersionOk(_data[0]))
+        return false;
+    _collision->flags = _data[0] & CAN_STATUS_FLAGS_MASK;
+    _collision->position = CanGetInt(_data + 1, 3);
+    _collision->errorDeviation = CanGetInt(_data + 4, 2);
+    _collision->currentDeviation = CanGetInt(_data + 6, 2);
+    return true;
+}
+
+static inline void CanPutFloat(uint8_t* _data, float _val)
+{
+    memcpy(_data, &_val, 4);
+}
+
+static inline float CanGetFloat(const uint8_t* _data)
+{
+    float val;
+    memcpy(&val, _data, 4);
+    return val;
+}
+
+static inline void CanPackHeartbeat(uint8_t* _data, uint64_t _serial, uint8_t _storedId)
+{
+    for (uint8_t i = 0; i < 6; i++)
+        _data[i] = (uint8_t) (_serial >> (8 * i));
+    _data[6] = _storedId;
+    _data[7] = 0;
+}
+
+static inline uint64_t CanUnpackHeartbeat(const uint8_t* _data, uint8_t* _storedId)
+{
+    uint64_t serial = 0;
+    for (uint8_t i = 0; i < 6; i++)
+        serial |= (uint64_t) _data[i] << (8 * i);
+    *_storedId = _data[6];
+    return serial;
+}
+
+#endif // CAN_CODEC_H
@@ -64,7 +64,9 @@ void CommunicationTask(void* ctx)
     // Allow main init to continue
     endpointListValid = true;
 
+    // UART first, its writer lock must exist before the logger writes to it
     StartUartServer();
+    StartLogServer();
     StartUsbServer();
     StartCanServer(CAN1);
     StartCanServer(CAN2);
@@ -79,11 +81,11 @@ extern "C" {
 int _write(int file, const char* data, int len);
 }
 
-// @brief This is what printf calls internally
+// @brief This is what printf calls internally, it only queues the text so
+// printf never waits on USB or UART. Where it ends up is up to the log sinks.
 int _write(int file, const char* data, int len)
 {
-    usbStreamOutputPtr->process_bytes((const uint8_t*) data, len, nullptr);
-    uart4StreamOutputPtr->process_bytes((const uint8_t*) data, len, nullptr);
+    LogWrite(LOG_LEVEL_INFO, data, len);
 
     return len;
 }
@@ -21,6 +21,7 @@ void UsbDeferredInterruptTask(void *ctx);
 #include "interface_usb.hpp"
 #include "interface_uart.hpp"
 #include "interface_can.hpp"
+#include "logger.hpp"
 
 #define COMMIT_PROTOCOL \
 using treeType = decltype(MakeObjTree());\
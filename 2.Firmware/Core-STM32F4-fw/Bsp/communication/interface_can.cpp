@@ -3,7 +3,8 @@
 * Zero-config node ID negotiation
 * -------------------------------
 *
-* A heartbeat message is a message with a 8 byte unique serial number as payload.
+* A heartbeat message carries the node's 6 byte unique serial number and the
+* node ID it has stored, see the 0x70 layout in can_codec.h.
 * A regular message is any message that is not a heartbeat message.
 *
 * All nodes MUST obey these four rules:
@@ -25,15 +26,38 @@
 * d) At a given point in time, a node MUST NOT send any regular message with
 *   a node ID that is not self-assigned.
 *
+*   The nodes are the stepper drivers, see node_id.cpp of the driver firmware.
+*   Heartbeats are command 0x70, sent every 250ms with the ID being claimed
+*   and carrying the node's stored ID as well (can_codec.h). A node listens
+*   for a second before its first claim and falls back to IDs 8~15 when its
+*   stored one is taken. This board addresses the nodes as the bus master:
+*   it only listens, keeps what each heartbeat said, and leaves assigning
+*   joints to the application (DummyRobot::ScanJoints).
+*
 * Hardware allocation
 * -------------------
+*   Filter banks 0~13 belong to CAN1, 14~27 to CAN2. Each bus gets 16-bit
+*   mask banks (two ID/mask pairs each) generated from can1RxFilters/
+*   can2RxFilters, one pair per entry:
 *   RX FIFO0:
-*       - filter bank 0: heartbeat messages
+*       - commands the control loop waits for (state replies)
+*   RX FIFO1:
+*       - everything else the application handles
+*
+* Timing statistics
+* -----------------
+*   Frames are stamped when queued and when their mailbox completes. A frame
+*   matching the bus' CAN_ReplyMatch table leaves a pending request on the
+*   addressed nodes, closed by the first reply with the expected command.
+*   Bus load counts the bits of every frame sent or received here, with
+*   worst-case bit stuffing, so it is an upper bound of our own traffic.
+*   Frames the hardware filters drop are not seen.
 */
 
 #include "common_inc.h"
 #include <stm32f4xx_hal.h>
 #include <cmsis_os.h>
+#include <cstring>
 
 // defined in can.c
 extern CAN_HandleTypeDef hcan1;
@@ -41,9 +65,15 @@ extern CAN_HandleTypeDef hcan2;
 
 CAN_context can1Ctx;
 CAN_context can2Ctx;
-static CAN_context* ctxs = nullptr;
-static CAN_RxHeaderTypeDef headerRx;
-static uint8_t data[8];
+
+#define CAN_RX_FLAG_CAN1 (1U << 0)
+#define CAN_RX_FLAG_CAN2 (1U << 1)
+osThreadId_t canRxTaskHandle = nullptr;
+static void CanRxTask(void* ctx);
+extern const osThreadAttr_t canRxTask_attributes;
+
+#define CAN_FILTER_SLAVE_START_BANK 14
+#define CAN_FILTER_BANK_COUNT 28
 
 
 struct CAN_context* get_can_ctx(CAN_HandleTypeDef* hcan)
@@ -56,48 +86,221 @@ struct CAN_context* get_can_ctx(CAN_HandleTypeDef* hcan)
         return nullptr;
 }
 
-bool StartCanServer(CAN_TypeDef* hcan)
+// Frame length on the wire: 47 fixed bits of a standard data frame plus the
+// data, and one stuff bit per four bits of the stuffed part at worst.
+static uint32_t FrameBits(uint8_t dlc)
 {
-    if (hcan == CAN1)
+    uint32_t stuffed = 34 + 8 * dlc;
+    return 47 + 8 * dlc + (stuffed - 1) / 4;
+}
+
+static void RecordLatency(CAN_LatencyStats &stats, uint32_t us)
+{
+    stats.cnt++;
+    stats.last_us = us;
+    if (us < stats.min_us)
+        stats.min_us = us;
+    if (us > stats.max_us)
+        stats.max_us = us;
+
+    uint8_t bucket = 0;
+    uint32_t limit = CAN_LATENCY_FIRST_BUCKET_US;
+    while (bucket < CAN_LATENCY_BUCKETS - 1 && us >= limit)
     {
-        ctxs = &can1Ctx;
-        ctxs->handle = &hcan1;
-    } else if (hcan == CAN2)
+        bucket++;
+        limit <<= 1;
+    }
+    stats.histogram[bucket]++;
+}
+
+static uint8_t ExpectedReply(const CAN_context* ctx, const CAN_TxHeaderTypeDef* header, const uint8_t* data)
+{
+    if (header->IDE != CAN_ID_STD)
+        return CAN_NO_REPLY;
+
+    uint8_t cmd = header->StdId & 0x7F;
+    for (size_t i = 0; i < ctx->reply_match_count; i++)
     {
-        ctxs = &can2Ctx;
-        ctxs->handle = &hcan2;
-    } else
-        return false; // fail if none of the above checks matched
+        const CAN_ReplyMatch &match = ctx->reply_matches[i];
+        if (match.request_cmd != cmd)
+            continue;
+        if (match.mask == 0 || (match.byte < header->DLC && (data[match.byte] & match.mask)))
+            return match.reply_cmd;
+    }
 
-    HAL_StatusTypeDef status;
+    return CAN_NO_REPLY;
+}
+
+static void StartRequest(CAN_NodeStats &node, uint8_t replyCmd, uint32_t enqueueUs, uint32_t sentUs)
+{
+    // Nodes that never answered are probably not there, don't count them
+    if (node.pending_cmd != CAN_NO_REPLY && node.rtt.cnt > 0)
+        node.unanswered_cnt++;
+    node.pending_cmd = replyCmd;
+    node.pending_enqueue_us = enqueueUs;
+    node.pending_sent_us = sentUs;
+}
+
+static uint32_t GetBitrate(CAN_HandleTypeDef* hcan)
+{
+    uint32_t btr = hcan->Instance->BTR;
+    uint32_t prescaler = (btr & CAN_BTR_BRP) + 1;
+    uint32_t quanta = 1 + ((btr & CAN_BTR_TS1) >> CAN_BTR_TS1_Pos) + 1 + ((btr & CAN_BTR_TS2) >> CAN_BTR_TS2_Pos) + 1;
+
+    return HAL_RCC_GetPCLK1Freq() / prescaler / quanta;
+}
+
+// _pairs holds two standard IDs, each followed by its mask
+static bool ConfigFilterBank(CAN_context* ctx, uint32_t bank, uint32_t fifo, const uint16_t* _pairs)
+{
+    // 16-bit filter layout: STDID[10:0] RTR IDE EXTID[17:15], RTR and IDE
+    // always compared so only standard data frames pass
+    const uint32_t frameBits = 0x18;
+    CAN_FilterTypeDef sFilterConfig = {
+        .FilterIdHigh = (uint32_t) _pairs[2] << 5,
+        .FilterIdLow = (uint32_t) _pairs[0] << 5,
+        .FilterMaskIdHigh = (uint32_t) _pairs[3] << 5 | frameBits,
+        .FilterMaskIdLow = (uint32_t) _pairs[1] << 5 | frameBits,
+        .FilterFIFOAssignment = fifo,
+        .FilterBank = bank,
+        .FilterMode = CAN_FILTERMODE_IDMASK,
+        .FilterScale = CAN_FILTERSCALE_16BIT, // two 16-bit ID/mask pairs
+        .FilterActivation = ENABLE,
+        .SlaveStartFilterBank = CAN_FILTER_SLAVE_START_BANK
+    };
+
+    return HAL_CAN_ConfigFilter(ctx->handle, &sFilterConfig) == HAL_OK;
+}
+
+// The command has to match exactly, the node only in the bits all of the
+// entry's nodes agree on: joints 1~6 let nodes 0~7 through, never 8~15.
+static void MakeFilterPair(const CAN_RxFilter &_filter, uint16_t* _pair)
+{
+    uint16_t nodeAnd = 0x0F, nodeOr = 0;
+    for (uint16_t node = 0; node < 16; node++)
+    {
+        if (!(_filter.node_mask & (1U << node)))
+            continue;
+        nodeAnd &= node;
+        nodeOr |= node;
+    }
+    uint16_t nodeCare = ~(nodeAnd ^ nodeOr) & 0x0F;
 
-    ctxs->node_id = 0;
-    ctxs->serial_number = serialNumber;
-    osSemaphoreDef(sem_send_heartbeat);
-    ctxs->sem_send_heartbeat = osSemaphoreNew(1, 0, osSemaphore(sem_send_heartbeat));
+    _pair[0] = (nodeAnd & nodeCare) << 7 | _filter.cmd;
+    _pair[1] = nodeCare << 7 | 0x7F;
+}
+
+// Turns the (node mask, command) table into ID/mask pairs, two per bank. A
+// bus with an empty table receives nothing. If the table doesn't fit, the bus
+// falls back to accepting everything into FIFO1 rather than missing frames.
+static bool ConfigRxFilters(CAN_context* ctx, const CAN_RxFilter* filters, size_t count,
+                            uint32_t firstBank, uint32_t endBank)
+{
+    uint32_t bank = firstBank;
+
+    for (uint32_t fifo : {CAN_RX_FIFO0, CAN_RX_FIFO1})
+    {
+        uint16_t pairs[4];
+        uint8_t n = 0;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (filters[i].fifo != fifo || filters[i].node_mask == 0)
+                continue;
+            MakeFilterPair(filters[i], pairs + n);
+            n += 2;
+            if (n < 4)
+                continue;
+            if (bank >= endBank)
+                goto overflow;
+            if (!ConfigFilterBank(ctx, bank++, fifo, pairs))
+                return false;
+            n = 0;
+        }
+
+        if (n > 0)
+        {
+            // Fill a half used bank with a copy of its pair
+            pairs[2] = pairs[0];
+            pairs[3] = pairs[1];
+            if (bank >= endBank)
+                goto overflow;
+            if (!ConfigFilterBank(ctx, bank++, fifo, pairs))
+                return false;
+        }
+    }
+
+    ctx->rx_filter_banks = bank - firstBank;
+    return true;
 
-    //// Set up filter
+overflow:
     CAN_FilterTypeDef sFilterConfig = {
         .FilterIdHigh = 0x0000,
         .FilterIdLow = 0x0000,
         .FilterMaskIdHigh = 0x0000,
         .FilterMaskIdLow = 0x0000,
-        .FilterFIFOAssignment = CAN_RX_FIFO0,
-        .FilterBank = 0,
+        .FilterFIFOAssignment = CAN_RX_FIFO1,
+        .FilterBank = firstBank,
         .FilterMode = CAN_FILTERMODE_IDMASK,
-        .FilterScale = CAN_FILTERSCALE_16BIT, // two 16-bit filters
+        .FilterScale = CAN_FILTERSCALE_32BIT,
         .FilterActivation = ENABLE,
-        .SlaveStartFilterBank = 0
+        .SlaveStartFilterBank = CAN_FILTER_SLAVE_START_BANK
     };
-    status = HAL_CAN_ConfigFilter(ctxs->handle, &sFilterConfig);
-    if (status != HAL_OK)
-        return false;
+    for (uint32_t b = firstBank + 1; b < endBank; b++)
+    {
+        CAN_FilterTypeDef unused = sFilterConfig;
+        unused.FilterBank = b;
+        unused.FilterActivation = DISABLE;
+        HAL_CAN_ConfigFilter(ctx->handle, &unused);
+    }
+    ctx->rx_filter_banks = 0;
+    return HAL_CAN_ConfigFilter(ctx->handle, &sFilterConfig) == HAL_OK;
+}
 
-    status = HAL_CAN_Start(ctxs->handle);
+bool StartCanServer(CAN_TypeDef* hcan)
+{
+    CAN_context* ctx;
+    if (hcan == CAN1)
+    {
+        ctx = &can1Ctx;
+        ctx->handle = &hcan1;
+    } else if (hcan == CAN2)
+    {
+        ctx = &can2Ctx;
+        ctx->handle = &hcan2;
+    } else
+        return false; // fail if none of the above checks matched
+
+    HAL_StatusTypeDef status;
+
+    // One task serves both buses, below the control loop but above everything else
+    if (canRxTaskHandle == nullptr)
+        canRxTaskHandle = osThreadNew(CanRxTask, nullptr, &canRxTask_attributes);
+
+    ctx->bitrate = GetBitrate(ctx->handle);
+    ctx->bus_window_start_ms = millis();
+
+    //// Set up filters
+    if (hcan == CAN1)
+    {
+        ctx->reply_matches = can1ReplyMatches;
+        ctx->reply_match_count = can1ReplyMatchCount;
+        if (!ConfigRxFilters(ctx, can1RxFilters, can1RxFilterCount, 0, CAN_FILTER_SLAVE_START_BANK))
+            return false;
+    } else
+    {
+        ctx->reply_matches = can2ReplyMatches;
+        ctx->reply_match_count = can2ReplyMatchCount;
+        if (!ConfigRxFilters(ctx, can2RxFilters, can2RxFilterCount,
+                             CAN_FILTER_SLAVE_START_BANK, CAN_FILTER_BANK_COUNT))
+            return false;
+    }
+
+    status = HAL_CAN_Start(ctx->handle);
     if (status != HAL_OK)
         return false;
 
-    status = HAL_CAN_ActivateNotification(ctxs->handle,
+    status = HAL_CAN_ActivateNotification(ctx->handle,
                                           CAN_IT_TX_MAILBOX_EMPTY |
                                           CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO1_MSG_PENDING |
                                           /* we probably only want this */
@@ -113,23 +316,72 @@ bool StartCanServer(CAN_TypeDef* hcan)
     return true;
 }
 
+// Moves queued frames into free mailboxes, higher priority first. Must run
+// with interrupts masked or from the CAN interrupts.
+static void CanTxRefill(CAN_context* ctx)
+{
+    while (HAL_CAN_GetTxMailboxesFreeLevel(ctx->handle) > 0)
+    {
+        CAN_TxQueue* queue = nullptr;
+        for (auto &q : ctx->tx_queue)
+        {
+            if (q.head != q.tail)
+            {
+                queue = &q;
+                break;
+            }
+        }
+        if (queue == nullptr)
+            return;
+
+        CAN_TxFrame &frame = queue->frames[queue->tail & (CAN_TX_QUEUE_SIZE - 1)];
+        uint32_t mailbox;
+        if (HAL_CAN_AddTxMessage(ctx->handle, &frame.header, frame.data, &mailbox) != HAL_OK)
+            return;
+        uint8_t index = mailbox == CAN_TX_MAILBOX0 ? 0 : (mailbox == CAN_TX_MAILBOX1 ? 1 : 2);
+        ctx->tx_in_flight[index] = {
+            .enqueue_us = frame.enqueue_us,
+            .std_id = (uint16_t) frame.header.StdId,
+            .dlc = (uint8_t) frame.header.DLC,
+            .reply_cmd = frame.reply_cmd
+        };
+        queue->tail++;
+        ctx->tx_msg_cnt++;
+    }
+}
+
 void tx_complete_callback(CAN_HandleTypeDef* hcan, uint8_t mailbox_idx)
 {
-//    CAN_context* ctx = get_can_ctx(hcan);
-//    if (!ctx) return;
-//    ctx->tx_msg_cnt++;
+    CAN_context* ctx = get_can_ctx(hcan);
+    if (!ctx) return;
+    ctx->TxMailboxCompleteCallbackCnt++;
 
-    if (hcan->Instance == CAN1)
-        osSemaphoreRelease(sem_can1_tx);
-    else if (hcan->Instance == CAN2)
-        osSemaphoreRelease(sem_can2_tx);
+    uint32_t now = micros();
+    CAN_TxInFlight &frame = ctx->tx_in_flight[mailbox_idx];
+    RecordLatency(ctx->tx_latency, now - frame.enqueue_us);
+    ctx->bus_bits += FrameBits(frame.dlc);
+
+    if (frame.reply_cmd != CAN_NO_REPLY)
+    {
+        uint8_t node = frame.std_id >> 7;
+        if (node == 0)
+        {
+            for (uint8_t i = 1; i < CAN_STATS_NODES; i++)
+                StartRequest(ctx->node_stats[i], frame.reply_cmd, frame.enqueue_us, now);
+        } else if (node < CAN_STATS_NODES)
+            StartRequest(ctx->node_stats[node], frame.reply_cmd, frame.enqueue_us, now);
+    }
+
+    CanTxRefill(ctx);
 }
 
 void tx_aborted_callback(CAN_HandleTypeDef* hcan, uint8_t mailbox_idx)
 {
-    if (!get_can_ctx(hcan))
-        return;
-    get_can_ctx(hcan)->TxMailboxAbortCallbackCnt++;
+    CAN_context* ctx = get_can_ctx(hcan);
+    if (!ctx) return;
+    ctx->TxMailboxAbortCallbackCnt++;
+
+    CanTxRefill(ctx);
 }
 
 void tx_error(CAN_context* ctx, uint8_t mailbox_idx)
@@ -154,27 +406,166 @@ void HAL_CAN_TxMailbox1AbortCallback(CAN_HandleTypeDef* hcan)
 void HAL_CAN_TxMailbox2AbortCallback(CAN_HandleTypeDef* hcan)
 { tx_aborted_callback(hcan, 2); }
 
-void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef* hcan)
+// The interrupt only moves the frame out of the hardware FIFO into the queue,
+// the application sees it in CanRxTask
+static void ReceiveCanMessage(CAN_HandleTypeDef* hcan, uint32_t fifo)
 {
     CAN_context* ctx = get_can_ctx(hcan);
     if (!ctx) return;
     ctx->received_msg_cnt++;
 
-    HAL_StatusTypeDef status = HAL_CAN_GetRxMessage(hcan, CAN_RX_FIFO0, &headerRx, data);
+    CAN_RxQueue &queue = ctx->rx_queue;
+    static CAN_RxFrame overflowFrame;
+    bool full = queue.head - queue.tail >= CAN_RX_QUEUE_SIZE;
+    // Even when full the frame has to be read to free the hardware FIFO
+    CAN_RxFrame &frame = full ? overflowFrame : queue.frames[queue.head & (CAN_RX_QUEUE_SIZE - 1)];
+
+    HAL_StatusTypeDef status = HAL_CAN_GetRxMessage(hcan, fifo, &frame.header, frame.data);
     if (status != HAL_OK)
     {
         ctx->unexpected_errors++;
         return;
     }
 
-    OnCanMessage(ctx, &headerRx, data);
+    uint32_t now = micros();
+    ctx->bus_bits += FrameBits(frame.header.DLC);
+    uint8_t node = frame.header.StdId >> 7;
+    if (frame.header.IDE == CAN_ID_STD && node < CAN_STATS_NODES &&
+        ctx->node_stats[node].pending_cmd == (frame.header.StdId & 0x7F))
+    {
+        CAN_NodeStats &stats = ctx->node_stats[node];
+        RecordLatency(stats.rtt, now - stats.pending_enqueue_us);
+        stats.wire_last_us = now - stats.pending_sent_us;
+        stats.pending_cmd = CAN_NO_REPLY;
+    }
+    if (full)
+    {
+        // Every 2^n-th drop, a flood would fill the log queue otherwise
+        ctx->rx_dropped_cnt++;
+        if (!(ctx->rx_dropped_cnt & (ctx->rx_dropped_cnt - 1)))
+            LogDeferred(LOG_LEVEL_WARN, "[can] CAN%ld RX queue full, %ld frames dropped\n",
+                        hcan->Instance == CAN1 ? 1 : 2, (int32_t) ctx->rx_dropped_cnt, 0, 0);
+        return;
+    }
+
+    __DMB();
+    queue.head++;
+    if (canRxTaskHandle != nullptr)
+        osThreadFlagsSet(canRxTaskHandle, hcan->Instance == CAN1 ? CAN_RX_FLAG_CAN1 : CAN_RX_FLAG_CAN2);
+}
+
+static void OnHeartbeat(CAN_context* ctx, uint8_t id, const uint8_t* data)
+{
+    if (id == 0 || id >= CAN_NODE_ID_COUNT)
+        return;
+    ctx->heartbeat_cnt++;
+
+    uint8_t storedId;
+    uint64_t serial = CanUnpackHeartbeat(data, &storedId);
+    uint32_t now = millis();
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    CAN_NodeInfo &node = ctx->nodes[id];
+    bool online = node.seen && now - node.last_heartbeat_ms < CAN_NODE_ID_WINDOW_MS;
+    // Two nodes claiming at once, both back off on their own
+    if (online && node.serial != serial)
+        ctx->node_id_conflict_cnt++;
+    if (!online || node.serial != serial)
+        node.online_since_ms = now;
+    node.serial = serial;
+    node.stored_id = storedId;
+    node.last_heartbeat_ms = now;
+    node.seen = true;
+    __set_PRIMASK(primask);
+}
+
+static void DrainRxQueue(CAN_context* ctx)
+{
+    CAN_RxQueue &queue = ctx->rx_queue;
+    uint32_t count = 0;
+
+    while (queue.tail != queue.head)
+    {
+        __DMB();
+        CAN_RxFrame &frame = queue.frames[queue.tail & (CAN_RX_QUEUE_SIZE - 1)];
+        if (frame.header.IDE == CAN_ID_STD && (frame.header.StdId & 0x7F) == CAN_CMD_HEARTBEAT)
+            OnHeartbeat(ctx, frame.header.StdId >> 7, frame.data);
+        else
+            OnCanMessage(ctx, &frame.header, frame.data);
+        __DMB();
+        queue.tail++;
+        count++;
+    }
+
+    if (count == 0)
+        return;
+    ctx->rx_batch_cnt++;
+    if (count > ctx->rx_batch_max_size)
+        ctx->rx_batch_max_size = count;
+    OnCanMessageBatch(ctx);
+}
+
+static void UpdateBusLoad(CAN_context* ctx)
+{
+    uint32_t elapsed = millis() - ctx->bus_window_start_ms;
+    if (ctx->bitrate == 0 || elapsed < CAN_BUS_LOAD_WINDOW_MS)
+        return;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t bits = ctx->bus_bits;
+    ctx->bus_bits = 0;
+    __set_PRIMASK(primask);
+
+    ctx->bus_load_permille = (uint64_t) bits * 1000000 / ((uint64_t) ctx->bitrate * elapsed);
+    ctx->bus_window_start_ms += elapsed;
+}
+
+static void CanRxTask(void* ctx)
+{
+    (void) ctx;
+
+    for (;;)
+    {
+        // Also wakes up on an idle bus to close the bus load window
+        uint32_t flags = osThreadFlagsWait(CAN_RX_FLAG_CAN1 | CAN_RX_FLAG_CAN2, osFlagsWaitAny,
+                                           CAN_BUS_LOAD_WINDOW_MS);
+        if (flags & osFlagsError)
+            flags = 0;
+
+        if ((flags & CAN_RX_FLAG_CAN1) && can1Ctx.handle != nullptr)
+            DrainRxQueue(&can1Ctx);
+        if ((flags & CAN_RX_FLAG_CAN2) && can2Ctx.handle != nullptr)
+            DrainRxQueue(&can2Ctx);
+
+        if (can1Ctx.handle != nullptr)
+            UpdateBusLoad(&can1Ctx);
+        if (can2Ctx.handle != nullptr)
+            UpdateBusLoad(&can2Ctx);
+    }
+}
+
+const osThreadAttr_t canRxTask_attributes = {
+    .name = "CanRxTask",
+    .stack_size = 2000,
+    .priority = (osPriority_t) osPriorityHigh,
+};
+
+void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef* hcan)
+{
+    if (get_can_ctx(hcan)) get_can_ctx(hcan)->RxFifo0MsgPendingCallbackCnt++;
+    ReceiveCanMessage(hcan, CAN_RX_FIFO0);
 }
 
 void HAL_CAN_RxFifo0FullCallback(CAN_HandleTypeDef* hcan)
 { if (get_can_ctx(hcan)) get_can_ctx(hcan)->RxFifo0FullCallbackCnt++; }
 
 void HAL_CAN_RxFifo1MsgPendingCallback(CAN_HandleTypeDef* hcan)
-{ if (get_can_ctx(hcan)) get_can_ctx(hcan)->RxFifo1MsgPendingCallbackCnt++; }
+{
+    if (get_can_ctx(hcan)) get_can_ctx(hcan)->RxFifo1MsgPendingCallbackCnt++;
+    ReceiveCanMessage(hcan, CAN_RX_FIFO1);
+}
 
 void HAL_CAN_RxFifo1FullCallback(CAN_HandleTypeDef* hcan)
 { if (get_can_ctx(hcan)) get_can_ctx(hcan)->RxFifo1FullCallbackCnt++; }
@@ -231,20 +622,96 @@ void HAL_CAN_ErrorCallback(CAN_HandleTypeDef* hcan)
     }
 
     if (hcan->ErrorCode)
+    {
         ctx->unexpected_errors++;
+        if (!(ctx->unexpected_errors & (ctx->unexpected_errors - 1)))
+            LogDeferred(LOG_LEVEL_WARN, "[can] CAN%ld error 0x%lx, %ld so far\n",
+                        hcan->Instance == CAN1 ? 1 : 2, (int32_t) original_error,
+                        (int32_t) ctx->unexpected_errors, 0);
+    }
+
+    // A failed transmission frees its mailbox without a TX-complete
+    CanTxRefill(ctx);
 }
 
-void CanSendMessage(CAN_context* canCtx, uint8_t* txData, CAN_TxHeaderTypeDef* txHeader)
+bool CanSendMessage(CAN_context* canCtx, uint8_t* txData, CAN_TxHeaderTypeDef* txHeader,
+                    CanTxPriority_t priority)
 {
-    osStatus semaphore_status;
-    if (canCtx->handle->Instance == CAN1)
-        semaphore_status = osSemaphoreAcquire(sem_can1_tx, osWaitForever);
-    else if (canCtx->handle->Instance == CAN2)
-        semaphore_status = osSemaphoreAcquire(sem_can2_tx, osWaitForever);
-    else
-        return;
+    if (canCtx == nullptr || canCtx->handle == nullptr || priority >= CAN_TX_PRIORITY_COUNT)
+        return false;
+
+    uint8_t replyCmd = ExpectedReply(canCtx, txHeader, txData);
+    uint32_t now = micros();
+
+    // The queue and the mailboxes are shared with the TX interrupt, this only
+    // holds interrupts off for a copy and at most three mailbox writes
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
 
-    if (semaphore_status == osOK)
-        HAL_CAN_AddTxMessage(canCtx->handle, txHeader, txData, &canCtx->last_heartbeat_mailbox);
+    CAN_TxQueue &queue = canCtx->tx_queue[priority];
+    uint32_t used = queue.head - queue.tail;
+    bool queued = used < CAN_TX_QUEUE_SIZE;
+    if (queued)
+    {
+        CAN_TxFrame &frame = queue.frames[queue.head & (CAN_TX_QUEUE_SIZE - 1)];
+        frame.header = *txHeader;
+        memcpy(frame.data, txData, txHeader->DLC <= 8 ? txHeader->DLC : 8);
+        frame.enqueue_us = now;
+        frame.reply_cmd = replyCmd;
+        queue.head++;
+        canCtx->tx_queued_cnt++;
+        if (used + 1 > canCtx->tx_queue_max_level)
+            canCtx->tx_queue_max_level = used + 1;
+    } else
+        canCtx->tx_dropped_cnt++;
+
+    CanTxRefill(canCtx);
+    __set_PRIMASK(primask);
+
+    return queued;
+}
+
+void CanResetStats(CAN_context* canCtx)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    canCtx->tx_latency = CAN_LatencyStats();
+    for (auto &node : canCtx->node_stats)
+    {
+        node.rtt = CAN_LatencyStats();
+        node.wire_last_us = 0;
+        node.unanswered_cnt = 0;
+    }
+    __set_PRIMASK(primask);
 }
 
+uint16_t CanGetOnlineNodes(CAN_context* canCtx)
+{
+    uint32_t now = millis();
+    uint16_t online = 0;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (uint8_t id = 1; id < CAN_NODE_ID_COUNT; id++)
+    {
+        const CAN_NodeInfo &node = canCtx->nodes[id];
+        if (node.seen && now - node.last_heartbeat_ms < CAN_NODE_ID_WINDOW_MS)
+            online |= 1U << id;
+    }
+    __set_PRIMASK(primask);
+
+    return online;
+}
+
+bool CanGetNodeInfo(CAN_context* canCtx, uint8_t id, CAN_NodeInfo* info)
+{
+    if (id >= CAN_NODE_ID_COUNT)
+        return false;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *info = canCtx->nodes[id];
+    __set_PRIMASK(primask);
+
+    return info->seen;
+}
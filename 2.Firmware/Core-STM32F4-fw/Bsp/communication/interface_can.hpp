@@ -4,22 +4,154 @@
 #include "fibre/protocol.hpp"
 #include <stm32f4xx_hal.h>
 #include <cmsis_os.h>
+#include "can_codec.h"
+
+// Frames per priority level and bus, must be a power of two
+#define CAN_TX_QUEUE_SIZE 32
+// Received frames waiting for the CAN RX task, must be a power of two
+#define CAN_RX_QUEUE_SIZE 32
+// Nodes with round-trip statistics, IDs 0~15 like the filter node masks
+#define CAN_STATS_NODES 16
+// Latency histogram buckets: [0] below 125us, doubling up to [7] from 8ms on
+#define CAN_LATENCY_BUCKETS 8
+#define CAN_LATENCY_FIRST_BUCKET_US 125
+#define CAN_BUS_LOAD_WINDOW_MS 100
+#define CAN_NO_REPLY 0xFF
+
+typedef enum
+{
+    CAN_TX_PRIORITY_HIGH = 0,   // Stop/disable frames, sent before anything queued
+    CAN_TX_PRIORITY_NORMAL,
+    CAN_TX_PRIORITY_COUNT
+} CanTxPriority_t;
+
+// One command the application handles, from the nodes set in node_mask.
+// StartCanServer turns each entry into a hardware ID/mask pair, so frames
+// nobody handles never raise an interrupt. The mask can only cover the nodes
+// as a block (joints 1~6 pass nodes 0~7), the handler still checks the node.
+struct CAN_RxFilter
+{
+    uint16_t node_mask;     // Bit n: accept from node ID n
+    uint8_t cmd;
+    uint32_t fifo;          // CAN_RX_FIFO0 for latency critical frames, CAN_RX_FIFO1 for the rest
+};
+
+// A request the addressed node (every node, if sent to node 0) answers with
+// reply_cmd. With a non-zero mask it only counts if data[byte] & mask, for
+// commands where the sender asks for the reply with a flag.
+struct CAN_ReplyMatch
+{
+    uint8_t request_cmd;
+    uint8_t reply_cmd;
+    uint8_t byte;
+    uint8_t mask;
+};
+
+struct CAN_TxFrame
+{
+    CAN_TxHeaderTypeDef header;
+    uint8_t data[8];
+    uint32_t enqueue_us;
+    uint8_t reply_cmd;      // CAN_NO_REPLY unless it matched a CAN_ReplyMatch
+};
+
+// What is known about the frame in each hardware mailbox
+struct CAN_TxInFlight
+{
+    uint32_t enqueue_us;
+    uint16_t std_id;
+    uint8_t dlc;
+    uint8_t reply_cmd;
+};
+
+struct CAN_LatencyStats
+{
+    uint32_t cnt = 0;
+    uint32_t last_us = 0;
+    uint32_t min_us = UINT32_MAX;
+    uint32_t max_us = 0;
+    uint32_t histogram[CAN_LATENCY_BUCKETS] = {0};
+};
+
+struct CAN_NodeStats
+{
+    CAN_LatencyStats rtt;           // Request enqueued -> reply received
+    uint32_t wire_last_us = 0;      // Request sent -> reply received
+    uint32_t unanswered_cnt = 0;    // Requests replaced by the next one before a reply
+
+    // The outstanding request, written by the TX interrupt, cleared by the RX one
+    uint8_t pending_cmd = CAN_NO_REPLY;
+    uint32_t pending_enqueue_us = 0;
+    uint32_t pending_sent_us = 0;
+};
+
+// A node as its heartbeats describe it, see the node ID negotiation
+struct CAN_NodeInfo
+{
+    uint64_t serial = 0;
+    uint8_t stored_id = 0;          // The ID the node prefers, 0 if it has none
+    uint32_t last_heartbeat_ms = 0;
+    uint32_t online_since_ms = 0;   // First heartbeat after the last gap
+    bool seen = false;
+};
+
+struct CAN_TxQueue
+{
+    CAN_TxFrame frames[CAN_TX_QUEUE_SIZE];
+    volatile uint32_t head = 0;
+    volatile uint32_t tail = 0;
+};
+
+struct CAN_RxFrame
+{
+    CAN_RxHeaderTypeDef header;
+    uint8_t data[8];
+};
+
+// Single producer (the RX interrupt), single consumer (the CAN RX task)
+struct CAN_RxQueue
+{
+    CAN_RxFrame frames[CAN_RX_QUEUE_SIZE];
+    volatile uint32_t head = 0;     // Written by the interrupt only
+    volatile uint32_t tail = 0;     // Written by the task only
+};
 
 struct CAN_context
 {
     CAN_HandleTypeDef* handle = nullptr;
-    uint8_t node_id = 0;
-    uint64_t serial_number = 0;
 
-    uint32_t node_ids_in_use_0[4]; // 128 bits (indicate if a node ID was in use up to 1 second ago)
-    uint32_t node_ids_in_use_1[4]; // 128 bits (indicats if a node ID was in use 1-2 seconds ago)
+    // Node ID negotiation, written by the CAN RX task. This board is the bus
+    // master and addresses the nodes, it only listens and never claims an ID.
+    CAN_NodeInfo nodes[CAN_NODE_ID_COUNT];
+    uint32_t heartbeat_cnt = 0;
+    uint32_t node_id_conflict_cnt = 0;  // Heartbeats for an ID another serial holds
 
-    uint32_t last_heartbeat_mailbox = 0;
     uint32_t tx_msg_cnt = 0;
 
-    uint8_t node_id_rng_state = 0;
+    // Filled by CanSendMessage, drained into the mailboxes by the TX interrupt
+    CAN_TxQueue tx_queue[CAN_TX_PRIORITY_COUNT];
+    uint32_t tx_queued_cnt = 0;
+    uint32_t tx_dropped_cnt = 0;
+    uint32_t tx_queue_max_level = 0;
+
+    // Filled by the RX interrupts, drained in batches by CanRxTask
+    CAN_RxQueue rx_queue;
+    uint32_t rx_dropped_cnt = 0;
+    uint32_t rx_batch_cnt = 0;
+    uint32_t rx_batch_max_size = 0;
 
-    osSemaphoreId_t sem_send_heartbeat;
+    // Timing, all stamped with micros() in the CAN interrupts
+    const CAN_ReplyMatch* reply_matches = nullptr;
+    size_t reply_match_count = 0;
+    CAN_TxInFlight tx_in_flight[3];
+    CAN_LatencyStats tx_latency;    // Enqueued -> TX complete, queueing plus arbitration
+    CAN_NodeStats node_stats[CAN_STATS_NODES];
+
+    // Frame bits seen in the current window, both directions
+    uint32_t bitrate = 0;
+    uint32_t bus_bits = 0;
+    uint32_t bus_window_start_ms = 0;
+    uint32_t bus_load_permille = 0;     // Of the last complete window
 
     // count occurrence various callbacks
     uint32_t TxMailboxCompleteCallbackCnt = 0;
@@ -32,15 +164,38 @@ struct CAN_context
     int WakeUpFromRxMsgCallbackCnt = 0;
     int ErrorCallbackCnt = 0;
 
+    uint32_t rx_filter_banks = 0;    // 0 if the filter table didn't fit and everything is accepted
     uint32_t received_msg_cnt = 0;
     uint32_t received_ack = 0;
     uint32_t unexpected_errors = 0;
     uint32_t unhandled_messages = 0;
 };
 
+// Defined next to OnCanMessage
+extern const CAN_RxFilter can1RxFilters[];
+extern const size_t can1RxFilterCount;
+extern const CAN_RxFilter can2RxFilters[];
+extern const size_t can2RxFilterCount;
+extern const CAN_ReplyMatch can1ReplyMatches[];
+extern const size_t can1ReplyMatchCount;
+extern const CAN_ReplyMatch can2ReplyMatches[];
+extern const size_t can2ReplyMatchCount;
+
 struct CAN_context* get_can_ctx(CAN_HandleTypeDef* hcan);
 bool StartCanServer(CAN_TypeDef* hcan);
-void CanSendMessage(CAN_context* canCtx, uint8_t* txData, CAN_TxHeaderTypeDef* txHeader);
+// @brief Queues a frame and returns without waiting for a mailbox, false if
+// the bus isn't started or the queue for this priority is full.
+bool CanSendMessage(CAN_context* canCtx, uint8_t* txData, CAN_TxHeaderTypeDef* txHeader,
+                    CanTxPriority_t priority = CAN_TX_PRIORITY_NORMAL);
+// Both run in the CAN RX task: OnCanMessage for each frame of a batch, then
+// OnCanMessageBatch once, to publish whatever the batch updated.
 void OnCanMessage(CAN_context* canCtx, CAN_RxHeaderTypeDef* rxHeader, uint8_t* data);
+void OnCanMessageBatch(CAN_context* canCtx);
+// @brief Clears the latency histograms and counters, not the bus load.
+void CanResetStats(CAN_context* canCtx);
+// @brief Nodes that sent a heartbeat within the last second, bit n for node ID n.
+uint16_t CanGetOnlineNodes(CAN_context* canCtx);
+// @brief A consistent copy of what the heartbeats of node id said, false if it never sent one.
+bool CanGetNodeInfo(CAN_context* canCtx, uint8_t id, CAN_NodeInfo* info);
 
 #endif // __INTERFACE_CAN_HPP
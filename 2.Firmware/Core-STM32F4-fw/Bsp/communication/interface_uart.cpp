@@ -4,178 +4,321 @@
 #include "fibre/protocol.hpp"
 #include "usart.h"
 
-#define UART_TX_BUFFER_SIZE 64
+// Must be a power of two, the indices wrap with a mask
+#define UART_TX_BUFFER_SIZE 1024
 #define UART_RX_BUFFER_SIZE 64
 
-// DMA open loop continous circular buffer
-// 1ms delay periodic, chase DMA ptr around
+// Thread flags the RX interrupts use to wake UartServerTask
+#define UART_RX_FLAG_UART4 (1U << 0)
+#define UART_RX_FLAG_UART5 (1U << 1)
+// The task also runs this often without an event, to catch a stopped DMA
+#define UART_RX_WATCHDOG_MS 100
+
+// DMA continous circular buffer, the IDLE-line and half/full-transfer
+// interrupts tell the server task when there is something to chase
 static uint8_t dma_rx_buffer[2][UART_RX_BUFFER_SIZE];
 static uint32_t dma_last_rcv_idx[2];
+// Time of the first event the task hasn't serviced yet, for the latency stats
+static volatile uint32_t rx_event_us[2];
+static volatile bool rx_event_pending[2];
 
 // FIXME: the stdlib doesn't know about CMSIS threads, so this is just a global variable
 // static thread_local uint32_t deadline_ms = 0;
 
 osThreadId_t uartServerTaskHandle;
+UARTStats_t uart4_stats_ = {0};
+UARTStats_t uart5_stats_ = {0};
 
 
-class UART4Sender : public StreamSink
+// Writers append to a ring buffer and return as soon as their bytes are in it,
+// the TX-complete interrupt chains the next contiguous region into the DMA.
+// Writers are serialized by a priority-inheriting mutex held for the copy, so a
+// preempted low-priority writer is boosted instead of holding up the others.
+// A write larger than the free space goes out in chunks, waiting for the DMA
+// to make room; only a DMA that frees nothing in PROTOCOL_SERVER_TIMEOUT_MS
+// drops the rest. BeginPacket() keeps the mutex and the room for a whole
+// fibre packet, so its header, payload and CRC go out back to back or not at
+// all.
+class UARTSender : public StreamSink
 {
 public:
-    UART4Sender()
+    UARTSender(UART_HandleTypeDef* huart, ChannelType_t channel_type, UARTStats_t &stats)
+        : huart_(huart), stats_(stats)
+    {
+        channelType = channel_type;
+    }
+
+    // Called once the kernel runs, before that there is one writer at most
+    // and nothing to wait with
+    void Init()
     {
-        channelType = CHANNEL_TYPE_UART4;
+        const osMutexAttr_t mutexAttr = {
+            .name = "uartTxMutex",
+            .attr_bits = osMutexRecursive | osMutexPrioInherit,
+        };
+        mutex_ = osMutexNew(&mutexAttr);
+        space_sem_ = osSemaphoreNew(1, 0, nullptr);
     }
 
     int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override
     {
-        // Loop to ensure all bytes get sent
+        Lock();
+        int ret = 0;
         while (length)
         {
-            size_t chunk = length < UART_TX_BUFFER_SIZE ? length : UART_TX_BUFFER_SIZE;
-            // wait for USB interface to become ready
-            // TODO: implement ring buffer to get a more continuous stream of data
-            // if (osSemaphoreWait(sem_uart_dma, deadline_to_timeout(deadline_ms)) != osOK)
-            if (osSemaphoreAcquire(sem_uart4_dma, PROTOCOL_SERVER_TIMEOUT_MS) != osOK)
-                return -1;
-            // transmit chunk
-            memcpy(tx_buf_, buffer, chunk);
-            if (HAL_UART_Transmit_DMA(&huart4, tx_buf_, chunk) != HAL_OK)
-                return -1;
+            uint32_t free = WaitForSpace(1);
+            if (free == 0)
+            {
+                stats_.tx_overflow_cnt++;
+                stats_.tx_dropped_bytes += length;
+                ret = -1;
+                break;
+            }
+
+            // tail_ only moves forward in the ISR, the space can't shrink
+            size_t chunk = length < free ? length : free;
+            uint32_t offset = head_ & (UART_TX_BUFFER_SIZE - 1);
+            size_t first = chunk < UART_TX_BUFFER_SIZE - offset ? chunk : UART_TX_BUFFER_SIZE - offset;
+            memcpy(tx_buf_ + offset, buffer, first);
+            memcpy(tx_buf_, buffer + first, chunk - first);
+
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+            head_ += chunk;
+            if (head_ - tail_ > stats_.tx_max_level)
+                stats_.tx_max_level = head_ - tail_;
+            StartDma();
+            __set_PRIMASK(primask);
+
+            stats_.tx_bytes += chunk;
             buffer += chunk;
             length -= chunk;
             if (processed_bytes)
                 *processed_bytes += chunk;
         }
-        return 0;
+        Unlock();
+        return ret;
     }
 
     size_t get_free_space() override
-    { return SIZE_MAX; }
+    { return UART_TX_BUFFER_SIZE - (head_ - tail_); }
+
+    // @brief Takes the writer lock and waits for _length bytes of room.
+    // @return false if the room didn't come up in time, the lock is released
+    bool BeginPacket(size_t _length)
+    {
+        Lock();
+        if (WaitForSpace(_length) < _length)
+        {
+            stats_.tx_overflow_cnt++;
+            stats_.tx_dropped_bytes += _length;
+            Unlock();
+            return false;
+        }
+        return true;
+    }
+
+    void EndPacket()
+    { Unlock(); }
+
+    // Called from HAL_UART_TxCpltCallback
+    void OnTxComplete()
+    {
+        tail_ += dma_length_;
+        dma_length_ = 0;
+        StartDma();
+        if (space_sem_ != nullptr)
+            osSemaphoreRelease(space_sem_);
+    }
+
+    // Called from HAL_UART_ErrorCallback. RX errors leave the TX DMA running,
+    // a TX DMA error aborts it without a TX-complete, so skip that region.
+    void OnError()
+    {
+        if (dma_length_ != 0 && huart_->gState == HAL_UART_STATE_READY)
+        {
+            stats_.tx_dropped_bytes += dma_length_;
+            OnTxComplete();
+        }
+    }
 
 private:
-    uint8_t tx_buf_[UART_TX_BUFFER_SIZE];
-} uart4_stream_output;
+    void Lock()
+    {
+        if (mutex_ != nullptr)
+            osMutexAcquire(mutex_, osWaitForever);
+    }
 
-class UART5Sender : public StreamSink
-{
-public:
-    UART5Sender()
+    void Unlock()
     {
-        channelType = CHANNEL_TYPE_UART5;
+        if (mutex_ != nullptr)
+            osMutexRelease(mutex_);
     }
 
-    int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override
+    // @return the free space once it is at least _length, or whatever there
+    // is when the DMA stopped making room
+    uint32_t WaitForSpace(size_t _length)
     {
-        // Loop to ensure all bytes get sent
-        while (length)
+        uint32_t free = UART_TX_BUFFER_SIZE - (head_ - tail_);
+        if (free >= _length || space_sem_ == nullptr)
+            return free;
+
+        stats_.tx_wait_cnt++;
+        for (;;)
         {
-            size_t chunk = length < UART_TX_BUFFER_SIZE ? length : UART_TX_BUFFER_SIZE;
-            // wait for USB interface to become ready
-            // TODO: implement ring buffer to get a more continuous stream of data
-            // if (osSemaphoreWait(sem_uart_dma, deadline_to_timeout(deadline_ms)) != osOK)
-            if (osSemaphoreAcquire(sem_uart5_dma, PROTOCOL_SERVER_TIMEOUT_MS) != osOK)
-                return -1;
-            // transmit chunk
-            memcpy(tx_buf_, buffer, chunk);
-            if (HAL_UART_Transmit_DMA(&huart5, tx_buf_, chunk) != HAL_OK)
-                return -1;
-            buffer += chunk;
-            length -= chunk;
-            if (processed_bytes)
-                *processed_bytes += chunk;
+            if (osSemaphoreAcquire(space_sem_, PROTOCOL_SERVER_TIMEOUT_MS) != osOK)
+                return UART_TX_BUFFER_SIZE - (head_ - tail_);
+            free = UART_TX_BUFFER_SIZE - (head_ - tail_);
+            if (free >= _length)
+                return free;
         }
-        return 0;
     }
 
-    size_t get_free_space() override
-    { return SIZE_MAX; }
+    // Must run with interrupts masked or from the TX-complete interrupt
+    void StartDma()
+    {
+        if (dma_length_ != 0 || head_ == tail_)
+            return;
 
-private:
+        uint32_t offset = tail_ & (UART_TX_BUFFER_SIZE - 1);
+        uint32_t pending = head_ - tail_;
+        uint32_t contiguous = UART_TX_BUFFER_SIZE - offset;
+        uint32_t length = pending < contiguous ? pending : contiguous;
+
+        if (HAL_UART_Transmit_DMA(huart_, tx_buf_ + offset, length) == HAL_OK)
+        {
+            dma_length_ = length;
+            stats_.tx_dma_cnt++;
+        }
+    }
+
+    UART_HandleTypeDef* huart_;
+    UARTStats_t &stats_;
+    osMutexId_t mutex_ = nullptr;
+    osSemaphoreId_t space_sem_ = nullptr;   // Released by every TX-complete
     uint8_t tx_buf_[UART_TX_BUFFER_SIZE];
-} uart5_stream_output;
+    // Free running indices, only the masked value addresses tx_buf_
+    volatile uint32_t head_ = 0;            // End of data that is ready to send
+    volatile uint32_t tail_ = 0;            // Start of data not yet sent, owned by the ISR
+    volatile uint32_t dma_length_ = 0;      // Length of the running transfer, 0 if idle
+};
+
+// Frames fibre packets like StreamBasedPacketSink, with the room for the whole
+// frame reserved up front
+class UARTPacketSink : public PacketSink
+{
+public:
+    explicit UARTPacketSink(UARTSender &output) : output_(output), framer_(output)
+    {}
+
+    int process_packet(const uint8_t* buffer, size_t length) override
+    {
+        // 3 bytes header, 2 bytes CRC16
+        if (!output_.BeginPacket(length + 5))
+            return -1;
+        int ret = framer_.process_packet(buffer, length);
+        output_.EndPacket();
+        return ret;
+    }
+
+private:
+    UARTSender &output_;
+    StreamBasedPacketSink framer_;
+};
+
+UARTSender uart4_stream_output(&huart4, StreamSink::CHANNEL_TYPE_UART4, uart4_stats_);
+UARTSender uart5_stream_output(&huart5, StreamSink::CHANNEL_TYPE_UART5, uart5_stats_);
 
 StreamSink* uart4StreamOutputPtr = &uart4_stream_output;
-StreamBasedPacketSink uart4_packet_output(uart4_stream_output);
+UARTPacketSink uart4_packet_output(uart4_stream_output);
 BidirectionalPacketBasedChannel uart4_channel(uart4_packet_output);
 StreamToPacketSegmenter uart4_stream_input(uart4_channel);
 
 StreamSink* uart5StreamOutputPtr = &uart5_stream_output;
-StreamBasedPacketSink uart5_packet_output(uart5_stream_output);
+UARTPacketSink uart5_packet_output(uart5_stream_output);
 BidirectionalPacketBasedChannel uart5_channel(uart5_packet_output);
 StreamToPacketSegmenter uart5_stream_input(uart5_channel);
 
-static void UartServerTask(void* ctx)
+static void ProcessUartRx(uint8_t port, UART_HandleTypeDef* huart, StreamToPacketSegmenter &stream_input,
+                         StreamSink &stream_output, UARTStats_t &stats)
 {
-    (void) ctx;
-
-    for (;;)
+    stats.rx_wakeup_cnt++;
+    if (rx_event_pending[port])
     {
-        // Check for UART errors and restart recieve DMA transfer if required
-        if (huart4.ErrorCode != HAL_UART_ERROR_NONE)
-        {
-            HAL_UART_AbortReceive(&huart4);
-            HAL_UART_Receive_DMA(&huart4, dma_rx_buffer[0], sizeof(dma_rx_buffer[0]));
-        }
-        // Fetch the circular buffer "write pointer", where it would write next
-        uint32_t new_rcv_idx = UART_RX_BUFFER_SIZE - huart4.hdmarx->Instance->NDTR;
-
-        // deadline_ms = timeout_to_deadline(PROTOCOL_SERVER_TIMEOUT_MS);
-        // Process bytes in one or two chunks (two in case there was a wrap)
-        if (new_rcv_idx < dma_last_rcv_idx[0])
-        {
-            uart4_stream_input.process_bytes(dma_rx_buffer[0] + dma_last_rcv_idx[0],
-                                             UART_RX_BUFFER_SIZE - dma_last_rcv_idx[0],
-                                             nullptr); // TODO: use process_all
-            ASCII_protocol_parse_stream(dma_rx_buffer[0] + dma_last_rcv_idx[0],
-                                        UART_RX_BUFFER_SIZE - dma_last_rcv_idx[0], uart4_stream_output);
-            dma_last_rcv_idx[0] = 0;
-        }
-        if (new_rcv_idx > dma_last_rcv_idx[0])
-        {
-            uart4_stream_input.process_bytes(dma_rx_buffer[0] + dma_last_rcv_idx[0],
-                                             new_rcv_idx - dma_last_rcv_idx[0],
-                                             nullptr); // TODO: use process_all
-            ASCII_protocol_parse_stream(dma_rx_buffer[0] + dma_last_rcv_idx[0],
-                                        new_rcv_idx - dma_last_rcv_idx[0], uart4_stream_output);
-            dma_last_rcv_idx[0] = new_rcv_idx;
-        }
+        uint32_t latency = micros() - rx_event_us[port];
+        rx_event_pending[port] = false;
+        stats.rx_latency_last_us = latency;
+        stats.rx_latency_total_us += latency;
+        stats.rx_latency_cnt++;
+        if (latency > stats.rx_latency_max_us)
+            stats.rx_latency_max_us = latency;
+    }
 
+    // Check for UART errors and restart recieve DMA transfer if required
+    if (huart->ErrorCode != HAL_UART_ERROR_NONE)
+    {
+        stats.rx_error_cnt++;
+        if (!(stats.rx_error_cnt & (stats.rx_error_cnt - 1)))
+            LOG_WARN("[uart] UART%d RX error 0x%lx, %lu so far\n", port + 4, (unsigned long) huart->ErrorCode,
+                     (unsigned long) stats.rx_error_cnt);
+        HAL_UART_AbortReceive(huart);
+        HAL_UARTEx_ReceiveToIdle_DMA(huart, dma_rx_buffer[port], sizeof(dma_rx_buffer[port]));
+        dma_last_rcv_idx[port] = 0;
+    }
+    // Fetch the circular buffer "write pointer", where it would write next
+    uint32_t new_rcv_idx = UART_RX_BUFFER_SIZE - huart->hdmarx->Instance->NDTR;
 
-        // Check for UART errors and restart recieve DMA transfer if required
-        if (huart5.ErrorCode != HAL_UART_ERROR_NONE)
-        {
-            HAL_UART_AbortReceive(&huart5);
-            HAL_UART_Receive_DMA(&huart5, dma_rx_buffer[1], sizeof(dma_rx_buffer[1]));
-        }
-        // Fetch the circular buffer "write pointer", where it would write next
-        new_rcv_idx = UART_RX_BUFFER_SIZE - huart5.hdmarx->Instance->NDTR;
+    // Process bytes in one or two chunks (two in case there was a wrap)
+    if (new_rcv_idx < dma_last_rcv_idx[port])
+    {
+        uint32_t length = UART_RX_BUFFER_SIZE - dma_last_rcv_idx[port];
+        stream_input.process_bytes(dma_rx_buffer[port] + dma_last_rcv_idx[port], length,
+                                   nullptr); // TODO: use process_all
+        ASCII_protocol_parse_stream(dma_rx_buffer[port] + dma_last_rcv_idx[port], length, stream_output);
+        stats.rx_bytes += length;
+        dma_last_rcv_idx[port] = 0;
+    }
+    if (new_rcv_idx > dma_last_rcv_idx[port])
+    {
+        uint32_t length = new_rcv_idx - dma_last_rcv_idx[port];
+        stream_input.process_bytes(dma_rx_buffer[port] + dma_last_rcv_idx[port], length,
+                                   nullptr); // TODO: use process_all
+        ASCII_protocol_parse_stream(dma_rx_buffer[port] + dma_last_rcv_idx[port], length, stream_output);
+        stats.rx_bytes += length;
+        dma_last_rcv_idx[port] = new_rcv_idx;
+    }
+}
 
-        // deadline_ms = timeout_to_deadline(PROTOCOL_SERVER_TIMEOUT_MS);
-        // Process bytes in one or two chunks (two in case there was a wrap)
-        if (new_rcv_idx < dma_last_rcv_idx[1])
-        {
-            uart4_stream_input.process_bytes(dma_rx_buffer[1] + dma_last_rcv_idx[1],
-                                             UART_RX_BUFFER_SIZE - dma_last_rcv_idx[1],
-                                             nullptr); // TODO: use process_all
-            ASCII_protocol_parse_stream(dma_rx_buffer[1] + dma_last_rcv_idx[1],
-                                        UART_RX_BUFFER_SIZE - dma_last_rcv_idx[1], uart5_stream_output);
-            dma_last_rcv_idx[1] = 0;
-        }
-        if (new_rcv_idx > dma_last_rcv_idx[1])
-        {
-            uart4_stream_input.process_bytes(dma_rx_buffer[1] + dma_last_rcv_idx[1],
-                                             new_rcv_idx - dma_last_rcv_idx[1],
-                                             nullptr); // TODO: use process_all
-            ASCII_protocol_parse_stream(dma_rx_buffer[1] + dma_last_rcv_idx[1],
-                                        new_rcv_idx - dma_last_rcv_idx[1], uart5_stream_output);
-            dma_last_rcv_idx[1] = new_rcv_idx;
-        }
+static void UartServerTask(void* ctx)
+{
+    (void) ctx;
 
+    for (;;)
+    {
+        uint32_t flags = osThreadFlagsWait(UART_RX_FLAG_UART4 | UART_RX_FLAG_UART5,
+                                           osFlagsWaitAny, UART_RX_WATCHDOG_MS);
+        // Timeout (or any other error code): look at both ports anyway
+        if (flags & osFlagsError)
+            flags = UART_RX_FLAG_UART4 | UART_RX_FLAG_UART5;
 
-        osDelay(1);
+        if (flags & UART_RX_FLAG_UART4)
+            ProcessUartRx(0, &huart4, uart4_stream_input, uart4_stream_output, uart4_stats_);
+        if (flags & UART_RX_FLAG_UART5)
+            ProcessUartRx(1, &huart5, uart5_stream_input, uart5_stream_output, uart5_stats_);
     };
 }
 
+// Called from the UART/DMA interrupts
+static void NotifyUartRx(uint8_t port)
+{
+    if (!rx_event_pending[port])
+    {
+        rx_event_us[port] = micros();
+        rx_event_pending[port] = true;
+    }
+    osThreadFlagsSet(uartServerTaskHandle, 1U << port);
+}
+
 const osThreadAttr_t uartServerTask_attributes = {
     .name = "UartServerTask",
     .stack_size = 2000,
@@ -184,23 +327,65 @@ const osThreadAttr_t uartServerTask_attributes = {
 
 void StartUartServer()
 {
+    uart4_stream_output.Init();
+    uart5_stream_output.Init();
+
     // DMA is set up to receive in a circular buffer forever.
-    // We don't use interrupts to fetch the data, instead we periodically read
-    // data out of the circular buffer into a parse buffer, controlled by a state machine
-    HAL_UART_Receive_DMA(&huart4, dma_rx_buffer[0], sizeof(dma_rx_buffer[0]));
+    // In to-idle mode the HAL reports the IDLE line and the half/full transfer
+    // points through HAL_UARTEx_RxEventCallback, which wakes the server task
+    // to read the data out of the circular buffer.
+    HAL_UARTEx_ReceiveToIdle_DMA(&huart4, dma_rx_buffer[0], sizeof(dma_rx_buffer[0]));
     dma_last_rcv_idx[0] = UART_RX_BUFFER_SIZE - huart4.hdmarx->Instance->NDTR;
 
-    HAL_UART_Receive_DMA(&huart5, dma_rx_buffer[1], sizeof(dma_rx_buffer[1]));
+    HAL_UARTEx_ReceiveToIdle_DMA(&huart5, dma_rx_buffer[1], sizeof(dma_rx_buffer[1]));
     dma_last_rcv_idx[1] = UART_RX_BUFFER_SIZE - huart5.hdmarx->Instance->NDTR;
 
     // Start UART communication thread
     uartServerTaskHandle = osThreadNew(UartServerTask, nullptr, &uartServerTask_attributes);
 }
 
+// The interrupts count too, clear everything in one go
+void UartResetStats(UARTStats_t* stats)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *stats = UARTStats_t();
+    __set_PRIMASK(primask);
+}
+
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart)
 {
     if (huart->Instance == UART4)
-        osSemaphoreRelease(sem_uart4_dma);
+        uart4_stream_output.OnTxComplete();
     else if (huart->Instance == UART5)
-        osSemaphoreRelease(sem_uart5_dma);
+        uart5_stream_output.OnTxComplete();
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef* huart)
+{
+    // Also wake the server task, it restarts the RX DMA if it was aborted
+    if (huart->Instance == UART4)
+    {
+        uart4_stream_output.OnError();
+        NotifyUartRx(0);
+    } else if (huart->Instance == UART5)
+    {
+        uart5_stream_output.OnError();
+        NotifyUartRx(1);
+    }
+}
+
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef* huart, uint16_t Size)
+{
+    (void) Size;
+
+    if (huart->Instance == UART4)
+    {
+        uart4_stats_.rx_event_cnt++;
+        NotifyUartRx(0);
+    } else if (huart->Instance == UART5)
+    {
+        uart5_stats_.rx_event_cnt++;
+        NotifyUartRx(1);
+    }
 }
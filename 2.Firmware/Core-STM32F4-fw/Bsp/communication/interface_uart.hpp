@@ -12,10 +12,34 @@ extern "C" {
 #endif
 
 #include <cmsis_os.h>
+#include <stdint.h>
+
+typedef struct
+{
+    uint32_t tx_bytes;          // Bytes accepted into the TX ring
+    uint32_t tx_dma_cnt;        // DMA transfers started
+    uint32_t tx_wait_cnt;       // Writes that waited for the DMA to make room
+    uint32_t tx_overflow_cnt;   // Writes dropped because the DMA made no room in time
+    uint32_t tx_dropped_bytes;
+    uint32_t tx_max_level;      // High-water mark of the TX ring
+
+    uint32_t rx_bytes;
+    uint32_t rx_event_cnt;      // IDLE-line and DMA half/full transfer interrupts
+    uint32_t rx_wakeup_cnt;     // Times the server task ran for this port
+    uint32_t rx_error_cnt;      // RX DMA restarts after a UART error
+    uint32_t rx_latency_last_us;    // Interrupt to server task
+    uint32_t rx_latency_max_us;
+    uint32_t rx_latency_total_us;   // Divide by rx_latency_cnt for the average
+    uint32_t rx_latency_cnt;
+} UARTStats_t;
+
+extern UARTStats_t uart4_stats_;
+extern UARTStats_t uart5_stats_;
 
 extern osThreadId uart_thread;
 
 void StartUartServer(void);
+void UartResetStats(UARTStats_t* stats);
 
 #ifdef __cplusplus
 }
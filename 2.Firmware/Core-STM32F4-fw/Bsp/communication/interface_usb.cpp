@@ -11,8 +11,8 @@ USBStats_t usb_stats_ = {0};
 class USBSender : public PacketSink
 {
 public:
-    USBSender(uint8_t endpoint_pair, const osSemaphoreId &sem_usb_tx)
-        : endpoint_pair_(endpoint_pair), sem_usb_tx_(sem_usb_tx)
+    USBSender(uint8_t endpoint_pair, const osSemaphoreId &sem_usb_tx, USBEndpointStats_t &stats)
+        : endpoint_pair_(endpoint_pair), sem_usb_tx_(sem_usb_tx), stats_(stats)
     {}
 
     int process_packet(const uint8_t *buffer, size_t length) override
@@ -28,16 +28,20 @@ public:
             // TX buffer if this wait times out. The implication is that the channel is no longer lossless.
             // TODO: handle endpoint reset properly
             usb_stats_.tx_overrun_cnt++;
+            stats_.tx_overrun_cnt++;
         }
 
         // transmit packet
         uint8_t status = CDC_Transmit_FS(const_cast<uint8_t *>(buffer), length, endpoint_pair_);
         if (status != USBD_OK)
         {
+            if (status == USBD_BUSY)
+                stats_.tx_busy_cnt++;
             osSemaphoreRelease(sem_usb_tx_);
             return -1;
         }
         usb_stats_.tx_cnt++;
+        stats_.tx_cnt++;
 
         return 0;
     }
@@ -45,11 +49,12 @@ public:
 private:
     uint8_t endpoint_pair_;
     const osSemaphoreId &sem_usb_tx_;
+    USBEndpointStats_t &stats_;
 };
 
-// Note we could have independent semaphores here to allow concurrent transmission
-USBSender usb_packet_output_cdc(CDC_OUT_EP, sem_usb_tx);
-USBSender usb_packet_output_native(ODRIVE_OUT_EP, sem_usb_tx);
+// Each endpoint owns its semaphore, so a stuck ACK on one doesn't block the other
+USBSender usb_packet_output_cdc(CDC_OUT_EP, sem_usb_tx_cdc, usb_stats_.cdc);
+USBSender usb_packet_output_native(ODRIVE_OUT_EP, sem_usb_tx_native, usb_stats_.native);
 
 class TreatPacketSinkAsStreamSink : public StreamSink
 {
@@ -65,7 +70,7 @@ public:
         while (length)
         {
             size_t chunk = length < USB_TX_DATA_SIZE ? length : USB_TX_DATA_SIZE;
-            if (output_.process_packet(buffer, length) != 0)
+            if (output_.process_packet(buffer, chunk) != 0)
                 return -1;
             buffer += chunk;
             length -= chunk;
@@ -136,6 +141,7 @@ static void UsbServerTask(void *ctx)
             if (CDC_interface.data_pending)
             {
                 CDC_interface.data_pending = false;
+                usb_stats_.cdc.rx_cnt++;
 
                 ASCII_protocol_parse_stream(CDC_interface.rx_buf, CDC_interface.rx_len, usb_stream_output);
                 USBD_CDC_ReceivePacket(&hUsbDeviceFS, CDC_interface.out_ep);  // Allow next packet
@@ -145,6 +151,7 @@ static void UsbServerTask(void *ctx)
             if (ODrive_interface.data_pending)
             {
                 ODrive_interface.data_pending = false;
+                usb_stats_.native.rx_cnt++;
                 usb_channel.process_packet(ODrive_interface.rx_buf, ODrive_interface.rx_len);
                 USBD_CDC_ReceivePacket(&hUsbDeviceFS, ODrive_interface.out_ep);  // Allow next packet
             }
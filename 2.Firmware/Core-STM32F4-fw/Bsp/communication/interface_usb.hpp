@@ -13,11 +13,21 @@ extern "C" {
 #include <cmsis_os.h>
 #include <stdint.h>
 
+typedef struct
+{
+    uint32_t rx_cnt;
+    uint32_t tx_cnt;
+    uint32_t tx_overrun_cnt;    // TX-complete never came, buffer was taken over anyway
+    uint32_t tx_busy_cnt;       // Endpoint still busy when transmitting, packet dropped
+} USBEndpointStats_t;
+
 typedef struct
 {
     uint32_t rx_cnt;
     uint32_t tx_cnt;
     uint32_t tx_overrun_cnt;
+    USBEndpointStats_t cdc;     // ASCII protocol and printf
+    USBEndpointStats_t native;  // fibre protocol
 } USBStats_t;
 
 extern USBStats_t usb_stats_;
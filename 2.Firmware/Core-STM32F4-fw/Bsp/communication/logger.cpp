@@ -0,0 +1,264 @@
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include "common_inc.h"
+#include "logger.hpp"
+
+// Must be a power of two, the indices wrap with a mask
+#define LOG_QUEUE_SLOTS 32
+#define LOG_RECORD_TEXT_SIZE 60
+// Largest single LogPrintf, it is formatted on the caller's stack
+#define LOG_PRINTF_BUFFER_SIZE 128
+// The log task hands text to the sinks in chunks of up to this size
+#define LOG_BATCH_SIZE 256
+#define LOG_FLAG_NEW_RECORD (1U << 0)
+
+typedef struct
+{
+    volatile uint8_t ready;     // Set by the writer once the record is complete
+    uint8_t level;
+    uint8_t deferred;
+    uint8_t length;
+    union
+    {
+        char text[LOG_RECORD_TEXT_SIZE];
+        struct
+        {
+            const char* fmt;
+            int32_t args[4];
+        } event;
+    };
+} LogRecord_t;
+
+osThreadId_t logTaskHandle;
+LogStats_t log_stats_ = {0};
+
+// Writers claim the slots of a line with interrupts masked for a few
+// instructions, fill them with interrupts enabled and then mark them ready. The log task only consumes
+// records in order, so a writer that is preempted halfway just holds up the
+// records behind it until it finishes, it never loses them.
+static LogRecord_t records[LOG_QUEUE_SLOTS];
+static volatile uint32_t record_head = 0;   // Next slot to hand out
+static volatile uint32_t record_tail = 0;   // Next slot to print, owned by the log task
+
+static StreamSink** const sink_outputs[LOG_SINK_COUNT] = {
+    &usbStreamOutputPtr,
+    &uart4StreamOutputPtr,
+    &uart5StreamOutputPtr,
+};
+// printf used to go to USB and UART4, keep it that way
+static volatile uint8_t sink_levels[LOG_SINK_COUNT] = {
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_NONE,
+};
+static volatile uint8_t min_level = LOG_LEVEL_INFO;
+
+
+// @brief Claims count consecutive records, all of them or none.
+// @return index of the first one, to be masked, or false if there is no room
+static bool ClaimRecords(LogLevel_t level, uint32_t count, uint32_t* first)
+{
+    if (level < min_level)
+    {
+        log_stats_.filtered_cnt++;
+        return false;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t used = record_head - record_tail;
+    if (count > LOG_QUEUE_SLOTS - used)
+    {
+        log_stats_.dropped_cnt += count;
+        __set_PRIMASK(primask);
+        return false;
+    }
+    *first = record_head;
+    record_head += count;
+    log_stats_.record_cnt += count;
+    if (used + count > log_stats_.max_level)
+        log_stats_.max_level = used + count;
+    __set_PRIMASK(primask);
+
+    for (uint32_t i = 0; i < count; i++)
+        records[(*first + i) & (LOG_QUEUE_SLOTS - 1)].level = level;
+    return true;
+}
+
+static void PublishRecord(LogRecord_t* record)
+{
+    __DMB();
+    record->ready = 1;
+    if (logTaskHandle != nullptr)
+        osThreadFlagsSet(logTaskHandle, LOG_FLAG_NEW_RECORD);
+}
+
+void LogWrite(LogLevel_t level, const char* data, size_t len)
+{
+    if (len == 0)
+        return;
+
+    // Text that wouldn't fit even an empty queue is cut to its size
+    uint32_t count = (len + LOG_RECORD_TEXT_SIZE - 1) / LOG_RECORD_TEXT_SIZE;
+    if (count > LOG_QUEUE_SLOTS)
+    {
+        count = LOG_QUEUE_SLOTS;
+        len = LOG_QUEUE_SLOTS * LOG_RECORD_TEXT_SIZE;
+    }
+
+    uint32_t index;
+    if (!ClaimRecords(level, count, &index))
+        return;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        LogRecord_t* record = &records[(index + i) & (LOG_QUEUE_SLOTS - 1)];
+        size_t chunk = len < LOG_RECORD_TEXT_SIZE ? len : LOG_RECORD_TEXT_SIZE;
+        memcpy(record->text, data, chunk);
+        record->length = chunk;
+        record->deferred = 0;
+        PublishRecord(record);
+
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+void LogPrintf(LogLevel_t level, const char* fmt, ...)
+{
+    // Don't pay for the formatting if nobody would print it
+    if (level < min_level)
+    {
+        log_stats_.filtered_cnt++;
+        return;
+    }
+
+    char buffer[LOG_PRINTF_BUFFER_SIZE];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+
+    if (len < 0)
+        return;
+    if (len >= (int) sizeof(buffer))
+        len = sizeof(buffer) - 1;
+
+    LogWrite(level, buffer, len);
+}
+
+void LogDeferred(LogLevel_t level, const char* fmt, int32_t a0, int32_t a1, int32_t a2, int32_t a3)
+{
+    uint32_t index;
+    if (!ClaimRecords(level, 1, &index))
+        return;
+
+    LogRecord_t* record = &records[index & (LOG_QUEUE_SLOTS - 1)];
+    record->event.fmt = fmt;
+    record->event.args[0] = a0;
+    record->event.args[1] = a1;
+    record->event.args[2] = a2;
+    record->event.args[3] = a3;
+    record->deferred = 1;
+    PublishRecord(record);
+}
+
+void LogSetSinkLevel(LogSink_t sink, LogLevel_t level)
+{
+    if (sink >= LOG_SINK_COUNT)
+        return;
+
+    sink_levels[sink] = level;
+
+    uint8_t lowest = LOG_LEVEL_NONE;
+    for (uint8_t sinkLevel : sink_levels)
+        if (sinkLevel < lowest)
+            lowest = sinkLevel;
+    min_level = lowest;
+}
+
+static uint32_t SinkMask(uint8_t level)
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < LOG_SINK_COUNT; i++)
+        if (level >= sink_levels[i])
+            mask |= 1U << i;
+    return mask;
+}
+
+static void FlushBatch(const char* batch, size_t len, uint32_t mask)
+{
+    if (len == 0)
+        return;
+
+    for (int i = 0; i < LOG_SINK_COUNT; i++)
+        if (mask & (1U << i))
+            (*sink_outputs[i])->process_bytes((const uint8_t*) batch, len, nullptr);
+}
+
+static void LogTask(void* ctx)
+{
+    (void) ctx;
+
+    static char batch[LOG_BATCH_SIZE];
+    size_t batchLen = 0;
+    uint32_t batchMask = 0;
+
+    for (;;)
+    {
+        osThreadFlagsWait(LOG_FLAG_NEW_RECORD, osFlagsWaitAny, osWaitForever);
+
+        // Neighbouring records that go to the same sinks are sent together
+        while (record_tail != record_head)
+        {
+            LogRecord_t* record = &records[record_tail & (LOG_QUEUE_SLOTS - 1)];
+            if (!record->ready)
+                break; // Writer still filling it in, it sets the flag again when done
+            __DMB();
+
+            char text[LOG_PRINTF_BUFFER_SIZE];
+            const char* data = record->text;
+            size_t len = record->length;
+            if (record->deferred)
+            {
+                int n = snprintf(text, sizeof(text), record->event.fmt,
+                                 record->event.args[0], record->event.args[1],
+                                 record->event.args[2], record->event.args[3]);
+                data = text;
+                len = n < 0 ? 0 : (n < (int) sizeof(text) ? n : sizeof(text) - 1);
+            }
+
+            uint32_t mask = SinkMask(record->level);
+            if (mask != batchMask || batchLen + len > sizeof(batch))
+            {
+                FlushBatch(batch, batchLen, batchMask);
+                batchLen = 0;
+                batchMask = mask;
+            }
+            memcpy(batch + batchLen, data, len);
+            batchLen += len;
+
+            // Hand the slot back to the writers
+            record->ready = 0;
+            __DMB();
+            record_tail++;
+        }
+
+        FlushBatch(batch, batchLen, batchMask);
+        batchLen = 0;
+    }
+}
+
+const osThreadAttr_t logTask_attributes = {
+    .name = "LogTask",
+    .stack_size = 2000,
+    .priority = (osPriority_t) osPriorityLow,
+};
+
+void StartLogServer()
+{
+    logTaskHandle = osThreadNew(LogTask, nullptr, &logTask_attributes);
+    // Print whatever was logged before the task existed
+    osThreadFlagsSet(logTaskHandle, LOG_FLAG_NEW_RECORD);
+}
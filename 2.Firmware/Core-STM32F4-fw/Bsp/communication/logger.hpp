@@ -0,0 +1,72 @@
+#ifndef __LOGGER_HPP
+#define __LOGGER_HPP
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum
+{
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_NONE      // As a threshold: drop everything
+} LogLevel_t;
+
+typedef enum
+{
+    LOG_SINK_USB = 0,
+    LOG_SINK_UART4,
+    LOG_SINK_UART5,
+    LOG_SINK_COUNT
+} LogSink_t;
+
+typedef struct
+{
+    uint32_t record_cnt;        // Records accepted into the queue
+    uint32_t dropped_cnt;       // Records lost because the queue was full
+    uint32_t filtered_cnt;      // Records below every sink's level
+    uint32_t max_level;         // High-water mark of queued records
+} LogStats_t;
+
+extern LogStats_t log_stats_;
+
+// All writers only copy into a queue and return, they never wait for USB or
+// UART. The queue is drained to the sinks by a low priority task. A line
+// longer than one record takes several, claimed together so lines from
+// different writers never interleave; when they don't all fit the whole line
+// is dropped.
+
+// @brief Queues already formatted text. Safe from any task and from interrupts.
+void LogWrite(LogLevel_t level, const char* data, size_t len);
+
+// @brief Formats in the caller's context, then queues the text. Tasks only:
+// newlib's vsnprintf isn't reentrant, and so neither is printf.
+void LogPrintf(LogLevel_t level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// @brief Queues fmt and up to four integer arguments, formatting happens in
+// the log task. Safe from interrupts and the cheapest option for real-time
+// code, but fmt must outlive the record (use a string literal) and only
+// integer conversions are allowed.
+void LogDeferred(LogLevel_t level, const char* fmt, int32_t a0, int32_t a1, int32_t a2, int32_t a3);
+
+// @brief Sets the lowest level a sink prints, LOG_LEVEL_NONE disables it.
+void LogSetSinkLevel(LogSink_t sink, LogLevel_t level);
+
+void StartLogServer(void);
+
+// Task context only, see LogPrintf
+#define LOG_DEBUG(...)  LogPrintf(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)   LogPrintf(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...)   LogPrintf(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...)  LogPrintf(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __LOGGER_HPP
@@ -0,0 +1,78 @@
+#ifndef REF_STM32F4_SEQLOCK_HPP
+#define REF_STM32F4_SEQLOCK_HPP
+
+#include "main.h"
+
+// Lets readers take a consistent copy of T without a lock: the sequence is
+// odd while a write is in progress, a reader retries if it saw an odd value
+// or the sequence changed under it. Writes mask interrupts for the copy, so
+// they never interleave with each other and never leave a reader spinning;
+// any task or interrupt may publish. T must be trivially copyable, and the
+// functors passed to Modify() run with interrupts masked, keep them short.
+template<typename T>
+class Seqlock
+{
+public:
+    void Write(const T &_val)
+    {
+        Modify([&](T &_data) { _data = _val; });
+    }
+
+    // @brief Read-modify-write of only some fields, atomic against other writers.
+    template<typename F>
+    void Modify(F _fn)
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        Apply(_fn);
+        __set_PRIMASK(primask);
+    }
+
+    // @brief Like Modify(), but only if nothing was written since the Read()
+    // that returned _sequence. For results that were derived from that copy.
+    template<typename F>
+    bool CompareAndModify(uint32_t _sequence, F _fn)
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        bool unchanged = (sequence == _sequence);
+        if (unchanged)
+            Apply(_fn);
+        __set_PRIMASK(primask);
+
+        return unchanged;
+    }
+
+    T Read(uint32_t* _sequence = nullptr) const
+    {
+        T copy;
+        uint32_t seq;
+        do
+        {
+            seq = sequence;
+            __DMB();
+            copy = data;
+            __DMB();
+        } while ((seq & 1) || seq != sequence);
+
+        if (_sequence != nullptr)
+            *_sequence = seq;
+        return copy;
+    }
+
+private:
+    volatile uint32_t sequence = 0;
+    T data{};
+
+    template<typename F>
+    void Apply(F &_fn)
+    {
+        sequence++;
+        __DMB();
+        _fn(data);
+        __DMB();
+        sequence++;
+    }
+};
+
+#endif //REF_STM32F4_SEQLOCK_HPP
@@ -50,12 +50,9 @@
 
 // List of semaphores
 osSemaphoreId sem_usb_irq;
-osSemaphoreId sem_uart4_dma;
-osSemaphoreId sem_uart5_dma;
 osSemaphoreId sem_usb_rx;
-osSemaphoreId sem_usb_tx;
-osSemaphoreId sem_can1_tx;
-osSemaphoreId sem_can2_tx;
+osSemaphoreId sem_usb_tx_cdc;
+osSemaphoreId sem_usb_tx_native;
 
 /* USER CODE END Variables */
 /* Definitions for defaultTask */
@@ -96,25 +93,15 @@ void MX_FREERTOS_Init(void) {
     osSemaphoreDef(sem_usb_irq);
     sem_usb_irq = osSemaphoreNew(1, 0, osSemaphore(sem_usb_irq));
 
-    // Create a semaphore for UART DMA and remove a token
-    osSemaphoreDef(sem_uart4_dma);
-    sem_uart4_dma = osSemaphoreNew(1, 1, osSemaphore(sem_uart4_dma));
-    osSemaphoreDef(sem_uart5_dma);
-    sem_uart5_dma = osSemaphoreNew(1, 1, osSemaphore(sem_uart5_dma));
-
     // Create a semaphore for USB RX, and start with no tokens by removing the starting one.
     osSemaphoreDef(sem_usb_rx);
     sem_usb_rx = osSemaphoreNew(1, 0, osSemaphore(sem_usb_rx));
 
-    // Create a semaphore for USB TX
-    osSemaphoreDef(sem_usb_tx);
-    sem_usb_tx = osSemaphoreNew(1, 1, osSemaphore(sem_usb_tx));
-
-    // Create a semaphore for CAN TX
-    osSemaphoreDef(sem_can1_tx);
-    sem_can1_tx = osSemaphoreNew(1, 1, osSemaphore(sem_can1_tx));
-    osSemaphoreDef(sem_can2_tx);
-    sem_can2_tx = osSemaphoreNew(1, 1, osSemaphore(sem_can2_tx));
+    // Create a semaphore for each USB TX endpoint, so ASCII and native traffic don't serialize
+    osSemaphoreDef(sem_usb_tx_cdc);
+    sem_usb_tx_cdc = osSemaphoreNew(1, 1, osSemaphore(sem_usb_tx_cdc));
+    osSemaphoreDef(sem_usb_tx_native);
+    sem_usb_tx_native = osSemaphoreNew(1, 1, osSemaphore(sem_usb_tx_native));
 
   /* USER CODE END RTOS_SEMAPHORES */
 
@@ -278,6 +278,16 @@ void CAN1_RX0_IRQHandler(void)
 void CAN1_RX1_IRQHandler(void)
 {
   /* USER CODE BEGIN CAN1_RX1_IRQn 0 */
+    if (( READ_REG(hcan1.Instance->IER) & CAN_IT_RX_FIFO1_MSG_PENDING) != 0U)
+    {
+        /* Check if message is still pending */
+        if ((hcan1.Instance->RF1R & CAN_RF1R_FMP1) != 0U)
+        {
+            /* Call weak (surcharged) callback */
+            HAL_CAN_RxFifo1MsgPendingCallback(&hcan1);
+        }
+    }
+    return;
 
   /* USER CODE END CAN1_RX1_IRQn 0 */
   HAL_CAN_IRQHandler(&hcan1);
@@ -571,12 +571,17 @@ static uint8_t  USBD_CDC_DataIn (USBD_HandleTypeDef *pdev, uint8_t epnum)
     if(pdev->pClassData != NULL)
     {
         // NOTE: We would logically expect xx_IN_EP here, but we actually get the xx_OUT_EP
+        // Each endpoint has its own semaphore so both can transmit concurrently.
         if (epnum == CDC_OUT_EP)
+        {
             hcdc->CDC_Tx.State = 0;
+            osSemaphoreRelease(sem_usb_tx_cdc);
+        }
         if (epnum == ODRIVE_OUT_EP)
+        {
             hcdc->REF_Tx.State = 0;
-        //Note: We could use independent semaphores for simoultainous USB transmission.
-        osSemaphoreRelease(sem_usb_tx);
+            osSemaphoreRelease(sem_usb_tx_native);
+        }
         return USBD_OK;
     }
     else
@@ -1,11 +1,16 @@
 #include "ctrl_step.hpp"
 #include "communication.hpp"
+#include "can_codec.h"
+#include <cstring>
+
+// Velocity limits are resent this often even if unchanged, for drivers that rebooted
+#define GROUP_VELOCITY_REFRESH  100
 
 
 CtrlStepMotor::CtrlStepMotor(CAN_HandleTypeDef* _hcan, uint8_t _id, bool _inverse,
                              uint8_t _reduction, float _angleLimitMin, float _angleLimitMax) :
-    nodeID(_id), hcan(_hcan), inverseDirection(_inverse), reduction(_reduction),
-    angleLimitMin(_angleLimitMin), angleLimitMax(_angleLimitMax)
+    nodeID(_id), angleLimitMax(_angleLimitMax), angleLimitMin(_angleLimitMin),
+    inverseDirection(_inverse), reduction(_reduction), hcan(_hcan)
 {
     txHeader =
         {
@@ -25,6 +30,7 @@ void CtrlStepMotor::SetEnable(bool _enable)
 
     uint8_t mode = 0x01;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     // Int to Bytes
     uint32_t val = _enable ? 1 : 0;
@@ -32,7 +38,9 @@ void CtrlStepMotor::SetEnable(bool _enable)
     for (int i = 0; i < 4; i++)
         canBuf[i] = *(b + i);
 
-    CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
+    // Disabling is how the robot stops, don't let it wait behind setpoints
+    CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader,
+                   _enable ? CAN_TX_PRIORITY_NORMAL : CAN_TX_PRIORITY_HIGH);
 }
 
 
@@ -40,6 +48,7 @@ void CtrlStepMotor::DoCalibration()
 {
     uint8_t mode = 0x02;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
 }
@@ -51,6 +60,7 @@ void CtrlStepMotor::SetCurrentSetPoint(float _val)
 
     uint8_t mode = 0x03;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     // Float to Bytes
     auto* b = (unsigned char*) &_val;
@@ -67,6 +77,7 @@ void CtrlStepMotor::SetVelocitySetPoint(float _val)
 
     uint8_t mode = 0x04;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     // Float to Bytes
     auto* b = (unsigned char*) &_val;
@@ -81,6 +92,7 @@ void CtrlStepMotor::SetPositionSetPoint(float _val)
 {
     uint8_t mode = 0x05;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     // Float to Bytes
     auto* b = (unsigned char*) &_val;
@@ -94,16 +106,15 @@ void CtrlStepMotor::SetPositionSetPoint(float _val)
 
 void CtrlStepMotor::SetPositionWithVelocityLimit(float _pos, float _vel)
 {
-    uint8_t mode = 0x07;
+    uint8_t mode = 0x0B;
     txHeader.StdId = nodeID << 7 | mode;
 
-    // Float to Bytes
-    auto* b = (unsigned char*) &_pos;
-    for (int i = 0; i < 4; i++)
-        canBuf[i] = *(b + i);
-    b = (unsigned char*) &_vel;
-    for (int i = 4; i < 8; i++)
-        canBuf[i] = *(b + i - 4);
+    CanSetPoint_t setPoint = {
+        .position = CanTurnsToFixed(_pos, CAN_POSITION_FRAC_BITS, CAN_POSITION_BITS),
+        .velocity = CanTurnsToFixed(_vel, CAN_VELOCITY_FRAC_BITS, CAN_VELOCITY_BITS),
+        .flags = (uint8_t) (stateBroadcastPeriod ? 0 : CAN_STATUS_NEED_ACK)
+    };
+    CanPackSetPoint(canBuf, &setPoint);
 
     CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
 }
@@ -113,6 +124,7 @@ void CtrlStepMotor::SetNodeID(uint32_t _id)
 {
     uint8_t mode = 0x11;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     // Int to Bytes
     auto* b = (unsigned char*) &_id;
@@ -128,6 +140,7 @@ void CtrlStepMotor::SetCurrentLimit(float _val)
 {
     uint8_t mode = 0x12;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     // Float to Bytes
     auto* b = (unsigned char*) &_val;
@@ -143,6 +156,7 @@ void CtrlStepMotor::SetVelocityLimit(float _val)
 {
     uint8_t mode = 0x13;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     // Float to Bytes
     auto* b = (unsigned char*) &_val;
@@ -158,6 +172,7 @@ void CtrlStepMotor::SetAcceleration(float _val)
 {
     uint8_t mode = 0x14;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     // Float to Bytes
     auto* b = (unsigned char*) &_val;
@@ -169,10 +184,27 @@ void CtrlStepMotor::SetAcceleration(float _val)
 }
 
 
+void CtrlStepMotor::SetJerk(float _val)
+{
+    uint8_t mode = 0x1F;
+    txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
+
+    // Float to Bytes
+    auto* b = (unsigned char*) &_val;
+    for (int i = 0; i < 4; i++)
+        canBuf[i] = *(b + i);
+    canBuf[4] = 1; // Need save to EEPROM or not
+
+    CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
+}
+
+
 void CtrlStepMotor::ApplyPositionAsHome()
 {
     uint8_t mode = 0x15;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
 }
@@ -182,6 +214,7 @@ void CtrlStepMotor::SetEnableOnBoot(bool _enable)
 {
     uint8_t mode = 0x16;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     // Int to Bytes
     uint32_t val = _enable ? 1 : 0;
@@ -194,10 +227,92 @@ void CtrlStepMotor::SetEnableOnBoot(bool _enable)
 }
 
 
+void CtrlStepMotor::SetStateBroadcastPeriod(uint32_t _ms)
+{
+    uint8_t mode = 0x1C;
+    txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
+
+    auto* b = (unsigned char*) &_ms;
+    for (int i = 0; i < 4; i++)
+        canBuf[i] = *(b + i);
+    canBuf[4] = 1; // Need save to EEPROM or not
+
+    CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
+    stateBroadcastPeriod = _ms;
+}
+
+
+void CtrlStepMotor::SetEstimator(uint32_t _type)
+{
+    uint8_t mode = 0x1D;
+    txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
+
+    auto* b = (unsigned char*) &_type;
+    for (int i = 0; i < 4; i++)
+        canBuf[i] = *(b + i);
+    canBuf[4] = 1; // Need save to EEPROM or not
+
+    CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
+}
+
+
+void CtrlStepMotor::StartDceTune()
+{
+    uint8_t mode = 0x1E;
+    txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
+
+    dceTuneState = CAN_DCE_TUNE_RUNNING;
+    CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
+}
+
+
+void CtrlStepMotor::SetCollisionDetect(float _sigma, uint32_t _tripMs, uint32_t _errorFloor, float _currentFloor)
+{
+    uint8_t mode = 0x10;
+    txHeader.StdId = nodeID << 7 | mode;
+
+    float threshold = _sigma * 4 + 0.5f;
+    float currentFloor = _currentFloor * 1000 + 0.5f;
+    CanCollisionConfig_t config = {
+        .threshold = (uint8_t) (threshold < 0 ? 0 : threshold > 255 ? 255 : threshold),
+        .tripTime = (uint8_t) (_tripMs > 255 ? 255 : _tripMs),
+        .errorFloor = (uint16_t) (_errorFloor > 0xFFFF ? 0xFFFF : _errorFloor),
+        .currentFloor = (uint16_t) (currentFloor < 0 ? 0 : currentFloor > 0xFFFF ? 0xFFFF : currentFloor),
+        .store = true
+    };
+    CanPackCollisionConfig(canBuf, &config);
+
+    CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
+}
+
+
+void CtrlStepMotor::UpdateDceTune()
+{
+    static const uint8_t items[] = {
+        CAN_DCE_TUNE_INERTIA, CAN_DCE_TUNE_STIFFNESS, CAN_DCE_TUNE_DAMPING,
+        CAN_DCE_TUNE_DELAY, CAN_DCE_TUNE_BANDWIDTH, CAN_DCE_TUNE_GAINS
+    };
+
+    uint8_t mode = 0x29;
+    txHeader.StdId = nodeID << 7 | mode;
+
+    for (uint8_t item : items)
+    {
+        memset(canBuf, 0, sizeof(canBuf));
+        canBuf[0] = item;
+        CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
+    }
+}
+
+
 void CtrlStepMotor::SetEnableStallProtect(bool _enable)
 {
     uint8_t mode = 0x1B;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     uint32_t val = _enable ? 1 : 0;
     auto* b = (unsigned char*) &val;
@@ -213,6 +328,7 @@ void CtrlStepMotor::Reboot()
 {
     uint8_t mode = 0x7f;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
 }
@@ -222,6 +338,7 @@ void CtrlStepMotor::EraseConfigs()
 {
     uint8_t mode = 0x7e;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
 }
@@ -229,24 +346,111 @@ void CtrlStepMotor::EraseConfigs()
 
 void CtrlStepMotor::SetAngle(float _angle)
 {
-    _angle = inverseDirection ? -_angle : _angle;
-    float stepMotorCnt = _angle / 360.0f * (float) reduction;
-    SetPositionSetPoint(stepMotorCnt);
+    SetPositionSetPoint(AngleToPosition(_angle));
 }
 
 
 void CtrlStepMotor::SetAngleWithVelocityLimit(float _angle, float _vel)
+{
+    SetPositionWithVelocityLimit(AngleToPosition(_angle), _vel);
+}
+
+
+float CtrlStepMotor::AngleToPosition(float _angle)
 {
     _angle = inverseDirection ? -_angle : _angle;
-    float stepMotorCnt = _angle / 360.0f * (float) reduction;
-    SetPositionWithVelocityLimit(stepMotorCnt, _vel);
+    return _angle / 360.0f * (float) reduction;
+}
+
+
+void CtrlStepMotor::SetGroupPositionWithVelocityLimit(const float* _pos, const float* _vel, bool _needAck)
+{
+    CAN_context* ctx = get_can_ctx(hcan);
+
+    // Velocity limits rarely change during a move, only send them when they do.
+    // One extra bit of range as signed, so negative values clamp to 0.
+    uint16_t vel[GROUP_JOINT_NUM];
+    for (int i = 0; i < GROUP_JOINT_NUM; i++)
+    {
+        int32_t fixed = CanTurnsToFixed(_vel[i], CAN_GROUP_VELOCITY_FRAC_BITS, CAN_GROUP_VELOCITY_BITS + 1);
+        vel[i] = fixed < 0 ? 0 : fixed;
+    }
+    if (groupVelocityAge >= GROUP_VELOCITY_REFRESH || memcmp(vel, groupVelocitySent, sizeof(vel)) != 0)
+    {
+        memset(canBuf, 0, sizeof(canBuf));
+        for (int i = 0; i < GROUP_JOINT_NUM; i++)
+            CanSetField(canBuf, i, CAN_GROUP_VELOCITY_BITS, vel[i]);
+        txHeader.StdId = nodeID << 7 | 0x0A;
+        CanSendMessage(ctx, canBuf, &txHeader);
+
+        memcpy(groupVelocitySent, vel, sizeof(vel));
+        groupVelocityAge = 0;
+    } else
+        groupVelocityAge++;
+
+    // 0x08 latches joints 1~3, 0x09 latches joints 4~6 and applies all of them
+    for (int frame = 0; frame < 2; frame++)
+    {
+        memset(canBuf, 0, sizeof(canBuf));
+        for (int i = 0; i < CAN_GROUP_JOINTS_PER_FRAME; i++)
+            CanSetField(canBuf, i, CAN_GROUP_POSITION_BITS,
+                        CanTurnsToFixed(_pos[frame * CAN_GROUP_JOINTS_PER_FRAME + i],
+                                        CAN_GROUP_POSITION_FRAC_BITS, CAN_GROUP_POSITION_BITS));
+        if (frame == 1 && _needAck)
+            canBuf[7] |= 0x80;
+        txHeader.StdId = nodeID << 7 | (0x08 + frame);
+        CanSendMessage(ctx, canBuf, &txHeader);
+    }
+}
+
+
+void CtrlStepMotor::SetTrajectoryClock(uint32_t _clock)
+{
+    uint8_t mode = 0x0C;
+    txHeader.StdId = nodeID << 7 | mode;
+
+    CanPackTrajectoryClock(canBuf, _clock);
+
+    CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
+}
+
+
+void CtrlStepMotor::AddTrajectoryPoint(uint32_t _time, float _pos, float _vel, bool _flush, bool _needAck)
+{
+    uint8_t mode = 0x0D;
+    txHeader.StdId = nodeID << 7 | mode;
+
+    CanTrajectoryPoint_t point = {
+        .position = CanTurnsToFixed(_pos, CAN_POSITION_FRAC_BITS, CAN_POSITION_BITS),
+        .velocity = CanTurnsToFixed(_vel, CAN_VELOCITY_FRAC_BITS, CAN_VELOCITY_BITS),
+        .time = (uint16_t) _time,
+        .flags = (uint8_t) ((_flush ? CAN_TRAJECTORY_FLUSH : 0) | (_needAck ? CAN_STATUS_NEED_ACK : 0))
+    };
+    CanPackTrajectoryPoint(canBuf, &point);
+
+    CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
+}
+
+
+void CtrlStepMotor::UpdateTrajectoryStatus()
+{
+    uint8_t mode = 0x28;
+    txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
+
+    CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
 }
 
 
 void CtrlStepMotor::UpdateAngle()
 {
-    uint8_t mode = 0x23;
+    // The state arrives periodically anyway
+    if (stateBroadcastPeriod)
+        return;
+
+    uint8_t mode = 0x25;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     CanSendMessage(get_can_ctx(hcan), canBuf, &txHeader);
 }
@@ -261,10 +465,83 @@ void CtrlStepMotor::UpdateAngleCallback(float _pos, bool _isFinished)
 }
 
 
+void CtrlStepMotor::UpdateStateCallback(const uint8_t* _data)
+{
+    CanState_t canState;
+    if (!CanUnpackState(_data, &canState))
+        return;
+
+    UpdateAngleCallback(CanFixedToTurns(canState.position, CAN_POSITION_FRAC_BITS),
+                        canState.flags & CAN_STATUS_FINISHED);
+
+    float tmp = CanFixedToTurns(canState.velocity, CAN_VELOCITY_FRAC_BITS) / (float) reduction * 360;
+    velocity = inverseDirection ? -tmp : tmp;
+    current = (float) canState.current / 1000.f;
+}
+
+
+void CtrlStepMotor::UpdateTrajectoryStatusCallback(const uint8_t* _data)
+{
+    CanTrajectoryStatus_t status;
+    if (!CanUnpackTrajectoryStatus(_data, &status))
+        return;
+
+    trajectoryFreePoints = status.freePoints;
+    trajectoryClock = status.clock;
+}
+
+
+void CtrlStepMotor::UpdateDceTuneCallback(const uint8_t* _data)
+{
+    dceTuneState = _data[1];
+
+    switch (_data[0])
+    {
+        case CAN_DCE_TUNE_INERTIA:
+            dceTuneInertia = CanGetFloat(_data + 2);
+            break;
+        case CAN_DCE_TUNE_STIFFNESS:
+            dceTuneStiffness = CanGetFloat(_data + 2);
+            break;
+        case CAN_DCE_TUNE_DAMPING:
+            dceTuneDamping = CanGetFloat(_data + 2);
+            break;
+        case CAN_DCE_TUNE_DELAY:
+            dceTuneDelay = CanGetFloat(_data + 2);
+            break;
+        case CAN_DCE_TUNE_BANDWIDTH:
+            dceTuneBandwidth = CanGetFloat(_data + 2);
+            break;
+        case CAN_DCE_TUNE_GAINS:
+            dceTuneKp = (uint16_t) CanGetInt(_data + 2, 2);
+            dceTuneKi = (uint16_t) CanGetInt(_data + 4, 2);
+            dceTuneKd = (uint16_t) CanGetInt(_data + 6, 2);
+            break;
+        default:
+            break;
+    }
+}
+
+
+bool CtrlStepMotor::UpdateCollisionCallback(const uint8_t* _data)
+{
+    CanCollision_t collision;
+    if (!CanUnpackCollision(_data, &collision))
+        return false;
+
+    UpdateAngleCallback(CanFixedToTurns(collision.position, CAN_POSITION_FRAC_BITS), false);
+    collisionCount++;
+    collisionErrorDeviation = collision.errorDeviation;
+    collisionCurrentDeviation = (float) collision.currentDeviation / 1000.f;
+    return true;
+}
+
+
 void CtrlStepMotor::SetDceKp(int32_t _val)
 {
     uint8_t mode = 0x17;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     auto* b = (unsigned char*) &_val;
     for (int i = 0; i < 4; i++)
@@ -279,6 +556,7 @@ void CtrlStepMotor::SetDceKv(int32_t _val)
 {
     uint8_t mode = 0x18;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     auto* b = (unsigned char*) &_val;
     for (int i = 0; i < 4; i++)
@@ -293,6 +571,7 @@ void CtrlStepMotor::SetDceKi(int32_t _val)
 {
     uint8_t mode = 0x19;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     auto* b = (unsigned char*) &_val;
     for (int i = 0; i < 4; i++)
@@ -307,6 +586,7 @@ void CtrlStepMotor::SetDceKd(int32_t _val)
 {
     uint8_t mode = 0x1A;
     txHeader.StdId = nodeID << 7 | mode;
+    memset(canBuf, 0, sizeof(canBuf));
 
     auto* b = (unsigned char*) &_val;
     for (int i = 0; i < 4; i++)
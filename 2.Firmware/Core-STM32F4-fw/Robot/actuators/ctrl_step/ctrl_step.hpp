@@ -16,20 +16,39 @@ public:
 
 
     const uint32_t CTRL_CIRCLE_COUNT = 200 * 256;
+    static const uint8_t GROUP_JOINT_NUM = 6;
 
     CtrlStepMotor(CAN_HandleTypeDef* _hcan, uint8_t _id, bool _inverse = false, uint8_t _reduction = 1,
                   float _angleLimitMin = -180, float _angleLimitMax = 180);
 
     uint8_t nodeID;
     float angle = 0;
+    float velocity = 0;     // deg/s, joint side
+    float current = 0;      // A
     float angleLimitMax;
     float angleLimitMin;
     bool inverseDirection;
     uint8_t reduction;
     State state = STOP;
+    uint32_t stateBroadcastPeriod = 0;  // ms, set when the driver sends its state on its own
+    uint8_t trajectoryFreePoints = 0;   // From the last 0x28 reply
+    uint32_t trajectoryClock = 0;       // Driver ticks, when it sent that reply
+    // From the 0x29 replies, the model is motor side
+    uint8_t dceTuneState = 0;           // CAN_DCE_TUNE_*
+    float dceTuneInertia = 0;           // mA per turn/s^2
+    float dceTuneStiffness = 0;         // mA per turn
+    float dceTuneDamping = 0;           // mA per turn/s
+    float dceTuneDelay = 0;             // s
+    float dceTuneBandwidth = 0;         // Hz
+    int32_t dceTuneKp = 0, dceTuneKi = 0, dceTuneKd = 0;
+    // From the 0x2A reports, the driver stalled itself on each
+    uint32_t collisionCount = 0;
+    int32_t collisionErrorDeviation = 0;    // steps
+    float collisionCurrentDeviation = 0;    // A
 
     void SetAngle(float _angle);
     void SetAngleWithVelocityLimit(float _angle, float _vel);
+    float AngleToPosition(float _angle);
     // CAN Command
     void SetEnable(bool _enable);
     void DoCalibration();
@@ -41,6 +60,8 @@ public:
     void SetCurrentLimit(float _val);
     void SetVelocityLimit(float _val);
     void SetAcceleration(float _val);
+    // r/s^3, S-curve position moves, 0 for trapezoidal
+    void SetJerk(float _val);
     void SetDceKp(int32_t _val);
     void SetDceKv(int32_t _val);
     void SetDceKi(int32_t _val);
@@ -48,11 +69,31 @@ public:
     void ApplyPositionAsHome();
     void SetEnableOnBoot(bool _enable);
     void SetEnableStallProtect(bool _enable);
+    void SetStateBroadcastPeriod(uint32_t _ms);
+    // 0 filter, 1 PLL, the driver switches after its next reboot
+    void SetEstimator(uint32_t _type);
+    // The driver finds and stores its own DCE gains, poll UpdateDceTune() for the result
+    void StartDceTune();
+    void UpdateDceTune();
+    // Stalls the driver within milliseconds of hitting something, stored to EEPROM.
+    // _sigma 0 disables it, the floors keep small deviations of a quiet joint from counting.
+    void SetCollisionDetect(float _sigma, uint32_t _tripMs, uint32_t _errorFloor, float _currentFloor);
     void Reboot();
     void EraseConfigs();
+    // Broadcast only (node 0), _pos and _vel hold GROUP_JOINT_NUM motor-side values
+    void SetGroupPositionWithVelocityLimit(const float* _pos, const float* _vel, bool _needAck);
+    // Node 0 for all joints at once. The clock counts CAN_TRAJECTORY_CLOCK_HZ ticks.
+    void SetTrajectoryClock(uint32_t _clock);
+    // Motor-side point due at _time of the driver's clock, played back smoothly between points
+    void AddTrajectoryPoint(uint32_t _time, float _pos, float _vel, bool _flush = false, bool _needAck = false);
+    void UpdateTrajectoryStatus();
 
     void UpdateAngle();
     void UpdateAngleCallback(float _pos, bool _isFinished);
+    void UpdateStateCallback(const uint8_t* _data);
+    void UpdateTrajectoryStatusCallback(const uint8_t* _data);
+    void UpdateDceTuneCallback(const uint8_t* _data);
+    bool UpdateCollisionCallback(const uint8_t* _data);
 
 
     // Communication protocol definitions
@@ -60,6 +101,8 @@ public:
     {
         return make_protocol_member_list(
             make_protocol_ro_property("angle", &angle),
+            make_protocol_ro_property("velocity", &velocity),
+            make_protocol_ro_property("current", &current),
             make_protocol_function("reboot", *this, &CtrlStepMotor::Reboot),
             make_protocol_function("erase_configs", *this, &CtrlStepMotor::EraseConfigs),
             make_protocol_function("set_enable", *this, &CtrlStepMotor::SetEnable, "enable"),
@@ -72,6 +115,7 @@ public:
             make_protocol_function("set_current_limit", *this, &CtrlStepMotor::SetCurrentLimit, "current"),
             make_protocol_function("set_node_id", *this, &CtrlStepMotor::SetNodeID, "id"),
             make_protocol_function("set_acceleration", *this, &CtrlStepMotor::SetAcceleration, "acc"),
+            make_protocol_function("set_jerk", *this, &CtrlStepMotor::SetJerk, "jerk"),
             make_protocol_function("apply_home_offset", *this, &CtrlStepMotor::ApplyPositionAsHome),
             make_protocol_function("do_calibration", *this, &CtrlStepMotor::DoCalibration),
             make_protocol_function("set_enable_on_boot", *this, &CtrlStepMotor::SetEnableOnBoot, "enable"),
@@ -81,6 +125,17 @@ public:
             make_protocol_function("set_dce_kd", *this, &CtrlStepMotor::SetDceKd, "vel"),
             make_protocol_function("set_enable_stall_protect", *this, &CtrlStepMotor::SetEnableStallProtect,
                                    "enable"),
+            make_protocol_function("set_state_broadcast_period", *this, &CtrlStepMotor::SetStateBroadcastPeriod,
+                                   "period_ms"),
+            make_protocol_function("set_estimator", *this, &CtrlStepMotor::SetEstimator, "type"),
+            make_protocol_ro_property("dce_tune_state", &dceTuneState),
+            make_protocol_ro_property("dce_tune_inertia", &dceTuneInertia),
+            make_protocol_ro_property("dce_tune_bandwidth", &dceTuneBandwidth),
+            make_protocol_function("start_dce_tune", *this, &CtrlStepMotor::StartDceTune),
+            make_protocol_function("update_dce_tune", *this, &CtrlStepMotor::UpdateDceTune),
+            make_protocol_function("set_collision_detect", *this, &CtrlStepMotor::SetCollisionDetect,
+                                   "sigma", "trip_ms", "error_floor", "current_floor"),
+            make_protocol_ro_property("collision_count", &collisionCount),
             make_protocol_function("update_angle", *this, &CtrlStepMotor::UpdateAngle)
         );
     }
@@ -90,6 +145,8 @@ private:
     CAN_HandleTypeDef* hcan;
     uint8_t canBuf[8] = {};
     CAN_TxHeaderTypeDef txHeader = {};
+    uint16_t groupVelocitySent[GROUP_JOINT_NUM] = {};
+    uint32_t groupVelocityAge = UINT32_MAX;
 };
 
 #endif //DUMMY_CORE_FW_CTRL_STEP_HPP
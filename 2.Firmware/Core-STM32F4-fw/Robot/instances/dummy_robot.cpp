@@ -1,5 +1,6 @@
 #include "communication.hpp"
 #include "dummy_robot.h"
+#include "time_utils.h"
 
 inline float AbsMaxOf6(DOF6Kinematic::Joint6D_t _joints, uint8_t &_index)
 {
@@ -28,8 +29,13 @@ DummyRobot::DummyRobot(CAN_HandleTypeDef* _hcan) :
     motorJ[5] = new CtrlStepMotor(_hcan, 5, true, 30, -120, 120);
     motorJ[6] = new CtrlStepMotor(_hcan, 6, true, 50, -720, 720);
     hand = new DummyHand(_hcan, 7);
+    motorUnassigned = new CtrlStepMotor(_hcan, 0);
 
     dof6Solver = new DOF6Kinematic(0.109f, 0.035f, 0.146f, 0.115f, 0.052f, 0.072f);
+
+    JointState_t restState = {};
+    restState.joints = REST_POSE;
+    jointState.Write(restState);
 }
 
 
@@ -39,14 +45,22 @@ DummyRobot::~DummyRobot()
         delete motorJ[j];
 
     delete hand;
+    delete motorUnassigned;
     delete dof6Solver;
 }
 
 
+// Called once the kernel runs, before the node scan timer starts
 void DummyRobot::Init()
 {
     SetCommandMode(DEFAULT_COMMAND_MODE);
     SetJointSpeed(DEFAULT_JOINT_SPEED);
+
+    const osMutexAttr_t mutexAttr = {
+        .name = "nodeIdMutex",
+        .attr_bits = osMutexPrioInherit,
+    };
+    nodeIdMutex = osMutexNew(&mutexAttr);
 }
 
 
@@ -60,6 +74,16 @@ void DummyRobot::Reboot()
 
 void DummyRobot::MoveJoints(DOF6Kinematic::Joint6D_t _joints)
 {
+    if (groupSync)
+    {
+        float pos[6];
+        for (int j = 1; j <= 6; j++)
+            pos[j - 1] = motorJ[j]->AngleToPosition(_joints.a[j - 1] - initPose.a[j - 1]);
+        motorJ[ALL]->SetGroupPositionWithVelocityLimit(pos, dynamicJointSpeeds.a,
+                                                       motorJ[ALL]->stateBroadcastPeriod == 0);
+        return;
+    }
+
     for (int j = 1; j <= 6; j++)
     {
         motorJ[j]->SetAngleWithVelocityLimit(_joints.a[j - 1] - initPose.a[j - 1],
@@ -82,7 +106,7 @@ bool DummyRobot::MoveJ(float _j1, float _j2, float _j3, float _j4, float _j5, fl
 
     if (valid)
     {
-        DOF6Kinematic::Joint6D_t deltaJoints = targetJointsTmp - currentJoints;
+        DOF6Kinematic::Joint6D_t deltaJoints = targetJointsTmp - GetJointState().joints;
         uint8_t index;
         float maxAngle = AbsMaxOf6(deltaJoints, index);
         float time = maxAngle * (float) (motorJ[index + 1]->reduction) / jointSpeed;
@@ -92,7 +116,7 @@ bool DummyRobot::MoveJ(float _j1, float _j2, float _j3, float _j4, float _j5, fl
                 abs(deltaJoints.a[j - 1] * (float) (motorJ[j]->reduction) / time * 0.1f); //0~10r/s
         }
 
-        jointsStateFlag = 0;
+        jointState.Modify([](JointState_t &_state) { _state.stateFlag = 0; });
         targetJoints = targetJointsTmp;
 
         return true;
@@ -132,6 +156,7 @@ bool DummyRobot::MoveL(float _x, float _y, float _z, float _a, float _b, float _
 
     if (validCnt)
     {
+        DOF6Kinematic::Joint6D_t currentJoints = GetJointState().joints;
         float min = 1000;
         uint8_t indexConfig = 0, indexJoint = 0;
         for (int i = 0; i < 8; i++)
@@ -166,15 +191,23 @@ void DummyRobot::UpdateJointAngles()
 
 void DummyRobot::UpdateJointAnglesCallback()
 {
+    DOF6Kinematic::Joint6D_t joints;
+    uint8_t finished = 0;
     for (int i = 1; i <= 6; i++)
     {
-        currentJoints.a[i - 1] = motorJ[i]->angle + initPose.a[i - 1];
+        joints.a[i - 1] = motorJ[i]->angle + initPose.a[i - 1];
 
         if (motorJ[i]->state == CtrlStepMotor::FINISH)
-            jointsStateFlag |= (1 << i);
-        else
-            jointsStateFlag &= ~(1 << i);
+            finished |= (1 << i);
     }
+
+    uint32_t timestamp = micros();
+    jointState.Modify([&](JointState_t &_state)
+                      {
+                          _state.joints = joints;
+                          _state.stateFlag = finished;
+                          _state.timestamp = timestamp;
+                      });
 }
 
 
@@ -215,7 +248,7 @@ void DummyRobot::CalibrateHomeOffset()
 
     // 3.Go to Resting-Pose
     initPose = DOF6Kinematic::Joint6D_t(0, 0, 90, 0, 0, 0);
-    currentJoints = DOF6Kinematic::Joint6D_t(0, 0, 90, 0, 0, 0);
+    jointState.Modify([](JointState_t &_state) { _state.joints = DOF6Kinematic::Joint6D_t(0, 0, 90, 0, 0, 0); });
     Resting();
     osDelay(500);
 
@@ -268,16 +301,30 @@ void DummyRobot::SetEnable(bool _enable)
 
 void DummyRobot::UpdateJointPose6D()
 {
-    dof6Solver->SolveFK(currentJoints, currentPose6D);
-    currentPose6D.X *= 1000; // m -> mm
-    currentPose6D.Y *= 1000; // m -> mm
-    currentPose6D.Z *= 1000; // m -> mm
+    // The FK runs outside the lock, if new joints were published meanwhile
+    // solve again so the pose always belongs to the joints next to it.
+    uint32_t sequence;
+    DOF6Kinematic::Pose6D_t pose;
+    do
+    {
+        JointState_t state = jointState.Read(&sequence);
+        dof6Solver->SolveFK(state.joints, pose);
+        pose.X *= 1000; // m -> mm
+        pose.Y *= 1000; // m -> mm
+        pose.Z *= 1000; // m -> mm
+    } while (!jointState.CompareAndModify(sequence, [&](JointState_t &_state) { _state.pose = pose; }));
 }
 
 
 bool DummyRobot::IsMoving()
 {
-    return jointsStateFlag != 0b1111110;
+    return GetJointState().stateFlag != 0b1111110;
+}
+
+
+DummyRobot::JointState_t DummyRobot::GetJointState()
+{
+    return jointState.Read();
 }
 
 
@@ -287,6 +334,90 @@ bool DummyRobot::IsEnabled()
 }
 
 
+// One broadcast configures all joints, the per-joint copies decide whether to poll
+void DummyRobot::SetStateBroadcastPeriod(uint32_t _ms)
+{
+    motorJ[ALL]->SetStateBroadcastPeriod(_ms);
+    for (int j = 1; j <= 6; j++)
+        motorJ[j]->stateBroadcastPeriod = _ms;
+}
+
+
+// @brief Updates jointsOnline from the heartbeats and hands the ID of a
+// missing joint to a driver that came up without one. Returns jointsOnline.
+uint32_t DummyRobot::ScanJoints()
+{
+    CAN_context* ctx = get_can_ctx(hcan);
+    uint16_t online = CanGetOnlineNodes(ctx);
+    jointsOnline = online & JOINT_NODES;
+
+    uint16_t missing = JOINT_NODES & ~online;
+    uint8_t missingCnt = 0, joint = 0;
+    uint8_t newCnt = 0, node = 0;
+    bool settled = false;
+    for (uint8_t id = 1; id < CAN_NODE_ID_COUNT; id++)
+    {
+        if (missing & (1U << id))
+        {
+            missingCnt++;
+            joint = id;
+        }
+
+        CAN_NodeInfo info;
+        if (id >= CAN_NODE_ID_DYNAMIC_FIRST && (online & (1U << id)) &&
+            CanGetNodeInfo(ctx, id, &info) && info.stored_id == 0)
+        {
+            newCnt++;
+            node = id;
+            settled = millis() - info.online_since_ms >= NEW_NODE_SETTLE_MS;
+        }
+    }
+
+    // Only when it's unambiguous, otherwise AssignNodeId() by hand. The node
+    // needs a moment to switch IDs, don't repeat the command meanwhile.
+    if (missingCnt == 1 && newCnt == 1 && settled && millis() - lastAssignMs > NEW_NODE_SETTLE_MS &&
+        SendNodeId(node, joint, 0))
+        lastAssignMs = millis();
+
+    return jointsOnline;
+}
+
+
+// @brief Gives node _from the ID _to, which it stores and claims from then on.
+void DummyRobot::AssignNodeId(uint32_t _from, uint32_t _to)
+{
+    SendNodeId(_from, _to, osWaitForever);
+}
+
+
+// The comm tasks (#SETNODE, fibre) and the node scan timer all come here.
+// The timer task must not block, it passes no timeout and gets false while
+// someone else holds motorUnassigned, the next scan tries again.
+bool DummyRobot::SendNodeId(uint32_t _from, uint32_t _to, uint32_t _timeout)
+{
+    if (_from == 0 || _from >= CAN_NODE_ID_COUNT || _to >= CAN_NODE_ID_COUNT)
+        return false;
+    if (nodeIdMutex != nullptr && osMutexAcquire(nodeIdMutex, _timeout) != osOK)
+        return false;
+
+    motorUnassigned->nodeID = _from;
+    motorUnassigned->SetNodeID(_to);
+
+    if (nodeIdMutex != nullptr)
+        osMutexRelease(nodeIdMutex);
+    return true;
+}
+
+
+// @brief Holds every joint where it is and disables the robot, like a STOP
+// command. The joint that hit something already stalled itself.
+void DummyRobot::OnJointCollision(uint8_t _id)
+{
+    collisionJoint = _id;
+    commandHandler.EmergencyStop();
+}
+
+
 void DummyRobot::SetCommandMode(uint32_t _mode)
 {
     if (_mode < COMMAND_TARGET_POINT_SEQUENTIAL ||
@@ -383,8 +514,9 @@ uint32_t DummyRobot::CommandHandler::Push(const std::string &_cmd)
 
 void DummyRobot::CommandHandler::EmergencyStop()
 {
-    context->MoveJ(context->currentJoints.a[0], context->currentJoints.a[1], context->currentJoints.a[2],
-                   context->currentJoints.a[3], context->currentJoints.a[4], context->currentJoints.a[5]);
+    DOF6Kinematic::Joint6D_t currentJoints = context->GetJointState().joints;
+    context->MoveJ(currentJoints.a[0], currentJoints.a[1], currentJoints.a[2],
+                   currentJoints.a[3], currentJoints.a[4], currentJoints.a[5]);
     context->MoveJoints(context->targetJoints);
     context->isEnabled = false;
     ClearFifo();
@@ -3,6 +3,9 @@
 
 #include "algorithms/kinematic/6dof_kinematic.h"
 #include "actuators/ctrl_step/ctrl_step.hpp"
+#include "seqlock.hpp"
+#include "can_codec.h"
+#include <string>
 
 #define ALL 0
 
@@ -110,14 +113,29 @@ public:
     const float DEFAULT_JOINT_ACCELERATION_LOW = 30;    // 0~100
     const float DEFAULT_JOINT_ACCELERATION_HIGH = 100;  // 0~100
     const CommandMode DEFAULT_COMMAND_MODE = COMMAND_TARGET_POINT_INTERRUPTABLE;
+    const uint16_t JOINT_NODES = 0b1111110;    // Joint j is CAN node j
+    // A new driver must have been online this long before it replaces a
+    // missing joint, so joints still negotiating at power on aren't mistaken
+    const uint32_t NEW_NODE_SETTLE_MS = 2 * CAN_NODE_ID_WINDOW_MS;
+
+
+    // Joint feedback is written by the CAN RX task and the control thread and
+    // read everywhere else, always take a copy with GetJointState().
+    struct JointState_t
+    {
+        DOF6Kinematic::Joint6D_t joints;
+        DOF6Kinematic::Pose6D_t pose;   // Solved from joints by UpdateJointPose6D()
+        uint8_t stateFlag;              // Bit i set when joint i reached its target
+        uint32_t timestamp;             // micros() of the last joints update
+    };
 
 
-    DOF6Kinematic::Joint6D_t currentJoints = REST_POSE;
     DOF6Kinematic::Joint6D_t targetJoints = REST_POSE;
     DOF6Kinematic::Joint6D_t initPose = REST_POSE;
-    DOF6Kinematic::Pose6D_t currentPose6D = {};
-    volatile uint8_t jointsStateFlag = 0b00000000;
     CommandMode commandMode = DEFAULT_COMMAND_MODE;
+    bool groupSync = true;  // Two broadcast frames per tick instead of one frame per joint
+    uint32_t jointsOnline = 0;  // Bit j set while joint j sends heartbeats
+    uint32_t collisionJoint = 0;    // Last joint that reported a collision, 0 for none
     CtrlStepMotor* motorJ[7] = {nullptr};
     DummyHand* hand = {nullptr};
 
@@ -137,8 +155,14 @@ public:
     void Homing();
     void Resting();
     bool IsMoving();
+    JointState_t GetJointState();
     bool IsEnabled();
     void SetCommandMode(uint32_t _mode);
+    void SetStateBroadcastPeriod(uint32_t _ms);
+    uint32_t ScanJoints();
+    void AssignNodeId(uint32_t _from, uint32_t _to);
+    // A driver stalled itself on a collision, the others mustn't keep pushing
+    void OnJointCollision(uint8_t _id);
 
 
     // Communication protocol definitions
@@ -163,6 +187,12 @@ public:
             make_protocol_function("set_joint_speed", *this, &DummyRobot::SetJointSpeed, "speed"),
             make_protocol_function("set_joint_acc", *this, &DummyRobot::SetJointAcceleration, "acc"),
             make_protocol_function("set_command_mode", *this, &DummyRobot::SetCommandMode, "mode"),
+            make_protocol_function("set_state_broadcast_period", *this, &DummyRobot::SetStateBroadcastPeriod,
+                                   "period_ms"),
+            make_protocol_function("assign_node_id", *this, &DummyRobot::AssignNodeId, "from", "to"),
+            make_protocol_ro_property("joints_online", &jointsOnline),
+            make_protocol_ro_property("collision_joint", &collisionJoint),
+            make_protocol_property("group_sync", &groupSync),
             make_protocol_object("tuning", tuningHelper.MakeProtocolDefinitions())
         );
     }
@@ -199,6 +229,12 @@ private:
     DOF6Kinematic::Joint6D_t dynamicJointSpeeds = {1, 1, 1, 1, 1, 1};
     DOF6Kinematic* dof6Solver;
     bool isEnabled = false;
+    Seqlock<JointState_t> jointState;
+    CtrlStepMotor* motorUnassigned;    // Talks to nodes that aren't a joint yet
+    osMutexId_t nodeIdMutex = nullptr; // Guards motorUnassigned
+    uint32_t lastAssignMs = 0;
+
+    bool SendNodeId(uint32_t _from, uint32_t _to, uint32_t _timeout);
 };
 
 
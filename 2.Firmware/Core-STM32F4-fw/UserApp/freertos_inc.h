@@ -7,26 +7,28 @@ extern "C" {
 
 // List of semaphores
 extern osSemaphoreId sem_usb_irq;
-extern osSemaphoreId sem_uart4_dma;
-extern osSemaphoreId sem_uart5_dma;
 extern osSemaphoreId sem_usb_rx;
-extern osSemaphoreId sem_usb_tx;
-extern osSemaphoreId sem_can1_tx;
-extern osSemaphoreId sem_can2_tx;
+extern osSemaphoreId sem_usb_tx_cdc;
+extern osSemaphoreId sem_usb_tx_native;
 
 // List of Tasks
 /*--------------------------------- System Tasks -------------------------------------*/
-extern osThreadId_t defaultTaskHandle;      // Usage: 2000 Bytes stack
-extern osThreadId_t commTaskHandle;         // Usage: 48000 Bytes stack
-extern osThreadId_t usbIrqTaskHandle;       // Usage: 512  Bytes stack
-extern osThreadId_t usbServerTaskHandle;    // Usage: 2048 Bytes stack
-extern osThreadId_t uartServerTaskHandle;   // Usage: 2048 Bytes stack
+extern osThreadId_t defaultTaskHandle;      // Usage: 2000 Bytes stack, freed after Main()
+extern osThreadId_t commTaskHandle;         // Usage: 45000 Bytes stack
+extern osThreadId_t usbIrqTaskHandle;       // Usage: 500  Bytes stack
+extern osThreadId_t usbServerTaskHandle;    // Usage: 2000 Bytes stack
+extern osThreadId_t uartServerTaskHandle;   // Usage: 2000 Bytes stack
+extern osThreadId_t logTaskHandle;          // Usage: 2000 Bytes stack
+extern osThreadId_t canRxTaskHandle;        // Usage: 2000 Bytes stack
+// Idle task: 512 Bytes stack, timer task: 1024 Bytes stack
 
 /*---------------------------------- User Tasks --------------------------------------*/
-extern osThreadId_t oledTaskHandle;         // Usage: 4000 Bytes stack
-extern osThreadId_t controlLoopFixUpdateHandle;  // Usage: 4000 Bytes stack
+extern osThreadId_t oledTaskHandle;         // Usage: 2000 Bytes stack
+extern osThreadId_t controlLoopFixUpdateHandle;  // Usage: 2000 Bytes stack
+extern osThreadId_t ControlLoopUpdateHandle;     // Usage: 2000 Bytes stack
+// Joints are rescanned by a timer (nodeScanTimerHandle), don't add a task for it
 
-/*---------------- 60K (used) / 64K (for FreeRTOS on ccram) ------------------*/
+/*---- 63036 Bytes stacks (61036 after Main()) + TCBs and queues / 65536 on ccram ----*/
 
 
 #ifdef __cplusplus
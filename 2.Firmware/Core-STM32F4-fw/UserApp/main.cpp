@@ -77,22 +77,23 @@ void ThreadOledUpdate(void* argument)
         oled.printf("| FPS:%lu", 1000000 / (micros() - t));
         t = micros();
 
+        DummyRobot::JointState_t state = dummy.GetJointState();
         oled.drawBox(0, 15, 128, 3);
         oled.setCursor(0, 30);
         oled.printf(">%3d|%3d|%3d|%3d|%3d|%3d",
-                    (int) roundf(dummy.currentJoints.a[0]), (int) roundf(dummy.currentJoints.a[1]),
-                    (int) roundf(dummy.currentJoints.a[2]), (int) roundf(dummy.currentJoints.a[3]),
-                    (int) roundf(dummy.currentJoints.a[4]), (int) roundf(dummy.currentJoints.a[5]));
+                    (int) roundf(state.joints.a[0]), (int) roundf(state.joints.a[1]),
+                    (int) roundf(state.joints.a[2]), (int) roundf(state.joints.a[3]),
+                    (int) roundf(state.joints.a[4]), (int) roundf(state.joints.a[5]));
 
         oled.drawBox(40, 35, 128, 24);
         oled.setFont(u8g2_font_6x12_tr);
         oled.setDrawColor(0);
         oled.setCursor(42, 45);
-        oled.printf("%4d|%4d|%4d", (int) roundf(dummy.currentPose6D.X),
-                    (int) roundf(dummy.currentPose6D.Y), (int) roundf(dummy.currentPose6D.Z));
+        oled.printf("%4d|%4d|%4d", (int) roundf(state.pose.X),
+                    (int) roundf(state.pose.Y), (int) roundf(state.pose.Z));
         oled.setCursor(42, 56);
-        oled.printf("%4d|%4d|%4d", (int) roundf(dummy.currentPose6D.A),
-                    (int) roundf(dummy.currentPose6D.B), (int) roundf(dummy.currentPose6D.C));
+        oled.printf("%4d|%4d|%4d", (int) roundf(state.pose.A),
+                    (int) roundf(state.pose.B), (int) roundf(state.pose.C));
         oled.setDrawColor(1);
         oled.setCursor(0, 45);
         oled.printf("[XYZ]:");
@@ -104,12 +105,16 @@ void ThreadOledUpdate(void* argument)
         if (dummy.IsEnabled())
         {
             for (int i = 1; i <= 6; i++)
-                buf[i - 1] = (dummy.jointsStateFlag & (1 << i) ? '*' : '_');
+                buf[i - 1] = (state.stateFlag & (1 << i) ? '*' : '_');
             buf[6] = 0;
             oled.printf("[%s] %s", cmdModeNames[dummy.commandMode - 1], buf);
         } else
         {
-            oled.printf("[%s] %s", cmdModeNames[dummy.commandMode - 1], "======");
+            // '?' for joints the bus doesn't see
+            for (int i = 1; i <= 6; i++)
+                buf[i - 1] = (dummy.jointsOnline & (1 << i) ? '=' : '?');
+            buf[6] = 0;
+            oled.printf("[%s] %s", cmdModeNames[dummy.commandMode - 1], buf);
         }
 
         oled.sendBuffer();
@@ -117,6 +122,16 @@ void ThreadOledUpdate(void* argument)
 }
 
 
+// Runs in the RTOS timer task, ScanJoints() only queues frames and never
+// blocks, so it needs no stack of its own
+osTimerId_t nodeScanTimerHandle;
+void OnNodeScanTimer(void* argument)
+{
+    // Picks up replaced or newly plugged drivers while running
+    dummy.ScanJoints();
+}
+
+
 /* Timer Callbacks -------------------------------------------------------*/
 void OnTimer7Callback()
 {
@@ -177,6 +192,10 @@ void Main(void)
     timerCtrlLoop.SetCallback(OnTimer7Callback);
     timerCtrlLoop.Start();
 
+    nodeScanTimerHandle = osTimerNew(OnNodeScanTimer, osTimerPeriodic, nullptr, nullptr);
+    if (nodeScanTimerHandle == nullptr || osTimerStart(nodeScanTimerHandle, 500) != osOK)
+        Respond(*uart4StreamOutputPtr, "[sys] Node scan timer failed, AssignNodeId() by hand\n");
+
     // System started, light switch-led up.
     Respond(*uart4StreamOutputPtr, "[sys] Heap remain: %d Bytes\n", xPortGetMinimumEverFreeHeapSize());
     pwm.SetDuty(PWM::CH_A1, 0.5);
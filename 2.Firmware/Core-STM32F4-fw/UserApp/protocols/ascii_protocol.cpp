@@ -1,6 +1,76 @@
 #include "common_inc.h"
 
 extern DummyRobot dummy;
+extern CAN_context can1Ctx;
+
+
+// Joint bus timing, one node per three lines: RTT last/min/max, then the histogram
+static void RespondCanStats(StreamSink &_responseChannel)
+{
+    Respond(_responseChannel, "ok load %lu.%lu%%",
+            can1Ctx.bus_load_permille / 10, can1Ctx.bus_load_permille % 10);
+    Respond(_responseChannel, "tx %lu drop %lu lat %lu/%luus",
+            can1Ctx.tx_msg_cnt, can1Ctx.tx_dropped_cnt,
+            can1Ctx.tx_latency.last_us, can1Ctx.tx_latency.max_us);
+    Respond(_responseChannel, "rx %lu drop %lu", can1Ctx.received_msg_cnt, can1Ctx.rx_dropped_cnt);
+
+    for (int i = 0; i < CAN_STATS_NODES; i++)
+    {
+        const CAN_NodeStats &node = can1Ctx.node_stats[i];
+        if (node.rtt.cnt == 0)
+            continue;
+        const uint32_t* h = node.rtt.histogram;
+        Respond(_responseChannel, "N%d rtt %lu/%lu/%luus miss %lu",
+                i, node.rtt.last_us, node.rtt.min_us, node.rtt.max_us, node.unanswered_cnt);
+        Respond(_responseChannel, "N%d <1ms %lu %lu %lu %lu", i, h[0], h[1], h[2], h[3]);
+        Respond(_responseChannel, "N%d >1ms %lu %lu %lu %lu", i, h[4], h[5], h[6], h[7]);
+    }
+}
+
+
+// Nodes heard since boot: ID, serial, the ID the node has stored, online or not
+static void RespondCanNodes(StreamSink &_responseChannel)
+{
+    uint16_t online = CanGetOnlineNodes(&can1Ctx);
+    Respond(_responseChannel, "ok joints 0x%02lX conflicts %lu",
+            dummy.jointsOnline, can1Ctx.node_id_conflict_cnt);
+
+    for (uint8_t id = 1; id < CAN_NODE_ID_COUNT; id++)
+    {
+        CAN_NodeInfo info;
+        if (!CanGetNodeInfo(&can1Ctx, id, &info))
+            continue;
+        Respond(_responseChannel, "N%d %04lX%08lX id %d %s", id,
+                (uint32_t) (info.serial >> 32), (uint32_t) info.serial, info.stored_id,
+                online & (1U << id) ? "online" : "offline");
+    }
+}
+
+
+// #CANSTAT, #CANNODES and #SETNODE, the same on every port that takes them
+// @return false if _cmd is none of these
+static bool OnCanAsciiCmd(const std::string &_s, const char* _cmd, StreamSink &_responseChannel)
+{
+    if (_s.find("CANSTAT") != std::string::npos)
+    {
+        RespondCanStats(_responseChannel);
+    } else if (_s.find("CANNODES") != std::string::npos)
+    {
+        RespondCanNodes(_responseChannel);
+    } else if (_s.find("SETNODE") != std::string::npos)
+    {
+        uint32_t from, to;
+        if (sscanf(_cmd, "#SETNODE %lu %lu", &from, &to) == 2)
+        {
+            dummy.AssignNodeId(from, to);
+            Respond(_responseChannel, "Node [%lu] -> [%lu]", from, to);
+        } else
+            Respond(_responseChannel, "usage: #SETNODE from to");
+    } else
+        return false;
+
+    return true;
+}
 
 
 void OnUsbAsciiCmd(const char* _cmd, size_t _len, StreamSink &_responseChannel)
@@ -27,24 +97,23 @@ void OnUsbAsciiCmd(const char* _cmd, size_t _len, StreamSink &_responseChannel)
         std::string s(_cmd);
         if (s.find("GETJPOS") != std::string::npos)
         {
+            DOF6Kinematic::Joint6D_t joints = dummy.GetJointState().joints;
             Respond(_responseChannel, "ok %.2f %.2f %.2f %.2f %.2f %.2f",
-                    dummy.currentJoints.a[0], dummy.currentJoints.a[1],
-                    dummy.currentJoints.a[2], dummy.currentJoints.a[3],
-                    dummy.currentJoints.a[4], dummy.currentJoints.a[5]);
+                    joints.a[0], joints.a[1], joints.a[2],
+                    joints.a[3], joints.a[4], joints.a[5]);
         } else if (s.find("GETLPOS") != std::string::npos)
         {
             dummy.UpdateJointPose6D();
+            DOF6Kinematic::Pose6D_t pose = dummy.GetJointState().pose;
             Respond(_responseChannel, "ok %.2f %.2f %.2f %.2f %.2f %.2f",
-                    dummy.currentPose6D.X, dummy.currentPose6D.Y,
-                    dummy.currentPose6D.Z, dummy.currentPose6D.A,
-                    dummy.currentPose6D.B, dummy.currentPose6D.C);
+                    pose.X, pose.Y, pose.Z, pose.A, pose.B, pose.C);
         } else if (s.find("CMDMODE") != std::string::npos)
         {
             uint32_t mode;
             sscanf(_cmd, "#CMDMODE %lu", &mode);
             dummy.SetCommandMode(mode);
             Respond(_responseChannel, "Set command mode to [%lu]", mode);
-        } else
+        } else if (!OnCanAsciiCmd(s, _cmd, _responseChannel))
             Respond(_responseChannel, "ok");
     } else if (_cmd[0] == '>' || _cmd[0] == '@')
     {
@@ -80,24 +149,23 @@ void OnUart4AsciiCmd(const char* _cmd, size_t _len, StreamSink &_responseChannel
         std::string s(_cmd);
         if (s.find("GETJPOS") != std::string::npos)
         {
+            DOF6Kinematic::Joint6D_t joints = dummy.GetJointState().joints;
             Respond(_responseChannel, "ok %.2f %.2f %.2f %.2f %.2f %.2f",
-                    dummy.currentJoints.a[0], dummy.currentJoints.a[1],
-                    dummy.currentJoints.a[2], dummy.currentJoints.a[3],
-                    dummy.currentJoints.a[4], dummy.currentJoints.a[5]);
+                    joints.a[0], joints.a[1], joints.a[2],
+                    joints.a[3], joints.a[4], joints.a[5]);
         } else if (s.find("GETLPOS") != std::string::npos)
         {
             dummy.UpdateJointPose6D();
+            DOF6Kinematic::Pose6D_t pose = dummy.GetJointState().pose;
             Respond(_responseChannel, "ok %.2f %.2f %.2f %.2f %.2f %.2f",
-                    dummy.currentPose6D.X, dummy.currentPose6D.Y,
-                    dummy.currentPose6D.Z, dummy.currentPose6D.A,
-                    dummy.currentPose6D.B, dummy.currentPose6D.C);
+                    pose.X, pose.Y, pose.Z, pose.A, pose.B, pose.C);
         } else if (s.find("CMDMODE") != std::string::npos)
         {
             uint32_t mode;
             sscanf(_cmd, "#CMDMODE %lu", &mode);
             dummy.SetCommandMode(mode);
             Respond(_responseChannel, "Set command mode to [%lu]", mode);
-        } else
+        } else if (!OnCanAsciiCmd(s, _cmd, _responseChannel))
             Respond(_responseChannel, "ok");
     } else if (_cmd[0] == '>' || _cmd[0] == '@')
     {
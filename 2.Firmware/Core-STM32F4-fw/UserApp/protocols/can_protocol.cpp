@@ -1,4 +1,5 @@
 #include "common_inc.h"
+#include "can_codec.h"
 
 
 // Used for response CAN message.
@@ -14,6 +15,50 @@ static CAN_TxHeaderTypeDef txHeader =
 
 extern DummyRobot dummy;
 
+// Every command OnCanMessage handles must be listed here, the hardware
+// filters drop everything else. Joints are nodes 1~6, their filters also let
+// nodes 0 and 7 through, so OnCanMessage checks the node.
+//
+// Bank budget: each entry takes half of a filter bank, rounded up per FIFO,
+// out of the 14 banks CAN1 owns. A table that doesn't fit makes CAN1 accept
+// every frame, so it stays within 13 banks, one spare.
+#define JOINT_NODES 0b1111110
+#define ALL_NODES 0xFFFE
+const CAN_RxFilter can1RxFilters[] = {
+    {JOINT_NODES, 0x25, CAN_RX_FIFO0},  // State, compact
+    {JOINT_NODES, 0x26, CAN_RX_FIFO0},  // State, periodic broadcast
+    {JOINT_NODES, 0x23, CAN_RX_FIFO1},  // Position & finish flag, legacy drivers
+    {JOINT_NODES, 0x28, CAN_RX_FIFO1},  // Trajectory buffer
+    {JOINT_NODES, 0x29, CAN_RX_FIFO1},  // DCE auto-tune
+    {JOINT_NODES, 0x2A, CAN_RX_FIFO0},  // Collision, stops the robot
+    {ALL_NODES, CAN_CMD_HEARTBEAT, CAN_RX_FIFO1},   // Node IDs, handled by interface_can
+};
+const size_t can1RxFilterCount = sizeof(can1RxFilters) / sizeof(can1RxFilters[0]);
+static_assert(can1RxFilterCount <= 24, "CAN1 filter table needs more than 13 banks");
+
+// No node set: CAN2 receives nothing until its protocol needs something
+const CAN_RxFilter can2RxFilters[] = {
+    {0, 0x00, CAN_RX_FIFO1},
+};
+const size_t can2RxFilterCount = sizeof(can2RxFilters) / sizeof(can2RxFilters[0]);
+
+// Requests that nodes answer, for the round-trip statistics of each node
+const CAN_ReplyMatch can1ReplyMatches[] = {
+    {0x25, 0x25, 0, 0},                     // State poll
+    {0x23, 0x23, 0, 0},                     // Position poll, legacy drivers
+    {0x09, 0x25, 7, 0x80},                  // Group setpoint with bit 63 set
+    {0x0B, 0x25, 0, CAN_STATUS_NEED_ACK},   // Setpoint asking for a state reply
+    {0x0D, 0x28, 0, CAN_STATUS_NEED_ACK},   // Trajectory point asking for the buffer
+    {0x28, 0x28, 0, 0},                     // Trajectory buffer poll
+    {0x29, 0x29, 0, 0},                     // DCE auto-tune poll
+};
+const size_t can1ReplyMatchCount = sizeof(can1ReplyMatches) / sizeof(can1ReplyMatches[0]);
+
+const CAN_ReplyMatch can2ReplyMatches[] = {
+    {0x00, CAN_NO_REPLY, 0, 0},
+};
+const size_t can2ReplyMatchCount = sizeof(can2ReplyMatches) / sizeof(can2ReplyMatches[0]);
+
 void OnCanMessage(CAN_context* canCtx, CAN_RxHeaderTypeDef* rxHeader, uint8_t* data)
 {
     // Common CAN message callback, uses ID 32~0x7FF.
@@ -22,21 +67,45 @@ void OnCanMessage(CAN_context* canCtx, CAN_RxHeaderTypeDef* rxHeader, uint8_t* d
         uint8_t id = rxHeader->StdId >> 7; // 4Bits ID & 7Bits Msg
         uint8_t cmd = rxHeader->StdId & 0x7F; // 4Bits ID & 7Bits Msg
 
+        // Joints only, see can1RxFilters
+        if (id == ALL || id >= sizeof(dummy.motorJ) / sizeof(dummy.motorJ[0]))
+            return;
+
         /*----------------------- ↓ Add Your CAN1 Packet Protocol Here ↓ ------------------------*/
         switch (cmd)
         {
             case 0x23:
                 dummy.motorJ[id]->UpdateAngleCallback(*(float*) (data), data[4]);
                 break;
+            case 0x25:
+            case 0x26:
+                dummy.motorJ[id]->UpdateStateCallback(data);
+                break;
+            case 0x28:
+                dummy.motorJ[id]->UpdateTrajectoryStatusCallback(data);
+                break;
+            case 0x29:
+                dummy.motorJ[id]->UpdateDceTuneCallback(data);
+                break;
+            case 0x2A:
+                if (dummy.motorJ[id]->UpdateCollisionCallback(data))
+                    dummy.OnJointCollision(id);
+                break;
             default:
                 break;
         }
 
-        dummy.UpdateJointAnglesCallback();
-
     } else if (canCtx->handle->Instance == CAN2)
     {
         /*----------------------- ↓ Add Your CAN2 Packet Protocol Here ↓ ------------------------*/
     }
     /*----------------------- ↑ Add Your Packet Protocol Here ↑ ------------------------*/
-}
\ No newline at end of file
+}
+
+
+void OnCanMessageBatch(CAN_context* canCtx)
+{
+    // Derive the joint state once per batch instead of after every reply
+    if (canCtx->handle->Instance == CAN1)
+        dummy.UpdateJointAnglesCallback();
+}
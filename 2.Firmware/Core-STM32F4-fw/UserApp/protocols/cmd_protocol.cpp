@@ -3,6 +3,7 @@
 
 /*----------------- 1.Add Your Extern Variables Here (Optional) ------------------*/
 extern DummyRobot dummy;
+extern CAN_context can1Ctx;
 
 class HelperFunctions
 {
@@ -11,9 +12,71 @@ public:
     float GetTemperatureHelper()
     { return AdcGetChipTemperature(); }
 
+    // Joint bus timing, see interface_can.cpp
+    uint32_t GetCanRttLastHelper(uint32_t _node)
+    { return _node < CAN_STATS_NODES ? can1Ctx.node_stats[_node].rtt.last_us : 0; }
+
+    uint32_t GetCanRttMinHelper(uint32_t _node)
+    { return _node < CAN_STATS_NODES && can1Ctx.node_stats[_node].rtt.cnt ? can1Ctx.node_stats[_node].rtt.min_us : 0; }
+
+    uint32_t GetCanRttMaxHelper(uint32_t _node)
+    { return _node < CAN_STATS_NODES ? can1Ctx.node_stats[_node].rtt.max_us : 0; }
+
+    uint32_t GetCanRttCountHelper(uint32_t _node)
+    { return _node < CAN_STATS_NODES ? can1Ctx.node_stats[_node].rtt.cnt : 0; }
+
+    uint32_t GetCanRttBucketHelper(uint32_t _node, uint32_t _bucket)
+    {
+        if (_node >= CAN_STATS_NODES || _bucket >= CAN_LATENCY_BUCKETS)
+            return 0;
+        return can1Ctx.node_stats[_node].rtt.histogram[_bucket];
+    }
+
+    uint32_t GetCanUnansweredHelper(uint32_t _node)
+    { return _node < CAN_STATS_NODES ? can1Ctx.node_stats[_node].unanswered_cnt : 0; }
+
+    void ResetCanStatsHelper()
+    { CanResetStats(&can1Ctx); }
+
+    // UART transfer and RX wakeup statistics, see interface_uart.cpp
+    uint32_t GetUart4RxLatencyAvgHelper()
+    { return uart4_stats_.rx_latency_cnt ? uart4_stats_.rx_latency_total_us / uart4_stats_.rx_latency_cnt : 0; }
+
+    uint32_t GetUart5RxLatencyAvgHelper()
+    { return uart5_stats_.rx_latency_cnt ? uart5_stats_.rx_latency_total_us / uart5_stats_.rx_latency_cnt : 0; }
+
+    void ResetUart4StatsHelper()
+    { UartResetStats(&uart4_stats_); }
+
+    void ResetUart5StatsHelper()
+    { UartResetStats(&uart5_stats_); }
+
 } staticFunctions;
 
 
+static inline auto MakeUartObject(const char* _name, UARTStats_t &_stats,
+                                  uint32_t (HelperFunctions::*_getRxLatencyAvg)(),
+                                  void (HelperFunctions::*_resetStats)())
+{
+    return make_protocol_object(_name,
+        make_protocol_ro_property("tx_bytes", &_stats.tx_bytes),
+        make_protocol_ro_property("tx_dma_cnt", &_stats.tx_dma_cnt),
+        make_protocol_ro_property("tx_wait_cnt", &_stats.tx_wait_cnt),
+        make_protocol_ro_property("tx_overflow_cnt", &_stats.tx_overflow_cnt),
+        make_protocol_ro_property("tx_dropped_bytes", &_stats.tx_dropped_bytes),
+        make_protocol_ro_property("tx_max_level", &_stats.tx_max_level),
+        make_protocol_ro_property("rx_bytes", &_stats.rx_bytes),
+        make_protocol_ro_property("rx_event_cnt", &_stats.rx_event_cnt),
+        make_protocol_ro_property("rx_wakeup_cnt", &_stats.rx_wakeup_cnt),
+        make_protocol_ro_property("rx_error_cnt", &_stats.rx_error_cnt),
+        make_protocol_ro_property("rx_latency_last_us", &_stats.rx_latency_last_us),
+        make_protocol_ro_property("rx_latency_max_us", &_stats.rx_latency_max_us),
+        make_protocol_function("get_rx_latency_avg_us", staticFunctions, _getRxLatencyAvg),
+        make_protocol_function("reset_stats", staticFunctions, _resetStats)
+    );
+}
+
+
 // Define options that intractable with "reftool".
 static inline auto MakeObjTree()
 {
@@ -22,6 +85,31 @@ static inline auto MakeObjTree()
         // Add Read-Only Variables
         make_protocol_ro_property("serial_number", &serialNumber),
         make_protocol_function("get_temperature", staticFunctions, &HelperFunctions::GetTemperatureHelper),
+        make_protocol_object("can",
+            make_protocol_ro_property("bitrate", &can1Ctx.bitrate),
+            make_protocol_ro_property("bus_load_permille", &can1Ctx.bus_load_permille),
+            make_protocol_ro_property("tx_msg_cnt", &can1Ctx.tx_msg_cnt),
+            make_protocol_ro_property("tx_dropped_cnt", &can1Ctx.tx_dropped_cnt),
+            make_protocol_ro_property("tx_queue_max_level", &can1Ctx.tx_queue_max_level),
+            make_protocol_ro_property("tx_latency_last_us", &can1Ctx.tx_latency.last_us),
+            make_protocol_ro_property("tx_latency_max_us", &can1Ctx.tx_latency.max_us),
+            make_protocol_ro_property("received_msg_cnt", &can1Ctx.received_msg_cnt),
+            make_protocol_ro_property("rx_dropped_cnt", &can1Ctx.rx_dropped_cnt),
+            make_protocol_ro_property("rx_batch_max_size", &can1Ctx.rx_batch_max_size),
+            make_protocol_ro_property("unexpected_errors", &can1Ctx.unexpected_errors),
+            make_protocol_function("get_rtt_last", staticFunctions, &HelperFunctions::GetCanRttLastHelper, "node"),
+            make_protocol_function("get_rtt_min", staticFunctions, &HelperFunctions::GetCanRttMinHelper, "node"),
+            make_protocol_function("get_rtt_max", staticFunctions, &HelperFunctions::GetCanRttMaxHelper, "node"),
+            make_protocol_function("get_rtt_count", staticFunctions, &HelperFunctions::GetCanRttCountHelper, "node"),
+            make_protocol_function("get_rtt_bucket", staticFunctions, &HelperFunctions::GetCanRttBucketHelper,
+                                   "node", "bucket"),
+            make_protocol_function("get_unanswered", staticFunctions, &HelperFunctions::GetCanUnansweredHelper, "node"),
+            make_protocol_function("reset_stats", staticFunctions, &HelperFunctions::ResetCanStatsHelper)
+        ),
+        MakeUartObject("uart4", uart4_stats_, &HelperFunctions::GetUart4RxLatencyAvgHelper,
+                       &HelperFunctions::ResetUart4StatsHelper),
+        MakeUartObject("uart5", uart5_stats_, &HelperFunctions::GetUart5RxLatencyAvgHelper,
+                       &HelperFunctions::ResetUart5StatsHelper),
         make_protocol_object("robot", dummy.MakeProtocolDefinitions())
     );
 }
@@ -23,6 +23,7 @@
 /* USER CODE BEGIN 0 */
 #include "common_inc.h"
 #include "configurations.h"
+#include "can_codec.h"
 
 CAN_TxHeaderTypeDef TxHeader;
 CAN_RxHeaderTypeDef RxHeader;
@@ -197,11 +198,44 @@ void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef* CanHandle)
 
     uint8_t id = (RxHeader.StdId >> 7); // 4Bits ID & 7Bits Msg
     uint8_t cmd = RxHeader.StdId & 0x7F; // 4Bits ID & 7Bits Msg
-    if (id == 0 || id == boardConfig.canNodeId)
+    uint8_t nodeId = GetNodeId();
+    if (cmd == CAN_CMD_HEARTBEAT)
+    {
+        OnCanHeartbeat(id, RxData);
+    } else if (nodeId != 0 && (id == 0 || id == nodeId))
     {
         OnCanCmd(cmd, RxData, RxHeader.DLC);
     }
 }
+
+void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef* CanHandle)
+{
+    OnCanTxComplete(CAN_TX_MAILBOX0);
+}
+
+void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef* CanHandle)
+{
+    OnCanTxComplete(CAN_TX_MAILBOX1);
+}
+
+void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef* CanHandle)
+{
+    OnCanTxComplete(CAN_TX_MAILBOX2);
+}
+
+void HAL_CAN_ErrorCallback(CAN_HandleTypeDef* CanHandle)
+{
+    uint32_t error = HAL_CAN_GetError(CanHandle);
+
+    if (error & (HAL_CAN_ERROR_TX_ALST0 | HAL_CAN_ERROR_TX_TERR0))
+        OnCanTxFailed(CAN_TX_MAILBOX0, error & HAL_CAN_ERROR_TX_ALST0);
+    if (error & (HAL_CAN_ERROR_TX_ALST1 | HAL_CAN_ERROR_TX_TERR1))
+        OnCanTxFailed(CAN_TX_MAILBOX1, error & HAL_CAN_ERROR_TX_ALST1);
+    if (error & (HAL_CAN_ERROR_TX_ALST2 | HAL_CAN_ERROR_TX_TERR2))
+        OnCanTxFailed(CAN_TX_MAILBOX2, error & HAL_CAN_ERROR_TX_ALST2);
+
+    HAL_CAN_ResetError(CanHandle);
+}
 /* USER CODE END 1 */
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -55,6 +55,8 @@ extern void GpioPin7InterruptCallback();
 extern void Tim1Callback100Hz();
 extern void Tim3CaptureCallback();
 extern void Tim4Callback20kHz();
+extern void Tim4CompareCallback();
+extern void Spi1DmaCallback();
 
 /* USER CODE END PFP */
 
@@ -359,7 +361,12 @@ void TIM3_IRQHandler(void)
 void TIM4_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM4_IRQn 0 */
-    Tim4Callback20kHz();
+    // Compare channel 1 starts the encoder read a few us before the tick
+    if (__HAL_TIM_GET_FLAG(&htim4, TIM_FLAG_CC1) != RESET &&
+        __HAL_TIM_GET_IT_SOURCE(&htim4, TIM_IT_CC1) != RESET)
+        Tim4CompareCallback();
+    if (__HAL_TIM_GET_FLAG(&htim4, TIM_FLAG_UPDATE) != RESET)
+        Tim4Callback20kHz();
     return;
   /* USER CODE END TIM4_IRQn 0 */
   HAL_TIM_IRQHandler(&htim4);
@@ -397,6 +404,14 @@ void USART1_IRQHandler(void)
 }
 
 /* USER CODE BEGIN 1 */
+/**
+  * @brief This function handles DMA1 channel2 global interrupt, SPI1 RX for the encoder.
+  */
+void DMA1_Channel2_IRQHandler(void)
+{
+    DMA1->IFCR = DMA_IFCR_CGIF2;
+    Spi1DmaCallback();
+}
 
 /* USER CODE END 1 */
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -23,15 +23,15 @@ protected:
 
 
     /***** Port Specified Implements *****/
-    virtual void InitGpio();
+    virtual void InitGpio() = 0;
 
-    virtual void InitPwm();
+    virtual void InitPwm() = 0;
 
-    virtual void DacOutputVoltage(uint16_t _voltageA_3300mVIn12bits, uint16_t _voltageB_3300mVIn12bits);
+    virtual void DacOutputVoltage(uint16_t _voltageA_3300mVIn12bits, uint16_t _voltageB_3300mVIn12bits) = 0;
 
-    virtual void SetInputA(bool _statusAp, bool _statusAm);
+    virtual void SetInputA(bool _statusAp, bool _statusAm) = 0;
 
-    virtual void SetInputB(bool _statusBp, bool _statusBm);
+    virtual void SetInputB(bool _statusBp, bool _statusBm) = 0;
 };
 
 #endif
@@ -0,0 +1,124 @@
+#include "collision_detector.h"
+
+
+static int32_t Clamp(int64_t _val, int32_t _limit)
+{
+    if (_val > _limit) return _limit;
+    if (_val < -_limit) return -_limit;
+    return (int32_t) _val;
+}
+
+
+void CollisionDetector::Init(int32_t _frequency)
+{
+    frequency = _frequency;
+    SetConfig(config);
+}
+
+
+void CollisionDetector::SetConfig(const Config_t &_config)
+{
+    config = _config;
+    if (config.threshold < 0) config.threshold = 0;
+    if (config.threshold > MAX_THRESHOLD) config.threshold = MAX_THRESHOLD;
+
+    tripTicks = (int32_t) ((int64_t) config.tripTime * frequency / 1000);
+    if (tripTicks < 1) tripTicks = 1;
+}
+
+
+void CollisionDetector::Reset()
+{
+    isStarted = false;
+    outTicks = 0;
+    learnTicks = 0;
+}
+
+
+void CollisionDetector::Start(Channel_t &_channel, int32_t _value)
+{
+    _channel.slowMean = (int64_t) _value << STAT_FRAC_BITS;
+    _channel.fastMean = _channel.slowMean;
+    _channel.variance = 0;
+}
+
+
+void CollisionDetector::UpdateFast(Channel_t &_channel, int32_t _value)
+{
+    _channel.fastMean += (((int64_t) _value << STAT_FRAC_BITS) - _channel.fastMean) >> FAST_SHIFT;
+}
+
+
+void CollisionDetector::UpdateSlow(Channel_t &_channel, int32_t _value, int32_t _floor) const
+{
+    int32_t diff = Clamp((((int64_t) _value << STAT_FRAC_BITS) - _channel.slowMean) >> STAT_FRAC_BITS,
+                         MAX_DEVIATION);
+    _channel.slowMean += ((int64_t) diff << STAT_FRAC_BITS) >> MEAN_SHIFT;
+
+    // A sample that would count as out adds to the spread as if at the
+    // floor, so a start or a hit doesn't widen what's normal
+    if (IsOut(_channel, diff, _floor))
+        diff = diff > 0 ? _floor : -_floor;
+    _channel.variance += ((int64_t) diff * diff - _channel.variance) >> VARIANCE_SHIFT;
+}
+
+
+int32_t CollisionDetector::Deviation(const Channel_t &_channel)
+{
+    return Clamp((_channel.fastMean - _channel.slowMean) >> STAT_FRAC_BITS, MAX_DEVIATION);
+}
+
+
+bool CollisionDetector::IsOut(const Channel_t &_channel, int32_t _deviation, int32_t _floor) const
+{
+    int64_t deviation = _deviation < 0 ? -_deviation : _deviation;
+    if (deviation < _floor)
+        return false;
+
+    // deviation > threshold/4 * sigma, squared
+    int64_t threshold = config.threshold;
+    return deviation * deviation * 16 > threshold * threshold * _channel.variance;
+}
+
+
+bool CollisionDetector::Tick(int32_t _error, int32_t _current)
+{
+    if (!IsEnabled())
+        return false;
+
+    if (!isStarted)
+    {
+        Start(error, _error);
+        Start(current, _current);
+        isStarted = true;
+    }
+    UpdateFast(error, _error);
+    UpdateFast(current, _current);
+
+    int32_t errorDeviation = Deviation(error);
+    int32_t currentDeviation = Deviation(current);
+
+    if (learnTicks >= (1 << VARIANCE_SHIFT) &&
+        (errorDeviation > 0) == (currentDeviation > 0) &&
+        IsOut(error, errorDeviation, config.errorFloor) &&
+        IsOut(current, currentDeviation, config.currentFloor))
+    {
+        if (++outTicks < tripTicks)
+            return false;
+
+        outTicks = 0;
+        tripCount++;
+        tripErrorDeviation = errorDeviation;
+        tripCurrentDeviation = currentDeviation;
+        reportPending = true;
+        return true;
+    }
+
+    outTicks = 0;
+    if (learnTicks < (1 << VARIANCE_SHIFT))
+        learnTicks++;
+    UpdateSlow(error, _error, config.errorFloor);
+    UpdateSlow(current, _current, config.currentFloor);
+
+    return false;
+}
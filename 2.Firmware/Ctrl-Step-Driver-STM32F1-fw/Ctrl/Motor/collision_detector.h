@@ -0,0 +1,82 @@
+#ifndef CTRL_STEP_FW_COLLISION_DETECTOR_H
+#define CTRL_STEP_FW_COLLISION_DETECTOR_H
+
+#include <cstdint>
+
+
+/*
+ * Tells a collision from normal motion within milliseconds, from the follow
+ * error and the current of the position loop.
+ *
+ * Both are averaged twice: slowly, with their variance, for what the joint
+ * normally sees under its load, and over about a millisecond. Hitting
+ * something moves both fast averages away from the slow ones the same way,
+ * the rotor falls behind the goal and the loop pushes harder towards it.
+ * The detector trips once both stay more than threshold sigmas and their
+ * floor out for the trip time. While they are out it doesn't learn, or a
+ * slow push would become normal. It only trips after learning for a slow
+ * window, enabling the loop isn't normal either.
+ *
+ * Tick() runs in the 20kHz interrupt, integer only.
+ */
+class CollisionDetector
+{
+public:
+    typedef struct
+    {
+        int32_t threshold;      // sigma/4, 0 disables
+        int32_t tripTime;       // ms
+        int32_t errorFloor;     // steps, smallest follow error deviation that counts
+        int32_t currentFloor;   // mA
+    } Config_t;
+
+    static const uint8_t MEAN_SHIFT = 9;        // 2^9 ticks, 26ms at 20kHz
+    static const uint8_t VARIANCE_SHIFT = 12;   // 205ms
+    static const uint8_t FAST_SHIFT = 4;        // 0.8ms
+    static const int32_t MAX_THRESHOLD = 255;
+
+
+    Config_t config{};
+    volatile bool reportPending = false;    // Set on a trip, cleared once the Core was told
+    uint32_t tripCount = 0;
+    int32_t tripErrorDeviation = 0;         // steps, fast from slow average when it tripped
+    int32_t tripCurrentDeviation = 0;       // mA
+
+
+    void Init(int32_t _frequency);
+    void SetConfig(const Config_t &_config);
+    bool IsEnabled() const
+    { return config.threshold > 0; }
+    // Forgets the statistics, while the position loop isn't running
+    void Reset();
+    // True once, on the tick it trips
+    bool Tick(int32_t _error, int32_t _current);
+
+
+private:
+    static const uint8_t STAT_FRAC_BITS = 16;
+    static const int32_t MAX_DEVIATION = 1 << 24;   // Keeps the squares within int64
+
+    typedef struct
+    {
+        int64_t slowMean;   // STAT_FRAC_BITS
+        int64_t fastMean;   // STAT_FRAC_BITS
+        int64_t variance;
+    } Channel_t;
+
+    int32_t frequency = 20000;
+    int32_t tripTicks = 1;
+    int32_t outTicks = 0;
+    int32_t learnTicks = 0;
+    bool isStarted = false;
+    Channel_t error{};
+    Channel_t current{};
+
+    static void Start(Channel_t &_channel, int32_t _value);
+    static void UpdateFast(Channel_t &_channel, int32_t _value);
+    void UpdateSlow(Channel_t &_channel, int32_t _value, int32_t _floor) const;
+    static int32_t Deviation(const Channel_t &_channel);
+    bool IsOut(const Channel_t &_channel, int32_t _deviation, int32_t _floor) const;
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include "dce_tuner.h"
+#include <cmath>
+
+
+const int32_t DceTuner::EXCITE_FREQUENCY[EXCITE_FREQUENCY_NUM] = {50, 200};
+
+// Position amplitude below which the response is mostly encoder noise (steps)
+static const int32_t MIN_AMPLITUDE = 4;
+// Smallest excitation the halving on clipped current goes down to (steps)
+static const int32_t MIN_EXCITE_AMPLITUDE = 16;
+// Loop delays tried in the fit (s)
+static const float MAX_DELAY = 1e-3f;
+static const int32_t DELAY_SEARCH_NUM = 100;
+// Tuned loop bandwidth: a share of what the delay allows, within these (rad/s).
+// Friction and detent under load fit as a shorter delay than the loop has,
+// the top stays where the gains still hold with the load taken off.
+static const float DELAY_BANDWIDTH_RATIO = 0.18f;
+static const float MIN_BANDWIDTH = 60;
+static const float MAX_BANDWIDTH = 300;
+// Largest integer gain, keeps the DCE products within int32
+static const int32_t MAX_GAIN = 30000;
+
+static const float PI = 3.14159265f;
+
+
+void DceTuner::Init(int32_t _controlFrequency, int32_t _stepsPerTurn)
+{
+    controlFrequency = _controlFrequency;
+    stepsPerTurn = _stepsPerTurn;
+}
+
+
+bool DceTuner::Start(int32_t _kv, int32_t _currentLimit)
+{
+    if (state == STATE_RUNNING || state == STATE_ANALYZING)
+        return false;
+
+    keptKv = _kv;
+    currentLimit = _currentLimit;
+    for (uint8_t i = 0; i < EXCITE_FREQUENCY_NUM; i++)
+    {
+        float step = 2 * PI * (float) EXCITE_FREQUENCY[i] / (float) controlFrequency;
+        rotateCos[i] = (int64_t) (cosf(step) * (float) (1L << 30));
+        rotateSin[i] = (int64_t) (sinf(step) * (float) (1L << 30));
+        amplitude[i] = EXCITE_AMPLITUDE;
+        amplitudeVelocity[i] = (int32_t) ((float) EXCITE_AMPLITUDE * step * (float) controlFrequency);
+    }
+    holdValid = false;
+    StartFrequency(0);
+    state = STATE_RUNNING;
+
+    return true;
+}
+
+
+void DceTuner::Abort()
+{
+    if (state != STATE_RUNNING)
+        return;
+
+    goPosition = holdPosition;
+    goVelocity = 0;
+    state = STATE_FAILED;
+}
+
+
+void DceTuner::StartFrequency(uint8_t _index)
+{
+    frequencyIndex = _index;
+    periodTicks = controlFrequency / EXCITE_FREQUENCY[_index];
+    tickCount = 0;
+    oscCos = 1L << 30;
+    oscSin = 0;
+
+    positionSin[_index] = positionCos[_index] = 0;
+    currentSin[_index] = currentCos[_index] = 0;
+}
+
+
+void DceTuner::Tick(int32_t _position, int32_t _current)
+{
+    if (state != STATE_RUNNING)
+        return;
+
+    if (!holdValid)
+    {
+        holdPosition = _position;
+        holdValid = true;
+    }
+
+    // The measurement belongs to the phase the last goal was given at
+    if (tickCount >= SETTLE_PERIODS * periodTicks)
+    {
+        if (_current >= currentLimit || _current <= -currentLimit)
+        {
+            if (amplitude[frequencyIndex] / 2 < MIN_EXCITE_AMPLITUDE)
+            {
+                Abort();
+                return;
+            }
+            amplitude[frequencyIndex] /= 2;
+            amplitudeVelocity[frequencyIndex] /= 2;
+            StartFrequency(frequencyIndex);
+            goPosition = holdPosition;
+            goVelocity = amplitudeVelocity[frequencyIndex];
+            return;
+        }
+
+        int64_t position = _position - holdPosition;
+        positionSin[frequencyIndex] += (position * oscSin) >> 10;
+        positionCos[frequencyIndex] += (position * oscCos) >> 10;
+        currentSin[frequencyIndex] += ((int64_t) _current * oscSin) >> 10;
+        currentCos[frequencyIndex] += ((int64_t) _current * oscCos) >> 10;
+    }
+
+    if (++tickCount >= (SETTLE_PERIODS + MEASURE_PERIODS) * periodTicks)
+    {
+        if (frequencyIndex + 1 < EXCITE_FREQUENCY_NUM)
+        {
+            StartFrequency(frequencyIndex + 1);
+        } else
+        {
+            goPosition = holdPosition;
+            goVelocity = 0;
+            state = STATE_ANALYZING;
+            return;
+        }
+    } else
+    {
+        int64_t rc = rotateCos[frequencyIndex], rs = rotateSin[frequencyIndex];
+        int64_t cosNext = (oscCos * rc - oscSin * rs + (1L << 29)) >> 30;
+        oscSin = (oscSin * rc + oscCos * rs + (1L << 29)) >> 30;
+        oscCos = cosNext;
+    }
+
+    goPosition = holdPosition + (int32_t) ((amplitude[frequencyIndex] * oscSin) >> 30);
+    goVelocity = (int32_t) ((amplitudeVelocity[frequencyIndex] * oscCos) >> 30);
+}
+
+
+bool DceTuner::TickMainLoop()
+{
+    if (state != STATE_ANALYZING)
+        return false;
+
+    if (Analyze())
+    {
+        state = STATE_DONE;
+        return true;
+    }
+    state = STATE_FAILED;
+
+    return false;
+}
+
+
+bool DceTuner::Analyze()
+{
+    float omega[EXCITE_FREQUENCY_NUM];
+    float magnitude[EXCITE_FREQUENCY_NUM];
+    float phase[EXCITE_FREQUENCY_NUM];
+
+    for (uint8_t i = 0; i < EXCITE_FREQUENCY_NUM; i++)
+    {
+        // Phasors relative to the sine, each sum is 2^20 * N/2 * amplitude
+        float xRe = (float) positionSin[i], xIm = (float) positionCos[i];
+        float iRe = (float) currentSin[i], iIm = (float) currentCos[i];
+        float xSquare = xRe * xRe + xIm * xIm;
+        float samples = (float) (MEASURE_PERIODS * controlFrequency / EXCITE_FREQUENCY[i]);
+
+        // The loop has to follow the goal some, or there is nothing to measure
+        float amplitude = sqrtf(xSquare) * 2 / samples / (float) (1L << 20);
+        if (amplitude < (float) MIN_AMPLITUDE)
+            return false;
+
+        // Current over position, mA per step
+        float hRe = (iRe * xRe + iIm * xIm) / xSquare;
+        float hIm = (iIm * xRe - iRe * xIm) / xSquare;
+        omega[i] = 2 * PI * (float) EXCITE_FREQUENCY[i];
+        magnitude[i] = sqrtf(hRe * hRe + hIm * hIm);
+        phase[i] = atan2f(hIm, hRe);
+    }
+
+    /*
+     * The load takes (stiffness - w^2*inertia + jw*damping) * e^(jw*delay),
+     * two frequencies give the four. Without the delay the imaginary parts
+     * give the same damping at both, the delay is where they do.
+     */
+    float delay = 0, misfit = -1;
+    for (int32_t i = 0; i <= DELAY_SEARCH_NUM; i++)
+    {
+        float tryDelay = MAX_DELAY * (float) i / DELAY_SEARCH_NUM;
+        float diff = magnitude[0] * sinf(phase[0] - omega[0] * tryDelay) / omega[0] -
+                     magnitude[1] * sinf(phase[1] - omega[1] * tryDelay) / omega[1];
+        if (misfit < 0 || fabsf(diff) < misfit)
+        {
+            misfit = fabsf(diff);
+            delay = tryDelay;
+        }
+    }
+
+    float re[EXCITE_FREQUENCY_NUM];
+    float damping = 0;
+    for (uint8_t i = 0; i < EXCITE_FREQUENCY_NUM; i++)
+    {
+        re[i] = magnitude[i] * cosf(phase[i] - omega[i] * delay);
+        damping += magnitude[i] * sinf(phase[i] - omega[i] * delay) / omega[i] / EXCITE_FREQUENCY_NUM;
+    }
+    float inertia = (re[0] - re[1]) / (omega[1] * omega[1] - omega[0] * omega[0]);   // mA per step/s^2
+    float stiffness = re[0] + omega[0] * omega[0] * inertia;
+    if (!(inertia > 0))
+        return false;
+
+    float bandwidth = delay > 0 ? DELAY_BANDWIDTH_RATIO / delay : MAX_BANDWIDTH;
+    if (bandwidth > MAX_BANDWIDTH) bandwidth = MAX_BANDWIDTH;
+    if (bandwidth < MIN_BANDWIDTH) bandwidth = MIN_BANDWIDTH;
+
+    /*
+     * Three closed-loop poles at the bandwidth: inertia * (s + w)^3, in mA
+     * per step. Stiffness and damping come from the detent torque and
+     * friction near where it was tuned, they are left to the loop.
+     */
+    float kpTotal = 3 * inertia * bandwidth * bandwidth;
+    float ki = inertia * bandwidth * bandwidth * bandwidth;
+    float kd = 3 * inertia * bandwidth;
+
+    // Back to the DCE's fixed point, see Motor::Controller::CalcDceToOutput()
+    float frequency = (float) controlFrequency;
+    float kvShare = (float) keptKv * frequency / (float) (1L << 24);
+    float gains[3] = {
+        (kpTotal - kvShare) * 1024,
+        ki * (float) (1L << 17) / frequency,
+        kd * (float) (1L << 17)
+    };
+    int32_t fixed[3];
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        if (gains[i] < 0) gains[i] = 0;
+        fixed[i] = gains[i] > (float) MAX_GAIN ? MAX_GAIN : (int32_t) (gains[i] + 0.5f);
+    }
+
+    float turn = (float) stepsPerTurn;
+    result.inertia = inertia * turn;
+    result.stiffness = stiffness * turn;
+    result.damping = damping * turn;
+    result.delay = delay;
+    result.bandwidth = bandwidth / (2 * PI);
+    result.kp = fixed[0];
+    result.kv = keptKv;
+    result.ki = fixed[1];
+    result.kd = fixed[2];
+
+    return true;
+}
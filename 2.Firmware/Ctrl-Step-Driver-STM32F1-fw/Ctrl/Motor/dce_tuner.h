@@ -0,0 +1,99 @@
+#ifndef CTRL_STEP_FW_DCE_TUNER_H
+#define CTRL_STEP_FW_DCE_TUNER_H
+
+#include <cstdint>
+
+
+/*
+ * Identifies the load and picks the DCE gains for it.
+ *
+ * While running it replaces the soft goal of position mode with a small
+ * sine around where it started, at each of EXCITE_FREQUENCY in turn, and
+ * correlates the estimated position and the commanded current with it. A
+ * frequency whose current reaches the limit starts over at half the
+ * amplitude, a clipped response would fit as a shorter delay. The
+ * current to position response at two frequencies gives the effective
+ * inertia, stiffness and damping the motor pushes against and the loop
+ * delay. The gains place the three closed-loop poles of a PID on that
+ * inertia at the bandwidth the delay allows.
+ *
+ * Tick() runs in the 20kHz interrupt, TickMainLoop() does the float math
+ * once the excitation is done.
+ */
+class DceTuner
+{
+public:
+    // Sent as is in the 0x29 reply, see CAN_DCE_TUNE_* in can_codec.h
+    typedef enum
+    {
+        STATE_IDLE,
+        STATE_RUNNING,
+        STATE_ANALYZING,
+        STATE_DONE,
+        STATE_FAILED
+    } State_t;
+
+    typedef struct
+    {
+        float inertia;      // mA per turn/s^2
+        float stiffness;    // mA per turn
+        float damping;      // mA per turn/s
+        float delay;        // s
+        float bandwidth;    // Hz, of the tuned loop
+        int32_t kp, kv, ki, kd;
+    } Result_t;
+
+    static const uint8_t EXCITE_FREQUENCY_NUM = 2;
+    static const int32_t EXCITE_FREQUENCY[EXCITE_FREQUENCY_NUM];   // Hz, dividing the control frequency
+    static const int32_t EXCITE_AMPLITUDE = 128;    // steps, 0.9°
+    static const int32_t SETTLE_PERIODS = 2;        // Not measured
+    static const int32_t MEASURE_PERIODS = 8;
+
+
+    volatile State_t state = STATE_IDLE;
+    Result_t result{};
+    int32_t goPosition = 0;
+    int32_t goVelocity = 0;
+
+
+    void Init(int32_t _controlFrequency, int32_t _stepsPerTurn);
+    // _kv is kept, its proportional share is left out of kp. _currentLimit
+    // is where the DCE output clips (mA).
+    bool Start(int32_t _kv, int32_t _currentLimit);
+    void Abort();
+    void Tick(int32_t _position, int32_t _current);
+    // True once, when new gains are in result
+    bool TickMainLoop();
+
+
+private:
+    int32_t controlFrequency = 20000;
+    int32_t stepsPerTurn = 51200;
+    int32_t keptKv = 0;
+    int32_t currentLimit = 0;
+    bool holdValid = false;
+    int32_t holdPosition = 0;
+    uint8_t frequencyIndex = 0;
+    int32_t periodTicks = 0;
+    int32_t tickCount = 0;
+
+    // Unit phasor turned by one tick's angle each tick, Q30. The float math
+    // is done in Start(), it doesn't fit in a tick.
+    int64_t rotateCos[EXCITE_FREQUENCY_NUM] = {};
+    int64_t rotateSin[EXCITE_FREQUENCY_NUM] = {};
+    int32_t amplitude[EXCITE_FREQUENCY_NUM] = {};
+    int32_t amplitudeVelocity[EXCITE_FREQUENCY_NUM] = {};
+    int64_t oscCos = 0;
+    int64_t oscSin = 0;
+
+    // Correlations with sin and cos, per frequency
+    int64_t positionSin[EXCITE_FREQUENCY_NUM] = {};
+    int64_t positionCos[EXCITE_FREQUENCY_NUM] = {};
+    int64_t currentSin[EXCITE_FREQUENCY_NUM] = {};
+    int64_t currentCos[EXCITE_FREQUENCY_NUM] = {};
+
+    void StartFrequency(uint8_t _index);
+    bool Analyze();
+};
+
+#endif
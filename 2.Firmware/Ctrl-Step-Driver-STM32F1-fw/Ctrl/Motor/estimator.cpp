@@ -0,0 +1,105 @@
+#include "estimator.h"
+
+
+void FilterEstimator::Reset(int32_t _position)
+{
+    lastPosition = _position;
+    velocityIntegral = 0;
+    position = _position;
+    velocity = 0;
+}
+
+
+void FilterEstimator::Update(int32_t _realPosition)
+{
+    // Estimate Velocity
+    velocityIntegral += (_realPosition - lastPosition) * frequency + ((velocity << 5) - velocity);
+    velocity = velocityIntegral >> 5;
+    velocityIntegral -= (velocity << 5);
+    lastPosition = _realPosition;
+
+    // Estimate Position
+    position = _realPosition + CompensateAdvancedAngle(velocity);
+}
+
+
+int32_t FilterEstimator::CompensateAdvancedAngle(int32_t _vel)
+{
+    /*
+     * The code is for DPS series sensors, need to measured and renew for TLE5012/MT6816.
+     */
+
+    int32_t compensate;
+
+    if (_vel < 0)
+    {
+        if (_vel > -100000) compensate = 0;
+        else if (_vel > -1300000) compensate = (((_vel + 100000) * 262) >> 20) - 0;
+        else if (_vel > -2200000) compensate = (((_vel + 1300000) * 105) >> 20) - 300;
+        else compensate = (((_vel + 2200000) * 52) >> 20) - 390;
+
+        if (compensate < -430) compensate = -430;
+    } else
+    {
+        if (_vel < 100000) compensate = 0;
+        else if (_vel < 1300000) compensate = (((_vel - 100000) * 262) >> 20) + 0;
+        else if (_vel < 2200000) compensate = (((_vel - 1300000) * 105) >> 20) + 300;
+        else compensate = (((_vel - 2200000) * 52) >> 20) + 390;
+
+        if (compensate > 430) compensate = 430;
+    }
+
+    return compensate;
+}
+
+
+void PllEstimator::Init(int32_t _frequency)
+{
+    EstimatorBase::Init(_frequency);
+    CalcGains();
+}
+
+
+void PllEstimator::SetBandwidth(int32_t _bandwidth)
+{
+    bandwidth = _bandwidth;
+    CalcGains();
+}
+
+
+void PllEstimator::CalcGains()
+{
+    // Poles of s^2 + 2ws + w^2, discretized per tick
+    kp = (int32_t) (((int64_t) 2 * bandwidth << GAIN_FRAC_BITS) / frequency);
+    ki = (int32_t) (((int64_t) bandwidth * bandwidth << GAIN_FRAC_BITS) / ((int64_t) frequency * frequency));
+}
+
+
+void PllEstimator::Reset(int32_t _position)
+{
+    // Multiplied, left shifts of negative positions are undefined
+    positionState = (int64_t) _position * (1 << STATE_FRAC_BITS);
+    velocityState = 0;
+    position = _position;
+    velocity = 0;
+}
+
+
+void PllEstimator::Update(int32_t _realPosition)
+{
+    int64_t predicted = positionState + velocityState;
+    int64_t error = (int64_t) _realPosition * (1 << STATE_FRAC_BITS) - predicted;
+
+    // Over 32768 steps off only after a jump of the position itself, lock again at once
+    if (error > INT32_MAX || error < INT32_MIN)
+    {
+        Reset(_realPosition);
+        return;
+    }
+
+    velocityState += (int32_t) ((error * ki) >> GAIN_FRAC_BITS);
+    positionState = predicted + ((error * kp) >> GAIN_FRAC_BITS);
+
+    position = (int32_t) ((positionState + (1 << (STATE_FRAC_BITS - 1))) >> STATE_FRAC_BITS);
+    velocity = (int32_t) (((int64_t) velocityState * frequency) >> STATE_FRAC_BITS);
+}
@@ -0,0 +1,83 @@
+#ifndef CTRL_STEP_FW_ESTIMATOR_H
+#define CTRL_STEP_FW_ESTIMATOR_H
+
+#include <cstdint>
+
+
+/*
+ * Rotor position and velocity from the unwrapped encoder position, updated
+ * once per control tick from the tick interrupt. Reset() puts the estimate
+ * at rest at a position, e.g. on the first tick.
+ */
+class EstimatorBase
+{
+public:
+    int32_t position = 0;   // steps, what the controller takes as the rotor position
+    int32_t velocity = 0;   // steps/s
+
+
+    virtual void Init(int32_t _frequency)
+    { frequency = _frequency; }
+
+    virtual void Reset(int32_t _position) = 0;
+
+    virtual void Update(int32_t _realPosition) = 0;
+
+
+protected:
+    int32_t frequency = 20000;
+};
+
+
+/*
+ * The original estimate: first-order IIR (1/32 per tick) on position
+ * differences, plus a piecewise lead on the position that was measured for
+ * the DPS series sensors.
+ */
+class FilterEstimator : public EstimatorBase
+{
+public:
+    void Reset(int32_t _position) override;
+    void Update(int32_t _realPosition) override;
+
+
+private:
+    int32_t lastPosition = 0;
+    int32_t velocityIntegral = 0;
+
+    static int32_t CompensateAdvancedAngle(int32_t _vel);
+};
+
+
+/*
+ * Second-order tracking loop: predicts the position from the velocity, then
+ * corrects both with the prediction error. It follows a constant velocity
+ * without lag, so it needs no lead compensation. Critically damped with the
+ * bandwidth set, integer only.
+ */
+class PllEstimator : public EstimatorBase
+{
+public:
+    static const int32_t DEFAULT_BANDWIDTH = 2000;  // rad/s
+
+
+    void Init(int32_t _frequency) override;
+    void SetBandwidth(int32_t _bandwidth);
+    void Reset(int32_t _position) override;
+    void Update(int32_t _realPosition) override;
+
+
+private:
+    static const uint8_t GAIN_FRAC_BITS = 24;
+    static const uint8_t STATE_FRAC_BITS = 16;
+
+    int32_t bandwidth = DEFAULT_BANDWIDTH;
+    int32_t kp = 0;                 // Per tick, GAIN_FRAC_BITS
+    int32_t ki = 0;
+    int64_t positionState = 0;      // steps, STATE_FRAC_BITS
+    int32_t velocityState = 0;      // steps per tick, STATE_FRAC_BITS
+
+    void CalcGains();
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "motion_planner.h"
 #include "math.h"
+#include <atomic>
 
 
 void MotionPlanner::CurrentTracker::Init()
@@ -175,6 +176,28 @@ void MotionPlanner::PositionTracker::SetVelocityAcc(int32_t value)
     velocityUpAcc = value;
     velocityDownAcc = value;
     quickVelocityDownAcc = 0.5f / (float) velocityDownAcc;
+    UpdateWindow();
+}
+
+
+void MotionPlanner::PositionTracker::SetJerk(int32_t _jerk)
+{
+    jerk = _jerk;
+    UpdateWindow();
+}
+
+
+void MotionPlanner::PositionTracker::UpdateWindow()
+{
+    int32_t ticks = 0;
+    if (jerk > 0)
+    {
+        // Time to reach the acceleration at the jerk
+        int64_t time = (int64_t) velocityUpAcc * (context->CONTROL_FREQUENCY / 1000) / jerk;
+        ticks = time > S_CURVE_MAX_WINDOW ? S_CURVE_MAX_WINDOW : (int32_t) time;
+        ticks -= ticks % S_CURVE_BLOCK_TICKS;
+    }
+    requestWindow = ticks;
 }
 
 
@@ -184,6 +207,28 @@ void MotionPlanner::PositionTracker::NewTask(int32_t real_location, int32_t real
     trackVelocity = real_speed;
     positionIntegral = 0;
     trackPosition = real_location;
+
+    window = requestWindow;
+    ResetHistory(real_location, real_speed);
+}
+
+
+void MotionPlanner::PositionTracker::ResetHistory(int32_t _position, int32_t _velocity)
+{
+    for (int32_t i = 0; i < window / S_CURVE_BLOCK_TICKS; i++)
+        velocityHistory[i] = _velocity * S_CURVE_BLOCK_TICKS;
+    historyIndex = 0;
+    historySum = _velocity * window;
+    blockSum = 0;
+    blockTicks = 0;
+    restTicks = _velocity == 0 ? window + S_CURVE_BLOCK_TICKS : 0;
+    smoothIntegral = 0;
+    smoothPosition = _position;
+
+    // As if it had been moving all along, the average trails the trapezoid by half a window
+    if (window > 0)
+        trackPosition = _position + (int32_t) ((int64_t) _velocity * (window - 1) /
+                                               (2 * context->CONTROL_FREQUENCY));
 }
 
 
@@ -325,8 +370,60 @@ void MotionPlanner::PositionTracker::CalcSoftGoal(int32_t _goalPosition)
 
     CalcPositionIntegral(trackVelocity);
 
-    go_location = (int32_t) trackPosition;
-    go_velocity = (int32_t) trackVelocity;
+    CalcSmoothGoal();
+}
+
+
+void MotionPlanner::PositionTracker::CalcSmoothGoal()
+{
+    // A new window starts on an empty history, so only at rest
+    if (window != requestWindow && trackVelocity == 0 && restTicks >= window + S_CURVE_BLOCK_TICKS)
+    {
+        window = requestWindow;
+        ResetHistory(trackPosition, 0);
+    }
+
+    if (window == 0)
+    {
+        go_location = trackPosition;
+        go_velocity = trackVelocity;
+        return;
+    }
+
+    // The oldest block leaves in equal shares, the last tick takes the remainder
+    int32_t oldest = velocityHistory[historyIndex];
+    int32_t share = oldest / S_CURVE_BLOCK_TICKS;
+    if (blockTicks == S_CURVE_BLOCK_TICKS - 1)
+        share = oldest - share * (S_CURVE_BLOCK_TICKS - 1);
+    historySum += trackVelocity - share;
+    blockSum += trackVelocity;
+    if (++blockTicks >= S_CURVE_BLOCK_TICKS)
+    {
+        velocityHistory[historyIndex] = blockSum;
+        blockSum = 0;
+        blockTicks = 0;
+        if (++historyIndex >= window / S_CURVE_BLOCK_TICKS)
+            historyIndex = 0;
+    }
+    if (trackVelocity != 0)
+        restTicks = 0;
+    else if (restTicks < window + S_CURVE_BLOCK_TICKS)
+        restTicks++;
+
+    int32_t divider = window * context->CONTROL_FREQUENCY;
+    smoothIntegral += historySum;
+    smoothPosition += smoothIntegral / divider;
+    smoothIntegral %= divider;
+
+    // Arrived, drop what the trapezoid's rounding left
+    if (restTicks >= window + S_CURVE_BLOCK_TICKS)
+    {
+        smoothIntegral = 0;
+        smoothPosition = trackPosition;
+    }
+
+    go_location = smoothPosition;
+    go_velocity = historySum / window;
 }
 
 
@@ -392,20 +489,77 @@ void MotionPlanner::TrajectoryTracker::NewTask(int32_t real_location, int32_t re
     velocityNow = real_speed;
     velovityNowRemainder = 0;
     positionNow = real_location;
+    // Queued points are blended into from here
+    playing = false;
 }
 
 
 void MotionPlanner::TrajectoryTracker::CalcSoftGoal(int32_t _goalPosition, int32_t _goalVelocity)
 {
+    /*************************** Buffered Points ****************************/
+    if (restartRequested)
+    {
+        restartRequested = false;
+        playing = false;
+    }
+
+    // Points that are due end the segment they were the end of
+    while (pointHead != pointTail && (int32_t) (points[pointHead].time - clock) <= 0)
+    {
+        segmentStart = points[pointHead];
+        pointHead = (pointHead + 1) % POINT_BUFFER_SIZE;
+        playing = true;
+        segmentReady = false;
+    }
+
+    if (pointHead != pointTail)
+    {
+        // The first point after a pause starts from where the soft goal is now
+        if (!playing)
+        {
+            segmentStart = {clock, positionNow, velocityNow};
+            playing = true;
+            segmentReady = false;
+        }
+        if (!segmentReady)
+            StartSegment(points[pointHead]);
+        CalcSegment();
+
+        // Don't take the single goal left from before as an update later
+        recordPosition = _goalPosition;
+        recordVelocity = _goalVelocity;
+        goPosition = positionNow;
+        goVelocity = velocityNow;
+        return;
+    }
+
+    if (playing)
+    {
+        // Ran dry: continue from the last point, slowing down like a timeout
+        playing = false;
+        positionNow = segmentStart.position;
+        velocityNow = segmentStart.velocity;
+        velovityNowRemainder = 0;
+        dynamicVelocityAccRemainder = 0;
+        recordPosition = _goalPosition;
+        recordVelocity = _goalVelocity;
+        overtimeFlag = true;
+    }
+
+    /****************************** Single Goal *****************************/
     if (_goalVelocity != recordVelocity || _goalPosition != recordPosition)
     {
         updateTime = 0;
         recordVelocity = _goalVelocity;
         recordPosition = _goalPosition;
 
-        dynamicVelocityAcc = (int32_t) ((float) (_goalVelocity + velocityNow) *
-                                        (float) (_goalVelocity - velocityNow) /
-                                        (float) (2 * (_goalPosition - positionNow)));
+        // Already there: hold the velocity rather than divide by zero
+        if (_goalPosition == positionNow)
+            dynamicVelocityAcc = 0;
+        else
+            dynamicVelocityAcc = (int32_t) ((float) (_goalVelocity + velocityNow) *
+                                            (float) (_goalVelocity - velocityNow) /
+                                            (float) (2 * (_goalPosition - positionNow)));
 
         overtimeFlag = false;
     } else
@@ -466,6 +620,110 @@ void MotionPlanner::TrajectoryTracker::CalcPositionIntegral(int32_t value)
 }
 
 
+void MotionPlanner::TrajectoryTracker::StartSegment(const Point_t &_end)
+{
+    // Cubic Hermite in the segment fraction s: p = p0 + c0*s + c1*s^2 + c2*s^3,
+    // with both velocities scaled by the segment length into steps
+    segmentTicks = _end.time - segmentStart.time;
+    if (segmentTicks == 0)
+        segmentTicks = 1;
+    int64_t frequency = context->CONTROL_FREQUENCY;
+    int32_t deltaPosition = _end.position - segmentStart.position;
+    int32_t startSpan = (int32_t) ((int64_t) segmentStart.velocity * segmentTicks / frequency);
+    int32_t endSpan = (int32_t) ((int64_t) _end.velocity * segmentTicks / frequency);
+
+    positionCoef[0] = startSpan;
+    positionCoef[1] = 3 * deltaPosition - 2 * startSpan - endSpan;
+    positionCoef[2] = -2 * deltaPosition + startSpan + endSpan;
+
+    // Its derivative back in steps/s, less the start velocity
+    velocityCoef[0] = (int32_t) (2 * (int64_t) positionCoef[1] * frequency / segmentTicks);
+    velocityCoef[1] = (int32_t) (3 * (int64_t) positionCoef[2] * frequency / segmentTicks);
+
+    segmentReady = true;
+}
+
+
+void MotionPlanner::TrajectoryTracker::CalcSegment()
+{
+    // A clock set back before the segment holds its start
+    int32_t elapsed = (int32_t) (clock - segmentStart.time);
+    if (elapsed < 0)
+        elapsed = 0;
+    // Segment fraction in Q16, the 64-bit division only for segments over 3.2s
+    int64_t s = elapsed < 0x10000 ?
+                ((uint32_t) elapsed << 16) / segmentTicks :
+                ((int64_t) elapsed << 16) / segmentTicks;
+
+    int64_t position = (positionCoef[2] * s) >> 16;
+    position = ((position + positionCoef[1]) * s) >> 16;
+    position = ((position + positionCoef[0]) * s) >> 16;
+    int64_t velocity = (velocityCoef[1] * s) >> 16;
+    velocity = ((velocity + velocityCoef[0]) * s) >> 16;
+
+    positionNow = segmentStart.position + (int32_t) position;
+    velocityNow = segmentStart.velocity + (int32_t) velocity;
+    velovityNowRemainder = 0;
+    dynamicVelocityAccRemainder = 0;
+}
+
+
+void MotionPlanner::TrajectoryTracker::TickClock()
+{
+    clock = clock + 1;
+}
+
+
+void MotionPlanner::TrajectoryTracker::SyncClock(uint32_t _time)
+{
+    clock = _time;
+}
+
+
+uint32_t MotionPlanner::TrajectoryTracker::GetClock()
+{
+    return clock;
+}
+
+
+bool MotionPlanner::TrajectoryTracker::PushPoint(uint32_t _time, int32_t _position, int32_t _velocity)
+{
+    uint8_t tail = pointTail;
+    uint8_t next = (tail + 1) % POINT_BUFFER_SIZE;
+    int32_t lead = (int32_t) (_time - clock);
+
+    // Full, already due, too far ahead, or not after the last queued point
+    if (next == pointHead || lead <= 0 || lead > (int32_t) POINT_MAX_LEAD ||
+        (tail != pointHead &&
+         (int32_t) (_time - points[(tail + POINT_BUFFER_SIZE - 1) % POINT_BUFFER_SIZE].time) <= 0))
+    {
+        rejectedPointCount++;
+        return false;
+    }
+
+    points[tail] = {_time, _position, _velocity};
+    // The point must be written before the tick can see it
+    std::atomic_signal_fence(std::memory_order_release);
+    pointTail = next;
+
+    return true;
+}
+
+
+// The tick only moves the head up to the tail, so it can't undo this
+void MotionPlanner::TrajectoryTracker::ClearPoints()
+{
+    restartRequested = true;
+    pointHead = pointTail;
+}
+
+
+uint8_t MotionPlanner::TrajectoryTracker::GetFreePointCount()
+{
+    return (pointHead + POINT_BUFFER_SIZE - pointTail - 1) % POINT_BUFFER_SIZE;
+}
+
+
 void MotionPlanner::TrajectoryTracker::Init(int32_t _updateTimeout)
 {
     //SetSlowDownVelocityAcc(context->config->ratedVelocityAcc / 10);
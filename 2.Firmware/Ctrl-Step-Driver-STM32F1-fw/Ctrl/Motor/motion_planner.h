@@ -80,6 +80,14 @@ public:
     };
     VelocityTracker velocityTracker = VelocityTracker(this);
 
+    /*
+     * Trapezoidal profile to the goal. With a jerk set, the trapezoid's
+     * velocity is averaged over the time it takes to reach the acceleration
+     * at that jerk, giving an S-curve: the acceleration ramps at the jerk
+     * instead of stepping, at the cost of that time on every move. Where a
+     * short move turns from speeding up straight to braking the ramp is twice
+     * as steep. The average can't overshoot where the trapezoid doesn't.
+     */
     class PositionTracker
     {
     public:
@@ -89,12 +97,19 @@ public:
         }
 
 
+        static const int32_t S_CURVE_MAX_WINDOW = 512;  // ticks, limits the smoothing to 25.6ms
+        // Ticks summed per history entry, windows are multiples of it
+        static const int32_t S_CURVE_BLOCK_TICKS = 4;
+
+
         int32_t go_location = 0;
         int32_t go_velocity = 0;
 
 
         void Init();
         void SetVelocityAcc(int32_t value);
+        // (steps/s^2 per ms) 0 for the plain trapezoid, applies once at rest
+        void SetJerk(int32_t _jerk);
         void NewTask(int32_t real_location, int32_t real_speed);
         void CalcSoftGoal(int32_t _goalPosition);
 
@@ -110,9 +125,27 @@ public:
         int32_t positionIntegral = 0;
         int32_t trackPosition = 0;
 
+        // Moving average of trackVelocity for the S-curve
+        int32_t jerk = 0;
+        volatile int32_t requestWindow = 0;
+        int32_t window = 0;                 // ticks, 0 for none
+        // Sums of S_CURVE_BLOCK_TICKS velocities, 512 bytes instead of one
+        // entry per tick. The oldest block leaves the sum a share per tick.
+        int32_t velocityHistory[S_CURVE_MAX_WINDOW / S_CURVE_BLOCK_TICKS] = {};
+        int32_t historyIndex = 0;
+        int32_t historySum = 0;
+        int32_t blockSum = 0;
+        int32_t blockTicks = 0;
+        int32_t restTicks = 0;              // Zero velocities in a row, the history is empty after a window and a block
+        int32_t smoothIntegral = 0;
+        int32_t smoothPosition = 0;
+
 
         void CalcVelocityIntegral(int32_t value);
         void CalcPositionIntegral(int32_t value);
+        void UpdateWindow();
+        void ResetHistory(int32_t _position, int32_t _velocity);
+        void CalcSmoothGoal();
     };
     PositionTracker positionTracker = PositionTracker(this);
 
@@ -153,14 +186,33 @@ public:
         }
 
 
+        // A setpoint due at a tick of the trajectory clock
+        struct Point_t
+        {
+            uint32_t time;
+            int32_t position;
+            int32_t velocity;
+        };
+
+        static const uint8_t POINT_BUFFER_SIZE = 16;
+        static const uint32_t POINT_MAX_LEAD = 32767;   // ticks, how far ahead a point may be due
+
+
         int32_t goPosition = 0;
         int32_t goVelocity = 0;
+        uint32_t rejectedPointCount = 0;
 
 
         void Init(int32_t _updateTimeout);
         void SetSlowDownVelocityAcc(int32_t value);
         void NewTask(int32_t real_location, int32_t real_speed);
         void CalcSoftGoal(int32_t _goalPosition, int32_t _goalVelocity);
+        void TickClock();
+        void SyncClock(uint32_t _time);
+        uint32_t GetClock();
+        bool PushPoint(uint32_t _time, int32_t _position, int32_t _velocity);
+        void ClearPoints();
+        uint8_t GetFreePointCount();
 
 
     private:
@@ -177,9 +229,25 @@ public:
         int32_t velovityNowRemainder = 0;
         int32_t positionNow = 0;
 
+        // Ring of points, pushed by the CAN interrupt and played by the tick
+        volatile uint32_t clock = 0;
+        Point_t points[POINT_BUFFER_SIZE] = {};
+        volatile uint8_t pointHead = 0;
+        volatile uint8_t pointTail = 0;
+        volatile bool restartRequested = false;
+        bool playing = false;
+        bool segmentReady = false;
+        Point_t segmentStart = {};
+        // Hermite segment as cubics of the segment fraction in Q16
+        uint32_t segmentTicks = 1;
+        int32_t positionCoef[3] = {};
+        int32_t velocityCoef[2] = {};
+
 
         void CalcVelocityIntegral(int32_t value);
         void CalcPositionIntegral(int32_t value);
+        void StartSegment(const Point_t &_end);
+        void CalcSegment();
     };
     TrajectoryTracker trajectoryTracker = TrajectoryTracker(this);
 
@@ -8,6 +8,7 @@ void Motor::Tick20kHz()
 {
     // 1.Encoder data Update
     encoder->UpdateAngle();
+    if (profiler) profiler->Mark(TickProfilerBase::STAGE_ENCODER);
 
     // 2.Motor Control Update
     CloseLoopControlTick();
@@ -26,10 +27,22 @@ void Motor::AttachDriver(DriverBase* _driver)
 }
 
 
+void Motor::AttachProfiler(TickProfilerBase* _profiler)
+{
+    profiler = _profiler;
+}
+
+
+void Motor::AttachEstimator(EstimatorBase* _estimator)
+{
+    estimator = _estimator;
+    estimator->Init(motionPlanner.CONTROL_FREQUENCY);
+}
+
+
 void Motor::CloseLoopControlTick()
 {
     /************************************ First Called ************************************/
-    static bool isFirstCalled = true;
     if (isFirstCalled)
     {
         int32_t angle;
@@ -53,6 +66,7 @@ void Motor::CloseLoopControlTick()
         controller->realLapPositionLast = angle;
         controller->realPosition = angle;
         controller->realPositionLast = angle;
+        estimator->Reset(angle);
 
         isFirstCalled = false;
         return;
@@ -77,20 +91,14 @@ void Motor::CloseLoopControlTick()
     controller->realPosition += deltaLapPosition;
 
     /********************************* Estimate Data *********************************/
-    // Estimate Velocity
-    controller->estVelocityIntegral += (
-        (controller->realPosition - controller->realPositionLast) * motionPlanner.CONTROL_FREQUENCY
-        + ((controller->estVelocity << 5) - controller->estVelocity)
-    );
-    controller->estVelocity = controller->estVelocityIntegral >> 5;
-    controller->estVelocityIntegral -= (controller->estVelocity << 5);
-
-    // Estimate Position
-    controller->estLeadPosition = Controller::CompensateAdvancedAngle(controller->estVelocity);
-    controller->estPosition = controller->realPosition + controller->estLeadPosition;
+    estimator->Update(controller->realPosition);
+    controller->estVelocity = estimator->velocity;
+    controller->estPosition = estimator->position;
+    controller->estLeadPosition = controller->estPosition - controller->realPosition;
 
     // Estimate Error
     controller->estError = controller->softPosition - controller->estPosition;
+    if (profiler) profiler->Mark(TickProfilerBase::STAGE_ESTIMATE);
 
     /************************************ Ctrl Loop ************************************/
     if (controller->isStalled ||
@@ -142,6 +150,7 @@ void Motor::CloseLoopControlTick()
                 break;
         }
     }
+    if (profiler) profiler->Mark(TickProfilerBase::STAGE_CONTROL);
 
     /******************************* Mode Change Handle *******************************/
     if (controller->modeRunning != controller->requestMode)
@@ -209,6 +218,8 @@ void Motor::CloseLoopControlTick()
     }
 
     /******************************* Update Soft Goal *******************************/
+    motionPlanner.trajectoryTracker.TickClock();
+
     switch (controller->modeRunning)
     {
         case MODE_STOP:
@@ -253,8 +264,31 @@ void Motor::CloseLoopControlTick()
             break;
     }
 
+    // The auto-tune takes over the soft goal of position mode while it runs
+    if (dceTuner.state == DceTuner::STATE_RUNNING)
+    {
+        if (controller->modeRunning == MODE_COMMAND_POSITION &&
+            !controller->isStalled && !controller->softDisable && !controller->softBrake)
+        {
+            dceTuner.Tick(controller->estPosition, controller->focCurrent);
+            controller->softPosition = dceTuner.goPosition;
+            controller->softVelocity = dceTuner.goVelocity;
+        } else
+        {
+            dceTuner.Abort();
+        }
+
+        // Stay where the excitation ended
+        if (dceTuner.state != DceTuner::STATE_RUNNING)
+        {
+            controller->goalPosition = controller->estPosition;
+            controller->softNewCurve = true;
+        }
+    }
+
     controller->softDisable = controller->goalDisable;
     controller->softBrake = controller->goalBrake;
+    if (profiler) profiler->Mark(TickProfilerBase::STAGE_PLAN);
 
     /******************************** State Check ********************************/
     int32_t current = abs(controller->focCurrent);
@@ -297,6 +331,21 @@ void Motor::CloseLoopControlTick()
         controller->overloadFlag = false;
     }
 
+    // Collision detect, on the position loop's error and current
+    if ((controller->modeRunning == MODE_COMMAND_POSITION ||
+         controller->modeRunning == MODE_COMMAND_Trajectory ||
+         controller->modeRunning == MODE_PWM_POSITION ||
+         controller->modeRunning == MODE_STEP_DIR) &&
+        !controller->isStalled && !controller->softDisable && !controller->softBrake &&
+        encoder->IsCalibrated() && dceTuner.state != DceTuner::STATE_RUNNING)
+    {
+        if (collisionDetector.Tick(controller->estError, controller->focCurrent))
+            controller->isStalled = true;
+    } else
+    {
+        collisionDetector.Reset();
+    }
+
     /******************************** Update State ********************************/
     if (!encoder->IsCalibrated())
         controller->state = STATE_NO_CALIB;
@@ -332,6 +381,7 @@ void Motor::CloseLoopControlTick()
             controller->state = STATE_FINISH;
         }
     }
+    if (profiler) profiler->Mark(TickProfilerBase::STAGE_STATE);
 }
 
 
@@ -425,6 +475,13 @@ void Motor::Controller::AddTrajectorySetPoint(int32_t _pos, int32_t _vel)
 }
 
 
+bool Motor::Controller::AddTrajectoryPoint(uint32_t _time, int32_t _pos, int32_t _vel)
+{
+    return context->motionPlanner.trajectoryTracker.PushPoint(
+        _time, _pos + context->config.motionParams.encoderHomeOffset, _vel);
+}
+
+
 void Motor::Controller::SetPositionSetPoint(int32_t _pos)
 {
     goalPosition = _pos + context->config.motionParams.encoderHomeOffset;
@@ -491,6 +548,24 @@ float Motor::Controller::GetFocCurrent()
 }
 
 
+int32_t Motor::Controller::GetPositionSteps()
+{
+    return realPosition - context->config.motionParams.encoderHomeOffset;
+}
+
+
+int32_t Motor::Controller::GetVelocitySteps()
+{
+    return estVelocity;
+}
+
+
+int32_t Motor::Controller::GetFocCurrentMilliAmps()
+{
+    return focCurrent;
+}
+
+
 void Motor::Controller::SetCurrentSetPoint(int32_t _cur)
 {
     if (_cur > context->config.motionParams.ratedCurrent)
@@ -522,33 +597,19 @@ void Motor::Controller::ClearStallFlag()
 }
 
 
-int32_t Motor::Controller::CompensateAdvancedAngle(int32_t _vel)
+bool Motor::Controller::StartDceTune()
 {
-    /*
-     * The code is for DPS series sensors, need to measured and renew for TLE5012/MT6816.
-     */
-
-    int32_t compensate;
-
-    if (_vel < 0)
+    if (!context->encoder->IsCalibrated() || isStalled)
     {
-        if (_vel > -100000) compensate = 0;
-        else if (_vel > -1300000) compensate = (((_vel + 100000) * 262) >> 20) - 0;
-        else if (_vel > -2200000) compensate = (((_vel + 1300000) * 105) >> 20) - 300;
-        else compensate = (((_vel + 2200000) * 52) >> 20) - 390;
-
-        if (compensate < -430) compensate = -430;
-    } else
-    {
-        if (_vel < 100000) compensate = 0;
-        else if (_vel < 1300000) compensate = (((_vel - 100000) * 262) >> 20) + 0;
-        else if (_vel < 2200000) compensate = (((_vel - 1300000) * 105) >> 20) + 300;
-        else compensate = (((_vel - 2200000) * 52) >> 20) + 390;
-
-        if (compensate > 430) compensate = 430;
+        // Tell the one who asked, unless there is a result coming
+        if (context->dceTuner.state != DceTuner::STATE_ANALYZING)
+            context->dceTuner.state = DceTuner::STATE_FAILED;
+        return false;
     }
 
-    return compensate;
+    requestMode = MODE_COMMAND_POSITION;
+
+    return context->dceTuner.Start(config->dce.kv, context->config.motionParams.ratedCurrent);
 }
 
 
@@ -564,7 +625,6 @@ void Motor::Controller::Init()
     realPosition = 0;
     realPositionLast = 0;
 
-    estVelocityIntegral = 0;
     estVelocity = 0;
     estLeadPosition = 0;
     estPosition = 0;
@@ -4,6 +4,10 @@
 #include "Motor/motion_planner.h"
 #include "Sensor/Encoder/encoder_base.h"
 #include "Driver/driver_base.h"
+#include "Motor/tick_profiler_base.h"
+#include "Motor/estimator.h"
+#include "Motor/dce_tuner.h"
+#include "Motor/collision_detector.h"
 
 class Motor
 {
@@ -39,6 +43,8 @@ public:
 
         motionPlanner.AttachConfig(&config.motionParams);
         controller->AttachConfig(&config.ctrlParams);
+        dceTuner.Init(motionPlanner.CONTROL_FREQUENCY, MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS);
+        collisionDetector.Init(motionPlanner.CONTROL_FREQUENCY);
     }
 
 
@@ -130,11 +136,19 @@ public:
         float GetPosition(bool _isLap = false);
         float GetVelocity();
         float GetFocCurrent();
+        // Same values without the float division, for the CAN interrupt
+        int32_t GetPositionSteps();
+        int32_t GetVelocitySteps();
+        int32_t GetFocCurrentMilliAmps();
         void AddTrajectorySetPoint(int32_t _pos, int32_t _vel);
+        // _time is a tick of motionPlanner.trajectoryTracker's clock
+        bool AddTrajectoryPoint(uint32_t _time, int32_t _pos, int32_t _vel);
         void SetDisable(bool _disable);
         void SetBrake(bool _brake);
         void ApplyPosAsHomeOffset();
         void ClearStallFlag();
+        // Excites the load in position mode, results come from dceTuner
+        bool StartDceTune();
 
 
     private:
@@ -144,7 +158,6 @@ public:
         int32_t realPosition{};
         int32_t realPositionLast{};
         int32_t estVelocity{};
-        int32_t estVelocityIntegral{};
         int32_t estLeadPosition{};
         int32_t estPosition{};
         int32_t estError{};
@@ -171,8 +184,6 @@ public:
         void CalcPidToOutput(int32_t _speed);
         void CalcDceToOutput(int32_t _location, int32_t _speed);
         void ClearIntegral() const;
-
-        static int32_t CompensateAdvancedAngle(int32_t _vel);
     };
 
 
@@ -187,15 +198,23 @@ public:
     Controller* controller = nullptr;
     EncoderBase* encoder = nullptr;
     DriverBase* driver = nullptr;
+    TickProfilerBase* profiler = nullptr;
+    EstimatorBase* estimator = nullptr;
+    DceTuner dceTuner;
+    // Stalls the motor like the stall protection does, within milliseconds
+    CollisionDetector collisionDetector;
 
 
     void Tick20kHz();
     void AttachEncoder(EncoderBase* _encoder);
     void AttachDriver(DriverBase* _driver);
+    void AttachProfiler(TickProfilerBase* _profiler);
+    void AttachEstimator(EstimatorBase* _estimator);
 
 
 private:
     Controller controllerInstance = Controller(this);
+    bool isFirstCalled = true;
 
 
     void CloseLoopControlTick();
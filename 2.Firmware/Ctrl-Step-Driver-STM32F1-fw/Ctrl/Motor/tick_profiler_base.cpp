@@ -0,0 +1,96 @@
+#include "tick_profiler_base.h"
+
+
+void TickProfilerBase::Init(uint32_t _tickFrequency)
+{
+    InitCounter();
+    budgetCycles = GetCounterFrequency() / _tickFrequency;
+
+    // Cost of one read, it ends up in every stage otherwise
+    uint32_t t0 = ReadCycles();
+    uint32_t t1 = ReadCycles();
+    readCycles = t1 - t0;
+
+    resetRequested = true;
+}
+
+
+void TickProfilerBase::Begin()
+{
+    if (resetRequested)
+    {
+        ClearStats();
+        resetRequested = false;
+    }
+
+    tickStart = ReadCycles();
+    stageStart = tickStart;
+}
+
+
+void TickProfilerBase::Mark(Stage_t _stage)
+{
+    uint32_t now = ReadCycles();
+    Record(_stage, now - stageStart);
+
+    // Start the next stage after the bookkeeping
+    stageStart = ReadCycles();
+}
+
+
+void TickProfilerBase::End()
+{
+    uint32_t cycles = ReadCycles() - tickStart;
+    Record(STAGE_TOTAL, cycles);
+
+    if (budgetCycles == 0)
+        return;
+
+    uint32_t bin = cycles * HISTOGRAM_BINS / budgetCycles;
+    histogram[bin < HISTOGRAM_BINS ? bin : HISTOGRAM_BINS - 1]++;
+    if (cycles > budgetCycles)
+        overrunCount++;
+}
+
+
+void TickProfilerBase::Reset()
+{
+    resetRequested = true;
+}
+
+
+uint32_t TickProfilerBase::GetAverage(Stage_t _stage) const
+{
+    return stats[_stage].count ? (uint32_t) (stats[_stage].sum / stats[_stage].count) : 0;
+}
+
+
+uint32_t TickProfilerBase::GetBinUpperBound(uint8_t _bin) const
+{
+    return budgetCycles * (_bin + 1) / HISTOGRAM_BINS;
+}
+
+
+void TickProfilerBase::Record(Stage_t _stage, uint32_t _cycles)
+{
+    if (_stage != STAGE_TOTAL)
+        _cycles = _cycles > readCycles ? _cycles - readCycles : 0;
+
+    Stats_t &s = stats[_stage];
+    if (s.count == 0 || _cycles < s.min)
+        s.min = _cycles;
+    if (_cycles > s.max)
+        s.max = _cycles;
+    s.sum += _cycles;
+    s.count++;
+}
+
+
+void TickProfilerBase::ClearStats()
+{
+    for (auto &s : stats)
+        s = Stats_t{0, 0, 0, 0};
+    for (auto &bin : histogram)
+        bin = 0;
+    overrunCount = 0;
+}
@@ -0,0 +1,77 @@
+#ifndef CTRL_STEP_FW_TICK_PROFILER_BASE_H
+#define CTRL_STEP_FW_TICK_PROFILER_BASE_H
+
+#include <cstdint>
+
+
+/*
+ * Cycle counts of the 20kHz control tick, per stage and in total.
+ *
+ * Begin() at the start of the interrupt and End() at its end measure the
+ * total, Mark() at the end of each stage measures that stage since the
+ * previous mark. Stage figures leave out the profiler's own cost, the total
+ * includes it. Everything is recorded from the tick interrupt, readers on
+ * other interrupts should copy the stats with interrupts masked.
+ */
+class TickProfilerBase
+{
+public:
+    typedef enum
+    {
+        STAGE_ENCODER = 0,  // SPI read of the angle
+        STAGE_ESTIMATE,     // Lap position, velocity and position estimation
+        STAGE_CONTROL,      // Current/PID/DCE loop and the driver output
+        STAGE_PLAN,         // Mode change, goal limits and motion planner
+        STAGE_STATE,        // Stall/overload detection and state
+        STAGE_TOTAL,        // Whole interrupt
+        STAGE_COUNT
+    } Stage_t;
+
+    // Equal bins over the tick's budget, the last one also counts overruns
+    static const uint8_t HISTOGRAM_BINS = 8;
+
+    typedef struct
+    {
+        uint32_t min;
+        uint32_t max;
+        uint64_t sum;
+        uint32_t count;
+    } Stats_t;
+
+
+    void Init(uint32_t _tickFrequency);
+    void Begin();
+    void Mark(Stage_t _stage);
+    void End();
+    // Takes effect at the next Begin()
+    void Reset();
+
+    uint32_t GetAverage(Stage_t _stage) const;
+    uint32_t GetBinUpperBound(uint8_t _bin) const;
+
+
+    uint32_t budgetCycles = 0;
+    Stats_t stats[STAGE_COUNT]{};
+    uint32_t histogram[HISTOGRAM_BINS]{};
+    uint32_t overrunCount = 0;
+
+
+private:
+    uint32_t tickStart = 0;
+    uint32_t stageStart = 0;
+    uint32_t readCycles = 0;
+    volatile bool resetRequested = true;
+
+    void Record(Stage_t _stage, uint32_t _cycles);
+    void ClearStats();
+
+
+    /***** Port Specified Implements *****/
+    virtual void InitCounter() = 0;
+
+    virtual uint32_t GetCounterFrequency() = 0;
+
+    virtual uint32_t ReadCycles() = 0;
+};
+
+#endif
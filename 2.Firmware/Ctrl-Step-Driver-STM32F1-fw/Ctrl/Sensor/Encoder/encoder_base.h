@@ -22,6 +22,17 @@ public:
     */
     const int32_t RESOLUTION = ((int32_t) ((0x00000001U) << 14));
 
+    /*
+     * Compact calibration table, 1 page instead of 32K: the count measured
+     * at each hard step, a reading is linearly interpolated between the two
+     * around it. Layout in uint16: magic, hard steps per turn, subdivide
+     * steps per hard step, the counts, then their sum as checksum.
+     * The magic is above any step value, so a full table is never taken for it.
+     */
+    static const uint16_t COMPACT_TABLE_MAGIC = 0xCA1B;
+    static const uint16_t COMPACT_TABLE_HEADER_SIZE = 3;
+    static const uint16_t COMPACT_TABLE_MAX_STEPS = 256;
+
     virtual bool Init() = 0;
 
     // Get current rawAngle
@@ -138,10 +138,21 @@ void EncoderCalibratorBase::Tick20kHz()
         case CALI_DISABLE:
             if (isTriggered)
             {
+                sweeping = sweepMode && !sweepFailed;
+                sweepFailed = false;
                 motor->driver->SetFocCurrentVector(goPosition, motor->config.motionParams.caliCurrent);
-                goPosition = motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS;
-                sampleCount = 0;
-                state = CALI_FORWARD_PREPARE;
+                if (sweeping)
+                {
+                    // 20 hard steps to lock onto the field, whole electrical cycles from 0
+                    goPosition = motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS - motor->SOFT_DIVIDE_NUM * 20;
+                    binCount = 0;
+                    state = CALI_SWEEP_PREPARE;
+                } else
+                {
+                    goPosition = motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS;
+                    sampleCount = 0;
+                    state = CALI_FORWARD_PREPARE;
+                }
                 errorCode = CALI_NO_ERROR;
             }
             break;
@@ -225,6 +236,46 @@ void EncoderCalibratorBase::Tick20kHz()
         case CALI_CALCULATING:
             motor->driver->SetFocCurrentVector(0, 0);
             break;
+        case CALI_SWEEP_PREPARE:
+            goPosition += AUTO_CALIB_SPEED;
+            motor->driver->SetFocCurrentVector(goPosition, motor->config.motionParams.caliCurrent);
+            if (goPosition == motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS - 2 * SWEEP_SAMPLE_WINDOW)
+                state = CALI_SWEEP_FORWARD;
+            break;
+        case CALI_SWEEP_FORWARD:
+            // The reading belongs to the vector set on the last tick
+            SweepSample(sampleDataAverageForward);
+            goPosition += SWEEP_CALIB_SPEED;
+            motor->driver->SetFocCurrentVector(goPosition, motor->config.motionParams.caliCurrent);
+            if (goPosition > 2 * motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS + SWEEP_SAMPLE_WINDOW)
+            {
+                SweepFinishBin(sampleDataAverageForward);
+                state = CALI_SWEEP_BACKWARD_RETURN;
+            }
+            break;
+        case CALI_SWEEP_BACKWARD_RETURN:
+            goPosition += SWEEP_CALIB_SPEED;
+            motor->driver->SetFocCurrentVector(goPosition, motor->config.motionParams.caliCurrent);
+            if (goPosition >= 2 * motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS + motor->SOFT_DIVIDE_NUM * 20)
+                state = CALI_SWEEP_BACKWARD_GAP_DISMISS;
+            break;
+        case CALI_SWEEP_BACKWARD_GAP_DISMISS:
+            goPosition -= SWEEP_CALIB_SPEED;
+            motor->driver->SetFocCurrentVector(goPosition, motor->config.motionParams.caliCurrent);
+            if (goPosition <= 2 * motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS + 2 * SWEEP_SAMPLE_WINDOW)
+                state = CALI_SWEEP_BACKWARD;
+            break;
+        case CALI_SWEEP_BACKWARD:
+            SweepSample(sampleDataAverageBackward);
+            goPosition -= SWEEP_CALIB_SPEED;
+            motor->driver->SetFocCurrentVector(goPosition, motor->config.motionParams.caliCurrent);
+            // Stop on a hard step, the rotor is left in a detent as when stepping
+            if (goPosition <= motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS - motor->SOFT_DIVIDE_NUM)
+            {
+                SweepFinishBin(sampleDataAverageBackward);
+                state = CALI_CALCULATING;
+            }
+            break;
         default:
             break;
     }
@@ -233,9 +284,6 @@ void EncoderCalibratorBase::Tick20kHz()
 
 void EncoderCalibratorBase::TickMainLoop()
 {
-    int32_t dataI32;
-    uint16_t dataU16;
-
     if (state != CALI_CALCULATING)
         return;
 
@@ -243,103 +291,33 @@ void EncoderCalibratorBase::TickMainLoop()
 
     CalibrationDataCheck();
 
+    // A sweep that doesn't pass gets a second chance the slow way
+    if (errorCode != CALI_NO_ERROR && sweeping)
+    {
+        sweepFailed = true;
+        state = CALI_DISABLE;
+        return;
+    }
+
     if (errorCode == CALI_NO_ERROR)
     {
-        int32_t stepX, stepY;
-        resultNum = 0;
+        // Compact table, the encoder interpolates between the hard steps itself
+        uint16_t checksum = 0;
 
         ClearFlash();
         BeginWriteFlash();
 
-        if (goDirection)
-        {
-            for (stepX = rcdX; stepX < rcdX + motor->MOTOR_ONE_CIRCLE_HARD_STEPS + 1; stepX++)
-            {
-                dataI32 = CycleSubtract(
-                    sampleDataAverageForward[CycleMod(stepX + 1, motor->MOTOR_ONE_CIRCLE_HARD_STEPS)],
-                    sampleDataAverageForward[CycleMod(stepX, motor->MOTOR_ONE_CIRCLE_HARD_STEPS)],
-                    motor->encoder->RESOLUTION);
-                if (stepX == rcdX)
-                {
-                    for (stepY = rcdY; stepY < dataI32; stepY++)
-                    {
-                        dataU16 = CycleMod(motor->SOFT_DIVIDE_NUM * stepX +
-                                           motor->SOFT_DIVIDE_NUM * stepY / dataI32,
-                                           motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS);
-                        WriteFlash16bitsAppend(dataU16);
-                        resultNum++;
-                    }
-                } else if (stepX == rcdX + motor->MOTOR_ONE_CIRCLE_HARD_STEPS)
-                {
-                    for (stepY = 0; stepY < rcdY; stepY++)
-                    {
-                        dataU16 = CycleMod(motor->SOFT_DIVIDE_NUM * stepX +
-                                           motor->SOFT_DIVIDE_NUM * stepY / dataI32,
-                                           motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS);
-                        WriteFlash16bitsAppend(dataU16);
-                        resultNum++;
-                    }
-                } else
-                {
-                    for (stepY = 0; stepY < dataI32; stepY++)
-                    {
-                        dataU16 = CycleMod(motor->SOFT_DIVIDE_NUM * stepX +
-                                           motor->SOFT_DIVIDE_NUM * stepY / dataI32,
-                                           motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS);
-                        WriteFlash16bitsAppend(dataU16);
-                        resultNum++;
-                    }
-                }
-            }
-        } else
+        WriteFlash16bitsAppend(EncoderBase::COMPACT_TABLE_MAGIC);
+        WriteFlash16bitsAppend(MOTOR_ONE_CIRCLE_HARD_STEPS);
+        WriteFlash16bitsAppend(motor->SOFT_DIVIDE_NUM);
+        for (int32_t step = 0; step < MOTOR_ONE_CIRCLE_HARD_STEPS; step++)
         {
-            for (stepX = rcdX + motor->MOTOR_ONE_CIRCLE_HARD_STEPS; stepX > rcdX - 1; stepX--)
-            {
-                dataI32 = CycleSubtract(
-                    sampleDataAverageForward[CycleMod(stepX, motor->MOTOR_ONE_CIRCLE_HARD_STEPS)],
-                    sampleDataAverageForward[CycleMod(stepX + 1, motor->MOTOR_ONE_CIRCLE_HARD_STEPS)],
-                    motor->encoder->RESOLUTION);
-                if (stepX == rcdX + motor->MOTOR_ONE_CIRCLE_HARD_STEPS)
-                {
-                    for (stepY = rcdY; stepY < dataI32; stepY++)
-                    {
-                        dataU16 = CycleMod(
-                            motor->SOFT_DIVIDE_NUM * (stepX + 1) -
-                            motor->SOFT_DIVIDE_NUM * stepY / dataI32,
-                            motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS);
-                        WriteFlash16bitsAppend(dataU16);
-                        resultNum++;
-                    }
-                } else if (stepX == rcdX)
-                {
-                    for (stepY = 0; stepY < rcdY; stepY++)
-                    {
-                        dataU16 = CycleMod(
-                            motor->SOFT_DIVIDE_NUM * (stepX + 1) -
-                            motor->SOFT_DIVIDE_NUM * stepY / dataI32,
-                            motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS);
-                        WriteFlash16bitsAppend(dataU16);
-                        resultNum++;
-                    }
-                } else
-                {
-                    for (stepY = 0; stepY < dataI32; stepY++)
-                    {
-                        dataU16 = CycleMod(
-                            motor->SOFT_DIVIDE_NUM * (stepX + 1) -
-                            motor->SOFT_DIVIDE_NUM * stepY / dataI32,
-                            motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS);
-                        WriteFlash16bitsAppend(dataU16);
-                        resultNum++;
-                    }
-                }
-            }
+            WriteFlash16bitsAppend(sampleDataAverageForward[step]);
+            checksum += sampleDataAverageForward[step];
         }
+        WriteFlash16bitsAppend(checksum);
 
         EndWriteFlash();
-
-        if (resultNum != motor->encoder->RESOLUTION)
-            errorCode = CALI_ERROR_ANALYSIS_QUANTITY;
     }
 
     if (errorCode == CALI_NO_ERROR)
@@ -361,6 +339,51 @@ void EncoderCalibratorBase::TickMainLoop()
 }
 
 
+/*
+ * Adds the reading to the hard step the vector is within SWEEP_SAMPLE_WINDOW
+ * of, as an offset from the bin's first reading so it averages across the
+ * wrap. At constant velocity the window is symmetric, so its mean is the
+ * reading at the step itself.
+ */
+void EncoderCalibratorBase::SweepSample(uint16_t* _averages)
+{
+    int32_t position = (int32_t) goPosition - motor->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS;
+    int32_t step = (position + motor->SOFT_DIVIDE_NUM / 2) / motor->SOFT_DIVIDE_NUM;
+    int32_t offset = position - step * motor->SOFT_DIVIDE_NUM;
+
+    if (binCount > 0 && step != binStep)
+        SweepFinishBin(_averages);
+    if (offset < -SWEEP_SAMPLE_WINDOW || offset > SWEEP_SAMPLE_WINDOW ||
+        step < 0 || step > MOTOR_ONE_CIRCLE_HARD_STEPS)
+        return;
+
+    int32_t raw = motor->encoder->angleData.rawAngle;
+    if (binCount == 0)
+    {
+        binStep = step;
+        binReference = raw;
+        binSum = 0;
+    }
+    binSum += CycleSubtract(raw, binReference, motor->encoder->RESOLUTION);
+    binCount++;
+}
+
+
+void EncoderCalibratorBase::SweepFinishBin(uint16_t* _averages)
+{
+    if (binCount == 0)
+        return;
+
+    int32_t half = binCount / 2;
+    int32_t average = binReference + (binSum >= 0 ? binSum + half : binSum - half) / binCount;
+    if (average < 0) average += motor->encoder->RESOLUTION;
+    if (average >= motor->encoder->RESOLUTION) average -= motor->encoder->RESOLUTION;
+
+    _averages[binStep] = (uint16_t) average;
+    binCount = 0;
+}
+
+
 uint32_t EncoderCalibratorBase::CycleMod(uint32_t _a, uint32_t _b)
 {
     return (_a + _b) % _b;
@@ -10,6 +10,8 @@ public:
     static const uint8_t SAMPLE_COUNTS_PER_STEP = 16;
     static const uint8_t AUTO_CALIB_SPEED = 2;
     static const uint8_t FINE_TUNE_CALIB_SPEED = 1;
+    static const uint8_t SWEEP_CALIB_SPEED = 4;       // 1.56r/s without stopping
+    static const uint8_t SWEEP_SAMPLE_WINDOW = 96;    // averaged each side of a hard step
 
 
     typedef enum
@@ -30,6 +32,11 @@ public:
         CALI_BACKWARD_GAP_DISMISS,
         CALI_BACKWARD_MEASURE,
         CALI_CALCULATING,
+        CALI_SWEEP_PREPARE,
+        CALI_SWEEP_FORWARD,
+        CALI_SWEEP_BACKWARD_RETURN,
+        CALI_SWEEP_BACKWARD_GAP_DISMISS,
+        CALI_SWEEP_BACKWARD,
     } State_t;
 
 
@@ -43,11 +50,16 @@ public:
         goPosition = 0;
         rcdX = 0;
         rcdY = 0;
-        resultNum = 0;
     }
 
 
     bool isTriggered;
+    /*
+     * Sweep at constant velocity and average the readings around each hard
+     * step on the fly, instead of stopping at every one. Takes about 1.5s
+     * instead of 7s, falls back to stepping if the result fails the check.
+     */
+    bool sweepMode = true;
 
 
     void Tick20kHz();
@@ -66,10 +78,17 @@ private:
     uint16_t sampleDataAverageForward[MOTOR_ONE_CIRCLE_HARD_STEPS + 1]{};
     uint16_t sampleDataAverageBackward[MOTOR_ONE_CIRCLE_HARD_STEPS + 1]{};
     int32_t rcdX, rcdY;
-    uint32_t resultNum;
+    bool sweeping = false;
+    bool sweepFailed = false;
+    int32_t binStep = 0;
+    int32_t binReference = 0;
+    int32_t binSum = 0;
+    uint16_t binCount = 0;
 
 
     void CalibrationDataCheck();
+    void SweepSample(uint16_t* _averages);
+    void SweepFinishBin(uint16_t* _averages);
     static uint32_t CycleMod(uint32_t _a, uint32_t _b);
     static int32_t CycleSubtract(int32_t _a, int32_t _b, int32_t _cyc);
     static int32_t CycleAverage(int32_t _a, int32_t _b, int32_t _cyc);
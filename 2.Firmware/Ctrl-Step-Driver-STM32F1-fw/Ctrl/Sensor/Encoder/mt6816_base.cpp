@@ -6,11 +6,18 @@ bool MT6816Base::Init()
     UpdateAngle();
 
     // Check if the stored calibration data are valid
-    angleData.rectifyValid = true;
-    for (uint32_t i = 0; i < RESOLUTION; i++)
+    compactTable = quickCaliDataPtr[0] == COMPACT_TABLE_MAGIC;
+    if (compactTable)
     {
-        if (quickCaliDataPtr[i] == 0xFFFF)
-            angleData.rectifyValid = false;
+        angleData.rectifyValid = LoadCompactTable();
+    } else
+    {
+        angleData.rectifyValid = true;
+        for (uint32_t i = 0; i < RESOLUTION; i++)
+        {
+            if (quickCaliDataPtr[i] == 0xFFFF)
+                angleData.rectifyValid = false;
+        }
     }
 
     return angleData.rectifyValid;
@@ -19,31 +26,39 @@ bool MT6816Base::Init()
 
 uint16_t MT6816Base::UpdateAngle()
 {
+    if (pipelined)
+    {
+        // The buffer index is published after its sample, so it's always complete
+        uint32_t count = sampleCount;
+        isSampleStale = count == sampleCountUsed;
+        if (isSampleStale)
+        {
+            staleSampleCount++;
+        } else
+        {
+            sampleCountUsed = count;
+            spiRawData.rawData = sampleBuffer[sampleReadyIndex];
+            spiRawData.rawAngle = spiRawData.rawData >> 2;
+            spiRawData.noMagFlag = (bool) (spiRawData.rawData & (0x0001 << 1));
+        }
+
+        angleData.rawAngle = spiRawData.rawAngle;
+        angleData.rectifiedAngle = RectifyAngle(angleData.rawAngle);
+
+        return angleData.rectifiedAngle;
+    }
+
     dataTx[0] = (0x80 | 0x03) << 8;
     dataTx[1] = (0x80 | 0x04) << 8;
 
-    for (uint8_t i = 0; i < 3; i++)
+    for (uint8_t i = 0; i < READ_ATTEMPTS; i++)
     {
         dataRx[0] = SpiTransmitAndRead16Bits(dataTx[0]);
         dataRx[1] = SpiTransmitAndRead16Bits(dataTx[1]);
 
-        spiRawData.rawData = ((dataRx[0] & 0x00FF) << 8) | (dataRx[1] & 0x00FF);
-
-        //奇偶校验
-        hCount = 0;
-        for (uint8_t j = 0; j < 16; j++)
-        {
-            if (spiRawData.rawData & (0x0001 << j))
-                hCount++;
-        }
-        if (hCount & 0x01)
-        {
-            spiRawData.checksumFlag = false;
-        } else
-        {
-            spiRawData.checksumFlag = true;
+        if (DecodeRawData())
             break;
-        }
+        parityErrorCount++;
     }
 
     if (spiRawData.checksumFlag)
@@ -53,14 +68,182 @@ uint16_t MT6816Base::UpdateAngle()
     }
 
     angleData.rawAngle = spiRawData.rawAngle;
-    angleData.rectifiedAngle = quickCaliDataPtr[angleData.rawAngle];
+    angleData.rectifiedAngle = RectifyAngle(angleData.rawAngle);
 
     return angleData.rectifiedAngle;
 }
 
 
+uint16_t MT6816Base::RectifyAngle(uint16_t _rawAngle)
+{
+    if (!compactTable)
+        return quickCaliDataPtr[_rawAngle];
+
+    const uint16_t* counts = quickCaliDataPtr + COMPACT_TABLE_HEADER_SIZE;
+    uint16_t step = compactIndex[_rawAngle >> 6];
+    int32_t offset = 0, span = 1;
+
+    // Steps are at least 41 counts apart, so the reading is within 3 of the start
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        uint16_t next = step + 1 == compactSteps ? 0 : step + 1;
+        offset = CycleSubtract(_rawAngle, counts[step], RESOLUTION);
+        span = CycleSubtract(counts[next], counts[step], RESOLUTION);
+
+        // Counts run up or down with the steps depending on the mounting
+        if (compactAscending)
+        {
+            if (offset < span) break;
+            step = next;
+        } else
+        {
+            if (offset <= 0) break;
+            step = step == 0 ? compactSteps - 1 : step - 1;
+        }
+    }
+    if (span == 0)
+        return 0;
+
+    // Truncated from the lower count's end either way, like the full table
+    int32_t angle = compactAscending
+                    ? step * compactStepSize + offset * compactStepSize / span
+                    : (step + 1) * compactStepSize - (offset - span) * compactStepSize / -span;
+    int32_t turn = compactSteps * compactStepSize;
+    if (angle < 0) angle += turn;
+    if (angle >= turn) angle -= turn;
+
+    return (uint16_t) angle;
+}
+
+
+bool MT6816Base::LoadCompactTable()
+{
+    compactSteps = quickCaliDataPtr[1];
+    compactStepSize = quickCaliDataPtr[2];
+    if (compactSteps < 2 || compactSteps > COMPACT_TABLE_MAX_STEPS ||
+        (uint32_t) compactSteps * compactStepSize > 0xFFFF)
+        return false;
+
+    const uint16_t* counts = quickCaliDataPtr + COMPACT_TABLE_HEADER_SIZE;
+    uint16_t sum = 0;
+    for (uint16_t i = 0; i < compactSteps; i++)
+    {
+        if (counts[i] >= RESOLUTION)
+            return false;
+        sum += counts[i];
+    }
+    if (counts[compactSteps] != sum)
+        return false;
+    compactAscending = CycleSubtract(counts[1], counts[0], RESOLUTION) > 0;
+
+    // The step whose span holds the first count of each bucket
+    for (uint16_t bucket = 0; bucket < 256; bucket++)
+    {
+        int32_t raw = bucket << 6;
+        for (uint16_t step = 0; step < compactSteps; step++)
+        {
+            uint16_t next = step + 1 == compactSteps ? 0 : step + 1;
+            int32_t offset = CycleSubtract(raw, counts[step], RESOLUTION);
+            int32_t span = CycleSubtract(counts[next], counts[step], RESOLUTION);
+            if (span > 0 ? (offset >= 0 && offset < span) : (offset <= 0 && offset > span))
+            {
+                compactIndex[bucket] = step;
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+int32_t MT6816Base::CycleSubtract(int32_t _a, int32_t _b, int32_t _cyc)
+{
+    int32_t sub = _a - _b;
+    if (sub > (_cyc >> 1)) sub -= _cyc;
+    if (sub < (-_cyc >> 1)) sub += _cyc;
+    return sub;
+}
+
+
+bool MT6816Base::DecodeRawData()
+{
+    spiRawData.rawData = ((dataRx[0] & 0x00FF) << 8) | (dataRx[1] & 0x00FF);
+
+    //奇偶校验
+    hCount = 0;
+    for (uint8_t j = 0; j < 16; j++)
+    {
+        if (spiRawData.rawData & (0x0001 << j))
+            hCount++;
+    }
+    spiRawData.checksumFlag = !(hCount & 0x01);
+
+    return spiRawData.checksumFlag;
+}
+
+
+void MT6816Base::SetPipelinedRead(bool _enable)
+{
+    // The first tick after switching reads the last sample, not an old one
+    sampleCountUsed = sampleCount;
+    pipelined = _enable;
+}
+
+
+void MT6816Base::StartSampleRead()
+{
+    // Still busy with the last one, the tick will find it stale
+    if (!pipelined || transferStep != TRANSFER_IDLE)
+        return;
+
+    dataTx[0] = (0x80 | 0x03) << 8;
+    dataTx[1] = (0x80 | 0x04) << 8;
+
+    transferAttempt = 0;
+    transferStep = TRANSFER_REG_3;
+    SpiStartTransfer16Bits(dataTx[0]);
+}
+
+
+void MT6816Base::OnSpiTransferComplete()
+{
+    switch (transferStep)
+    {
+        case TRANSFER_REG_3:
+            dataRx[0] = SpiEndTransfer16Bits();
+            transferStep = TRANSFER_REG_4;
+            SpiStartTransfer16Bits(dataTx[1]);
+            break;
+        case TRANSFER_REG_4:
+            dataRx[1] = SpiEndTransfer16Bits();
+            if (DecodeRawData())
+            {
+                uint8_t index = sampleReadyIndex ^ 1;
+                sampleBuffer[index] = spiRawData.rawData;
+                sampleReadyIndex = index;
+                sampleCount++;
+                transferStep = TRANSFER_IDLE;
+            } else
+            {
+                parityErrorCount++;
+                if (++transferAttempt < READ_ATTEMPTS)
+                {
+                    transferStep = TRANSFER_REG_3;
+                    SpiStartTransfer16Bits(dataTx[0]);
+                } else
+                {
+                    transferStep = TRANSFER_IDLE;
+                }
+            }
+            break;
+        case TRANSFER_IDLE:
+            break;
+    }
+}
+
+
 bool MT6816Base::IsCalibrated()
 {
     return angleData.rectifyValid;
 }
-
@@ -18,6 +18,22 @@ public:
     uint16_t UpdateAngle() override;  // Get current rawAngle (rad)
     bool IsCalibrated() override;
 
+    // Calibrated position of a raw count, in subdivide steps
+    uint16_t RectifyAngle(uint16_t _rawAngle);
+
+    /*
+     * Pipelined reads: a timer starts each sample shortly before the control
+     * tick and the transfer runs on its own, UpdateAngle() then only picks up
+     * the last sample that completed instead of waiting on the bus.
+     */
+    void SetPipelinedRead(bool _enable);
+    void StartSampleRead();         // Called by the timer, ahead of the tick
+    void OnSpiTransferComplete();   // Called when a started transfer is done
+
+    bool isSampleStale = false;     // Last UpdateAngle() found no new sample
+    volatile uint32_t parityErrorCount = 0;
+    uint32_t staleSampleCount = 0;
+
 
 private:
     typedef struct
@@ -28,18 +44,53 @@ private:
         bool checksumFlag;
     } SpiRawData_t;
 
+    typedef enum
+    {
+        TRANSFER_IDLE,
+        TRANSFER_REG_3,
+        TRANSFER_REG_4
+    } TransferStep_t;
+
+    const uint8_t READ_ATTEMPTS = 3;
+
 
     SpiRawData_t spiRawData;
     uint16_t* quickCaliDataPtr;
+    // Set when quickCaliDataPtr holds a compact table instead of a full one
+    bool compactTable = false;
+    bool compactAscending = true;
+    uint16_t compactSteps = 0;
+    uint16_t compactStepSize = 0;
+    // Hard step at the start of every 64 counts, where the search begins
+    uint8_t compactIndex[256] = {0};
     uint16_t dataTx[2];
     uint16_t dataRx[2];
     uint8_t hCount;
 
+    bool pipelined = false;
+    volatile TransferStep_t transferStep = TRANSFER_IDLE;
+    uint8_t transferAttempt = 0;
+    // Completed samples, the transfer fills one while the tick reads the other
+    uint16_t sampleBuffer[2] = {0};
+    volatile uint8_t sampleReadyIndex = 0;
+    volatile uint32_t sampleCount = 0;
+    uint32_t sampleCountUsed = 0;
+
+    bool DecodeRawData();
+    bool LoadCompactTable();
+    static int32_t CycleSubtract(int32_t _a, int32_t _b, int32_t _cyc);
+
 
     /***** Port Specified Implements *****/
-    virtual void SpiInit();
+    virtual void SpiInit() = 0;
+
+    virtual uint16_t SpiTransmitAndRead16Bits(uint16_t _dataTx) = 0;
+
+    // Selects the chip and starts a 16bits transfer without waiting for it
+    virtual void SpiStartTransfer16Bits(uint16_t _dataTx) = 0;
 
-    virtual uint16_t SpiTransmitAndRead16Bits(uint16_t _dataTx);
+    // Releases the chip once the transfer is done, returns what was read
+    virtual uint16_t SpiEndTransfer16Bits() = 0;
 
 };
 
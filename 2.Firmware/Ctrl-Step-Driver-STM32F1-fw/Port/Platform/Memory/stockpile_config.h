@@ -83,7 +83,8 @@
 #define		STOCKPILE_APP_FIRMWARE_SIZE			(0x0000BC00)		//Flash容量    47K    XDrive(APP_FIRMWARE)
 //APP_CALI
 #define		STOCKPILE_APP_CALI_ADDR					(0x08017C00)		//起始地址
-#define		STOCKPILE_APP_CALI_SIZE					(0x00008000)		//Flash容量    32K    XDrive(APP_CALI)(可容纳16K-2byte校准数据-即最大支持14位编码器的校准数据)
+#define		STOCKPILE_APP_CALI_SIZE					(0x00000400)		//Flash容量     1K    XDrive(APP_CALI)(精简校准表,每整步一个编码器值)
+//APP_FREE  (0x08018000) 31K 空闲, 旧固件写入的16K完整校准表仍保存在此, 重新校准前不要占用
 //APP_DATA
 #define		STOCKPILE_APP_DATA_ADDR					(0x0801FC00)		//起始地址
 #define		STOCKPILE_APP_DATA_SIZE					(0x00000400)		//Flash容量     1K    XDrive(APP_DATA)
@@ -4,6 +4,22 @@
 void MT6816::SpiInit()
 {
     MX_SPI1_Init();
+    __HAL_SPI_ENABLE(&hspi1);
+
+    // One 16bits word per transfer, the RX channel tells when it's done
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    DMA1_Channel2->CCR = 0;
+    DMA1_Channel2->CPAR = (uint32_t) &SPI1->DR;
+    DMA1_Channel2->CMAR = (uint32_t) &dmaRx;
+    DMA1_Channel2->CCR = DMA_CCR_PL | DMA_CCR_MSIZE_0 | DMA_CCR_PSIZE_0 | DMA_CCR_TCIE;
+    DMA1_Channel3->CCR = 0;
+    DMA1_Channel3->CPAR = (uint32_t) &SPI1->DR;
+    DMA1_Channel3->CMAR = (uint32_t) &dmaTx;
+    DMA1_Channel3->CCR = DMA_CCR_PL | DMA_CCR_MSIZE_0 | DMA_CCR_PSIZE_0 | DMA_CCR_DIR;
+
+    // Same priority as the 20kHz tick, so the two never preempt each other
+    HAL_NVIC_SetPriority(DMA1_Channel2_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel2_IRQn);
 }
 
 uint16_t MT6816::SpiTransmitAndRead16Bits(uint16_t _dataTx)
@@ -16,3 +32,30 @@ uint16_t MT6816::SpiTransmitAndRead16Bits(uint16_t _dataTx)
 
     return dataRx;
 }
+
+void MT6816::SpiStartTransfer16Bits(uint16_t _dataTx)
+{
+    dmaTx = _dataTx;
+    (void) SPI1->DR; // Drop a word left over from a blocking read
+
+    DMA1_Channel2->CCR &= ~DMA_CCR_EN;
+    DMA1_Channel3->CCR &= ~DMA_CCR_EN;
+    DMA1_Channel2->CNDTR = 1;
+    DMA1_Channel3->CNDTR = 1;
+
+    GPIOA->BRR = GPIO_PIN_15; // Chip select
+    // RX is armed before TX starts clocking, as the reference manual asks
+    SPI1->CR2 |= SPI_CR2_RXDMAEN;
+    DMA1_Channel2->CCR |= DMA_CCR_EN;
+    DMA1_Channel3->CCR |= DMA_CCR_EN;
+    SPI1->CR2 |= SPI_CR2_TXDMAEN;
+}
+
+uint16_t MT6816::SpiEndTransfer16Bits()
+{
+    // The blocking reads poll the same SPI, so give it back without DMA
+    SPI1->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+    GPIOA->BSRR = GPIO_PIN_15;
+
+    return dmaRx;
+}
@@ -8,17 +8,26 @@ class MT6816 : public MT6816Base
 public:
     /*
      * _quickCaliDataPtr is the start address where calibration data stored,
-     * in STM32F103CBT6 flash size is 128K (0x08000000 ~ 0x08020000), we use
-     * last 33K (32K clib + 1K user) for storage, and it starts from 0x08017C00.
+     * in STM32F103CBT6 flash size is 128K (0x08000000 ~ 0x08020000), it starts
+     * from 0x08017C00. The compact table takes 1K there, a full table written
+     * by older firmware takes 32K and is still read until recalibrated.
      */
     explicit MT6816() : MT6816Base((uint16_t*) (0x08017C00))
     {}
 
 
 private:
+    // SPI1 RX and TX run on DMA1 channel 2 and 3
+    volatile uint16_t dmaTx = 0;
+    volatile uint16_t dmaRx = 0;
+
     void SpiInit() override;
 
     uint16_t SpiTransmitAndRead16Bits(uint16_t _data) override;
+
+    void SpiStartTransfer16Bits(uint16_t _dataTx) override;
+
+    uint16_t SpiEndTransfer16Bits() override;
 };
 
 #endif
@@ -0,0 +1,20 @@
+#include "tick_profiler_stm32.h"
+#include "main.h"
+
+void TickProfiler::InitCounter()
+{
+    // DWT cycle counter, counts core clocks
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t TickProfiler::GetCounterFrequency()
+{
+    return SystemCoreClock;
+}
+
+uint32_t TickProfiler::ReadCycles()
+{
+    return DWT->CYCCNT;
+}
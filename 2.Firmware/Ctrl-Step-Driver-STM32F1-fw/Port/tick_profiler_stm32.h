@@ -0,0 +1,16 @@
+#ifndef CTRL_STEP_FW_TICK_PROFILER_STM32_H
+#define CTRL_STEP_FW_TICK_PROFILER_STM32_H
+
+#include "Motor/tick_profiler_base.h"
+
+class TickProfiler : public TickProfilerBase
+{
+private:
+    void InitCounter() override;
+
+    uint32_t GetCounterFrequency() override;
+
+    uint32_t ReadCycles() override;
+};
+
+#endif
@@ -5,11 +5,23 @@
 extern "C" {
 #endif
 /*---------------------------- C Scope ---------------------------*/
+#include <stdbool.h>
 #include "stdint-gcc.h"
 
 void Main();
 void OnUartCmd(uint8_t* _data, uint16_t _len);
+void InitCanCodec();
 void OnCanCmd(uint8_t _cmd, uint8_t* _data, uint32_t _len);
+void TickStateBroadcast20kHz();
+void SendStateBroadcast();
+void SendCollisionReport();
+void InitNodeId(uint64_t _serial);
+void UpdateNodeId();
+void RequestNodeId();
+uint8_t GetNodeId();
+void OnCanHeartbeat(uint8_t _id, const uint8_t* _data);
+void OnCanTxComplete(uint32_t _mailbox);
+void OnCanTxFailed(uint32_t _mailbox, bool _lostArbitration);
 
 #ifdef __cplusplus
 }
@@ -21,6 +33,7 @@ void OnCanCmd(uint8_t _cmd, uint8_t* _data, uint32_t _len);
 #include "encoder_calibrator_stm32.h"
 #include "button_stm32.h"
 #include "led_stm32.h"
+#include "tick_profiler_stm32.h"
 
 #endif
 #endif
@@ -15,6 +15,13 @@ typedef enum configStatus_t
     CONFIG_COMMIT
 } configStatus_t;
 
+typedef enum estimatorType_t
+{
+    ESTIMATOR_FILTER = 0,
+    ESTIMATOR_PLL,
+    ESTIMATOR_COUNT
+} estimatorType_t;
+
 
 typedef struct Config_t
 {
@@ -32,6 +39,13 @@ typedef struct Config_t
     int32_t dce_kd;
     bool enableMotorOnBoot;
     bool enableStallProtect;
+    uint32_t stateBroadcastPeriod; // ms, 0: only answer requests
+    uint32_t estimator; // estimatorType_t, applied on boot
+    int32_t velocityJerk; // steps/s^2 per ms, S-curve position moves, 0: trapezoidal
+    uint32_t collisionThreshold; // sigma/4, 0: no collision detection
+    uint32_t collisionTripTime; // ms
+    uint32_t collisionErrorFloor; // steps
+    uint32_t collisionCurrentFloor; // mA
 } BoardConfig_t;
 
 extern BoardConfig_t boardConfig;
@@ -1,15 +1,21 @@
 #include "common_inc.h"
 #include "configurations.h"
 #include "Platform/Utils/st_hardware.h"
+#include "can_codec.h"
 #include <tim.h>
 
 
 /* Component Definitions -----------------------------------------------------*/
+// TIM4 counts 0~49 us, the read starts 8us before the tick and takes about 5us
+const uint32_t ENCODER_READ_COMPARE = 42;
 BoardConfig_t boardConfig;
 Motor motor;
 TB67H450 tb67H450;
 MT6816 mt6816;
 EncoderCalibrator encoderCalibrator(&motor);
+TickProfiler tickProfiler;
+FilterEstimator filterEstimator;
+PllEstimator pllEstimator;
 Button button1(1, 1000), button2(2, 3000);
 void OnButton1Event(Button::Event _event);
 void OnButton2Event(Button::Event _event);
@@ -19,34 +25,6 @@ Led statusLed;
 /* Main Entry ----------------------------------------------------------------*/
 void Main()
 {
-    uint64_t serialNum = GetSerialNumber();
-    uint16_t defaultNodeID = 0;
-    // Change below to fit your situation
-    switch (serialNum)
-    {
-        case 431466563640: //J1
-            defaultNodeID = 1;
-            break;
-        case 384624576568: //J2
-            defaultNodeID = 2;
-            break;
-        case 384290670648: //J3
-            defaultNodeID = 3;
-            break;
-        case 431531051064: //J4
-            defaultNodeID = 4;
-            break;
-        case 431466760248: //J5
-            defaultNodeID = 5;
-            break;
-        case 431484848184: //J6
-            defaultNodeID = 6;
-            break;
-        default:
-            break;
-    }
-
-
     /*---------- Apply EEPROM Settings ----------*/
     // Setting priority is EEPROM > Motor.h
     EEPROM eeprom;
@@ -55,7 +33,7 @@ void Main()
     {
         boardConfig = BoardConfig_t{
             .configStatus = CONFIG_OK,
-            .canNodeId = defaultNodeID,
+            .canNodeId = 0, // Negotiated on the bus, the Core assigns the joint
             .encoderHomeOffset = 0,
             .defaultMode = Motor::MODE_COMMAND_POSITION,
             .currentLimit = 1 * 1000,    // A
@@ -67,30 +45,69 @@ void Main()
             .dce_ki = 300,
             .dce_kd = 250,
             .enableMotorOnBoot=false,
-            .enableStallProtect=false
+            .enableStallProtect=false,
+            .stateBroadcastPeriod = 0,
+            .estimator = ESTIMATOR_PLL,
+            .velocityJerk = 0,
+            .collisionThreshold = 0,
+            .collisionTripTime = 1,
+            .collisionErrorFloor = 1024,
+            .collisionCurrentFloor = 300
         };
         eeprom.put(0, boardConfig);
     }
+    // Configs stored by older firmware end before this field, erased flash reads 0xFF
+    if (boardConfig.stateBroadcastPeriod > 1000)
+        boardConfig.stateBroadcastPeriod = 0;
+    // A board tuned before the PLL keeps the filter its gains were tuned with
+    if (boardConfig.estimator >= ESTIMATOR_COUNT)
+        boardConfig.estimator = ESTIMATOR_FILTER;
+    if (boardConfig.velocityJerk < 0)
+        boardConfig.velocityJerk = 0;
+    if (boardConfig.collisionThreshold > CollisionDetector::MAX_THRESHOLD)
+    {
+        boardConfig.collisionThreshold = 0;
+        boardConfig.collisionTripTime = 1;
+        boardConfig.collisionErrorFloor = 1024;
+        boardConfig.collisionCurrentFloor = 300;
+    }
+    if (boardConfig.canNodeId >= CAN_NODE_ID_COUNT)
+        boardConfig.canNodeId = 0;
+    InitNodeId(GetSerialNumber());
     motor.config.motionParams.encoderHomeOffset = boardConfig.encoderHomeOffset;
     motor.config.motionParams.ratedCurrent = boardConfig.currentLimit;
     motor.config.motionParams.ratedVelocity = boardConfig.velocityLimit;
     motor.config.motionParams.ratedVelocityAcc = boardConfig.velocityAcc;
     motor.motionPlanner.velocityTracker.SetVelocityAcc(boardConfig.velocityAcc);
     motor.motionPlanner.positionTracker.SetVelocityAcc(boardConfig.velocityAcc);
+    motor.motionPlanner.positionTracker.SetJerk(boardConfig.velocityJerk);
     motor.config.motionParams.caliCurrent = boardConfig.calibrationCurrent;
     motor.config.ctrlParams.dce.kp = boardConfig.dce_kp;
     motor.config.ctrlParams.dce.kv = boardConfig.dce_kv;
     motor.config.ctrlParams.dce.ki = boardConfig.dce_ki;
     motor.config.ctrlParams.dce.kd = boardConfig.dce_kd;
     motor.config.ctrlParams.stallProtectSwitch = boardConfig.enableStallProtect;
+    motor.collisionDetector.SetConfig(CollisionDetector::Config_t{
+        .threshold = (int32_t) boardConfig.collisionThreshold,
+        .tripTime = (int32_t) boardConfig.collisionTripTime,
+        .errorFloor = (int32_t) boardConfig.collisionErrorFloor,
+        .currentFloor = (int32_t) boardConfig.collisionCurrentFloor
+    });
 
 
     /*---------------- Init Motor ----------------*/
     motor.AttachDriver(&tb67H450);
     motor.AttachEncoder(&mt6816);
+    motor.AttachProfiler(&tickProfiler);
+    if (boardConfig.estimator == ESTIMATOR_PLL)
+        motor.AttachEstimator(&pllEstimator);
+    else
+        motor.AttachEstimator(&filterEstimator);
     motor.controller->Init();
     motor.driver->Init();
     motor.encoder->Init();
+    tickProfiler.Init(motor.motionPlanner.CONTROL_FREQUENCY);
+    InitCanCodec();
 
 
     /*------------- Init peripherals -------------*/
@@ -103,6 +120,12 @@ void Main()
     HAL_TIM_Base_Start_IT(&htim1);  // 100Hz
     HAL_TIM_Base_Start_IT(&htim4);  // 20kHz
 
+    // Read the encoder ahead of each tick instead of inside it
+    __HAL_TIM_SET_COMPARE(&htim4, TIM_CHANNEL_1, ENCODER_READ_COMPARE);
+    __HAL_TIM_CLEAR_IT(&htim4, TIM_IT_CC1);
+    __HAL_TIM_ENABLE_IT(&htim4, TIM_IT_CC1);
+    mt6816.SetPipelinedRead(true);
+
     if (button1.IsPressed() && button2.IsPressed())
         encoderCalibrator.isTriggered = true;
 
@@ -110,6 +133,17 @@ void Main()
     for (;;)
     {
         encoderCalibrator.TickMainLoop();
+        if (motor.dceTuner.TickMainLoop())
+        {
+            const DceTuner::Result_t &result = motor.dceTuner.result;
+            motor.config.ctrlParams.dce.kp = boardConfig.dce_kp = result.kp;
+            motor.config.ctrlParams.dce.ki = boardConfig.dce_ki = result.ki;
+            motor.config.ctrlParams.dce.kd = boardConfig.dce_kd = result.kd;
+            boardConfig.configStatus = CONFIG_COMMIT;
+        }
+        UpdateNodeId();
+        SendCollisionReport();
+        SendStateBroadcast();
 
 
         if (boardConfig.configStatus == CONFIG_COMMIT)
@@ -139,11 +173,29 @@ extern "C" void Tim1Callback100Hz()
 extern "C" void Tim4Callback20kHz()
 {
     __HAL_TIM_CLEAR_IT(&htim4, TIM_IT_UPDATE);
+    tickProfiler.Begin();
 
     if (encoderCalibrator.isTriggered)
         encoderCalibrator.Tick20kHz();
     else
         motor.Tick20kHz();
+
+    TickStateBroadcast20kHz();
+    tickProfiler.End();
+}
+
+
+extern "C" void Tim4CompareCallback()
+{
+    __HAL_TIM_CLEAR_IT(&htim4, TIM_IT_CC1);
+
+    mt6816.StartSampleRead();
+}
+
+
+extern "C" void Spi1DmaCallback()
+{
+    mt6816.OnSpiTransferComplete();
 }
 
 
@@ -1,10 +1,13 @@
 #include "common_inc.h"
 #include "configurations.h"
 #include <can.h>
+#include "can_codec.h"
 
 
 extern Motor motor;
 extern EncoderCalibrator encoderCalibrator;
+extern TickProfiler tickProfiler;
+extern MT6816 mt6816;
 
 CAN_TxHeaderTypeDef txHeader =
     {
@@ -17,10 +20,313 @@ CAN_TxHeaderTypeDef txHeader =
     };
 
 
+// Latched by the group setpoint frames, see can_codec.h
+static int32_t groupPosition = 0;
+static bool groupPositionPending = false;
+static int32_t groupVelocity = 0;
+static bool groupVelocityValid = false;
+
+// Periodic state broadcast (0x26). Each node sends in its own slot of the
+// period. The slot is placed when the period is set, and again on the first
+// group setpoint after that or after the node ID changed, so the slots line up
+// with the Core's control tick. Later group setpoints near the slot only nudge
+// it by a tick to follow the drift between the clocks: the Core may send them
+// more often than the period, restarting the count on each would starve the
+// later slots.
+#define STATE_BROADCAST_SLOTS 8
+static uint32_t stateBroadcastTicks = 0;
+static uint8_t stateBroadcastSlotNode = 0;  // Node ID the slot was placed for, 0 for none
+static volatile bool stateBroadcastDue = false;
+static uint32_t stateBroadcastSkipped = 0;
+
+// Steps to CAN fixed-point, set up by InitCanCodec(). The state is packed in
+// interrupts, too often for a 64-bit division each time.
+static CanStepScale_t positionScale = {0, 0};
+static CanStepScale_t velocityScale = {0, 0};
+
+
+void InitCanCodec()
+{
+    positionScale = CanMakeStepScale(motor.MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS, CAN_POSITION_FRAC_BITS);
+    velocityScale = CanMakeStepScale(motor.MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS, CAN_VELOCITY_FRAC_BITS);
+}
+
+
+static void PackState(uint8_t* _data)
+{
+    CanState_t state = {
+        .position = CanStepsToFixed(motor.controller->GetPositionSteps(), &positionScale, CAN_POSITION_BITS),
+        .velocity = CanStepsToFixed(motor.controller->GetVelocitySteps(), &velocityScale, CAN_VELOCITY_BITS),
+        .current = CanSaturate(motor.controller->GetFocCurrentMilliAmps(), CAN_CURRENT_BITS),
+        .flags = 0
+    };
+    if (motor.controller->state == Motor::STATE_FINISH)
+        state.flags |= CAN_STATUS_FINISHED;
+    if (motor.controller->modeRunning != Motor::MODE_STOP)
+        state.flags |= CAN_STATUS_ENABLED;
+    if (motor.controller->isStalled)
+        state.flags |= CAN_STATUS_STALLED;
+
+    CanPackState(_data, &state);
+}
+
+
+static void PutU16(uint8_t* _data, uint32_t _value)
+{
+    if (_value > 0xFFFF) _value = 0xFFFF;
+    _data[0] = _value & 0xFF;
+    _data[1] = _value >> 8;
+}
+
+
+static void PutU32(uint8_t* _data, uint32_t _value)
+{
+    for (int i = 0; i < 4; i++)
+        _data[i] = (_value >> (8 * i)) & 0xFF;
+}
+
+
+/*
+ * Replies to 0x27 with the item asked for in byte 0, cycles saturate at 0xFFFF:
+ *   0x00~0x05  stage, see TickProfilerBase::Stage_t   [2..3] min  [4..5] avg  [6..7] max
+ *   0x10~0x17  histogram bin of the total             [2..3] bin upper bound  [4..7] count
+ *   0x20       budget                                 [2..3] cycles per tick  [4..7] overruns
+ *   0x21       encoder reads                          [2..3] stale samples    [4..7] parity errors
+ *   0xFF       clears the profile, replies with byte 0 only
+ */
+static void SendTickProfile(uint8_t* _data)
+{
+    uint8_t item = _data[0];
+    for (int i = 1; i < 8; i++)
+        _data[i] = 0;
+
+    // The tick interrupt preempts this one, don't let it update halfway
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (item < TickProfilerBase::STAGE_COUNT)
+    {
+        auto stage = static_cast<TickProfilerBase::Stage_t>(item);
+        PutU16(_data + 2, tickProfiler.stats[stage].min);
+        PutU16(_data + 4, tickProfiler.GetAverage(stage));
+        PutU16(_data + 6, tickProfiler.stats[stage].max);
+    } else if (item >= 0x10 && item < 0x10 + TickProfilerBase::HISTOGRAM_BINS)
+    {
+        PutU16(_data + 2, tickProfiler.GetBinUpperBound(item - 0x10));
+        PutU32(_data + 4, tickProfiler.histogram[item - 0x10]);
+    } else if (item == 0x20)
+    {
+        PutU16(_data + 2, tickProfiler.budgetCycles);
+        PutU32(_data + 4, tickProfiler.overrunCount);
+    } else if (item == 0x21)
+    {
+        PutU16(_data + 2, mt6816.staleSampleCount);
+        PutU32(_data + 4, mt6816.parityErrorCount);
+    } else if (item == 0xFF)
+    {
+        tickProfiler.Reset();
+    } else
+    {
+        __set_PRIMASK(primask);
+        return;
+    }
+    __set_PRIMASK(primask);
+
+    txHeader.StdId = (GetNodeId() << 7) | 0x27;
+    CAN_Send(&txHeader, _data);
+}
+
+
+// Replies with a compact state frame (0x25), integer math only
+static void SendState(uint8_t* _data)
+{
+    PackState(_data);
+    txHeader.StdId = (GetNodeId() << 7) | 0x25;
+    CAN_Send(&txHeader, _data);
+}
+
+
+// Replies with the trajectory buffer (0x28), so the Core knows how many points to send
+static void SendTrajectoryStatus(uint8_t* _data)
+{
+    MotionPlanner::TrajectoryTracker &tracker = motor.motionPlanner.trajectoryTracker;
+    CanTrajectoryStatus_t status = {
+        .freePoints = tracker.GetFreePointCount(),
+        .rejectedPoints = (uint16_t) (tracker.rejectedPointCount > 0xFFFF ? 0xFFFF : tracker.rejectedPointCount),
+        .clock = tracker.GetClock(),
+        .flags = 0
+    };
+    if (motor.controller->modeRunning != Motor::MODE_STOP)
+        status.flags |= CAN_STATUS_ENABLED;
+    if (motor.controller->isStalled)
+        status.flags |= CAN_STATUS_STALLED;
+
+    CanPackTrajectoryStatus(_data, &status);
+    txHeader.StdId = (GetNodeId() << 7) | 0x28;
+    CAN_Send(&txHeader, _data);
+}
+
+
+// Replies to 0x29 with the item asked for in byte 0, see can_codec.h. The
+// values are only complete once the state reads done.
+static void SendDceTune(uint8_t* _data)
+{
+    const DceTuner &tuner = motor.dceTuner;
+    uint8_t item = _data[0];
+    for (int i = 1; i < 8; i++)
+        _data[i] = 0;
+    _data[1] = tuner.state;
+
+    switch (item)
+    {
+        case CAN_DCE_TUNE_INERTIA:
+            CanPutFloat(_data + 2, tuner.result.inertia);
+            break;
+        case CAN_DCE_TUNE_STIFFNESS:
+            CanPutFloat(_data + 2, tuner.result.stiffness);
+            break;
+        case CAN_DCE_TUNE_DAMPING:
+            CanPutFloat(_data + 2, tuner.result.damping);
+            break;
+        case CAN_DCE_TUNE_DELAY:
+            CanPutFloat(_data + 2, tuner.result.delay);
+            break;
+        case CAN_DCE_TUNE_BANDWIDTH:
+            CanPutFloat(_data + 2, tuner.result.bandwidth);
+            break;
+        case CAN_DCE_TUNE_GAINS:
+            PutU16(_data + 2, tuner.result.kp);
+            PutU16(_data + 4, tuner.result.ki);
+            PutU16(_data + 6, tuner.result.kd);
+            break;
+        default:
+            return;
+    }
+
+    txHeader.StdId = (GetNodeId() << 7) | 0x29;
+    CAN_Send(&txHeader, _data);
+}
+
+
+// From the CAN interrupt, which the 20kHz tick preempts. _provisional places
+// the slot until the next group setpoint, which all nodes see at once.
+static void AlignStateBroadcast(bool _provisional)
+{
+    uint32_t period = boardConfig.stateBroadcastPeriod * 20;
+    uint8_t nodeId = GetNodeId();
+    if (period == 0 || nodeId == 0)
+        return;
+
+    // Count at which the broadcast is this node's slot away
+    uint32_t offset = period * (nodeId % STATE_BROADCAST_SLOTS) / STATE_BROADCAST_SLOTS;
+    uint32_t target = (period - offset) % period;
+    int32_t maxSlip = (int32_t) (period / (4 * STATE_BROADCAST_SLOTS));
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (_provisional || stateBroadcastSlotNode != nodeId)
+    {
+        stateBroadcastTicks = target;
+        stateBroadcastSlotNode = _provisional ? 0 : nodeId;
+    } else
+    {
+        // Signed distance from the slot within half a period, a group setpoint
+        // further away than a quarter slot isn't the one the slot counts from
+        int32_t error = (int32_t) ((stateBroadcastTicks + period - target) % period);
+        if (error > (int32_t) period / 2)
+            error -= (int32_t) period;
+        if (error > 0 && error <= maxSlip && stateBroadcastTicks > 0)
+            stateBroadcastTicks--;
+        else if (error < 0 && error >= -maxSlip && stateBroadcastTicks + 1 < period)
+            stateBroadcastTicks++;
+    }
+    __set_PRIMASK(primask);
+}
+
+
+void TickStateBroadcast20kHz()
+{
+    uint32_t period = boardConfig.stateBroadcastPeriod * 20; // ms -> ticks
+    if (period == 0)
+        return;
+
+    if (++stateBroadcastTicks >= period)
+    {
+        stateBroadcastTicks = 0;
+        stateBroadcastDue = true;
+    }
+}
+
+
+// Called from the main loop: the 20kHz tick preempts the CAN interrupts, so
+// it must not touch the mailboxes itself
+void SendStateBroadcast()
+{
+    if (!stateBroadcastDue)
+        return;
+    stateBroadcastDue = false;
+    uint8_t nodeId = GetNodeId();
+    if (nodeId == 0)
+        return;
+
+    uint8_t data[8];
+    PackState(data);
+    CAN_TxHeaderTypeDef header = txHeader;
+    header.StdId = (nodeId << 7) | 0x26;
+
+    // A missed broadcast is replaced by the next one, never block or fail on it
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (HAL_CAN_GetTxMailboxesFreeLevel(&hcan) > 0)
+        HAL_CAN_AddTxMessage(&hcan, &header, data, &TxMailbox);
+    else
+        stateBroadcastSkipped++;
+    __set_PRIMASK(primask);
+}
+
+
+// Called from the main loop like the broadcast. A trip is reported once, as
+// soon as a mailbox is free, the Core stops the other joints on it.
+void SendCollisionReport()
+{
+    CollisionDetector &detector = motor.collisionDetector;
+    if (!detector.reportPending)
+        return;
+    uint8_t nodeId = GetNodeId();
+    if (nodeId == 0)
+    {
+        detector.reportPending = false;
+        return;
+    }
+
+    uint8_t data[8];
+    CanCollision_t collision = {
+        .position = CanStepsToFixed(motor.controller->GetPositionSteps(), &positionScale, CAN_POSITION_BITS),
+        .errorDeviation = detector.tripErrorDeviation,
+        .currentDeviation = detector.tripCurrentDeviation,
+        .flags = CAN_STATUS_STALLED
+    };
+    if (motor.controller->modeRunning != Motor::MODE_STOP)
+        collision.flags |= CAN_STATUS_ENABLED;
+    CanPackCollision(data, &collision);
+    CAN_TxHeaderTypeDef header = txHeader;
+    header.StdId = (nodeId << 7) | 0x2A;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (HAL_CAN_GetTxMailboxesFreeLevel(&hcan) > 0)
+    {
+        HAL_CAN_AddTxMessage(&hcan, &header, data, &TxMailbox);
+        detector.reportPending = false;
+    }
+    __set_PRIMASK(primask);
+}
+
+
 void OnCanCmd(uint8_t _cmd, uint8_t* _data, uint32_t _len)
 {
     float tmpF;
     int32_t tmpI;
+    uint8_t nodeId = GetNodeId();
 
     switch (_cmd)
     {
@@ -62,7 +368,7 @@ void OnCanCmd(uint8_t _cmd, uint8_t* _data, uint32_t _len)
                 for (int i = 0; i < 4; i++)
                     _data[i] = *(b + i);
                 _data[4] = motor.controller->state == Motor::STATE_FINISH ? 1 : 0;
-                txHeader.StdId = (boardConfig.canNodeId << 7) | 0x23;
+                txHeader.StdId = (nodeId << 7) | 0x23;
                 CAN_Send(&txHeader, _data);
             }
             break;
@@ -79,7 +385,7 @@ void OnCanCmd(uint8_t _cmd, uint8_t* _data, uint32_t _len)
                 for (int i = 0; i < 4; i++)
                     _data[i] = *(b + i);
                 _data[4] = motor.controller->state == Motor::STATE_FINISH ? 1 : 0;
-                txHeader.StdId = (boardConfig.canNodeId << 7) | 0x23;
+                txHeader.StdId = (nodeId << 7) | 0x23;
                 CAN_Send(&txHeader, _data);
             }
             break;
@@ -100,16 +406,121 @@ void OnCanCmd(uint8_t _cmd, uint8_t* _data, uint32_t _len)
             for (int i = 0; i < 4; i++)
                 _data[i] = *(b + i);
             _data[4] = motor.controller->state == Motor::STATE_FINISH ? 1 : 0;
-            txHeader.StdId = (boardConfig.canNodeId << 7) | 0x23;
+            txHeader.StdId = (nodeId << 7) | 0x23;
             CAN_Send(&txHeader, _data);
         }
             break;
 
+        case 0x08:  // Group Position SetPoint, joints 1~3
+        case 0x09:  // Group Position SetPoint, joints 4~6, applies the group
+        {
+            uint32_t first = (_cmd == 0x08) ? 1 : 1 + CAN_GROUP_JOINTS_PER_FRAME;
+            if (nodeId >= first && nodeId < first + CAN_GROUP_JOINTS_PER_FRAME)
+            {
+                groupPosition = CanFixedToSteps(
+                    CanGetSignedField(_data, nodeId - first, CAN_GROUP_POSITION_BITS),
+                    motor.MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS, CAN_GROUP_POSITION_FRAC_BITS);
+                groupPositionPending = true;
+            }
+            if (_cmd == 0x09)
+                AlignStateBroadcast(false);
+            if (_cmd != 0x09 || !groupPositionPending)
+                break;
+            groupPositionPending = false;
+
+            if (motor.controller->modeRunning != Motor::MODE_COMMAND_POSITION)
+                motor.controller->SetCtrlMode(Motor::MODE_COMMAND_POSITION);
+            motor.config.motionParams.ratedVelocity = groupVelocityValid ?
+                                                      groupVelocity : boardConfig.velocityLimit;
+            motor.controller->SetPositionSetPoint(groupPosition);
+            if (_data[7] & 0x80) // Need State ACK
+                SendState(_data);
+        }
+            break;
+        case 0x0A:  // Group Velocity-Limit, joints 1~6
+            if (nodeId >= 1 && nodeId <= 2 * CAN_GROUP_JOINTS_PER_FRAME)
+            {
+                groupVelocity = CanFixedToSteps(
+                    (int32_t) CanGetField(_data, nodeId - 1, CAN_GROUP_VELOCITY_BITS),
+                    motor.MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS, CAN_GROUP_VELOCITY_FRAC_BITS);
+                groupVelocityValid = true;
+                if (motor.controller->modeRunning == Motor::MODE_COMMAND_POSITION)
+                    motor.config.motionParams.ratedVelocity = groupVelocity;
+            }
+            break;
+        case 0x0B:  // Set Position with Velocity-Limit, compact
+        {
+            CanSetPoint_t setPoint;
+            if (!CanUnpackSetPoint(_data, &setPoint))
+                break;
+
+            if (motor.controller->modeRunning != Motor::MODE_COMMAND_POSITION)
+                motor.controller->SetCtrlMode(Motor::MODE_COMMAND_POSITION);
+            motor.config.motionParams.ratedVelocity =
+                CanFixedToSteps(setPoint.velocity < 0 ? -setPoint.velocity : setPoint.velocity,
+                                motor.MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS, CAN_VELOCITY_FRAC_BITS);
+            motor.controller->SetPositionSetPoint(
+                CanFixedToSteps(setPoint.position, motor.MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS,
+                                CAN_POSITION_FRAC_BITS));
+            if (setPoint.flags & CAN_STATUS_NEED_ACK)
+                SendState(_data);
+        }
+            break;
+        case 0x0C:  // Set Trajectory Clock, usually broadcast so all joints share it
+        {
+            uint32_t clock;
+            if (CanUnpackTrajectoryClock(_data, &clock))
+                motor.motionPlanner.trajectoryTracker.SyncClock(clock);
+        }
+            break;
+        case 0x0D:  // Add Trajectory Point
+        {
+            CanTrajectoryPoint_t point;
+            if (!CanUnpackTrajectoryPoint(_data, &point))
+                break;
+
+            if (motor.controller->modeRunning != Motor::MODE_COMMAND_Trajectory)
+                motor.controller->SetCtrlMode(Motor::MODE_COMMAND_Trajectory);
+            if (point.flags & CAN_TRAJECTORY_FLUSH)
+                motor.motionPlanner.trajectoryTracker.ClearPoints();
+            // The 16-bit time is the one within half its range of the clock
+            uint32_t clock = motor.motionPlanner.trajectoryTracker.GetClock();
+            motor.controller->AddTrajectoryPoint(
+                clock + (int16_t) (point.time - (uint16_t) clock),
+                CanFixedToSteps(point.position, motor.MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS, CAN_POSITION_FRAC_BITS),
+                CanFixedToSteps(point.velocity, motor.MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS, CAN_VELOCITY_FRAC_BITS));
+            if (point.flags & CAN_STATUS_NEED_ACK)
+                SendTrajectoryStatus(_data);
+        }
+            break;
+
             // 0x10~0x1F CMDs with Memory
-        case 0x11:  // Set Node-ID and Store to EEPROM
+        case 0x10:  // Set Collision Detection (layout in can_codec.h), can Store to EEPROM
+        {
+            CanCollisionConfig_t config;
+            if (!CanUnpackCollisionConfig(_data, &config))
+                break;
+            motor.collisionDetector.SetConfig(CollisionDetector::Config_t{
+                .threshold = config.threshold,
+                .tripTime = config.tripTime,
+                .errorFloor = config.errorFloor,
+                .currentFloor = config.currentFloor
+            });
+            boardConfig.collisionThreshold = config.threshold;
+            boardConfig.collisionTripTime = config.tripTime;
+            boardConfig.collisionErrorFloor = config.errorFloor;
+            boardConfig.collisionCurrentFloor = config.currentFloor;
+            if (config.store)
+                boardConfig.configStatus = CONFIG_COMMIT;
+            break;
+        }
+        case 0x11:  // Set Node-ID and Store to EEPROM, 0 to take any free one
+            if (*(uint32_t*) (RxData) >= CAN_NODE_ID_COUNT)
+                break;
             boardConfig.canNodeId = *(uint32_t*) (RxData);
             if (_data[4])
                 boardConfig.configStatus = CONFIG_COMMIT;
+            RequestNodeId();
             break;
         case 0x12:  // Set Current-Limit and Store to EEPROM
             motor.config.motionParams.ratedCurrent = (int32_t) (*(float*) RxData * 1000);
@@ -176,6 +587,32 @@ void OnCanCmd(uint8_t _cmd, uint8_t* _data, uint32_t _len)
             if (_data[4])
                 boardConfig.configStatus = CONFIG_COMMIT;
             break;
+        case 0x1C:  // Set State Broadcast Period (ms, 0 to stop) and Store to EEPROM
+            tmpI = *(int32_t*) (RxData);
+            boardConfig.stateBroadcastPeriod = (tmpI > 0 && tmpI <= 1000) ? tmpI : 0;
+            AlignStateBroadcast(true);
+            if (_data[4])
+                boardConfig.configStatus = CONFIG_COMMIT;
+            break;
+        case 0x1D:  // Set Estimator (0 filter, 1 PLL) and Store to EEPROM, applies after reboot
+            if (*(uint32_t*) (RxData) >= ESTIMATOR_COUNT)
+                break;
+            boardConfig.estimator = *(uint32_t*) (RxData);
+            if (_data[4])
+                boardConfig.configStatus = CONFIG_COMMIT;
+            break;
+        case 0x1E:  // Start DCE Auto-Tune, the gains found are stored to EEPROM
+            motor.controller->StartDceTune();
+            break;
+        case 0x1F:  // Set Jerk (r/s^3, 0 for trapezoidal position moves) and Store to EEPROM
+            tmpF = *(float*) RxData * (float) motor.MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS / 1000;
+            if (!(tmpF >= 0) || tmpF >= (float) INT32_MAX)
+                break;
+            motor.motionPlanner.positionTracker.SetJerk((int32_t) tmpF);
+            boardConfig.velocityJerk = (int32_t) tmpF;
+            if (_data[4])
+                boardConfig.configStatus = CONFIG_COMMIT;
+            break;
 
 
             // 0x20~0x2F Inquiry CMDs
@@ -187,7 +624,7 @@ void OnCanCmd(uint8_t _cmd, uint8_t* _data, uint32_t _len)
                 _data[i] = *(b + i);
             _data[4] = (motor.controller->state == Motor::STATE_FINISH ? 1 : 0);
 
-            txHeader.StdId = (boardConfig.canNodeId << 7) | 0x21;
+            txHeader.StdId = (nodeId << 7) | 0x21;
             CAN_Send(&txHeader, _data);
         }
             break;
@@ -199,7 +636,7 @@ void OnCanCmd(uint8_t _cmd, uint8_t* _data, uint32_t _len)
                 _data[i] = *(b + i);
             _data[4] = (motor.controller->state == Motor::STATE_FINISH ? 1 : 0);
 
-            txHeader.StdId = (boardConfig.canNodeId << 7) | 0x22;
+            txHeader.StdId = (nodeId << 7) | 0x22;
             CAN_Send(&txHeader, _data);
         }
             break;
@@ -211,17 +648,29 @@ void OnCanCmd(uint8_t _cmd, uint8_t* _data, uint32_t _len)
                 _data[i] = *(b + i);
             // Finished ACK
             _data[4] = motor.controller->state == Motor::STATE_FINISH ? 1 : 0;
-            txHeader.StdId = (boardConfig.canNodeId << 7) | 0x23;
+            txHeader.StdId = (nodeId << 7) | 0x23;
             CAN_Send(&txHeader, _data);
         }
             break;
+        case 0x25: // Get State, compact
+            SendState(_data);
+            break;
+        case 0x27: // Get 20kHz Tick Profile, one item per request
+            SendTickProfile(_data);
+            break;
+        case 0x28: // Get Trajectory Buffer
+            SendTrajectoryStatus(_data);
+            break;
+        case 0x29: // Get DCE Auto-Tune, one item per request
+            SendDceTune(_data);
+            break;
         case 0x24: // Get Offset
         {
             tmpI = motor.config.motionParams.encoderHomeOffset;
             auto* b = (unsigned char*) &tmpI;
             for (int i = 0; i < 4; i++)
                 _data[i] = *(b + i);
-            txHeader.StdId = (boardConfig.canNodeId << 7) | 0x24;
+            txHeader.StdId = (nodeId << 7) | 0x24;
             CAN_Send(&txHeader, _data);
         }
             break;
@@ -2,6 +2,46 @@
 #include "configurations.h"
 
 extern Motor motor;
+extern TickProfiler tickProfiler;
+extern MT6816 mt6816;
+
+static const char* tickStageNames[TickProfilerBase::STAGE_COUNT] = {
+    "encoder", "estimate", "control", "plan", "state", "total"
+};
+
+
+// Prints the 20kHz tick profile in cycles, avg also as share of the budget
+static void PrintTickProfile()
+{
+    TickProfilerBase::Stats_t stats[TickProfilerBase::STAGE_COUNT];
+    uint32_t histogram[TickProfilerBase::HISTOGRAM_BINS];
+    uint32_t overruns;
+
+    // Copy first, printing takes far longer than a tick
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (int i = 0; i < TickProfilerBase::STAGE_COUNT; i++)
+        stats[i] = tickProfiler.stats[i];
+    for (int i = 0; i < TickProfilerBase::HISTOGRAM_BINS; i++)
+        histogram[i] = tickProfiler.histogram[i];
+    overruns = tickProfiler.overrunCount;
+    __set_PRIMASK(primask);
+
+    uint32_t budget = tickProfiler.budgetCycles;
+    printf("tick budget %lu cycles, %lu ticks, %lu overruns\r\n", (unsigned long) budget,
+           (unsigned long) stats[TickProfilerBase::STAGE_TOTAL].count, (unsigned long) overruns);
+    for (int i = 0; i < TickProfilerBase::STAGE_COUNT; i++)
+    {
+        uint32_t avg = stats[i].count ? (uint32_t) (stats[i].sum / stats[i].count) : 0;
+        printf("%-8s min %4lu avg %4lu max %4lu  %3lu%%\r\n", tickStageNames[i],
+               (unsigned long) stats[i].min, (unsigned long) avg, (unsigned long) stats[i].max,
+               (unsigned long) (budget ? avg * 100 / budget : 0));
+    }
+    for (int i = 0; i < TickProfilerBase::HISTOGRAM_BINS; i++)
+        printf("<%4lu %lu\r\n", (unsigned long) tickProfiler.GetBinUpperBound(i), (unsigned long) histogram[i]);
+    printf("encoder %lu stale samples, %lu parity errors\r\n",
+           (unsigned long) mt6816.staleSampleCount, (unsigned long) mt6816.parityErrorCount);
+}
 
 void OnUartCmd(uint8_t* _data, uint16_t _len)
 {
@@ -52,6 +92,15 @@ void OnUartCmd(uint8_t* _data, uint16_t _len)
                     (int32_t) (pos * (float) motor.MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS));
             }
             break;
+        case 't':   // "t" prints the tick profile, "t r" also starts a new one
+        {
+            char arg = 0;
+            sscanf((char*) _data, "t %c", &arg);
+            PrintTickProfile();
+            if (arg == 'r')
+                tickProfiler.Reset();
+        }
+            break;
     }
 }
 
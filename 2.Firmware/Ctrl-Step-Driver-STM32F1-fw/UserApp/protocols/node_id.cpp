@@ -0,0 +1,207 @@
+#include "common_inc.h"
+#include "configurations.h"
+#include <can.h>
+#include "can_codec.h"
+
+/*
+ * Node ID negotiation, driver side. The rules are described at the top of
+ * the Core firmware's interface_can.cpp, in short: heartbeats claim an ID,
+ * an ID someone else heartbeats or that failed to heartbeat is taken, and
+ * the ID is ours only while our heartbeats get ACK'd.
+ *
+ * The stored boardConfig.canNodeId is only a preference. A board without
+ * one, or whose ID is in use, picks a free ID from 8~15 and waits for the
+ * Core to assign it a joint (command 0x11). Until an ID is self-assigned
+ * the board sends nothing but heartbeats and ignores everything else.
+ */
+
+extern CAN_HandleTypeDef hcan;
+
+static uint64_t serialNumber = 0;
+static uint32_t rngState = 1;
+
+// Bit n: another node used ID n, or our heartbeat for it failed, within the
+// current/previous window
+static volatile uint16_t idsTaken[2] = {0, 0};
+static uint32_t windowStartMs = 0;
+
+static volatile uint8_t candidateId = 0;   // ID our heartbeats claim, 0 while choosing
+static volatile uint8_t nodeId = 0;        // Self-assigned ID, 0 while there is none
+static volatile uint32_t lastClaimMs = 0;  // Last heartbeat that was ACK'd
+static volatile uint32_t nextHeartbeatMs = 0;
+
+static volatile bool heartbeatInFlight = false;
+static volatile uint32_t heartbeatMailbox = 0;
+static volatile uint8_t heartbeatId = 0;
+static uint32_t heartbeatSentMs = 0;
+
+
+static uint32_t Random()
+{
+    // xorshift32
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+
+static uint8_t PickNodeId(uint16_t _taken)
+{
+    uint8_t stored = boardConfig.canNodeId;
+    if (stored != 0 && !(_taken & (1U << stored)))
+        return stored;
+
+    // Start at a random ID so boards booting together don't all try the same one
+    const uint8_t poolSize = CAN_NODE_ID_COUNT - CAN_NODE_ID_DYNAMIC_FIRST;
+    uint8_t start = Random() % poolSize;
+    for (uint8_t i = 0; i < poolSize; i++)
+    {
+        uint8_t id = CAN_NODE_ID_DYNAMIC_FIRST + (start + i) % poolSize;
+        if (id != stored && !(_taken & (1U << id)))
+            return id;
+    }
+
+    return 0;
+}
+
+
+static void SendHeartbeat(uint8_t _id)
+{
+    CAN_TxHeaderTypeDef header = {
+        .StdId = (uint32_t) _id << 7 | CAN_CMD_HEARTBEAT,
+        .ExtId = 0,
+        .IDE = CAN_ID_STD,
+        .RTR = CAN_RTR_DATA,
+        .DLC = 8,
+        .TransmitGlobalTime = DISABLE
+    };
+    uint8_t data[8];
+    CanPackHeartbeat(data, serialNumber, boardConfig.canNodeId);
+
+    // Like the state broadcast, a heartbeat that finds no free mailbox waits for the next period
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t mailbox;
+    if (HAL_CAN_GetTxMailboxesFreeLevel(&hcan) > 0 &&
+        HAL_CAN_AddTxMessage(&hcan, &header, data, &mailbox) == HAL_OK)
+    {
+        heartbeatMailbox = mailbox;
+        heartbeatId = _id;
+        heartbeatInFlight = true;
+        heartbeatSentMs = HAL_GetTick();
+    }
+    __set_PRIMASK(primask);
+}
+
+
+void InitNodeId(uint64_t _serial)
+{
+    serialNumber = _serial;
+    rngState = (uint32_t) (_serial ^ (_serial >> 32)) | 1;
+
+    // Listen for a whole window first: an ID isn't known to be free before
+    uint32_t now = HAL_GetTick();
+    windowStartMs = now;
+    nextHeartbeatMs = now + CAN_NODE_ID_WINDOW_MS + Random() % CAN_HEARTBEAT_PERIOD_MS;
+}
+
+
+uint8_t GetNodeId()
+{
+    return nodeId;
+}
+
+
+// Called from the main loop
+void UpdateNodeId()
+{
+    uint32_t now = HAL_GetTick();
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (now - windowStartMs >= CAN_NODE_ID_WINDOW_MS)
+    {
+        idsTaken[1] = idsTaken[0];
+        idsTaken[0] = 0;
+        windowStartMs = now;
+    }
+    uint16_t taken = idsTaken[0] | idsTaken[1];
+
+    if (candidateId != 0 && (taken & (1U << candidateId)))
+        candidateId = 0;
+    // Give the ID up as soon as someone else uses it, or once our claim lapsed
+    if (nodeId != 0 && (nodeId != candidateId || now - lastClaimMs > CAN_NODE_ID_WINDOW_MS))
+        nodeId = 0;
+    // Only a bus-off controller never finishes a frame, don't wait for it forever
+    if (heartbeatInFlight && now - heartbeatSentMs > CAN_NODE_ID_WINDOW_MS)
+        heartbeatInFlight = false;
+    __set_PRIMASK(primask);
+
+    if ((int32_t) (now - nextHeartbeatMs) < 0 || heartbeatInFlight)
+        return;
+    nextHeartbeatMs = now + CAN_HEARTBEAT_PERIOD_MS;
+
+    if (candidateId == 0)
+        candidateId = PickNodeId(taken);
+    if (candidateId != 0)
+        SendHeartbeat(candidateId);
+}
+
+
+// @brief Drops the current ID and claims the stored one, after it was changed.
+void RequestNodeId()
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    candidateId = 0;
+    nodeId = 0;
+    nextHeartbeatMs = HAL_GetTick();
+    __set_PRIMASK(primask);
+}
+
+
+// Called from the CAN RX interrupt
+void OnCanHeartbeat(uint8_t _id, const uint8_t* _data)
+{
+    uint8_t storedId;
+    if (_id == 0 || _id >= CAN_NODE_ID_COUNT || CanUnpackHeartbeat(_data, &storedId) == serialNumber)
+        return;
+
+    idsTaken[0] |= 1U << _id;
+    if (_id == nodeId)
+        nodeId = 0;
+}
+
+
+// Called from the CAN TX interrupt for every mailbox
+void OnCanTxComplete(uint32_t _mailbox)
+{
+    if (!heartbeatInFlight || _mailbox != heartbeatMailbox)
+        return;
+    heartbeatInFlight = false;
+
+    // Someone may have taken it while the heartbeat waited
+    if (heartbeatId == candidateId && !((idsTaken[0] | idsTaken[1]) & (1U << heartbeatId)))
+    {
+        lastClaimMs = HAL_GetTick();
+        nodeId = heartbeatId;
+    }
+}
+
+
+// Called from the CAN error interrupt. Retransmission is off, so a frame
+// that wasn't ACK'd, or collided with another heartbeat for the same ID,
+// fails here instead of being retried.
+void OnCanTxFailed(uint32_t _mailbox, bool _lostArbitration)
+{
+    if (!heartbeatInFlight || _mailbox != heartbeatMailbox)
+        return;
+    heartbeatInFlight = false;
+
+    // Losing arbitration to a lower ID says nothing about ours, just try again
+    if (_lostArbitration)
+        nextHeartbeatMs = HAL_GetTick();
+    else
+        idsTaken[0] |= 1U << heartbeatId;
+}
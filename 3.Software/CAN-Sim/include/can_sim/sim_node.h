@@ -0,0 +1,92 @@
+#ifndef CAN_SIM_SIM_NODE_H
+#define CAN_SIM_SIM_NODE_H
+
+/*
+ * What a board module exports to the bench. Each module is one firmware's
+ * CAN layer built for the host against the HAL shim, loaded from its own
+ * file so every board has its own copy of the firmware's globals. The
+ * modules don't link against can_sim: frames go out through the port the
+ * bench passes to boot() and come back in through receive()/tx_complete().
+ *
+ * Time only moves forward, a module never calls back into the bench outside
+ * of port->transmit().
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_NODE_EXPORT __attribute__((visibility("default")))
+
+typedef struct
+{
+    uint32_t id;
+    bool extended;
+    bool remote;
+    uint8_t dlc;
+    uint8_t data[8];
+} SimCanFrame_t;
+
+// Where the board's controller puts a frame it loaded into a TX mailbox
+typedef struct
+{
+    void* ctx;
+    void (*transmit)(void* ctx, const SimCanFrame_t* frame);
+} SimCanPort_t;
+
+typedef struct
+{
+    // @brief Powers the board up at time 0, as if it had been flashed with
+    // _storedId in its config and its MCU had unique ID _serial.
+    void (*boot)(const SimCanPort_t* port, uint32_t bitrate, uint64_t serial, uint8_t storedId);
+    // @brief A frame some other node finished on the bus at timeNs.
+    void (*receive)(const SimCanFrame_t* frame, uint64_t timeNs);
+    // @brief A frame this node transmitted finished at timeNs.
+    void (*tx_complete)(const SimCanFrame_t* frame, uint64_t timeNs);
+    // @brief Runs the board's timers, tasks and main loop up to timeNs.
+    void (*run_until)(uint64_t timeNs);
+} SimNodeApi_t;
+
+typedef struct
+{
+    SimNodeApi_t node;
+    // The self-assigned ID, 0 while negotiating
+    uint8_t (*node_id)(void);
+    // Error_Handler() calls, each would have hung the board
+    uint32_t (*error_count)(void);
+} SimDriverApi_t;
+
+typedef struct
+{
+    uint32_t tx_pending;        // Frames queued or in a mailbox
+    uint32_t tx_dropped;        // CanSendMessage() found the queue full
+    uint32_t rx_dropped;        // CAN RX task queue full
+    uint32_t fifo_overruns;     // Hardware FIFO overruns
+    uint32_t can_errors;        // Unexpected errors the error interrupt saw
+    uint32_t joints_online;     // DummyRobot::jointsOnline
+} SimCoreStats_t;
+
+typedef struct
+{
+    SimNodeApi_t node;
+    void (*set_enable)(bool enable);
+    void (*set_group_sync)(bool groupSync);
+    void (*set_state_broadcast_period)(uint32_t ms);
+    // @brief One tick of the control loop towards joint angles in degrees,
+    // relative to the rest pose.
+    void (*move_joints)(const float* angles);
+    void (*get_stats)(SimCoreStats_t* stats);
+} SimCoreApi_t;
+
+// Entry points, looked up with dlsym()
+SIM_NODE_EXPORT const SimDriverApi_t* SimDriverNode(void);
+SIM_NODE_EXPORT const SimCoreApi_t* SimCoreNode(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
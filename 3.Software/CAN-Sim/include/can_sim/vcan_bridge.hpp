@@ -0,0 +1,43 @@
+#ifndef CAN_SIM_VCAN_BRIDGE_HPP
+#define CAN_SIM_VCAN_BRIDGE_HPP
+
+#include <string>
+
+#include "virtual_can_bus.hpp"
+
+namespace can_sim
+{
+
+// @brief Mirrors a VirtualCanBus onto a Linux SocketCAN interface (vcan0,
+// or a real adapter) so candump, python-can etc. see the simulated traffic,
+// and frames written to the interface are sent on the simulated bus.
+//
+// Needs the interface up, e.g.:
+//   sudo ip link add dev vcan0 type vcan && sudo ip link set up vcan0
+class VcanBridge
+{
+public:
+    VcanBridge(VirtualCanBus &bus, const std::string &interface);
+    ~VcanBridge();
+
+    VcanBridge(const VcanBridge &) = delete;
+    VcanBridge &operator=(const VcanBridge &) = delete;
+
+    // @brief Moves frames that arrived on the interface onto the bus,
+    // without blocking. Returns how many were taken.
+    int poll();
+
+    // Bus frames the socket didn't take
+    uint64_t dropped() const
+    { return dropped_; }
+
+private:
+    VirtualCanBus &bus_;
+    int port_;
+    int fd_ = -1;
+    uint64_t dropped_ = 0;
+};
+
+}
+
+#endif
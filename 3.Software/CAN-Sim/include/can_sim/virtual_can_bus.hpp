@@ -0,0 +1,145 @@
+#ifndef CAN_SIM_VIRTUAL_CAN_BUS_HPP
+#define CAN_SIM_VIRTUAL_CAN_BUS_HPP
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace can_sim
+{
+
+struct Frame
+{
+    uint32_t id = 0;
+    bool extended = false;
+    bool remote = false;
+    uint8_t dlc = 0;
+    uint8_t data[8] = {};
+};
+
+// @brief Length of a frame on the wire including its actual stuff bits, the
+// ACK slot, EOF and the 3-bit intermission before the next frame.
+uint32_t frame_bits(const Frame &frame);
+
+struct BusStats_t
+{
+    uint64_t frame_cnt;
+    uint64_t error_cnt;         // Injected errors, each one is retransmitted
+    uint64_t busy_ns;           // Time spent on frames and error frames
+    uint64_t arbitration_lost_cnt;  // Times a node had to wait for a lower ID
+    size_t max_pending;         // Most frames waiting for the bus at once
+};
+
+struct PortStats_t
+{
+    uint64_t tx_cnt;
+    uint64_t rx_cnt;
+    uint64_t tx_dropped_cnt;    // Queue full
+    uint64_t max_latency_ns;    // Send() to end of frame
+};
+
+// @brief Simulated CAN bus for host builds of the firmwares.
+//
+// Everything runs on the caller's thread in simulated time: nodes attach a
+// port, send frames into it and get every frame other ports put on the bus
+// through their receive handler. Like bxCAN, each port has three mailboxes
+// fed from a software queue, and of all mailboxes on the bus the lowest ID
+// wins arbitration. Frames take their exact length at the configured
+// bitrate, and a receive handler may send replies, which compete from the
+// end of the frame that triggered them.
+class VirtualCanBus
+{
+public:
+    using RxHandler = std::function<void(const Frame &frame, uint64_t time_ns)>;
+    using Filter = std::function<bool(const Frame &frame)>;
+    using Tap = std::function<void(int sender, const Frame &frame, uint64_t time_ns)>;
+
+    explicit VirtualCanBus(uint32_t bitrate = 1000000);
+
+    // @param fifo_order: mailboxes leave in request order (bxCAN TXFP)
+    //                    instead of lowest ID first
+    int attach(const std::string &name, RxHandler handler, Filter filter = nullptr,
+               bool fifo_order = false, size_t queue_size = 32);
+
+    // @brief Sees every frame that completes and which port sent it, for
+    // bridges and loggers.
+    void add_tap(Tap tap);
+
+    // @brief Queues a frame at now(), false if the port's queue is full.
+    // An urgent frame goes ahead of the queue, not of the loaded mailboxes.
+    bool send(int port, const Frame &frame, bool urgent = false);
+
+    // @brief Transmits whatever is pending until time_ns. A frame that
+    // started before time_ns finishes, so now() can end up a bit later.
+    void run_until(uint64_t time_ns);
+
+    // @brief Runs until nothing is pending or limit_ns is reached,
+    // true if the bus went idle.
+    bool run_until_idle(uint64_t limit_ns);
+
+    uint64_t now() const
+    { return now_; }
+
+    uint32_t bitrate() const
+    { return bitrate_; }
+
+    // @brief Each transmission is hit by an error with this probability. The
+    // sender sees an error frame and retries, as the hardware would.
+    void set_error_rate(double probability, uint32_t seed = 1);
+
+    // @brief Time-bounded bus load since the stats were last reset.
+    double load() const;
+
+    BusStats_t get_stats() const
+    { return stats_; }
+
+    PortStats_t get_port_stats(int port) const
+    { return ports_[port].stats; }
+
+    size_t pending(int port) const;
+
+    void reset_stats();
+
+private:
+    struct Queued_t
+    {
+        Frame frame;
+        uint64_t queued_ns;
+    };
+
+    struct Port_t
+    {
+        std::string name;
+        RxHandler handler;
+        Filter filter;
+        bool fifo_order;
+        size_t queue_size;
+        std::deque<Queued_t> queue;
+        std::vector<Queued_t> mailboxes;
+        PortStats_t stats;
+    };
+
+    void refill(Port_t &port);
+    // Returns the port whose mailbox wins arbitration and that mailbox, -1 if idle
+    int arbitrate(size_t* mailbox);
+    void transmit_one();
+
+    uint32_t bitrate_;
+    uint64_t now_ = 0;
+    uint64_t stats_start_ns_ = 0;
+    std::vector<Port_t> ports_;
+    std::vector<Tap> taps_;
+
+    double error_rate_ = 0;
+    std::mt19937 rng_;
+    std::uniform_real_distribution<double> uniform_{0.0, 1.0};
+
+    BusStats_t stats_ = {};
+};
+
+}
+
+#endif
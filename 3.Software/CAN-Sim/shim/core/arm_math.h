@@ -0,0 +1,19 @@
+#ifndef CAN_SIM_CORE_ARM_MATH_H
+#define CAN_SIM_CORE_ARM_MATH_H
+
+// The CMSIS-DSP functions the kinematics use, from libm. Through the double
+// versions: 6dof_kinematic.cpp defines its own sinf()/cosf() on top of these.
+
+#include <math.h>
+
+#define PI 3.14159265358979f
+
+typedef float float32_t;
+
+static inline float32_t arm_sin_f32(float32_t x)
+{ return (float32_t) sin(x); }
+
+static inline float32_t arm_cos_f32(float32_t x)
+{ return (float32_t) cos(x); }
+
+#endif
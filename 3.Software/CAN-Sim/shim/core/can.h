@@ -0,0 +1,23 @@
+#ifndef CAN_SIM_CORE_CAN_H
+#define CAN_SIM_CORE_CAN_H
+
+// Same declarations as the Core firmware's Core/Inc/can.h, which would pull
+// in the board's main.h from its own directory
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+extern CAN_HandleTypeDef hcan1;
+extern CAN_HandleTypeDef hcan2;
+
+void MX_CAN1_Init(void);
+void MX_CAN2_Init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
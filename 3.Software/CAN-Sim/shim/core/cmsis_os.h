@@ -0,0 +1,139 @@
+#ifndef CAN_SIM_CORE_CMSIS_OS_H
+#define CAN_SIM_CORE_CMSIS_OS_H
+
+/*
+ * The CMSIS-RTOS2 calls the Core firmware's CAN and robot code makes,
+ * implemented by cmsis_os_sim.cpp on coroutines in simulated time. Ticks
+ * are milliseconds, like the board's FreeRTOS config. Timer callbacks run
+ * from the bench's context, outside of any thread, like the timer task.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define osWaitForever       0xFFFFFFFFU
+
+#define osFlagsWaitAny      0x00000000U
+#define osFlagsWaitAll      0x00000001U
+#define osFlagsNoClear      0x00000002U
+
+#define osFlagsError        0x80000000U
+#define osFlagsErrorUnknown 0xFFFFFFFFU
+#define osFlagsErrorTimeout 0xFFFFFFFEU
+#define osFlagsErrorResource 0xFFFFFFFDU
+#define osFlagsErrorParameter 0xFFFFFFFCU
+#define osFlagsErrorISR     0xFFFFFFFAU
+
+#define osMutexRecursive    0x00000001U
+#define osMutexPrioInherit  0x00000002U
+#define osMutexRobust       0x00000008U
+
+typedef enum
+{
+    osOK = 0,
+    osError = -1,
+    osErrorTimeout = -2,
+    osErrorResource = -3,
+    osErrorParameter = -4,
+    osErrorNoMemory = -5,
+    osErrorISR = -6
+} osStatus_t;
+
+typedef enum
+{
+    osPriorityNone = 0,
+    osPriorityIdle = 1,
+    osPriorityLow = 8,
+    osPriorityBelowNormal = 16,
+    osPriorityNormal = 24,
+    osPriorityAboveNormal = 32,
+    osPriorityHigh = 40,
+    osPriorityRealtime = 48
+} osPriority_t;
+
+typedef void (*osThreadFunc_t)(void* argument);
+typedef void (*osTimerFunc_t)(void* argument);
+
+typedef void* osThreadId_t;
+typedef void* osTimerId_t;
+typedef void* osMutexId_t;
+typedef void* osMessageQueueId_t;
+
+// CMSIS-RTOS v1 name some headers still use
+typedef osThreadId_t osThreadId;
+
+typedef struct
+{
+    const char* name;
+    uint32_t attr_bits;
+    void* cb_mem;
+    uint32_t cb_size;
+    void* stack_mem;
+    uint32_t stack_size;
+    osPriority_t priority;
+    uint32_t tz_module;
+    uint32_t reserved;
+} osThreadAttr_t;
+
+typedef enum
+{
+    osTimerOnce = 0,
+    osTimerPeriodic = 1
+} osTimerType_t;
+
+typedef struct
+{
+    const char* name;
+    uint32_t attr_bits;
+    void* cb_mem;
+    uint32_t cb_size;
+} osTimerAttr_t;
+
+typedef struct
+{
+    const char* name;
+    uint32_t attr_bits;
+    void* cb_mem;
+    uint32_t cb_size;
+} osMutexAttr_t;
+
+typedef struct
+{
+    const char* name;
+    uint32_t attr_bits;
+    void* cb_mem;
+    uint32_t cb_size;
+    void* mq_mem;
+    uint32_t mq_size;
+} osMessageQueueAttr_t;
+
+osThreadId_t osThreadNew(osThreadFunc_t func, void* argument, const osThreadAttr_t* attr);
+uint32_t osThreadFlagsSet(osThreadId_t thread_id, uint32_t flags);
+uint32_t osThreadFlagsWait(uint32_t flags, uint32_t options, uint32_t timeout);
+osStatus_t osDelay(uint32_t ticks);
+uint32_t osKernelGetTickCount(void);
+
+osTimerId_t osTimerNew(osTimerFunc_t func, osTimerType_t type, void* argument, const osTimerAttr_t* attr);
+osStatus_t osTimerStart(osTimerId_t timer_id, uint32_t ticks);
+osStatus_t osTimerStop(osTimerId_t timer_id);
+
+osMutexId_t osMutexNew(const osMutexAttr_t* attr);
+osStatus_t osMutexAcquire(osMutexId_t mutex_id, uint32_t timeout);
+osStatus_t osMutexRelease(osMutexId_t mutex_id);
+
+osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, const osMessageQueueAttr_t* attr);
+osStatus_t osMessageQueuePut(osMessageQueueId_t mq_id, const void* msg_ptr, uint8_t msg_prio, uint32_t timeout);
+osStatus_t osMessageQueueGet(osMessageQueueId_t mq_id, void* msg_ptr, uint8_t* msg_prio, uint32_t timeout);
+uint32_t osMessageQueueGetCount(osMessageQueueId_t mq_id);
+uint32_t osMessageQueueGetSpace(osMessageQueueId_t mq_id);
+osStatus_t osMessageQueueReset(osMessageQueueId_t mq_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
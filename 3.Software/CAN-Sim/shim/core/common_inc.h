@@ -0,0 +1,23 @@
+#ifndef CAN_SIM_CORE_COMMON_INC_H
+#define CAN_SIM_CORE_COMMON_INC_H
+
+// The part of the Core firmware's UserApp/common_inc.h that its CAN server,
+// CAN protocol and robot need, without the board's other peripherals.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+#include "cmsis_os.h"
+#include "time_utils.h"
+
+#ifdef __cplusplus
+}
+
+#include "communication.hpp"
+#include "actuators/ctrl_step/ctrl_step.hpp"
+#include "instances/dummy_robot.h"
+
+#endif
+#endif
@@ -0,0 +1,18 @@
+#ifndef CAN_SIM_CORE_MAIN_H
+#define CAN_SIM_CORE_MAIN_H
+
+// Stands in for the Core firmware's Cube-generated main.h
+
+#include "stm32f4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void Error_Handler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
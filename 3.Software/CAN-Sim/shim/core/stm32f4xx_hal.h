@@ -0,0 +1,6 @@
+#ifndef CAN_SIM_CORE_STM32F4XX_HAL_H
+#define CAN_SIM_CORE_STM32F4XX_HAL_H
+
+#include "stm32_hal_sim.h"
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef CAN_SIM_DRIVER_BUTTON_STM32_H
+#define CAN_SIM_DRIVER_BUTTON_STM32_H
+
+// No buttons on the bench
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef CAN_SIM_DRIVER_CAN_H
+#define CAN_SIM_DRIVER_CAN_H
+
+// Same declarations as the driver firmware's Core/Inc/can.h, which would
+// pull in the board's main.h from its own directory
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+
+extern CAN_HandleTypeDef hcan;
+extern CAN_TxHeaderTypeDef TxHeader;
+extern CAN_RxHeaderTypeDef RxHeader;
+extern uint8_t TxData[8];
+extern uint8_t RxData[8];
+extern uint32_t TxMailbox;
+
+void MX_CAN_Init(void);
+
+void CAN_Send(CAN_TxHeaderTypeDef* pHeader, uint8_t* data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef CAN_SIM_DRIVER_COMMON_INC_H
+#define CAN_SIM_DRIVER_COMMON_INC_H
+
+// The driver firmware's own common_inc.h, with its board objects, which
+// main.cpp defines on the board, mapped onto the node's MotorRig.
+
+#include_next "common_inc.h"
+
+#if defined(__cplusplus) && !defined(SIM_DRIVER_NODE)
+Motor* SimBoardMotor();
+MT6816* SimBoardEncoder();
+EncoderCalibrator* SimBoardCalibrator();
+TickProfiler* SimBoardProfiler();
+
+#define motor (*SimBoardMotor())
+#define mt6816 (*SimBoardEncoder())
+#define encoderCalibrator (*SimBoardCalibrator())
+#define tickProfiler (*SimBoardProfiler())
+#endif
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef CAN_SIM_DRIVER_LED_STM32_H
+#define CAN_SIM_DRIVER_LED_STM32_H
+
+// No LED on the bench
+
+#endif
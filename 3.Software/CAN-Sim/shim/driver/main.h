@@ -0,0 +1,18 @@
+#ifndef CAN_SIM_DRIVER_MAIN_H
+#define CAN_SIM_DRIVER_MAIN_H
+
+// Stands in for the driver firmware's Cube-generated main.h
+
+#include "stm32_hal_sim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void Error_Handler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
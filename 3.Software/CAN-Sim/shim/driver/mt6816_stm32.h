@@ -0,0 +1,8 @@
+#ifndef CAN_SIM_DRIVER_MT6816_STM32_H
+#define CAN_SIM_DRIVER_MT6816_STM32_H
+
+#include "motor_sim/motor_rig.hpp"
+
+typedef motor_sim::MT6816Sim MT6816;
+
+#endif
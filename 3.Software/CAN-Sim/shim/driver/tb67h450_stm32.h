@@ -0,0 +1,8 @@
+#ifndef CAN_SIM_DRIVER_TB67H450_STM32_H
+#define CAN_SIM_DRIVER_TB67H450_STM32_H
+
+#include "motor_sim/motor_rig.hpp"
+
+typedef motor_sim::TB67H450Sim TB67H450;
+
+#endif
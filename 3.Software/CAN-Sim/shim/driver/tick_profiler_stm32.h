@@ -0,0 +1,24 @@
+#ifndef CAN_SIM_DRIVER_TICK_PROFILER_STM32_H
+#define CAN_SIM_DRIVER_TICK_PROFILER_STM32_H
+
+#include <chrono>
+#include "Motor/tick_profiler_base.h"
+
+// Counts host nanoseconds, the figures are this process' time per tick
+class TickProfiler : public TickProfilerBase
+{
+private:
+    void InitCounter() override
+    {}
+
+    uint32_t GetCounterFrequency() override
+    { return 1000000000; }
+
+    uint32_t ReadCycles() override
+    {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return (uint32_t) std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+    }
+};
+
+#endif
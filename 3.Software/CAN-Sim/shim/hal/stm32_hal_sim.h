@@ -0,0 +1,330 @@
+#ifndef CAN_SIM_STM32_HAL_SIM_H
+#define CAN_SIM_STM32_HAL_SIM_H
+
+/*
+ * The STM32 HAL as both firmwares' CAN code sees it, for host builds: the
+ * bxCAN driver with its real types and constants, backed by hal_sim.cpp,
+ * plus enough of the GPIO, RCC and NVIC HAL for the Cube-generated can.c
+ * of either board to compile. Those only configure pins and do nothing.
+ *
+ * Everything runs on one thread, interrupts included, so masking them is a
+ * no-op.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __IO volatile
+
+typedef enum
+{
+    HAL_OK = 0x00U,
+    HAL_ERROR = 0x01U,
+    HAL_BUSY = 0x02U,
+    HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+typedef enum
+{
+    DISABLE = 0,
+    ENABLE = !DISABLE
+} FunctionalState;
+
+#define SET_BIT(REG, BIT)   ((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT) ((REG) &= ~(BIT))
+#define READ_BIT(REG, BIT)  ((REG) & (BIT))
+
+static inline uint32_t __get_PRIMASK(void)
+{ return 0; }
+
+static inline void __set_PRIMASK(uint32_t priMask)
+{ (void) priMask; }
+
+static inline void __disable_irq(void)
+{}
+
+static inline void __enable_irq(void)
+{}
+
+#define __DMB() __asm__ volatile("" ::: "memory")
+
+uint32_t HAL_GetTick(void);
+void HAL_NVIC_SystemReset(void);
+
+/* bxCAN ---------------------------------------------------------------------*/
+
+typedef struct
+{
+    __IO uint32_t TIR;
+    __IO uint32_t TDTR;
+    __IO uint32_t TDLR;
+    __IO uint32_t TDHR;
+} CAN_TxMailBox_TypeDef;
+
+// Only BTR and the mailboxes' TXRQ bits mean anything here
+typedef struct
+{
+    __IO uint32_t MCR;
+    __IO uint32_t MSR;
+    __IO uint32_t TSR;
+    __IO uint32_t RF0R;
+    __IO uint32_t RF1R;
+    __IO uint32_t IER;
+    __IO uint32_t ESR;
+    __IO uint32_t BTR;
+    CAN_TxMailBox_TypeDef sTxMailBox[3];
+} CAN_TypeDef;
+
+extern CAN_TypeDef simCan1Regs;
+extern CAN_TypeDef simCan2Regs;
+#define CAN1 (&simCan1Regs)
+#define CAN2 (&simCan2Regs)
+
+#define CAN_BTR_BRP_Pos     (0U)
+#define CAN_BTR_BRP         (0x3FFU << CAN_BTR_BRP_Pos)
+#define CAN_BTR_TS1_Pos     (16U)
+#define CAN_BTR_TS1         (0xFU << CAN_BTR_TS1_Pos)
+#define CAN_BTR_TS2_Pos     (20U)
+#define CAN_BTR_TS2         (0x7U << CAN_BTR_TS2_Pos)
+#define CAN_BTR_SJW_Pos     (24U)
+
+#define CAN_TI0R_TXRQ       (1U << 0)
+#define CAN_TI1R_TXRQ       (1U << 0)
+#define CAN_TI2R_TXRQ       (1U << 0)
+
+typedef struct
+{
+    uint32_t Prescaler;
+    uint32_t Mode;
+    uint32_t SyncJumpWidth;
+    uint32_t TimeSeg1;
+    uint32_t TimeSeg2;
+    FunctionalState TimeTriggeredMode;
+    FunctionalState AutoBusOff;
+    FunctionalState AutoWakeUp;
+    FunctionalState AutoRetransmission;
+    FunctionalState ReceiveFifoLocked;
+    FunctionalState TransmitFifoPriority;
+} CAN_InitTypeDef;
+
+typedef enum
+{
+    HAL_CAN_STATE_RESET = 0x00U,
+    HAL_CAN_STATE_READY = 0x01U,
+    HAL_CAN_STATE_LISTENING = 0x02U,
+    HAL_CAN_STATE_SLEEP_PENDING = 0x03U,
+    HAL_CAN_STATE_SLEEP_ACTIVE = 0x04U,
+    HAL_CAN_STATE_ERROR = 0x05U
+} HAL_CAN_StateTypeDef;
+
+typedef struct
+{
+    CAN_TypeDef* Instance;
+    CAN_InitTypeDef Init;
+    __IO HAL_CAN_StateTypeDef State;
+    __IO uint32_t ErrorCode;
+} CAN_HandleTypeDef;
+
+typedef struct
+{
+    uint32_t FilterIdHigh;
+    uint32_t FilterIdLow;
+    uint32_t FilterMaskIdHigh;
+    uint32_t FilterMaskIdLow;
+    uint32_t FilterFIFOAssignment;
+    uint32_t FilterBank;
+    uint32_t FilterMode;
+    uint32_t FilterScale;
+    uint32_t FilterActivation;
+    uint32_t SlaveStartFilterBank;
+} CAN_FilterTypeDef;
+
+typedef struct
+{
+    uint32_t StdId;
+    uint32_t ExtId;
+    uint32_t IDE;
+    uint32_t RTR;
+    uint32_t DLC;
+    FunctionalState TransmitGlobalTime;
+} CAN_TxHeaderTypeDef;
+
+typedef struct
+{
+    uint32_t StdId;
+    uint32_t ExtId;
+    uint32_t IDE;
+    uint32_t RTR;
+    uint32_t DLC;
+    uint32_t Timestamp;
+    uint32_t FilterMatchIndex;
+} CAN_RxHeaderTypeDef;
+
+#define CAN_MODE_NORMAL             0x00000000U
+#define CAN_SJW_1TQ                 0x00000000U
+#define CAN_BS1_TQ(n)               ((uint32_t) ((n) - 1) << CAN_BTR_TS1_Pos)
+#define CAN_BS1_3TQ                 CAN_BS1_TQ(3)
+#define CAN_BS1_5TQ                 CAN_BS1_TQ(5)
+#define CAN_BS2_TQ(n)               ((uint32_t) ((n) - 1) << CAN_BTR_TS2_Pos)
+#define CAN_BS2_2TQ                 CAN_BS2_TQ(2)
+#define CAN_BS2_3TQ                 CAN_BS2_TQ(3)
+
+#define CAN_ID_STD                  0x00000000U
+#define CAN_ID_EXT                  0x00000004U
+#define CAN_RTR_DATA                0x00000000U
+#define CAN_RTR_REMOTE              0x00000002U
+
+#define CAN_RX_FIFO0                0x00000000U
+#define CAN_RX_FIFO1                0x00000001U
+
+#define CAN_TX_MAILBOX0             0x00000001U
+#define CAN_TX_MAILBOX1             0x00000002U
+#define CAN_TX_MAILBOX2             0x00000004U
+
+#define CAN_FILTERMODE_IDMASK       0x00000000U
+#define CAN_FILTERMODE_IDLIST       0x00000001U
+#define CAN_FILTERSCALE_16BIT       0x00000000U
+#define CAN_FILTERSCALE_32BIT       0x00000001U
+
+#define CAN_IT_TX_MAILBOX_EMPTY     (1U << 0)
+#define CAN_IT_RX_FIFO0_MSG_PENDING (1U << 1)
+#define CAN_IT_RX_FIFO0_FULL        (1U << 2)
+#define CAN_IT_RX_FIFO0_OVERRUN     (1U << 3)
+#define CAN_IT_RX_FIFO1_MSG_PENDING (1U << 4)
+#define CAN_IT_RX_FIFO1_FULL        (1U << 5)
+#define CAN_IT_RX_FIFO1_OVERRUN     (1U << 6)
+#define CAN_IT_ERROR_WARNING        (1U << 8)
+#define CAN_IT_ERROR_PASSIVE        (1U << 9)
+#define CAN_IT_BUSOFF               (1U << 10)
+#define CAN_IT_LAST_ERROR_CODE      (1U << 11)
+#define CAN_IT_ERROR                (1U << 15)
+#define CAN_IT_WAKEUP               (1U << 16)
+#define CAN_IT_SLEEP_ACK            (1U << 17)
+
+#define HAL_CAN_ERROR_NONE          0x00000000U
+#define HAL_CAN_ERROR_EWG           0x00000001U
+#define HAL_CAN_ERROR_EPV           0x00000002U
+#define HAL_CAN_ERROR_BOF           0x00000004U
+#define HAL_CAN_ERROR_STF           0x00000008U
+#define HAL_CAN_ERROR_FOR           0x00000010U
+#define HAL_CAN_ERROR_ACK           0x00000020U
+#define HAL_CAN_ERROR_BR            0x00000040U
+#define HAL_CAN_ERROR_BD            0x00000080U
+#define HAL_CAN_ERROR_CRC           0x00000100U
+#define HAL_CAN_ERROR_RX_FOV0       0x00000200U
+#define HAL_CAN_ERROR_RX_FOV1       0x00000400U
+#define HAL_CAN_ERROR_TX_ALST0      0x00000800U
+#define HAL_CAN_ERROR_TX_TERR0      0x00001000U
+#define HAL_CAN_ERROR_TX_ALST1      0x00002000U
+#define HAL_CAN_ERROR_TX_TERR1      0x00004000U
+#define HAL_CAN_ERROR_TX_ALST2      0x00008000U
+#define HAL_CAN_ERROR_TX_TERR2      0x00010000U
+#define HAL_CAN_ERROR_NOT_INITIALIZED 0x00040000U
+#define HAL_CAN_ERROR_NOT_READY     0x00080000U
+#define HAL_CAN_ERROR_NOT_STARTED   0x00100000U
+#define HAL_CAN_ERROR_PARAM         0x00200000U
+
+HAL_StatusTypeDef HAL_CAN_Init(CAN_HandleTypeDef* hcan);
+HAL_StatusTypeDef HAL_CAN_ConfigFilter(CAN_HandleTypeDef* hcan, CAN_FilterTypeDef* sFilterConfig);
+HAL_StatusTypeDef HAL_CAN_Start(CAN_HandleTypeDef* hcan);
+HAL_StatusTypeDef HAL_CAN_ActivateNotification(CAN_HandleTypeDef* hcan, uint32_t ActiveITs);
+HAL_StatusTypeDef HAL_CAN_AddTxMessage(CAN_HandleTypeDef* hcan, CAN_TxHeaderTypeDef* pHeader,
+                                       uint8_t aData[], uint32_t* pTxMailbox);
+uint32_t HAL_CAN_GetTxMailboxesFreeLevel(CAN_HandleTypeDef* hcan);
+HAL_StatusTypeDef HAL_CAN_GetRxMessage(CAN_HandleTypeDef* hcan, uint32_t RxFifo,
+                                       CAN_RxHeaderTypeDef* pHeader, uint8_t aData[]);
+uint32_t HAL_CAN_GetError(CAN_HandleTypeDef* hcan);
+HAL_StatusTypeDef HAL_CAN_ResetError(CAN_HandleTypeDef* hcan);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+
+// Weak defaults in hal_sim.cpp, like the HAL's
+void HAL_CAN_MspInit(CAN_HandleTypeDef* hcan);
+void HAL_CAN_MspDeInit(CAN_HandleTypeDef* hcan);
+void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef* hcan);
+void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef* hcan);
+void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef* hcan);
+void HAL_CAN_TxMailbox0AbortCallback(CAN_HandleTypeDef* hcan);
+void HAL_CAN_TxMailbox1AbortCallback(CAN_HandleTypeDef* hcan);
+void HAL_CAN_TxMailbox2AbortCallback(CAN_HandleTypeDef* hcan);
+void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef* hcan);
+void HAL_CAN_RxFifo0FullCallback(CAN_HandleTypeDef* hcan);
+void HAL_CAN_RxFifo1MsgPendingCallback(CAN_HandleTypeDef* hcan);
+void HAL_CAN_RxFifo1FullCallback(CAN_HandleTypeDef* hcan);
+void HAL_CAN_SleepCallback(CAN_HandleTypeDef* hcan);
+void HAL_CAN_WakeUpFromRxMsgCallback(CAN_HandleTypeDef* hcan);
+void HAL_CAN_ErrorCallback(CAN_HandleTypeDef* hcan);
+
+/* GPIO, RCC and NVIC, for can.c -----------------------------------------------*/
+
+typedef struct GPIO_TypeDef GPIO_TypeDef;
+#define GPIOB ((GPIO_TypeDef*) 0)
+
+typedef struct
+{
+    uint32_t Pin;
+    uint32_t Mode;
+    uint32_t Pull;
+    uint32_t Speed;
+    uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+#define GPIO_PIN_8                  (1U << 8)
+#define GPIO_PIN_9                  (1U << 9)
+#define GPIO_PIN_12                 (1U << 12)
+#define GPIO_PIN_13                 (1U << 13)
+#define GPIO_MODE_INPUT             0x00000000U
+#define GPIO_MODE_AF_PP             0x00000002U
+#define GPIO_NOPULL                 0x00000000U
+#define GPIO_PULLUP                 0x00000001U
+#define GPIO_SPEED_FREQ_HIGH        0x00000002U
+#define GPIO_SPEED_FREQ_VERY_HIGH   0x00000003U
+#define GPIO_AF9_CAN1               0x09U
+#define GPIO_AF9_CAN2               0x09U
+
+static inline void HAL_GPIO_Init(GPIO_TypeDef* GPIOx, GPIO_InitTypeDef* GPIO_Init)
+{ (void) GPIOx; (void) GPIO_Init; }
+
+static inline void HAL_GPIO_DeInit(GPIO_TypeDef* GPIOx, uint32_t GPIO_Pin)
+{ (void) GPIOx; (void) GPIO_Pin; }
+
+#define __HAL_RCC_CAN1_CLK_ENABLE()     do {} while (0)
+#define __HAL_RCC_CAN1_CLK_DISABLE()    do {} while (0)
+#define __HAL_RCC_CAN2_CLK_ENABLE()     do {} while (0)
+#define __HAL_RCC_CAN2_CLK_DISABLE()    do {} while (0)
+#define __HAL_RCC_GPIOB_CLK_ENABLE()    do {} while (0)
+#define __HAL_AFIO_REMAP_CAN1_2()       do {} while (0)
+
+// The CAN interrupts of both parts
+typedef enum
+{
+    USB_HP_CAN1_TX_IRQn,
+    USB_LP_CAN1_RX0_IRQn,
+    CAN1_TX_IRQn,
+    CAN1_RX0_IRQn,
+    CAN1_RX1_IRQn,
+    CAN1_SCE_IRQn,
+    CAN2_TX_IRQn,
+    CAN2_RX0_IRQn,
+    CAN2_RX1_IRQn,
+    CAN2_SCE_IRQn
+} IRQn_Type;
+
+static inline void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority)
+{ (void) IRQn; (void) PreemptPriority; (void) SubPriority; }
+
+static inline void HAL_NVIC_EnableIRQ(IRQn_Type IRQn)
+{ (void) IRQn; }
+
+static inline void HAL_NVIC_DisableIRQ(IRQn_Type IRQn)
+{ (void) IRQn; }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,444 @@
+#include "cmsis_os_sim.hpp"
+#include "cmsis_os.h"
+#include "hal_sim.hpp"
+
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <ucontext.h>
+
+/*
+ * Just enough of CMSIS-RTOS2 for the Core's CAN RX task: threads are
+ * ucontext coroutines that run until they wait, in priority order, after
+ * every interrupt and whenever simulated time moves. A thread woken from
+ * another thread only runs once that one waits, not right away. Timer
+ * callbacks and anything else called outside a thread can't block: their
+ * waits fail as they would in an interrupt.
+ */
+
+#define THREAD_STACK_SIZE (64 * 1024)
+#define NS_PER_TICK 1000000ULL
+#define NO_DEADLINE UINT64_MAX
+
+enum ThreadState_t
+{
+    THREAD_READY,
+    THREAD_WAITING,
+    THREAD_TERMINATED
+};
+
+struct Thread_t
+{
+    ucontext_t context;
+    std::unique_ptr<uint8_t[]> stack;
+    osThreadFunc_t func;
+    void* argument;
+    int priority;
+    ThreadState_t state;
+
+    uint32_t flags;
+    uint32_t waitFlags;         // 0 for osDelay()
+    uint32_t waitOptions;
+    uint64_t deadlineNs;
+    uint32_t waitResult;
+};
+
+struct Timer_t
+{
+    osTimerFunc_t func;
+    void* argument;
+    osTimerType_t type;
+    bool running;
+    uint64_t periodNs;
+    uint64_t nextNs;
+};
+
+struct Mutex_t
+{
+    bool recursive;
+    Thread_t* owner;            // nullptr for the bench's context
+    uint32_t count;
+};
+
+struct MessageQueue_t
+{
+    uint32_t msgCount;
+    uint32_t msgSize;
+    std::unique_ptr<uint8_t[]> buffer;
+    uint32_t first;
+    uint32_t level;
+};
+
+static std::vector<std::unique_ptr<Thread_t>> threads;
+static std::vector<std::unique_ptr<Timer_t>> timers;
+static std::vector<std::unique_ptr<Mutex_t>> mutexes;
+static ucontext_t schedulerContext;
+static Thread_t* current = nullptr;
+
+
+static void ThreadEntry()
+{
+    current->func(current->argument);
+    current->state = THREAD_TERMINATED;
+    swapcontext(&current->context, &schedulerContext);
+}
+
+
+// Back to the scheduler until something wakes this thread
+static void Block()
+{
+    swapcontext(&current->context, &schedulerContext);
+}
+
+
+static bool FlagsSatisfied(const Thread_t &_thread)
+{
+    uint32_t set = _thread.flags & _thread.waitFlags;
+    if (_thread.waitOptions & osFlagsWaitAll)
+        return set == _thread.waitFlags;
+    return set != 0;
+}
+
+
+// Ends a satisfied flags wait the way osThreadFlagsWait() returns
+static uint32_t TakeFlags(Thread_t &_thread)
+{
+    uint32_t flags = _thread.flags;
+    if (!(_thread.waitOptions & osFlagsNoClear))
+        _thread.flags &= ~_thread.waitFlags;
+    return flags;
+}
+
+
+void SimOsRunReady()
+{
+    if (current != nullptr)
+        return;
+
+    for (;;)
+    {
+        Thread_t* next = nullptr;
+        for (auto &thread : threads)
+            if (thread->state == THREAD_READY && (next == nullptr || thread->priority > next->priority))
+                next = thread.get();
+        if (next == nullptr)
+            return;
+
+        current = next;
+        swapcontext(&schedulerContext, &next->context);
+        current = nullptr;
+    }
+}
+
+
+void SimOsRunUntil(uint64_t _timeNs)
+{
+    for (;;)
+    {
+        uint64_t nextNs = NO_DEADLINE;
+        for (auto &thread : threads)
+            if (thread->state == THREAD_WAITING && thread->deadlineNs < nextNs)
+                nextNs = thread->deadlineNs;
+        for (auto &timer : timers)
+            if (timer->running && timer->nextNs < nextNs)
+                nextNs = timer->nextNs;
+        if (nextNs > _timeNs)
+            break;
+
+        SimHalSetTime(nextNs);
+        for (auto &thread : threads)
+        {
+            if (thread->state != THREAD_WAITING || thread->deadlineNs != nextNs)
+                continue;
+            thread->waitResult = thread->waitFlags ? osFlagsErrorTimeout : 0;
+            thread->state = THREAD_READY;
+        }
+        for (size_t i = 0; i < timers.size(); i++)
+        {
+            Timer_t &timer = *timers[i];
+            if (!timer.running || timer.nextNs != nextNs)
+                continue;
+            if (timer.type == osTimerPeriodic)
+                timer.nextNs += timer.periodNs;
+            else
+                timer.running = false;
+            timer.func(timer.argument);
+        }
+        SimOsRunReady();
+    }
+
+    SimHalSetTime(_timeNs);
+    SimOsRunReady();
+}
+
+
+// Every interrupt of the HAL shim ends here, a task it woke runs before
+// the bench goes on
+extern "C" void SimAfterInterrupt()
+{
+    SimOsRunReady();
+}
+
+
+/* Threads -------------------------------------------------------------------*/
+
+osThreadId_t osThreadNew(osThreadFunc_t func, void* argument, const osThreadAttr_t* attr)
+{
+    auto thread = std::make_unique<Thread_t>();
+    thread->func = func;
+    thread->argument = argument;
+    thread->priority = (attr != nullptr && attr->priority != osPriorityNone) ? attr->priority : osPriorityNormal;
+    thread->state = THREAD_READY;
+    thread->deadlineNs = NO_DEADLINE;
+
+    thread->stack.reset(new uint8_t[THREAD_STACK_SIZE]);
+    getcontext(&thread->context);
+    thread->context.uc_stack.ss_sp = thread->stack.get();
+    thread->context.uc_stack.ss_size = THREAD_STACK_SIZE;
+    thread->context.uc_link = nullptr;
+    makecontext(&thread->context, ThreadEntry, 0);
+
+    threads.push_back(std::move(thread));
+    return threads.back().get();
+}
+
+
+uint32_t osThreadFlagsSet(osThreadId_t thread_id, uint32_t flags)
+{
+    auto* thread = (Thread_t*) thread_id;
+    if (thread == nullptr || (flags & osFlagsError))
+        return osFlagsErrorParameter;
+
+    thread->flags |= flags;
+    uint32_t result = thread->flags;
+    if (thread->state == THREAD_WAITING && thread->waitFlags && FlagsSatisfied(*thread))
+    {
+        thread->waitResult = TakeFlags(*thread);
+        thread->state = THREAD_READY;
+    }
+
+    return result;
+}
+
+
+uint32_t osThreadFlagsWait(uint32_t flags, uint32_t options, uint32_t timeout)
+{
+    if (current == nullptr)
+        return osFlagsErrorISR;
+    if (flags == 0 || (flags & osFlagsError))
+        return osFlagsErrorParameter;
+
+    current->waitFlags = flags;
+    current->waitOptions = options;
+    if (FlagsSatisfied(*current))
+        return TakeFlags(*current);
+    if (timeout == 0)
+        return osFlagsErrorResource;
+
+    current->deadlineNs = timeout == osWaitForever ? NO_DEADLINE : SimHalTimeNs() + timeout * NS_PER_TICK;
+    current->state = THREAD_WAITING;
+    Block();
+    current->deadlineNs = NO_DEADLINE;
+
+    return current->waitResult;
+}
+
+
+osStatus_t osDelay(uint32_t ticks)
+{
+    if (current == nullptr)
+        return osErrorISR;
+    if (ticks == 0)
+        return osErrorParameter;
+
+    current->waitFlags = 0;
+    current->deadlineNs = SimHalTimeNs() + ticks * NS_PER_TICK;
+    current->state = THREAD_WAITING;
+    Block();
+    current->deadlineNs = NO_DEADLINE;
+
+    return osOK;
+}
+
+
+uint32_t osKernelGetTickCount(void)
+{
+    return (uint32_t) (SimHalTimeNs() / NS_PER_TICK);
+}
+
+
+/* Timers --------------------------------------------------------------------*/
+
+osTimerId_t osTimerNew(osTimerFunc_t func, osTimerType_t type, void* argument, const osTimerAttr_t* attr)
+{
+    (void) attr;
+    if (func == nullptr)
+        return nullptr;
+
+    auto timer = std::make_unique<Timer_t>();
+    timer->func = func;
+    timer->argument = argument;
+    timer->type = type;
+
+    timers.push_back(std::move(timer));
+    return timers.back().get();
+}
+
+
+osStatus_t osTimerStart(osTimerId_t timer_id, uint32_t ticks)
+{
+    auto* timer = (Timer_t*) timer_id;
+    if (timer == nullptr || ticks == 0)
+        return osErrorParameter;
+
+    timer->periodNs = ticks * NS_PER_TICK;
+    timer->nextNs = SimHalTimeNs() + timer->periodNs;
+    timer->running = true;
+
+    return osOK;
+}
+
+
+osStatus_t osTimerStop(osTimerId_t timer_id)
+{
+    auto* timer = (Timer_t*) timer_id;
+    if (timer == nullptr)
+        return osErrorParameter;
+    if (!timer->running)
+        return osErrorResource;
+
+    timer->running = false;
+    return osOK;
+}
+
+
+/* Mutexes -------------------------------------------------------------------*/
+
+// Nothing the bench runs contends for a mutex, so they never block either:
+// taking one someone else holds fails right away.
+
+osMutexId_t osMutexNew(const osMutexAttr_t* attr)
+{
+    auto mutex = std::make_unique<Mutex_t>();
+    mutex->recursive = attr != nullptr && (attr->attr_bits & osMutexRecursive);
+
+    mutexes.push_back(std::move(mutex));
+    return mutexes.back().get();
+}
+
+
+osStatus_t osMutexAcquire(osMutexId_t mutex_id, uint32_t timeout)
+{
+    auto* mutex = (Mutex_t*) mutex_id;
+    if (mutex == nullptr)
+        return osErrorParameter;
+
+    if (mutex->count > 0 && !(mutex->owner == current && mutex->recursive))
+        return timeout ? osErrorTimeout : osErrorResource;
+
+    mutex->owner = current;
+    mutex->count++;
+    return osOK;
+}
+
+
+osStatus_t osMutexRelease(osMutexId_t mutex_id)
+{
+    auto* mutex = (Mutex_t*) mutex_id;
+    if (mutex == nullptr)
+        return osErrorParameter;
+    if (mutex->count == 0 || mutex->owner != current)
+        return osErrorResource;
+
+    mutex->count--;
+    return osOK;
+}
+
+
+/* Message queues ------------------------------------------------------------*/
+
+// Nothing the bench runs waits on a queue, so they never block: a put into
+// a full queue or a get from an empty one fails right away.
+
+// Global objects create theirs before main(), so not a plain static
+static std::vector<std::unique_ptr<MessageQueue_t>> &Queues()
+{
+    static std::vector<std::unique_ptr<MessageQueue_t>> queues;
+    return queues;
+}
+
+osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, const osMessageQueueAttr_t* attr)
+{
+    (void) attr;
+    if (msg_count == 0 || msg_size == 0)
+        return nullptr;
+
+    auto queue = std::make_unique<MessageQueue_t>();
+    queue->msgCount = msg_count;
+    queue->msgSize = msg_size;
+    queue->buffer.reset(new uint8_t[msg_count * msg_size]);
+
+    Queues().push_back(std::move(queue));
+    return Queues().back().get();
+}
+
+
+osStatus_t osMessageQueuePut(osMessageQueueId_t mq_id, const void* msg_ptr, uint8_t msg_prio, uint32_t timeout)
+{
+    (void) msg_prio;
+    auto* queue = (MessageQueue_t*) mq_id;
+    if (queue == nullptr || msg_ptr == nullptr)
+        return osErrorParameter;
+    if (queue->level == queue->msgCount)
+        return timeout ? osErrorTimeout : osErrorResource;
+
+    uint32_t slot = (queue->first + queue->level) % queue->msgCount;
+    memcpy(&queue->buffer[slot * queue->msgSize], msg_ptr, queue->msgSize);
+    queue->level++;
+
+    return osOK;
+}
+
+
+osStatus_t osMessageQueueGet(osMessageQueueId_t mq_id, void* msg_ptr, uint8_t* msg_prio, uint32_t timeout)
+{
+    auto* queue = (MessageQueue_t*) mq_id;
+    if (queue == nullptr || msg_ptr == nullptr)
+        return osErrorParameter;
+    if (queue->level == 0)
+        return timeout ? osErrorTimeout : osErrorResource;
+
+    memcpy(msg_ptr, &queue->buffer[queue->first * queue->msgSize], queue->msgSize);
+    queue->first = (queue->first + 1) % queue->msgCount;
+    queue->level--;
+    if (msg_prio != nullptr)
+        *msg_prio = 0;
+
+    return osOK;
+}
+
+
+uint32_t osMessageQueueGetCount(osMessageQueueId_t mq_id)
+{
+    auto* queue = (MessageQueue_t*) mq_id;
+    return queue == nullptr ? 0 : queue->level;
+}
+
+
+uint32_t osMessageQueueGetSpace(osMessageQueueId_t mq_id)
+{
+    auto* queue = (MessageQueue_t*) mq_id;
+    return queue == nullptr ? 0 : queue->msgCount - queue->level;
+}
+
+
+osStatus_t osMessageQueueReset(osMessageQueueId_t mq_id)
+{
+    auto* queue = (MessageQueue_t*) mq_id;
+    if (queue == nullptr)
+        return osErrorParameter;
+
+    queue->first = 0;
+    queue->level = 0;
+    return osOK;
+}
@@ -0,0 +1,18 @@
+#ifndef CAN_SIM_CMSIS_OS_SIM_HPP
+#define CAN_SIM_CMSIS_OS_SIM_HPP
+
+// The bench side of the RTOS shim. The bench's own context plays the board's
+// control thread and timer task, the firmware's threads are coroutines that
+// run whenever the bench gives them the CPU.
+
+#include <cstdint>
+
+// @brief Runs the ready threads, highest priority first, until each of them
+// waits again. Does nothing when called from a thread.
+void SimOsRunReady();
+
+// @brief Expires timeouts and fires timers in time order up to timeNs,
+// running the threads they wake.
+void SimOsRunUntil(uint64_t timeNs);
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * The REF board: the Core firmware's can.c, CAN server, CAN protocol and
+ * DummyRobot as they ship, on the HAL and RTOS shims. The node does what
+ * the board's Main() does for CAN1 and the robot, the bench's calls stand
+ * in for the control loop thread. CAN2 (the hand and extensions) and the
+ * USB/UART servers aren't simulated.
+ */
+
+#include <cstdio>
+
+#include "common_inc.h"
+#include "can.h"
+#include "cmsis_os_sim.hpp"
+#include "hal_sim.hpp"
+
+DummyRobot dummy(&hcan1);
+
+static uint32_t errorCount = 0;
+
+
+extern "C" uint32_t micros(void)
+{
+    return (uint32_t) (SimHalTimeNs() / 1000);
+}
+
+
+extern "C" uint32_t millis(void)
+{
+    return (uint32_t) (SimHalTimeNs() / 1000000);
+}
+
+
+extern "C" void Error_Handler(void)
+{
+    errorCount++;
+}
+
+
+// Only DummyRobot::Reboot() resets the board, which the bench never calls
+extern "C" void HAL_NVIC_SystemReset(void)
+{
+}
+
+
+// The board's logger queues for its USB and UART sinks, here it goes
+// straight to stderr
+void LogDeferred(LogLevel_t level, const char* fmt, int32_t a0, int32_t a1, int32_t a2, int32_t a3)
+{
+    if (level < LOG_LEVEL_WARN)
+        return;
+    fprintf(stderr, fmt, (long) a0, (long) a1, (long) a2, (long) a3);
+}
+
+
+// Responses to the ASCII commands have nowhere to go
+class NullSink : public StreamSink
+{
+public:
+    int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override
+    {
+        (void) buffer;
+        if (processed_bytes)
+            *processed_bytes += length;
+        return 0;
+    }
+
+    size_t get_free_space() override
+    { return SIZE_MAX; }
+};
+
+static NullSink nullSink;
+StreamSink* usbStreamOutputPtr = &nullSink;
+StreamSink* uart4StreamOutputPtr = &nullSink;
+StreamSink* uart5StreamOutputPtr = &nullSink;
+
+
+// Runs from the bench's context, like the RTOS timer task
+static void OnNodeScanTimer(void* argument)
+{
+    (void) argument;
+    dummy.ScanJoints();
+}
+
+
+static void Boot(const SimCanPort_t* _port, uint32_t _bitrate, uint64_t _serial, uint8_t _storedId)
+{
+    (void) _serial;
+    (void) _storedId;
+
+    SimHalAttach(CAN1, _port, _bitrate);
+    MX_CAN1_Init();
+    StartCanServer(CAN1);
+    dummy.Init();
+
+    osTimerId_t nodeScanTimer = osTimerNew(OnNodeScanTimer, osTimerPeriodic, nullptr, nullptr);
+    osTimerStart(nodeScanTimer, 500);
+
+    SimOsRunReady();
+}
+
+
+static void Receive(const SimCanFrame_t* _frame, uint64_t _timeNs)
+{
+    SimOsRunUntil(_timeNs);
+    SimHalReceive(CAN1, _frame);
+}
+
+
+static void TxComplete(const SimCanFrame_t* _frame, uint64_t _timeNs)
+{
+    SimOsRunUntil(_timeNs);
+    SimHalTxComplete(CAN1, _frame);
+}
+
+
+static void RunUntil(uint64_t _timeNs)
+{
+    SimOsRunUntil(_timeNs);
+}
+
+
+static void SetEnable(bool _enable)
+{
+    dummy.SetEnable(_enable);
+    SimOsRunReady();
+}
+
+
+static void SetGroupSync(bool _groupSync)
+{
+    dummy.groupSync = _groupSync;
+}
+
+
+static void SetStateBroadcastPeriod(uint32_t _ms)
+{
+    dummy.SetStateBroadcastPeriod(_ms);
+    SimOsRunReady();
+}
+
+
+// What ThreadControlLoopFixUpdate does each tick in COMMAND_CONTINUES_TRAJECTORY
+static void MoveJoints(const float* _angles)
+{
+    DOF6Kinematic::Joint6D_t joints;
+    for (int j = 0; j < 6; j++)
+        joints.a[j] = _angles[j] + dummy.initPose.a[j];
+
+    dummy.MoveJoints(joints);
+    dummy.UpdateJointPose6D();
+    SimOsRunReady();
+}
+
+
+static void GetStats(SimCoreStats_t* _stats)
+{
+    CAN_context* ctx = get_can_ctx(&hcan1);
+
+    uint32_t pending = 3 - HAL_CAN_GetTxMailboxesFreeLevel(&hcan1);
+    for (auto &queue : ctx->tx_queue)
+        pending += queue.head - queue.tail;
+
+    _stats->tx_pending = pending;
+    _stats->tx_dropped = ctx->tx_dropped_cnt;
+    _stats->rx_dropped = ctx->rx_dropped_cnt;
+    _stats->fifo_overruns = SimHalFifoOverruns(CAN1);
+    _stats->can_errors = ctx->unexpected_errors + errorCount;
+    _stats->joints_online = dummy.jointsOnline;
+}
+
+
+extern "C" const SimCoreApi_t* SimCoreNode(void)
+{
+    static const SimCoreApi_t api = {
+        .node = {
+            .boot = Boot,
+            .receive = Receive,
+            .tx_complete = TxComplete,
+            .run_until = RunUntil
+        },
+        .set_enable = SetEnable,
+        .set_group_sync = SetGroupSync,
+        .set_state_broadcast_period = SetStateBroadcastPeriod,
+        .move_joints = MoveJoints,
+        .get_stats = GetStats
+    };
+
+    return &api;
+}
@@ -0,0 +1,156 @@
+/*
+ * One stepper driver board: the driver firmware's can.c, interface_can.cpp
+ * and node_id.cpp as they ship, on the HAL shim, with Motor-Sim's MotorRig
+ * for everything behind them. The node does what the board's Main(), its
+ * 20kHz timer interrupt and its main loop do around those files.
+ *
+ * A reboot (0x7F, or the calibrator) restarts the rig and re-runs the CAN
+ * setup, the CAN layer's file statics survive it, unlike on the board.
+ */
+
+#define SIM_DRIVER_NODE
+
+#include <memory>
+
+#include "common_inc.h"
+#include "configurations.h"
+#include "can.h"
+#include "hal_sim.hpp"
+#include "motor_sim/motor_rig.hpp"
+
+using motor_sim::MotorRig;
+
+static std::unique_ptr<MotorRig> rig;
+static TickProfiler profiler;
+static uint64_t serial = 0;
+static uint32_t bootCount = 0;
+static uint64_t nextTickNs = 0;
+static uint32_t errorCount = 0;
+
+
+Motor* SimBoardMotor()
+{ return &rig->motor(); }
+
+MT6816* SimBoardEncoder()
+{ return &rig->encoder(); }
+
+EncoderCalibrator* SimBoardCalibrator()
+{ return &rig->calibrator(); }
+
+TickProfiler* SimBoardProfiler()
+{ return &profiler; }
+
+
+// The board would stop here for good, keep count instead
+extern "C" void Error_Handler(void)
+{
+    errorCount++;
+}
+
+
+// What the Cube main() and Main() do for CAN before the loop starts
+static void StartCan()
+{
+    SimHalReset(CAN1);
+    MX_CAN_Init();
+    InitNodeId(serial);
+    InitCanCodec();
+}
+
+
+static void Boot(const SimCanPort_t* _port, uint32_t _bitrate, uint64_t _serial, uint8_t _storedId)
+{
+    SimHalAttach(CAN1, _port, _bitrate);
+    serial = _serial;
+
+    rig = std::make_unique<MotorRig>();
+    rig->config.canNodeId = _storedId;
+    rig->pipelined_read = true;
+    rig->load_ideal_calibration();
+    bootCount = rig->boot_count();
+    profiler.Init(rig->motor().motionPlanner.CONTROL_FREQUENCY);
+
+    StartCan();
+}
+
+
+static void Receive(const SimCanFrame_t* _frame, uint64_t _timeNs)
+{
+    SimHalSetTime(_timeNs);
+    rig->interrupt([&] { SimHalReceive(CAN1, _frame); });
+}
+
+
+static void TxComplete(const SimCanFrame_t* _frame, uint64_t _timeNs)
+{
+    SimHalSetTime(_timeNs);
+    rig->interrupt([&] { SimHalTxComplete(CAN1, _frame); });
+}
+
+
+static void RunUntil(uint64_t _timeNs)
+{
+    while (nextTickNs <= _timeNs)
+    {
+        SimHalSetTime(nextTickNs);
+
+        // Tim4Callback20kHz(), the rig's tick runs the main loop's
+        // calibrator and auto-tune steps as well
+        profiler.Begin();
+        rig->tick();
+        rig->interrupt([] { TickStateBroadcast20kHz(); });
+        profiler.End();
+        if (rig->boot_count() != bootCount)
+        {
+            bootCount = rig->boot_count();
+            StartCan();
+        }
+
+        // The rest of Main()'s loop, the rig's config is its EEPROM. A
+        // restore reboots with the stored config, the rig keeps no defaults.
+        rig->interrupt([]
+                       {
+                           UpdateNodeId();
+                           SendCollisionReport();
+                           SendStateBroadcast();
+                       });
+        if (boardConfig.configStatus == CONFIG_COMMIT)
+        {
+            boardConfig.configStatus = CONFIG_OK;
+            rig->config = boardConfig;
+        }
+
+        nextTickNs += (uint64_t) (MotorRig::TICK_S * 1e9 + 0.5);
+    }
+
+    SimHalSetTime(_timeNs);
+}
+
+
+static uint8_t NodeId()
+{
+    return GetNodeId();
+}
+
+
+static uint32_t ErrorCount()
+{
+    return errorCount;
+}
+
+
+extern "C" const SimDriverApi_t* SimDriverNode(void)
+{
+    static const SimDriverApi_t api = {
+        .node = {
+            .boot = Boot,
+            .receive = Receive,
+            .tx_complete = TxComplete,
+            .run_until = RunUntil
+        },
+        .node_id = NodeId,
+        .error_count = ErrorCount
+    };
+
+    return &api;
+}
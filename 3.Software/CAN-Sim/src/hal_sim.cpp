@@ -0,0 +1,497 @@
+#include "hal_sim.hpp"
+
+#include <cstring>
+
+/*
+ * bxCAN as the HAL drives it: three TX mailboxes, two 3-deep RX FIFOs with
+ * their filter banks, and the interrupts that come with them, called
+ * straight from the bus events. A frame goes to the port when it's loaded
+ * into a mailbox, the bus arbitrates between the ports.
+ *
+ * Not modelled: the bus retries a frame that lost arbitration or hit an
+ * error until it gets through, like a controller with automatic
+ * retransmission. Both boards run with it disabled (NART), so on the
+ * hardware such a frame fails with ALST/TERR instead.
+ */
+
+CAN_TypeDef simCan1Regs;
+CAN_TypeDef simCan2Regs;
+
+#define FILTER_BANK_COUNT 28
+#define RX_FIFO_DEPTH 3
+
+struct Mailbox_t
+{
+    bool busy;
+    uint32_t loadOrder;
+    SimCanFrame_t frame;
+};
+
+struct RxFifo_t
+{
+    CAN_RxHeaderTypeDef headers[RX_FIFO_DEPTH];
+    uint8_t data[RX_FIFO_DEPTH][8];
+    uint8_t first;
+    uint8_t level;
+};
+
+struct Controller_t
+{
+    CAN_HandleTypeDef* handle;
+    SimCanPort_t port;
+    bool attached;
+    bool started;
+    uint32_t interrupts;
+    Mailbox_t mailboxes[3];
+    uint32_t loadCount;
+    RxFifo_t fifos[2];
+    uint32_t fifoOverruns;
+};
+
+static Controller_t controllers[2];
+// Shared by both controllers, CAN2's banks start at slaveStartBank
+static CAN_FilterTypeDef filters[FILTER_BANK_COUNT];
+static uint32_t slaveStartBank = 14;
+static uint32_t busBitrate = 1000000;
+static uint64_t nowNs = 0;
+
+
+static Controller_t &GetController(CAN_TypeDef* _instance)
+{
+    return controllers[_instance == CAN2 ? 1 : 0];
+}
+
+
+static bool IsStarted(CAN_HandleTypeDef* _hcan)
+{
+    if (_hcan->Instance != CAN1 && _hcan->Instance != CAN2)
+        return false;
+    return GetController(_hcan->Instance).started;
+}
+
+
+void SimHalAttach(CAN_TypeDef* _instance, const SimCanPort_t* _port, uint32_t _bitrate)
+{
+    Controller_t &controller = GetController(_instance);
+    controller.port = *_port;
+    controller.attached = true;
+    busBitrate = _bitrate;
+}
+
+
+void SimHalReset(CAN_TypeDef* _instance)
+{
+    Controller_t &controller = GetController(_instance);
+    SimCanPort_t port = controller.port;
+    bool attached = controller.attached;
+    controller = Controller_t{};
+    controller.port = port;
+    controller.attached = attached;
+
+    uint32_t first = _instance == CAN2 ? slaveStartBank : 0;
+    uint32_t end = _instance == CAN2 ? FILTER_BANK_COUNT : slaveStartBank;
+    for (uint32_t bank = first; bank < end; bank++)
+        filters[bank] = CAN_FilterTypeDef{};
+    memset(_instance, 0, sizeof(CAN_TypeDef));
+}
+
+
+void SimHalSetTime(uint64_t _timeNs)
+{
+    if (_timeNs > nowNs)
+        nowNs = _timeNs;
+}
+
+
+uint64_t SimHalTimeNs()
+{
+    return nowNs;
+}
+
+
+extern "C" uint32_t HAL_GetTick(void)
+{
+    return (uint32_t) (nowNs / 1000000);
+}
+
+
+// The clock that gives the bus' bitrate with the bit timing CAN1 was set up with
+extern "C" uint32_t HAL_RCC_GetPCLK1Freq(void)
+{
+    uint32_t btr = CAN1->BTR;
+    uint32_t prescaler = (btr & CAN_BTR_BRP) + 1;
+    uint32_t quanta = 1 + ((btr & CAN_BTR_TS1) >> CAN_BTR_TS1_Pos) + 1 + ((btr & CAN_BTR_TS2) >> CAN_BTR_TS2_Pos) + 1;
+
+    return busBitrate * prescaler * quanta;
+}
+
+
+/* Filters -------------------------------------------------------------------*/
+
+static bool MatchFilter(const CAN_FilterTypeDef &_filter, const SimCanFrame_t &_frame)
+{
+    uint32_t ide = _frame.extended ? CAN_ID_EXT : CAN_ID_STD;
+    uint32_t rtr = _frame.remote ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+
+    if (_filter.FilterScale == CAN_FILTERSCALE_32BIT)
+    {
+        // STDID[10:0] EXTID[17:0] IDE RTR 0
+        uint32_t word = _frame.extended ? _frame.id << 3 : _frame.id << 21;
+        word |= ide | rtr;
+        uint32_t id = _filter.FilterIdHigh << 16 | (_filter.FilterIdLow & 0xFFFF);
+        uint32_t mask = _filter.FilterMaskIdHigh << 16 | (_filter.FilterMaskIdLow & 0xFFFF);
+
+        if (_filter.FilterMode == CAN_FILTERMODE_IDMASK)
+            return (word & mask) == (id & mask);
+        return word == id || word == mask;
+    }
+
+    // STDID[10:0] RTR IDE EXTID[17:15]
+    uint32_t stdId = _frame.extended ? _frame.id >> 18 : _frame.id;
+    uint32_t word = (stdId & 0x7FF) << 5 | (rtr ? 1U << 4 : 0) | (ide ? 1U << 3 : 0);
+    if (_frame.extended)
+        word |= (_frame.id >> 15) & 0x7;
+    const uint32_t values[4] = {_filter.FilterIdLow & 0xFFFF, _filter.FilterMaskIdLow & 0xFFFF,
+                                _filter.FilterIdHigh & 0xFFFF, _filter.FilterMaskIdHigh & 0xFFFF};
+
+    if (_filter.FilterMode == CAN_FILTERMODE_IDMASK)
+        return (word & values[1]) == (values[0] & values[1]) ||
+               (word & values[3]) == (values[2] & values[3]);
+    for (uint32_t value : values)
+        if (word == value)
+            return true;
+    return false;
+}
+
+
+// Lowest matching bank wins, -1 if the frame is dropped
+static int FilterFrame(CAN_TypeDef* _instance, const SimCanFrame_t &_frame, uint32_t* _fifo)
+{
+    uint32_t first = _instance == CAN2 ? slaveStartBank : 0;
+    uint32_t end = _instance == CAN2 ? FILTER_BANK_COUNT : slaveStartBank;
+
+    for (uint32_t bank = first; bank < end; bank++)
+    {
+        if (filters[bank].FilterActivation != ENABLE || !MatchFilter(filters[bank], _frame))
+            continue;
+        *_fifo = filters[bank].FilterFIFOAssignment;
+        return (int) bank;
+    }
+
+    return -1;
+}
+
+
+/* HAL -----------------------------------------------------------------------*/
+
+extern "C" HAL_StatusTypeDef HAL_CAN_Init(CAN_HandleTypeDef* hcan)
+{
+    if (hcan == nullptr || (hcan->Instance != CAN1 && hcan->Instance != CAN2))
+        return HAL_ERROR;
+
+    HAL_CAN_MspInit(hcan);
+
+    Controller_t &controller = GetController(hcan->Instance);
+    controller.handle = hcan;
+    hcan->Instance->BTR = (hcan->Init.Prescaler - 1) | hcan->Init.TimeSeg1 | hcan->Init.TimeSeg2 |
+                          hcan->Init.SyncJumpWidth;
+    hcan->ErrorCode = HAL_CAN_ERROR_NONE;
+    hcan->State = HAL_CAN_STATE_READY;
+
+    return HAL_OK;
+}
+
+
+extern "C" HAL_StatusTypeDef HAL_CAN_ConfigFilter(CAN_HandleTypeDef* hcan, CAN_FilterTypeDef* sFilterConfig)
+{
+    if (sFilterConfig->FilterBank >= FILTER_BANK_COUNT)
+    {
+        hcan->ErrorCode |= HAL_CAN_ERROR_PARAM;
+        return HAL_ERROR;
+    }
+
+    slaveStartBank = sFilterConfig->SlaveStartFilterBank;
+    filters[sFilterConfig->FilterBank] = *sFilterConfig;
+
+    return HAL_OK;
+}
+
+
+extern "C" HAL_StatusTypeDef HAL_CAN_Start(CAN_HandleTypeDef* hcan)
+{
+    if (hcan->State != HAL_CAN_STATE_READY)
+    {
+        hcan->ErrorCode |= HAL_CAN_ERROR_NOT_READY;
+        return HAL_ERROR;
+    }
+
+    GetController(hcan->Instance).started = true;
+    hcan->State = HAL_CAN_STATE_LISTENING;
+    hcan->ErrorCode = HAL_CAN_ERROR_NONE;
+
+    return HAL_OK;
+}
+
+
+extern "C" HAL_StatusTypeDef HAL_CAN_ActivateNotification(CAN_HandleTypeDef* hcan, uint32_t ActiveITs)
+{
+    GetController(hcan->Instance).interrupts |= ActiveITs;
+    hcan->Instance->IER |= ActiveITs;
+
+    return HAL_OK;
+}
+
+
+extern "C" HAL_StatusTypeDef HAL_CAN_AddTxMessage(CAN_HandleTypeDef* hcan, CAN_TxHeaderTypeDef* pHeader,
+                                                  uint8_t aData[], uint32_t* pTxMailbox)
+{
+    if (!IsStarted(hcan))
+    {
+        hcan->ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+        return HAL_ERROR;
+    }
+
+    // The hardware offers the lowest empty mailbox
+    Controller_t &controller = GetController(hcan->Instance);
+    int index = -1;
+    for (int i = 0; i < 3 && index < 0; i++)
+        if (!controller.mailboxes[i].busy)
+            index = i;
+    if (index < 0)
+    {
+        hcan->ErrorCode |= HAL_CAN_ERROR_PARAM;
+        return HAL_ERROR;
+    }
+
+    Mailbox_t &mailbox = controller.mailboxes[index];
+    mailbox = Mailbox_t{};
+    mailbox.busy = true;
+    mailbox.loadOrder = controller.loadCount++;
+    mailbox.frame.extended = pHeader->IDE == CAN_ID_EXT;
+    mailbox.frame.remote = pHeader->RTR == CAN_RTR_REMOTE;
+    mailbox.frame.id = mailbox.frame.extended ? pHeader->ExtId : pHeader->StdId;
+    mailbox.frame.dlc = pHeader->DLC > 8 ? 8 : (uint8_t) pHeader->DLC;
+    if (!mailbox.frame.remote)
+        memcpy(mailbox.frame.data, aData, mailbox.frame.dlc);
+    hcan->Instance->sTxMailBox[index].TIR |= CAN_TI0R_TXRQ;
+    *pTxMailbox = 1U << index;
+
+    if (controller.attached)
+        controller.port.transmit(controller.port.ctx, &mailbox.frame);
+
+    return HAL_OK;
+}
+
+
+extern "C" uint32_t HAL_CAN_GetTxMailboxesFreeLevel(CAN_HandleTypeDef* hcan)
+{
+    uint32_t free = 0;
+    for (const Mailbox_t &mailbox : GetController(hcan->Instance).mailboxes)
+        if (!mailbox.busy)
+            free++;
+
+    return free;
+}
+
+
+extern "C" HAL_StatusTypeDef HAL_CAN_GetRxMessage(CAN_HandleTypeDef* hcan, uint32_t RxFifo,
+                                                  CAN_RxHeaderTypeDef* pHeader, uint8_t aData[])
+{
+    RxFifo_t &fifo = GetController(hcan->Instance).fifos[RxFifo == CAN_RX_FIFO1 ? 1 : 0];
+    if (fifo.level == 0)
+    {
+        hcan->ErrorCode |= HAL_CAN_ERROR_PARAM;
+        return HAL_ERROR;
+    }
+
+    *pHeader = fifo.headers[fifo.first];
+    memcpy(aData, fifo.data[fifo.first], 8);
+    fifo.first = (fifo.first + 1) % RX_FIFO_DEPTH;
+    fifo.level--;
+
+    return HAL_OK;
+}
+
+
+extern "C" uint32_t HAL_CAN_GetError(CAN_HandleTypeDef* hcan)
+{
+    return hcan->ErrorCode;
+}
+
+
+extern "C" HAL_StatusTypeDef HAL_CAN_ResetError(CAN_HandleTypeDef* hcan)
+{
+    hcan->ErrorCode = HAL_CAN_ERROR_NONE;
+    return HAL_OK;
+}
+
+
+/* Bus events ----------------------------------------------------------------*/
+
+void SimHalReceive(CAN_TypeDef* _instance, const SimCanFrame_t* _frame)
+{
+    Controller_t &controller = GetController(_instance);
+    CAN_HandleTypeDef* hcan = controller.handle;
+    uint32_t fifoIndex;
+    if (!controller.started || hcan == nullptr)
+        return;
+    int bank = FilterFrame(_instance, *_frame, &fifoIndex);
+    if (bank < 0)
+        return;
+
+    bool fifo1 = fifoIndex == CAN_RX_FIFO1;
+    RxFifo_t &fifo = controller.fifos[fifo1 ? 1 : 0];
+    uint32_t slot;
+    if (fifo.level == RX_FIFO_DEPTH)
+    {
+        // Not locked: the newest message is overwritten
+        slot = (fifo.first + RX_FIFO_DEPTH - 1) % RX_FIFO_DEPTH;
+        controller.fifoOverruns++;
+        if (controller.interrupts & (fifo1 ? CAN_IT_RX_FIFO1_OVERRUN : CAN_IT_RX_FIFO0_OVERRUN))
+        {
+            hcan->ErrorCode |= fifo1 ? HAL_CAN_ERROR_RX_FOV1 : HAL_CAN_ERROR_RX_FOV0;
+            HAL_CAN_ErrorCallback(hcan);
+        }
+    } else
+    {
+        slot = (fifo.first + fifo.level) % RX_FIFO_DEPTH;
+        fifo.level++;
+    }
+
+    CAN_RxHeaderTypeDef &header = fifo.headers[slot];
+    header = CAN_RxHeaderTypeDef{};
+    header.IDE = _frame->extended ? CAN_ID_EXT : CAN_ID_STD;
+    header.RTR = _frame->remote ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+    if (_frame->extended)
+        header.ExtId = _frame->id;
+    else
+        header.StdId = _frame->id;
+    header.DLC = _frame->dlc;
+    header.FilterMatchIndex = (uint32_t) bank;
+    memset(fifo.data[slot], 0, 8);
+    memcpy(fifo.data[slot], _frame->data, _frame->dlc > 8 ? 8 : _frame->dlc);
+
+    if (fifo.level == RX_FIFO_DEPTH && (controller.interrupts & (fifo1 ? CAN_IT_RX_FIFO1_FULL : CAN_IT_RX_FIFO0_FULL)))
+    {
+        if (fifo1)
+            HAL_CAN_RxFifo1FullCallback(hcan);
+        else
+            HAL_CAN_RxFifo0FullCallback(hcan);
+    }
+
+    // The interrupt stays pending while the FIFO holds messages, stop if the
+    // callback leaves them there instead of re-entering forever
+    if (controller.interrupts & (fifo1 ? CAN_IT_RX_FIFO1_MSG_PENDING : CAN_IT_RX_FIFO0_MSG_PENDING))
+    {
+        while (fifo.level > 0)
+        {
+            uint8_t level = fifo.level;
+            if (fifo1)
+                HAL_CAN_RxFifo1MsgPendingCallback(hcan);
+            else
+                HAL_CAN_RxFifo0MsgPendingCallback(hcan);
+            if (fifo.level >= level)
+                break;
+        }
+    }
+
+    SimAfterInterrupt();
+}
+
+
+void SimHalTxComplete(CAN_TypeDef* _instance, const SimCanFrame_t* _frame)
+{
+    Controller_t &controller = GetController(_instance);
+    CAN_HandleTypeDef* hcan = controller.handle;
+
+    // Identical frames leave in the order they were loaded
+    int index = -1;
+    for (int i = 0; i < 3; i++)
+    {
+        const Mailbox_t &mailbox = controller.mailboxes[i];
+        if (!mailbox.busy || mailbox.frame.id != _frame->id || mailbox.frame.extended != _frame->extended ||
+            mailbox.frame.remote != _frame->remote || mailbox.frame.dlc != _frame->dlc ||
+            memcmp(mailbox.frame.data, _frame->data, mailbox.frame.dlc) != 0)
+            continue;
+        if (index < 0 || mailbox.loadOrder < controller.mailboxes[index].loadOrder)
+            index = i;
+    }
+    // Loaded before a reset
+    if (index < 0 || hcan == nullptr)
+        return;
+
+    controller.mailboxes[index].busy = false;
+    _instance->sTxMailBox[index].TIR &= ~CAN_TI0R_TXRQ;
+    if (controller.interrupts & CAN_IT_TX_MAILBOX_EMPTY)
+    {
+        if (index == 0)
+            HAL_CAN_TxMailbox0CompleteCallback(hcan);
+        else if (index == 1)
+            HAL_CAN_TxMailbox1CompleteCallback(hcan);
+        else
+            HAL_CAN_TxMailbox2CompleteCallback(hcan);
+    }
+
+    SimAfterInterrupt();
+}
+
+
+uint32_t SimHalFifoOverruns(CAN_TypeDef* _instance)
+{
+    return GetController(_instance).fifoOverruns;
+}
+
+
+/* Weak defaults -------------------------------------------------------------*/
+
+extern "C" {
+
+__attribute__((weak)) void SimAfterInterrupt()
+{}
+
+__attribute__((weak)) void HAL_CAN_MspInit(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_MspDeInit(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_TxMailbox0AbortCallback(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_TxMailbox1AbortCallback(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_TxMailbox2AbortCallback(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_RxFifo0FullCallback(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_RxFifo1MsgPendingCallback(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_RxFifo1FullCallback(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_SleepCallback(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_WakeUpFromRxMsgCallback(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+__attribute__((weak)) void HAL_CAN_ErrorCallback(CAN_HandleTypeDef* hcan)
+{ (void) hcan; }
+
+}
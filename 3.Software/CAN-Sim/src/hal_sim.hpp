@@ -0,0 +1,35 @@
+#ifndef CAN_SIM_HAL_SIM_HPP
+#define CAN_SIM_HAL_SIM_HPP
+
+// The node side of the HAL shim: time, and the bus events that raise the
+// controller's interrupts.
+
+#include "can_sim/sim_node.h"
+#include "stm32_hal_sim.h"
+
+// @brief Connects a controller to the bus. bitrate is what the bus runs at,
+// HAL_RCC_GetPCLK1Freq() follows from it and the controller's bit timing.
+void SimHalAttach(CAN_TypeDef* instance, const SimCanPort_t* port, uint32_t bitrate);
+
+// @brief Powers the controller off: mailboxes, FIFOs and filters cleared,
+// the port stays.
+void SimHalReset(CAN_TypeDef* instance);
+
+// Time only moves forward, an earlier time is ignored
+void SimHalSetTime(uint64_t timeNs);
+uint64_t SimHalTimeNs();
+
+// @brief Frame from another node: filtered into a FIFO, then the RX interrupts.
+void SimHalReceive(CAN_TypeDef* instance, const SimCanFrame_t* frame);
+
+// @brief One of our frames made it: frees its mailbox, then the TX interrupt.
+void SimHalTxComplete(CAN_TypeDef* instance, const SimCanFrame_t* frame);
+
+uint32_t SimHalFifoOverruns(CAN_TypeDef* instance);
+
+// @brief Called after every interrupt, where a higher priority task that
+// was woken would run. The default does nothing, the Core's RTOS shim
+// runs its tasks.
+extern "C" void SimAfterInterrupt();
+
+#endif
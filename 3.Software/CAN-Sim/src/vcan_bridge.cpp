@@ -0,0 +1,115 @@
+#include "can_sim/vcan_bridge.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef __linux__
+
+#include <linux/can.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace can_sim
+{
+
+VcanBridge::VcanBridge(VirtualCanBus &bus, const std::string &interface) :
+    bus_(bus)
+{
+    fd_ = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK, CAN_RAW);
+    if (fd_ < 0)
+        throw std::system_error(errno, std::generic_category(), "socket(PF_CAN)");
+
+    struct ifreq ifr = {};
+    strncpy(ifr.ifr_name, interface.c_str(), IFNAMSIZ - 1);
+    if (ioctl(fd_, SIOCGIFINDEX, &ifr) < 0)
+    {
+        int err = errno;
+        close(fd_);
+        throw std::system_error(err, std::generic_category(), "SIOCGIFINDEX " + interface);
+    }
+
+    struct sockaddr_can addr = {};
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(fd_, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+    {
+        int err = errno;
+        close(fd_);
+        throw std::system_error(err, std::generic_category(), "bind " + interface);
+    }
+
+    // Frames from the interface enter through their own port, so they
+    // arbitrate like any other node and aren't echoed back out
+    port_ = bus_.attach("vcan:" + interface, nullptr);
+
+    bus_.add_tap([this](int sender, const Frame &frame, uint64_t)
+                 {
+                     if (sender == port_)
+                         return;
+                     struct can_frame out = {};
+                     out.can_id = frame.extended ? (frame.id & CAN_EFF_MASK) | CAN_EFF_FLAG : frame.id & CAN_SFF_MASK;
+                     if (frame.remote)
+                         out.can_id |= CAN_RTR_FLAG;
+                     out.can_dlc = frame.dlc > 8 ? 8 : frame.dlc;
+                     memcpy(out.data, frame.data, out.can_dlc);
+                     // Best effort: a full socket buffer only loses the mirror copy
+                     if (write(fd_, &out, sizeof(out)) < 0)
+                         dropped_++;
+                 });
+}
+
+VcanBridge::~VcanBridge()
+{
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+int VcanBridge::poll()
+{
+    int count = 0;
+    struct can_frame in;
+
+    while (read(fd_, &in, sizeof(in)) == (ssize_t) sizeof(in))
+    {
+        if (in.can_id & CAN_ERR_FLAG)
+            continue;
+
+        Frame frame;
+        frame.extended = in.can_id & CAN_EFF_FLAG;
+        frame.remote = in.can_id & CAN_RTR_FLAG;
+        frame.id = in.can_id & (frame.extended ? CAN_EFF_MASK : CAN_SFF_MASK);
+        frame.dlc = in.can_dlc > 8 ? 8 : in.can_dlc;
+        memcpy(frame.data, in.data, frame.dlc);
+        bus_.send(port_, frame);
+        count++;
+    }
+
+    return count;
+}
+
+}
+
+#else
+
+namespace can_sim
+{
+
+VcanBridge::VcanBridge(VirtualCanBus &bus, const std::string &interface) :
+    bus_(bus), port_(-1)
+{
+    (void) interface;
+    throw std::runtime_error("SocketCAN is only available on Linux");
+}
+
+VcanBridge::~VcanBridge() = default;
+
+int VcanBridge::poll()
+{ return 0; }
+
+}
+
+#endif
@@ -0,0 +1,298 @@
+#include "can_sim/virtual_can_bus.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace can_sim
+{
+
+static const size_t MAILBOX_COUNT = 3;
+
+// Fixed recessive tail: CRC delimiter, ACK slot and delimiter, EOF, intermission
+static const uint32_t FRAME_TAIL_BITS = 1 + 2 + 7 + 3;
+// Error flag, worst-case superposition, delimiter and intermission
+static const uint32_t ERROR_FRAME_BITS = 6 + 6 + 8 + 3;
+
+
+/* Frame timing --------------------------------------------------------------*/
+
+static void push_bits(std::vector<bool> &bits, uint32_t value, int count)
+{
+    for (int i = count - 1; i >= 0; i--)
+        bits.push_back((value >> i) & 1);
+}
+
+static uint16_t crc15(const std::vector<bool> &bits)
+{
+    uint16_t crc = 0;
+    for (bool bit : bits)
+    {
+        bool top = ((crc >> 14) & 1) ^ bit;
+        crc = (crc << 1) & 0x7FFF;
+        if (top)
+            crc ^= 0x4599;
+    }
+    return crc;
+}
+
+uint32_t frame_bits(const Frame &frame)
+{
+    std::vector<bool> bits;
+    bits.reserve(160);
+
+    bits.push_back(false); // SOF
+    if (frame.extended)
+    {
+        push_bits(bits, frame.id >> 18, 11);
+        bits.push_back(true);  // SRR
+        bits.push_back(true);  // IDE
+        push_bits(bits, frame.id & 0x3FFFF, 18);
+        bits.push_back(frame.remote);
+        push_bits(bits, 0, 2); // r1, r0
+    } else
+    {
+        push_bits(bits, frame.id & 0x7FF, 11);
+        bits.push_back(frame.remote);
+        push_bits(bits, 0, 2); // IDE, r0
+    }
+    uint8_t dlc = std::min<uint8_t>(frame.dlc, 8);
+    push_bits(bits, dlc, 4);
+    if (!frame.remote)
+        for (uint8_t i = 0; i < dlc; i++)
+            push_bits(bits, frame.data[i], 8);
+    push_bits(bits, crc15(bits), 15);
+
+    // A stuff bit follows every five equal bits and starts the next run itself
+    uint32_t stuffBits = 0;
+    int run = 0;
+    bool last = !bits[0];
+    for (bool bit : bits)
+    {
+        if (bit == last)
+            run++;
+        else
+        {
+            last = bit;
+            run = 1;
+        }
+        if (run == 5)
+        {
+            stuffBits++;
+            last = !bit;
+            run = 1;
+        }
+    }
+
+    return (uint32_t) bits.size() + stuffBits + FRAME_TAIL_BITS;
+}
+
+// Order in which frames win arbitration, lower first: the base ID, then
+// RTR/SRR and IDE, so a data frame beats a remote or extended frame that
+// shares its base ID.
+static uint64_t arbitration_key(const Frame &frame)
+{
+    if (frame.extended)
+        return (uint64_t) (frame.id >> 18) << 21 | 1u << 20 | 1u << 19 |
+               (uint64_t) (frame.id & 0x3FFFF) << 1 | frame.remote;
+    return (uint64_t) (frame.id & 0x7FF) << 21 | (uint64_t) frame.remote << 20;
+}
+
+
+/* VirtualCanBus -------------------------------------------------------------*/
+
+VirtualCanBus::VirtualCanBus(uint32_t bitrate) :
+    bitrate_(bitrate)
+{
+    if (bitrate == 0)
+        throw std::invalid_argument("bitrate must not be 0");
+}
+
+int VirtualCanBus::attach(const std::string &name, RxHandler handler, Filter filter,
+                          bool fifo_order, size_t queue_size)
+{
+    Port_t port;
+    port.name = name;
+    port.handler = std::move(handler);
+    port.filter = std::move(filter);
+    port.fifo_order = fifo_order;
+    port.queue_size = queue_size;
+    port.stats = {};
+    ports_.push_back(std::move(port));
+
+    return (int) ports_.size() - 1;
+}
+
+void VirtualCanBus::add_tap(Tap tap)
+{
+    taps_.push_back(std::move(tap));
+}
+
+bool VirtualCanBus::send(int port, const Frame &frame, bool urgent)
+{
+    Port_t &p = ports_.at(port);
+    if (p.queue.size() >= p.queue_size)
+    {
+        p.stats.tx_dropped_cnt++;
+        return false;
+    }
+
+    if (urgent)
+        p.queue.push_front({frame, now_});
+    else
+        p.queue.push_back({frame, now_});
+    refill(p);
+
+    size_t total = 0;
+    for (auto &q : ports_)
+        total += q.queue.size() + q.mailboxes.size();
+    stats_.max_pending = std::max(stats_.max_pending, total);
+
+    return true;
+}
+
+void VirtualCanBus::refill(Port_t &port)
+{
+    while (port.mailboxes.size() < MAILBOX_COUNT && !port.queue.empty())
+    {
+        port.mailboxes.push_back(port.queue.front());
+        port.queue.pop_front();
+    }
+}
+
+int VirtualCanBus::arbitrate(size_t* mailbox)
+{
+    int winner = -1;
+    uint64_t winnerKey = UINT64_MAX;
+
+    for (size_t p = 0; p < ports_.size(); p++)
+    {
+        auto &boxes = ports_[p].mailboxes;
+        if (boxes.empty())
+            continue;
+
+        // Which mailbox this controller offers to the bus
+        size_t best = 0;
+        if (!ports_[p].fifo_order)
+            for (size_t m = 1; m < boxes.size(); m++)
+                if (arbitration_key(boxes[m].frame) < arbitration_key(boxes[best].frame))
+                    best = m;
+
+        uint64_t key = arbitration_key(boxes[best].frame);
+        if (key < winnerKey)
+        {
+            winnerKey = key;
+            winner = (int) p;
+            *mailbox = best;
+        }
+    }
+
+    return winner;
+}
+
+void VirtualCanBus::transmit_one()
+{
+    size_t mailbox = 0;
+    int winner = arbitrate(&mailbox);
+    if (winner < 0)
+        return;
+
+    for (size_t p = 0; p < ports_.size(); p++)
+        if ((int) p != winner && !ports_[p].mailboxes.empty())
+            stats_.arbitration_lost_cnt++;
+
+    Port_t &sender = ports_[winner];
+    Queued_t queued = sender.mailboxes[mailbox];
+    uint32_t bits = frame_bits(queued.frame);
+
+    if (error_rate_ > 0 && uniform_(rng_) < error_rate_)
+    {
+        // Detected somewhere in the frame, on average halfway, then the error
+        // frame. The mailbox stays requested and takes part in the next round.
+        uint64_t ns = (uint64_t) (bits / 2 + ERROR_FRAME_BITS) * 1000000000ull / bitrate_;
+        now_ += ns;
+        stats_.busy_ns += ns;
+        stats_.error_cnt++;
+        return;
+    }
+
+    uint64_t ns = (uint64_t) bits * 1000000000ull / bitrate_;
+    now_ += ns;
+    stats_.busy_ns += ns;
+    stats_.frame_cnt++;
+
+    sender.mailboxes.erase(sender.mailboxes.begin() + (long) mailbox);
+    sender.stats.tx_cnt++;
+    sender.stats.max_latency_ns = std::max(sender.stats.max_latency_ns, now_ - queued.queued_ns);
+    refill(sender);
+
+    for (auto &tap : taps_)
+        tap(winner, queued.frame, now_);
+
+    // Handlers may send, which can grow ports_ but never reorders it
+    for (size_t p = 0; p < ports_.size(); p++)
+    {
+        if ((int) p == winner)
+            continue;
+        if (ports_[p].filter && !ports_[p].filter(queued.frame))
+            continue;
+        ports_[p].stats.rx_cnt++;
+        if (ports_[p].handler)
+            ports_[p].handler(queued.frame, now_);
+    }
+}
+
+void VirtualCanBus::run_until(uint64_t time_ns)
+{
+    while (now_ < time_ns)
+    {
+        size_t mailbox;
+        if (arbitrate(&mailbox) < 0)
+        {
+            now_ = time_ns;
+            return;
+        }
+        transmit_one();
+    }
+}
+
+bool VirtualCanBus::run_until_idle(uint64_t limit_ns)
+{
+    while (now_ < limit_ns)
+    {
+        size_t mailbox;
+        if (arbitrate(&mailbox) < 0)
+            return true;
+        transmit_one();
+    }
+
+    size_t mailbox;
+    return arbitrate(&mailbox) < 0;
+}
+
+void VirtualCanBus::set_error_rate(double probability, uint32_t seed)
+{
+    error_rate_ = probability;
+    rng_.seed(seed);
+}
+
+double VirtualCanBus::load() const
+{
+    uint64_t elapsed = now_ - stats_start_ns_;
+    return elapsed ? (double) stats_.busy_ns / (double) elapsed : 0;
+}
+
+size_t VirtualCanBus::pending(int port) const
+{
+    const Port_t &p = ports_.at(port);
+    return p.queue.size() + p.mailboxes.size();
+}
+
+void VirtualCanBus::reset_stats()
+{
+    stats_ = {};
+    stats_start_ns_ = now_;
+    for (auto &port : ports_)
+        port.stats = {};
+}
+
+}
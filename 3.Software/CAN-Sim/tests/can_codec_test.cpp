@@ -0,0 +1,238 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "can_codec.h"
+
+/* Private variables ---------------------------------------------------------*/
+
+static int failures = 0;
+
+/* Private function prototypes -----------------------------------------------*/
+
+static void Check(bool _ok, const char* _what);
+static void Prefill(uint8_t* _data);
+static bool AllWritten(const uint8_t* _data);
+static void TestConversions();
+static void TestFields();
+static void TestSetPoint();
+static void TestState();
+static void TestTrajectory();
+static void TestCollision();
+static void TestHeartbeat();
+
+/* Function implementations --------------------------------------------------*/
+
+// Round trips every frame of the codec the Core and the drivers share, at
+// the ends of each field's range. Packers are run on a frame full of junk so
+// a byte they forget to write shows up, that byte would go out on the wire.
+int main()
+{
+    TestConversions();
+    TestFields();
+    TestSetPoint();
+    TestState();
+    TestTrajectory();
+    TestCollision();
+    TestHeartbeat();
+
+    printf("[test] can codec %s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
+
+void TestConversions()
+{
+    Check(CanTurnsToFixed(1.5f, CAN_POSITION_FRAC_BITS, CAN_POSITION_BITS) == 3 << 15, "turns to fixed");
+    Check(CanTurnsToFixed(-0.75f / 65536, CAN_POSITION_FRAC_BITS, CAN_POSITION_BITS) == -1,
+          "turns to fixed rounds away from zero");
+    Check(CanTurnsToFixed(1000.f, CAN_POSITION_FRAC_BITS, CAN_POSITION_BITS) == (1 << 23) - 1,
+          "turns to fixed saturates high");
+    Check(CanTurnsToFixed(-1000.f, CAN_POSITION_FRAC_BITS, CAN_POSITION_BITS) == -(1 << 23),
+          "turns to fixed saturates low");
+    Check(CanFixedToTurns(-(3 << 15), CAN_POSITION_FRAC_BITS) == -1.5f, "fixed to turns");
+
+    const int32_t stepsPerTurn = 51200;
+    const CanStepScale_t position = CanMakeStepScale(stepsPerTurn, CAN_POSITION_FRAC_BITS);
+    const CanStepScale_t velocity = CanMakeStepScale(stepsPerTurn, CAN_VELOCITY_FRAC_BITS);
+    Check(CanStepsToFixed(stepsPerTurn * 3, &position, CAN_POSITION_BITS) == 3 << 16, "steps to fixed");
+    Check(CanStepsToFixed(-stepsPerTurn * 3, &position, CAN_POSITION_BITS) == -(3 << 16),
+          "negative steps to fixed");
+    Check(CanStepsToFixed(INT32_MAX, &position, CAN_POSITION_BITS) == (1 << 23) - 1 &&
+          CanStepsToFixed(INT32_MIN, &position, CAN_POSITION_BITS) == -(1 << 23), "steps to fixed saturates");
+
+    // Against the exact quotient, rounded to nearest, over the whole range
+    bool ok = true;
+    for (int64_t steps = -128LL * stepsPerTurn; steps <= 128LL * stepsPerTurn; steps += 997)
+    {
+        int64_t num = steps * (1 << CAN_POSITION_FRAC_BITS);
+        int64_t exact = (num + (num < 0 ? -stepsPerTurn : stepsPerTurn) / 2) / stepsPerTurn;
+        int64_t got = CanStepsToFixed((int32_t) steps, &position, 32);
+        ok &= got - exact <= 1 && exact - got <= 1;
+        num = steps * (1 << CAN_VELOCITY_FRAC_BITS);
+        exact = (num + (num < 0 ? -stepsPerTurn : stepsPerTurn) / 2) / stepsPerTurn;
+        got = CanStepsToFixed((int32_t) steps, &velocity, 32);
+        ok &= got - exact <= 1 && exact - got <= 1;
+    }
+    Check(ok, "steps to fixed within 1 LSB of the quotient");
+    Check(CanFixedToSteps(-(5 << 16), stepsPerTurn, CAN_POSITION_FRAC_BITS) == -5 * stepsPerTurn,
+          "fixed to steps");
+}
+
+void TestFields()
+{
+    static const int32_t values24[] = {0, 1, -1, 0x7FFFFF, -0x800000, 123456, -654321};
+    static const int32_t values32[] = {INT32_MAX, INT32_MIN, -2};
+    uint8_t data[8];
+    bool ok = true;
+    for (int32_t val : values24)
+    {
+        CanPutInt(data + 2, val, 3);
+        ok &= CanGetInt(data + 2, 3) == val;
+    }
+    Check(ok, "3-byte ints round trip, sign extended");
+    ok = true;
+    for (int32_t val : values32)
+    {
+        CanPutInt(data, val, 4);
+        ok &= CanGetInt(data, 4) == val;
+    }
+    Check(ok, "4-byte ints round trip");
+
+    // Group frames: fields packed LSB first, neighbours untouched
+    const int32_t positions[CAN_GROUP_JOINTS_PER_FRAME] = {(1 << 20) - 1, -(1 << 20), -12345};
+    memset(data, 0, sizeof(data));
+    for (uint8_t i = 0; i < CAN_GROUP_JOINTS_PER_FRAME; i++)
+        CanSetField(data, i, CAN_GROUP_POSITION_BITS, (uint32_t) positions[i]);
+    ok = true;
+    for (uint8_t i = 0; i < CAN_GROUP_JOINTS_PER_FRAME; i++)
+        ok &= CanGetSignedField(data, i, CAN_GROUP_POSITION_BITS) == positions[i];
+    Check(ok, "group positions round trip");
+    Check(!(data[7] & 0x80), "group positions leave bit 63 free");
+
+    memset(data, 0, sizeof(data));
+    for (uint8_t i = 0; i < 6; i++)
+        CanSetField(data, i, CAN_GROUP_VELOCITY_BITS, 1000 + i);
+    CanSetField(data, 2, CAN_GROUP_VELOCITY_BITS, 0x3FF);
+    ok = CanGetField(data, 2, CAN_GROUP_VELOCITY_BITS) == 0x3FF;
+    for (uint8_t i = 0; i < 6; i++)
+        if (i != 2)
+            ok &= CanGetField(data, i, CAN_GROUP_VELOCITY_BITS) == 1000u + i;
+    Check(ok, "group velocities round trip");
+}
+
+void TestSetPoint()
+{
+    uint8_t data[8];
+    CanSetPoint_t in = {-(1 << 23), (1 << 15) - 1, CAN_STATUS_NEED_ACK};
+    CanSetPoint_t out = {};
+    Prefill(data);
+    CanPackSetPoint(data, &in);
+    Check(AllWritten(data), "setpoint writes all 8 bytes");
+    Check(CanUnpackSetPoint(data, &out) && out.position == in.position && out.velocity == in.velocity &&
+          out.flags == in.flags, "setpoint round trip");
+
+    data[0] = (CAN_CODEC_VERSION + 1) << CAN_STATUS_VERSION_SHIFT;
+    Check(!CanUnpackSetPoint(data, &out), "setpoint of another codec version rejected");
+}
+
+void TestState()
+{
+    uint8_t data[8];
+    CanState_t in = {(1 << 23) - 1, -(1 << 15), -2000, CAN_STATUS_ENABLED | CAN_STATUS_FINISHED};
+    CanState_t out = {};
+    Prefill(data);
+    CanPackState(data, &in);
+    Check(AllWritten(data), "state writes all 8 bytes");
+    Check(CanUnpackState(data, &out) && out.position == in.position && out.velocity == in.velocity &&
+          out.current == in.current && out.flags == in.flags, "state round trip");
+}
+
+void TestTrajectory()
+{
+    uint8_t data[8];
+    CanTrajectoryPoint_t point = {-777777, 32767, 0xFFFF, CAN_TRAJECTORY_FLUSH | CAN_STATUS_NEED_ACK};
+    CanTrajectoryPoint_t pointOut = {};
+    Prefill(data);
+    CanPackTrajectoryPoint(data, &point);
+    Check(AllWritten(data), "trajectory point writes all 8 bytes");
+    Check(CanUnpackTrajectoryPoint(data, &pointOut) && pointOut.position == point.position &&
+          pointOut.velocity == point.velocity && pointOut.time == point.time && pointOut.flags == point.flags,
+          "trajectory point round trip");
+
+    uint32_t clock = 0;
+    Prefill(data);
+    CanPackTrajectoryClock(data, 0xFEDCBA98);
+    Check(AllWritten(data), "trajectory clock writes all 8 bytes");
+    Check(CanUnpackTrajectoryClock(data, &clock) && clock == 0xFEDCBA98, "trajectory clock round trip");
+
+    CanTrajectoryStatus_t status = {31, 0xFFFF, 0x80000001, CAN_STATUS_ENABLED};
+    CanTrajectoryStatus_t statusOut = {};
+    Prefill(data);
+    CanPackTrajectoryStatus(data, &status);
+    Check(AllWritten(data), "trajectory status writes all 8 bytes");
+    Check(CanUnpackTrajectoryStatus(data, &statusOut) && statusOut.freePoints == status.freePoints &&
+          statusOut.rejectedPoints == status.rejectedPoints && statusOut.clock == status.clock &&
+          statusOut.flags == status.flags, "trajectory status round trip");
+}
+
+void TestCollision()
+{
+    uint8_t data[8];
+    CanCollisionConfig_t config = {255, 200, 0xFFFF, 1234, true};
+    CanCollisionConfig_t configOut = {};
+    Prefill(data);
+    CanPackCollisionConfig(data, &config);
+    Check(AllWritten(data), "collision config writes all 8 bytes");
+    Check(CanUnpackCollisionConfig(data, &configOut) && configOut.threshold == config.threshold && configOut.tripTime == config.tripTime &&
+          configOut.errorFloor == config.errorFloor && configOut.currentFloor == config.currentFloor &&
+          configOut.store == config.store, "collision config round trip");
+
+    data[7] = 1;
+    Check(!CanUnpackCollisionConfig(data, &configOut), "collision config with [7] set rejected");
+    data[7] = 0;
+    data[4] = 2;
+    Check(!CanUnpackCollisionConfig(data, &configOut), "collision config with bad store rejected");
+
+    CanCollision_t collision = {-(1 << 23), 40000, -40000, CAN_STATUS_STALLED | CAN_STATUS_ENABLED};
+    CanCollision_t collisionOut = {};
+    Prefill(data);
+    CanPackCollision(data, &collision);
+    Check(AllWritten(data), "collision writes all 8 bytes");
+    Check(CanUnpackCollision(data, &collisionOut) && collisionOut.position == collision.position &&
+          collisionOut.flags == collision.flags, "collision round trip");
+    Check(collisionOut.errorDeviation == 32767 && collisionOut.currentDeviation == -32768,
+          "collision deviations saturate to 16 bits");
+}
+
+void TestHeartbeat()
+{
+    uint8_t data[8];
+    uint8_t storedId = 0;
+    Prefill(data);
+    CanPackHeartbeat(data, 0xFEDCBA987654ULL, 6);
+    Check(AllWritten(data), "heartbeat writes all 8 bytes");
+    Check(CanUnpackHeartbeat(data, &storedId) == 0xFEDCBA987654ULL && storedId == 6, "heartbeat round trip");
+}
+
+void Check(bool _ok, const char* _what)
+{
+    printf("[check] %-44s %s\n", _what, _ok ? "ok" : "FAIL");
+    if (!_ok)
+        failures++;
+}
+
+// 0xA5 is never a valid status byte and none of the values above contain it
+void Prefill(uint8_t* _data)
+{
+    memset(_data, 0xA5, 8);
+}
+
+bool AllWritten(const uint8_t* _data)
+{
+    for (int i = 0; i < 8; i++)
+        if (_data[i] == 0xA5)
+            return false;
+    return true;
+}
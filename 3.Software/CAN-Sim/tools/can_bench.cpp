@@ -0,0 +1,418 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <dlfcn.h>
+
+#include "can_sim/sim_node.h"
+#include "can_sim/virtual_can_bus.hpp"
+#include "can_sim/vcan_bridge.hpp"
+
+/* Private typedef -----------------------------------------------------------*/
+
+using Clock = std::chrono::steady_clock;
+using can_sim::Frame;
+using can_sim::VirtualCanBus;
+
+enum Mode
+{
+    MODE_GROUP_ACK,         // 0x08/0x09 group setpoint, every joint replies 0x25
+    MODE_SINGLE_ACK,        // One 0x0B per joint, each asking for a 0x25
+    MODE_GROUP_BROADCAST    // Group setpoint without ACK, drivers send 0x26 on their own
+};
+
+struct Options_t
+{
+    uint32_t bitrate = 1000000;
+    double errorRate = 0;
+    uint32_t broadcastMs = 1;
+    double seconds = 0.5;       // Simulated time per tick rate tried
+    double maxLate = 0.001;     // Fraction of ticks allowed to miss their deadline
+    std::string vcan;
+};
+
+struct Result_t
+{
+    uint32_t ticks;
+    uint32_t lateTicks;         // Replies or own frames still pending at the next tick
+    uint32_t driverErrors;      // Error_Handler() calls, a driver without a free mailbox
+    uint32_t coreTxDropped;
+    uint32_t coreRxDropped;     // Core RX task queue or hardware FIFO full
+    double busLoad;
+    double maxStateAgeMs;
+    double wallSeconds;
+};
+
+// @brief A board module, loaded fresh for every run so each one boots with
+// its globals as the firmware's startup code leaves them.
+class Module
+{
+public:
+    explicit Module(const std::string &_name)
+    {
+        std::string path = std::string(CAN_SIM_NODE_DIR) + "/" + _name + CAN_SIM_NODE_SUFFIX;
+        handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (handle == nullptr)
+            throw std::runtime_error(dlerror());
+    }
+
+    ~Module()
+    {
+        dlclose(handle);
+    }
+
+    Module(const Module &) = delete;
+    Module &operator=(const Module &) = delete;
+
+    template<typename Api_t>
+    const Api_t* Entry(const char* _symbol)
+    {
+        auto entry = (const Api_t* (*)()) dlsym(handle, _symbol);
+        if (entry == nullptr)
+            throw std::runtime_error(dlerror());
+        return entry();
+    }
+
+private:
+    void* handle;
+};
+
+// @brief Puts a module on a bus port: its controller's frames go onto the
+// bus, frames from the others come back through receive().
+class Node
+{
+public:
+    Node(VirtualCanBus &_bus, const std::string &_name, const SimNodeApi_t* _api, bool _fifoOrder) :
+        bus(_bus), api(_api)
+    {
+        port = bus.attach(_name,
+                          [this](const Frame &_frame, uint64_t _timeNs)
+                          {
+                              SimCanFrame_t frame = ToSim(_frame);
+                              api->receive(&frame, _timeNs);
+                          },
+                          nullptr, _fifoOrder);
+        simPort.ctx = this;
+        simPort.transmit = Transmit;
+    }
+
+    void Boot(uint64_t _serial, uint8_t _storedId)
+    {
+        api->boot(&simPort, bus.bitrate(), _serial, _storedId);
+    }
+
+    void TxComplete(const Frame &_frame, uint64_t _timeNs)
+    {
+        SimCanFrame_t frame = ToSim(_frame);
+        api->tx_complete(&frame, _timeNs);
+    }
+
+    void RunUntil(uint64_t _timeNs)
+    {
+        api->run_until(_timeNs);
+    }
+
+    int Port() const
+    { return port; }
+
+private:
+    VirtualCanBus &bus;
+    const SimNodeApi_t* api;
+    int port;
+    SimCanPort_t simPort = {};
+
+    static SimCanFrame_t ToSim(const Frame &_frame)
+    {
+        SimCanFrame_t frame = {_frame.id, _frame.extended, _frame.remote, _frame.dlc, {}};
+        memcpy(frame.data, _frame.data, sizeof(frame.data));
+        return frame;
+    }
+
+    // Never more than the three mailboxes' worth, the bus queue can't fill
+    static void Transmit(void* _ctx, const SimCanFrame_t* _frame)
+    {
+        auto* node = (Node*) _ctx;
+        Frame frame;
+        frame.id = _frame->id;
+        frame.extended = _frame->extended;
+        frame.remote = _frame->remote;
+        frame.dlc = _frame->dlc;
+        memcpy(frame.data, _frame->data, sizeof(frame.data));
+        node->bus.send(node->port, frame);
+    }
+};
+
+/* Private variables ---------------------------------------------------------*/
+
+static const char* modeNames[] = {"group+ack", "single+ack", "group+broadcast"};
+
+// The drivers' 20kHz tick
+static const uint64_t DRIVER_TICK_NS = 50000;
+static const int JOINT_NUM = 6;
+static const uint32_t JOINT_NODES = 0b1111110;
+// Node ID negotiation takes a second of listening and a heartbeat or two,
+// then DummyRobot::ScanJoints() has to see them
+static const uint64_t WARM_UP_LIMIT_NS = 5000000000ULL;
+
+/* Private function prototypes -----------------------------------------------*/
+
+static Result_t RunAtRate(Mode _mode, double _rate, const Options_t &_opt);
+static bool Sustained(const Result_t &_result, const Options_t &_opt);
+static double FindMaxRate(Mode _mode, const Options_t &_opt, Result_t* _best);
+
+/* Function implementations --------------------------------------------------*/
+
+// Usage: can_bench [--bitrate BPS] [--error-rate P] [--broadcast-ms MS]
+//                  [--seconds S] [--max-late FRACTION] [--vcan IFNAME]
+//
+// Puts the Core firmware's CAN server and DummyRobot and six driver
+// firmwares' CAN layers, each on a simulated motor, on one simulated bus and
+// looks for the highest control tick rate at which every tick's frames and
+// replies fit before the next tick, for each way the Core can drive the
+// joints. Every run boots the boards and lets the drivers negotiate their
+// node IDs before the ticks start. Rates are simulated time, host ticks/s is
+// how fast this process ran the whole stack. With --vcan every run is
+// mirrored to a SocketCAN interface.
+int main(int argc, char** argv)
+{
+    Options_t opt;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--bitrate") && i + 1 < argc)
+            opt.bitrate = (uint32_t) atol(argv[++i]);
+        else if (!strcmp(argv[i], "--error-rate") && i + 1 < argc)
+            opt.errorRate = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--broadcast-ms") && i + 1 < argc)
+            opt.broadcastMs = (uint32_t) atol(argv[++i]);
+        else if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+            opt.seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--max-late") && i + 1 < argc)
+            opt.maxLate = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--vcan") && i + 1 < argc)
+            opt.vcan = argv[++i];
+        else
+        {
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (opt.bitrate == 0 || opt.broadcastMs == 0 || opt.broadcastMs > 1000)
+    {
+        fprintf(stderr, "bitrate must be > 0 and broadcast-ms 1~1000\n");
+        return 1;
+    }
+
+    printf("bus %u bit/s, error rate %g, broadcast %u ms, %g s per rate\n\n",
+           opt.bitrate, opt.errorRate, opt.broadcastMs, opt.seconds);
+    printf("%-16s %10s %8s %8s %10s %12s\n", "mode", "ticks/s", "load", "late", "state age", "host ticks/s");
+
+    try
+    {
+        for (int m = MODE_GROUP_ACK; m <= MODE_GROUP_BROADCAST; m++)
+        {
+            Result_t best = {};
+            double rate = FindMaxRate((Mode) m, opt, &best);
+            printf("%-16s %10.0f %7.1f%% %8u %7.2f ms %12.0f\n", modeNames[m], rate, best.busLoad * 100,
+                   best.lateTicks, best.maxStateAgeMs, best.wallSeconds > 0 ? best.ticks / best.wallSeconds : 0);
+            if (best.driverErrors || best.coreTxDropped || best.coreRxDropped)
+                printf("%-16s driver errors %u, Core TX dropped %u, Core RX dropped %u\n", "",
+                       best.driverErrors, best.coreTxDropped, best.coreRxDropped);
+        }
+    } catch (const std::exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static Result_t RunAtRate(Mode _mode, double _rate, const Options_t &_opt)
+{
+    VirtualCanBus bus(_opt.bitrate);
+    bus.set_error_rate(_opt.errorRate);
+
+    // bxCAN on the F4 is set up with TransmitFifoPriority
+    Module coreModule("core_node");
+    const SimCoreApi_t* core = coreModule.Entry<SimCoreApi_t>("SimCoreNode");
+    std::vector<std::unique_ptr<Node>> nodes;
+    nodes.push_back(std::make_unique<Node>(bus, "core", &core->node, true));
+
+    std::vector<std::unique_ptr<Module>> driverModules;
+    std::vector<const SimDriverApi_t*> drivers;
+    for (int id = 1; id <= JOINT_NUM; id++)
+    {
+        driverModules.push_back(std::make_unique<Module>("driver_node_" + std::to_string(id)));
+        drivers.push_back(driverModules.back()->Entry<SimDriverApi_t>("SimDriverNode"));
+        nodes.push_back(std::make_unique<Node>(bus, "driver" + std::to_string(id), &drivers.back()->node, false));
+    }
+
+    // What the Core sees on the wire from each joint
+    bool replied[JOINT_NUM + 1] = {};
+    uint64_t lastStateNs[JOINT_NUM + 1] = {};
+    bus.add_tap([&](int _sender, const Frame &_frame, uint64_t _timeNs)
+                {
+                    nodes[_sender]->TxComplete(_frame, _timeNs);
+
+                    uint8_t id = _frame.id >> 7;
+                    uint8_t cmd = _frame.id & 0x7F;
+                    if (_frame.extended || _sender == 0 || id < 1 || id > JOINT_NUM)
+                        return;
+                    if (cmd == 0x25)
+                        replied[id] = true;
+                    else if (cmd == 0x26)
+                        lastStateNs[id] = _timeNs;
+                });
+
+    std::unique_ptr<can_sim::VcanBridge> bridge;
+    if (!_opt.vcan.empty())
+        bridge = std::make_unique<can_sim::VcanBridge>(bus, _opt.vcan);
+
+    auto step = [&](uint64_t _timeNs)
+    {
+        bus.run_until(_timeNs);
+        for (auto &node : nodes)
+            node->RunUntil(_timeNs);
+        if (bridge)
+            bridge->poll();
+    };
+
+    nodes[0]->Boot(0, 0);
+    for (int id = 1; id <= JOINT_NUM; id++)
+        nodes[id]->Boot(0x1000 + id, (uint8_t) id);
+
+    uint64_t t = 0;
+    SimCoreStats_t stats = {};
+    for (; stats.joints_online != JOINT_NODES; t += DRIVER_TICK_NS)
+    {
+        if (t > WARM_UP_LIMIT_NS)
+            throw std::runtime_error("joints didn't come online, online mask 0x" +
+                                     std::to_string(stats.joints_online));
+        step(t);
+        core->get_stats(&stats);
+    }
+
+    core->set_group_sync(_mode != MODE_SINGLE_ACK);
+    core->set_state_broadcast_period(_mode == MODE_GROUP_BROADCAST ? _opt.broadcastMs : 0);
+    core->set_enable(true);
+    bus.reset_stats();
+    SimCoreStats_t baseline;
+    core->get_stats(&baseline);
+    uint32_t driverErrorsBefore = 0;
+    for (auto* driver : drivers)
+        driverErrorsBefore += driver->error_count();
+
+    Result_t result = {};
+    auto wallStart = Clock::now();
+    auto tickNs = (uint64_t) (1e9 / _rate);
+    uint64_t startNs = t;
+    uint64_t endNs = startNs + (uint64_t) (_opt.seconds * 1e9);
+    uint64_t nextTickNs = startNs;
+    uint64_t stateAgeMaxNs = 0;
+    bool tickOpen = false;
+    float angles[JOINT_NUM];
+
+    for (; t < endNs; t += DRIVER_TICK_NS)
+    {
+        while (nextTickNs <= t)
+        {
+            step(nextTickNs);
+
+            // Whatever the previous tick started must be done by now
+            bool late = false;
+            if (tickOpen)
+            {
+                core->get_stats(&stats);
+                late = stats.tx_pending != 0;
+                for (int j = 1; j <= JOINT_NUM && _mode != MODE_GROUP_BROADCAST; j++)
+                    late = late || !replied[j];
+            }
+            // Without replies the Core only knows the joints through the
+            // broadcasts, which lose arbitration to every setpoint frame
+            if (_mode == MODE_GROUP_BROADCAST && nextTickNs > startNs + 4 * _opt.broadcastMs * 1000000ull)
+            {
+                uint64_t ageNs = 0;
+                for (int j = 1; j <= JOINT_NUM; j++)
+                    ageNs = std::max(ageNs, bus.now() - std::max(lastStateNs[j], startNs));
+                stateAgeMaxNs = std::max(stateAgeMaxNs, ageNs);
+                late = late || ageNs > 2 * _opt.broadcastMs * 1000000ull;
+            }
+            if (late)
+                result.lateTicks++;
+
+            double s = (double) (nextTickNs - startNs) * 1e-9;
+            for (int j = 0; j < JOINT_NUM; j++)
+                angles[j] = (float) (30 * std::sin(2 * M_PI * 0.5 * s + j));
+            for (int j = 1; j <= JOINT_NUM; j++)
+                replied[j] = false;
+            core->move_joints(angles);
+            tickOpen = true;
+            result.ticks++;
+            nextTickNs += tickNs;
+        }
+
+        step(t);
+    }
+    result.wallSeconds = std::chrono::duration<double>(Clock::now() - wallStart).count();
+
+    core->get_stats(&stats);
+    for (auto* driver : drivers)
+        result.driverErrors += driver->error_count();
+    result.driverErrors -= driverErrorsBefore;
+    result.coreTxDropped = stats.tx_dropped - baseline.tx_dropped;
+    result.coreRxDropped = stats.rx_dropped - baseline.rx_dropped + stats.fifo_overruns - baseline.fifo_overruns;
+    result.busLoad = bus.load();
+    result.maxStateAgeMs = (double) stateAgeMaxNs * 1e-6;
+
+    return result;
+}
+
+
+static bool Sustained(const Result_t &_result, const Options_t &_opt)
+{
+    return _result.driverErrors == 0 && _result.coreTxDropped == 0 && _result.coreRxDropped == 0 &&
+           (double) _result.lateTicks <= _opt.maxLate * (double) _result.ticks;
+}
+
+
+// Doubles the rate until it fails, then bisects to within 1%
+static double FindMaxRate(Mode _mode, const Options_t &_opt, Result_t* _best)
+{
+    double good = 0;
+    double bad = 0;
+    for (double rate = 100; rate <= 1e6; rate *= 2)
+    {
+        Result_t result = RunAtRate(_mode, rate, _opt);
+        if (!Sustained(result, _opt))
+        {
+            bad = rate;
+            break;
+        }
+        good = rate;
+        *_best = result;
+    }
+    if (bad == 0)
+        return good;
+
+    while (bad - good > good * 0.01)
+    {
+        double rate = (good + bad) / 2;
+        Result_t result = RunAtRate(_mode, rate, _opt);
+        if (Sustained(result, _opt))
+        {
+            good = rate;
+            *_best = result;
+        } else
+            bad = rate;
+    }
+
+    return good;
+}
@@ -0,0 +1,133 @@
+#ifndef FIBRE_HOST_CHANNEL_HPP
+#define FIBRE_HOST_CHANNEL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "transport.hpp"
+
+namespace fibre
+{
+
+using Buffer = std::vector<uint8_t>;
+
+// @brief Invoked from the receive thread once per request.
+// A callback may issue new requests but must never wait for one (future.get(),
+// flush()): the receive thread it blocks is the one that completes them.
+// @param status: CHANNEL_OK on success, otherwise one of ChannelStatus_t
+// @param data: response payload (without seq_no), only valid during the call
+using ResponseCallback = std::function<void(int status, const uint8_t* data, size_t length)>;
+
+enum ChannelStatus_t
+{
+    CHANNEL_OK = 0,
+    CHANNEL_TIMEOUT = -1,
+    CHANNEL_CLOSED = -2,
+    CHANNEL_SEND_FAILED = -3,
+    CHANNEL_PACKET_LOST = -4,
+    CHANNEL_BAD_RESPONSE = -5,
+    CHANNEL_WOULD_BLOCK = -6
+};
+
+class ChannelError : public std::runtime_error
+{
+public:
+    explicit ChannelError(int status);
+
+    int status;
+};
+
+struct ChannelStats_t
+{
+    uint64_t tx_cnt;
+    uint64_t rx_cnt;
+    uint64_t resend_cnt;
+    uint64_t timeout_cnt;
+    uint64_t unexpected_ack_cnt;
+};
+
+// @brief Host side of BidirectionalPacketBasedChannel.
+//
+// Requests are written to the transport as soon as they are issued and matched
+// to their response by seq_no on a dedicated receive thread, so any number of
+// callers (up to max_in_flight) can have requests outstanding at the same time.
+// The device handles packets in arrival order, which is what lets a function
+// call pipeline its input writes, the trigger and the output read.
+class Channel : public PacketSink
+{
+public:
+    explicit Channel(std::unique_ptr<Transport> transport);
+    ~Channel();
+
+    Channel(const Channel &) = delete;
+    Channel &operator=(const Channel &) = delete;
+
+    // @brief Sends a request to endpoint_id and returns without waiting.
+    // If callback is empty the request is sent without the expect-response
+    // bit and nothing is tracked (fire and forget).
+    // Blocks only while max_in_flight requests are already outstanding. Called
+    // from a callback it can't wait for a slot, the receive thread would be
+    // waiting for itself: the callback then gets CHANNEL_WOULD_BLOCK at once.
+    void request_async(uint16_t endpoint_id, const uint8_t* input, size_t input_length,
+                       size_t output_length, uint16_t trailer, ResponseCallback callback);
+
+    std::future<Buffer> request(uint16_t endpoint_id, const Buffer &input,
+                                size_t output_length, uint16_t trailer);
+
+    // @brief Waits until every outstanding request has completed or timed out
+    // and its callback has returned. Must not be called from a callback.
+    void flush();
+
+    // Called on the receive thread for every packet the transport delivers.
+    int process_packet(const uint8_t* buffer, size_t length) override;
+
+    void close();
+
+    ChannelStats_t get_stats();
+
+    // Resends are off by default: a late retry of an input write would land
+    // after its function trigger and silently change the arguments.
+    std::chrono::milliseconds timeout = std::chrono::milliseconds(1000);
+    int max_retries = 0;
+    size_t max_in_flight = 16;
+
+private:
+    struct Pending_t
+    {
+        Buffer packet;
+        std::chrono::steady_clock::time_point deadline;
+        int retries_left;
+        ResponseCallback callback;
+    };
+
+    void receive_thread();
+    void check_timeouts();
+    int send_packet(const Buffer &packet);
+    void run_callback(ResponseCallback &callback, int status, const uint8_t* data, size_t length);
+
+    std::unique_ptr<Transport> transport_;
+    std::thread rx_thread_;
+    std::atomic<bool> running_{true};
+
+    std::mutex tx_mutex_;
+    std::mutex pending_mutex_;
+    std::condition_variable pending_cv_;
+    std::unordered_map<uint16_t, Pending_t> pending_;
+    size_t callbacks_running_ = 0;  // Taken out of pending_, not returned yet
+    uint16_t seq_no_ = 0;
+
+    ChannelStats_t stats_ = {};
+};
+
+}
+
+#endif
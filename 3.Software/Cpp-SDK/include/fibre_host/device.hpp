@@ -0,0 +1,277 @@
+#ifndef FIBRE_HOST_DEVICE_HPP
+#define FIBRE_HOST_DEVICE_HPP
+
+#include <atomic>
+#include <string>
+#include <type_traits>
+
+#include "channel.hpp"
+#include "json.hpp"
+
+namespace fibre
+{
+
+// Wire types as named in the JSON descriptor (see get_default_json_modifier)
+enum Codec_t
+{
+    CODEC_NONE,
+    CODEC_BOOL,
+    CODEC_INT8,
+    CODEC_UINT8,
+    CODEC_INT16,
+    CODEC_UINT16,
+    CODEC_INT32,
+    CODEC_UINT32,
+    CODEC_INT64,
+    CODEC_UINT64,
+    CODEC_FLOAT,
+    CODEC_ENDPOINT_REF
+};
+
+size_t codec_size(Codec_t codec);
+
+// @brief Serializes value into buffer using the device side representation of
+// codec, converting arithmetic types the way the python client does.
+// @return: number of bytes written, 0 if the codec can't hold a T
+template<typename T>
+size_t encode(Codec_t codec, T value, uint8_t* buffer)
+{
+    static_assert(std::is_arithmetic<T>::value, "only arithmetic values can be sent");
+    switch (codec)
+    {
+        case CODEC_BOOL:
+            return write_le<bool>(value != 0, buffer);
+        case CODEC_INT8:
+            return write_le<int8_t>(static_cast<int8_t>(value), buffer);
+        case CODEC_UINT8:
+            return write_le<uint8_t>(static_cast<uint8_t>(value), buffer);
+        case CODEC_INT16:
+            return write_le<int16_t>(static_cast<int16_t>(value), buffer);
+        case CODEC_UINT16:
+            return write_le<uint16_t>(static_cast<uint16_t>(value), buffer);
+        case CODEC_INT32:
+            return write_le<int32_t>(static_cast<int32_t>(value), buffer);
+        case CODEC_UINT32:
+            return write_le<uint32_t>(static_cast<uint32_t>(value), buffer);
+        case CODEC_INT64:
+            return write_le<int64_t>(static_cast<int64_t>(value), buffer);
+        case CODEC_UINT64:
+            return write_le<uint64_t>(static_cast<uint64_t>(value), buffer);
+        case CODEC_FLOAT:
+            return write_le<float>(static_cast<float>(value), buffer);
+        default:
+            return 0;
+    }
+}
+
+// @brief Inverse of encode(), returns false if length is too short for codec.
+template<typename T>
+bool decode(Codec_t codec, const uint8_t* buffer, size_t length, T* value)
+{
+    static_assert(std::is_arithmetic<T>::value, "only arithmetic values can be received");
+    if (codec == CODEC_NONE || codec == CODEC_ENDPOINT_REF || length < codec_size(codec))
+        return false;
+
+    switch (codec)
+    {
+        case CODEC_BOOL:
+            *value = static_cast<T>(buffer[0] != 0);
+            break;
+        case CODEC_INT8:
+            *value = static_cast<T>(static_cast<int8_t>(buffer[0]));
+            break;
+        case CODEC_UINT8:
+            *value = static_cast<T>(buffer[0]);
+            break;
+#define DECODE_CASE(codec_, type_) \
+        case codec_: { type_ v; read_le<type_>(&v, buffer); *value = static_cast<T>(v); break; }
+        DECODE_CASE(CODEC_INT16, int16_t)
+        DECODE_CASE(CODEC_UINT16, uint16_t)
+        DECODE_CASE(CODEC_INT32, int32_t)
+        DECODE_CASE(CODEC_UINT32, uint32_t)
+        DECODE_CASE(CODEC_INT64, int64_t)
+        DECODE_CASE(CODEC_UINT64, uint64_t)
+        DECODE_CASE(CODEC_FLOAT, float)
+#undef DECODE_CASE
+        default:
+            return false;
+    }
+    return true;
+}
+
+// @brief One entry of the device's object tree. Objects have members,
+// functions have inputs/outputs and use id as their trigger endpoint.
+struct RemoteNode
+{
+    std::string name;
+    std::string type;
+    uint16_t id = 0;
+    Codec_t codec = CODEC_NONE;
+    bool writable = false;
+    std::vector<RemoteNode> members;
+    std::vector<RemoteNode> inputs;
+    std::vector<RemoteNode> outputs;
+
+    const RemoteNode* find(const std::string &member_name) const;
+};
+
+// @brief A connected REF board (or anything else that runs fibre_publish).
+//
+//     fibre::Device dummy(std::make_unique<fibre::SerialTransport>("/dev/ttyACM0"));
+//     dummy.connect();
+//     float temp = dummy.call<float>("get_temperature").get();
+//     dummy.call("robot.move_j", 0, -73, 180, 0, 0, 0);    // don't wait
+//
+// All accessors return futures and never block on the device, so a caller
+// can keep many of them in flight and collect the results later.
+class Device
+{
+public:
+    explicit Device(std::unique_ptr<Transport> transport);
+
+    // @brief Downloads the JSON descriptor from endpoint 0 and builds the tree.
+    // Throws ChannelError or std::invalid_argument on failure.
+    void connect();
+
+    const RemoteNode &root() const
+    { return root_; }
+
+    // @brief Resolves a dotted path like "robot.joint_1.reduction".
+    // Throws std::out_of_range if it does not exist.
+    const RemoteNode &at(const std::string &path) const;
+
+    uint16_t get_json_crc() const
+    { return json_crc_; }
+
+    const std::string &get_json() const
+    { return json_; }
+
+    Channel &get_channel()
+    { return channel_; }
+
+    template<typename T>
+    void read_async(const RemoteNode &property, std::function<void(int status, T value)> callback)
+    {
+        Codec_t codec = property.codec;
+        channel_.request_async(property.id, nullptr, 0, codec_size(codec), json_crc_,
+                               [codec, callback](int status, const uint8_t* data, size_t length)
+                               {
+                                   T value = T();
+                                   if (!status && !decode<T>(codec, data, length, &value))
+                                       status = CHANNEL_BAD_RESPONSE;
+                                   callback(status, value);
+                               });
+    }
+
+    template<typename T>
+    std::future<T> read(const std::string &path)
+    {
+        auto promise = std::make_shared<std::promise<T>>();
+        std::future<T> future = promise->get_future();
+        read_async<T>(property_at(path), [promise](int status, T value)
+        {
+            if (status)
+                promise->set_exception(std::make_exception_ptr(ChannelError(status)));
+            else
+                promise->set_value(value);
+        });
+        return future;
+    }
+
+    template<typename T>
+    void write_async(const RemoteNode &property, T value, ResponseCallback callback)
+    {
+        uint8_t buffer[8];
+        size_t length = encode<T>(property.codec, value, buffer);
+        channel_.request_async(property.id, buffer, length, 0, json_crc_, std::move(callback));
+    }
+
+    template<typename T>
+    std::future<void> write(const std::string &path, T value)
+    {
+        const RemoteNode &property = property_at(path);
+        if (!property.writable)
+            throw std::invalid_argument(path + " is read-only");
+
+        auto promise = std::make_shared<std::promise<void>>();
+        std::future<void> future = promise->get_future();
+        write_async<T>(property, value, [promise](int status, const uint8_t*, size_t)
+        {
+            if (status)
+                promise->set_exception(std::make_exception_ptr(ChannelError(status)));
+            else
+                promise->set_value();
+        });
+        return future;
+    }
+
+    // @brief Calls a remote function. The input writes, the trigger and the
+    // read of the first output are all sent back to back; the result is only
+    // reported OK if every one of them was acknowledged.
+    template<typename R = void, typename... Args>
+    std::future<R> call(const std::string &path, Args... args)
+    {
+        const RemoteNode &function = at(path);
+        if (function.type != "function" || function.inputs.size() != sizeof...(Args))
+            throw std::invalid_argument(path + ": not a function taking " +
+                                        std::to_string(sizeof...(Args)) + " arguments");
+        if (!std::is_void<R>::value && function.outputs.empty())
+            throw std::invalid_argument(path + " has no return value");
+
+        auto call_state = std::make_shared<CallState_t>();
+        auto promise = std::make_shared<std::promise<R>>();
+        std::future<R> future = promise->get_future();
+
+        size_t i = 0;
+        (write_async(function.inputs[i++], args, call_state->track()), ...);
+
+        if constexpr (std::is_void<R>::value)
+        {
+            channel_.request_async(function.id, nullptr, 0, 0, json_crc_,
+                                   [call_state, promise](int status, const uint8_t*, size_t)
+                                   {
+                                       status = call_state->finish(status);
+                                       if (status)
+                                           promise->set_exception(std::make_exception_ptr(ChannelError(status)));
+                                       else
+                                           promise->set_value();
+                                   });
+        } else
+        {
+            channel_.request_async(function.id, nullptr, 0, 0, json_crc_, call_state->track());
+            read_async<R>(function.outputs[0], [call_state, promise](int status, R value)
+            {
+                status = call_state->finish(status);
+                if (status)
+                    promise->set_exception(std::make_exception_ptr(ChannelError(status)));
+                else
+                    promise->set_value(value);
+            });
+        }
+
+        return future;
+    }
+
+private:
+    // Bookkeeping for the acks of one pipelined function call. The device
+    // answers in order, so when the last ack arrives all others must be in.
+    struct CallState_t : std::enable_shared_from_this<CallState_t>
+    {
+        std::atomic<int> outstanding{0};
+        std::atomic<int> status{CHANNEL_OK};
+
+        ResponseCallback track();
+        int finish(int last_status);
+    };
+
+    const RemoteNode &property_at(const std::string &path) const;
+
+    Channel channel_;
+    RemoteNode root_;
+    std::string json_;
+    uint16_t json_crc_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef FIBRE_HOST_JSON_HPP
+#define FIBRE_HOST_JSON_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fibre
+{
+
+// @brief Just enough JSON to read the endpoint descriptor that
+// JSONDescriptorEndpoint produces, no external dependency for the host.
+struct JsonValue
+{
+    enum Type_t
+    {
+        JSON_NULL,
+        JSON_BOOL,
+        JSON_NUMBER,
+        JSON_STRING,
+        JSON_ARRAY,
+        JSON_OBJECT
+    };
+
+    Type_t type = JSON_NULL;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue>> object;
+
+    // @brief Returns the member named key, or nullptr if there is none.
+    const JsonValue* get(const std::string &key) const;
+
+    // @brief Parses text, throws std::invalid_argument on malformed input.
+    static JsonValue parse(const std::string &text);
+};
+
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef FIBRE_HOST_TRANSPORT_HPP
+#define FIBRE_HOST_TRANSPORT_HPP
+
+#include <cstdint>
+#include <string>
+#include <fibre/protocol.hpp>
+
+namespace fibre
+{
+
+// @brief Carries raw fibre packets (seq_no | endpoint | ... | trailer) between
+// the host and one device. Stream based transports add the 0xAA framing that
+// StreamToPacketSegmenter expects on the firmware side, packet based ones
+// (UDP) send every packet as it is.
+class Transport
+{
+public:
+    virtual ~Transport() = default;
+
+    // @brief Sends one packet. The Channel serializes calls to this.
+    // @return: 0 on success, otherwise a non-zero error code
+    virtual int send_packet(const uint8_t* buffer, size_t length) = 0;
+
+    // @brief Waits at most timeout_ms for incoming data and hands every
+    // complete packet to output. Only ever called from the receive thread.
+    // @return: 0 on success or timeout, otherwise a non-zero error code
+    virtual int receive(PacketSink &output, int timeout_ms) = 0;
+
+    virtual void close() = 0;
+};
+
+
+// @brief Transport over any connected byte stream file descriptor.
+// Takes ownership of the descriptor.
+class StreamTransport : public Transport
+{
+public:
+    explicit StreamTransport(int fd);
+    ~StreamTransport() override;
+
+    int send_packet(const uint8_t* buffer, size_t length) override;
+    int receive(PacketSink &output, int timeout_ms) override;
+    void close() override;
+
+protected:
+    StreamTransport() = default;
+
+    int fd_ = -1;
+
+private:
+    // StreamToPacketSegmenter binds its output on construction, the
+    // receive() caller decides where packets go, so forward through this.
+    class Forwarder : public PacketSink
+    {
+    public:
+        int process_packet(const uint8_t* buffer, size_t length) override
+        { return target ? target->process_packet(buffer, length) : 0; }
+
+        PacketSink* target = nullptr;
+    };
+
+    Forwarder rx_forwarder_;
+    StreamToPacketSegmenter rx_segmenter_ = StreamToPacketSegmenter(rx_forwarder_);
+};
+
+
+// @brief USB-CDC or UART link, e.g. "/dev/ttyACM0". The baudrate only matters
+// for the real UART (REF UART4/UART5 run at 115200).
+class SerialTransport : public StreamTransport
+{
+public:
+    explicit SerialTransport(const std::string &path, int baudrate = 115200);
+};
+
+
+class TcpTransport : public StreamTransport
+{
+public:
+    TcpTransport(const std::string &host, uint16_t port);
+};
+
+
+class UdpTransport : public Transport
+{
+public:
+    UdpTransport(const std::string &host, uint16_t port);
+    ~UdpTransport() override;
+
+    int send_packet(const uint8_t* buffer, size_t length) override;
+    int receive(PacketSink &output, int timeout_ms) override;
+    void close() override;
+
+private:
+    int fd_ = -1;
+};
+
+}
+
+#endif
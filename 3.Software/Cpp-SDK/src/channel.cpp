@@ -0,0 +1,298 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include "fibre_host/channel.hpp"
+
+namespace fibre
+{
+
+/* Private defines -----------------------------------------------------------*/
+
+// Upper bound for how long the receive thread blocks before it looks at the
+// request deadlines again.
+static constexpr int RX_POLL_INTERVAL_MS = 5;
+
+/* Private function prototypes -----------------------------------------------*/
+
+static const char* status_to_string(int status);
+
+/* Function implementations --------------------------------------------------*/
+
+ChannelError::ChannelError(int status) :
+    std::runtime_error(status_to_string(status)),
+    status(status)
+{
+}
+
+Channel::Channel(std::unique_ptr<Transport> transport) :
+    transport_(std::move(transport))
+{
+    rx_thread_ = std::thread(&Channel::receive_thread, this);
+}
+
+Channel::~Channel()
+{
+    close();
+}
+
+void Channel::request_async(uint16_t endpoint_id, const uint8_t* input, size_t input_length,
+                            size_t output_length, uint16_t trailer, ResponseCallback callback)
+{
+    bool expect_response = static_cast<bool>(callback);
+
+    Buffer packet(8 + input_length);
+    write_le<uint16_t>(0, &packet[0]);
+    write_le<uint16_t>(endpoint_id | (expect_response ? 0x8000 : 0), &packet[2]);
+    write_le<uint16_t>(output_length, &packet[4]);
+    if (input_length)
+        memcpy(&packet[6], input, input_length);
+    write_le<uint16_t>(trailer, &packet[6 + input_length]);
+
+    uint16_t seq_no;
+    {
+        std::unique_lock<std::mutex> lock(pending_mutex_);
+        // Only the receive thread frees slots, it must not wait for one
+        if (std::this_thread::get_id() == rx_thread_.get_id())
+        {
+            if (expect_response && pending_.size() >= max_in_flight && running_)
+            {
+                lock.unlock();
+                callback(CHANNEL_WOULD_BLOCK, nullptr, 0);
+                return;
+            }
+        } else
+            pending_cv_.wait(lock, [this] { return pending_.size() < max_in_flight || !running_; });
+        if (!running_)
+        {
+            lock.unlock();
+            if (callback)
+                callback(CHANNEL_CLOSED, nullptr, 0);
+            return;
+        }
+
+        // Bit 7 is hardwired to 1 like in the python client so a packet can
+        // never be mistaken for a line of the ascii protocol on shared UARTs.
+        do
+            seq_no = ((++seq_no_) & 0x7fff) | 0x80;
+        while (pending_.count(seq_no));
+        write_le<uint16_t>(seq_no, &packet[0]);
+
+        // Register before sending, the response may beat us back otherwise.
+        if (expect_response)
+            pending_[seq_no] = Pending_t{packet, std::chrono::steady_clock::now() + timeout,
+                                         max_retries, std::move(callback)};
+    }
+
+    if (send_packet(packet) && expect_response)
+    {
+        ResponseCallback failed;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex_);
+            auto it = pending_.find(seq_no);
+            if (it != pending_.end())
+            {
+                failed = std::move(it->second.callback);
+                pending_.erase(it);
+                callbacks_running_++;
+            }
+        }
+        pending_cv_.notify_all();
+        if (failed)
+            run_callback(failed, CHANNEL_SEND_FAILED, nullptr, 0);
+    }
+}
+
+std::future<Buffer> Channel::request(uint16_t endpoint_id, const Buffer &input,
+                                     size_t output_length, uint16_t trailer)
+{
+    auto promise = std::make_shared<std::promise<Buffer>>();
+    std::future<Buffer> future = promise->get_future();
+
+    request_async(endpoint_id, input.data(), input.size(), output_length, trailer,
+                  [promise](int status, const uint8_t* data, size_t length)
+                  {
+                      if (status)
+                          promise->set_exception(std::make_exception_ptr(ChannelError(status)));
+                      else
+                          promise->set_value(Buffer(data, data + length));
+                  });
+
+    return future;
+}
+
+void Channel::flush()
+{
+    std::unique_lock<std::mutex> lock(pending_mutex_);
+    pending_cv_.wait(lock, [this] { return pending_.empty() && !callbacks_running_; });
+}
+
+int Channel::process_packet(const uint8_t* buffer, size_t length)
+{
+    if (length < 2)
+        return -1;
+
+    uint16_t seq_no = read_le<uint16_t>(&buffer, &length);
+
+    // Requests from the device side are not supported by the firmware yet
+    if (!(seq_no & 0x8000))
+        return 0;
+    seq_no &= 0x7fff;
+
+    ResponseCallback callback;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        stats_.rx_cnt++;
+        auto it = pending_.find(seq_no);
+        if (it == pending_.end())
+        {
+            stats_.unexpected_ack_cnt++;
+            return 0;
+        }
+        callback = std::move(it->second.callback);
+        pending_.erase(it);
+        callbacks_running_++;
+    }
+    pending_cv_.notify_all();
+
+    run_callback(callback, CHANNEL_OK, buffer, length);
+
+    return 0;
+}
+
+void Channel::close()
+{
+    running_ = false;
+    if (rx_thread_.joinable())
+        rx_thread_.join();
+    transport_->close();
+
+    std::unordered_map<uint16_t, Pending_t> orphans;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        orphans.swap(pending_);
+        callbacks_running_ += orphans.size();
+    }
+    pending_cv_.notify_all();
+
+    for (auto &it : orphans)
+        run_callback(it.second.callback, CHANNEL_CLOSED, nullptr, 0);
+}
+
+ChannelStats_t Channel::get_stats()
+{
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    return stats_;
+}
+
+void Channel::receive_thread()
+{
+    while (running_)
+    {
+        if (transport_->receive(*this, RX_POLL_INTERVAL_MS))
+        {
+            // Transport is gone (unplugged, peer closed), fail everything
+            // that is still waiting instead of running into the timeouts.
+            running_ = false;
+            break;
+        }
+        check_timeouts();
+    }
+
+    std::unordered_map<uint16_t, Pending_t> orphans;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        orphans.swap(pending_);
+        callbacks_running_ += orphans.size();
+    }
+    pending_cv_.notify_all();
+
+    for (auto &it : orphans)
+        run_callback(it.second.callback, CHANNEL_CLOSED, nullptr, 0);
+}
+
+void Channel::check_timeouts()
+{
+    auto now = std::chrono::steady_clock::now();
+    std::vector<Buffer> resend;
+    std::vector<ResponseCallback> expired;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        for (auto it = pending_.begin(); it != pending_.end();)
+        {
+            if (it->second.deadline > now)
+            {
+                ++it;
+            } else if (it->second.retries_left > 0)
+            {
+                it->second.retries_left--;
+                it->second.deadline = now + timeout;
+                resend.push_back(it->second.packet);
+                stats_.resend_cnt++;
+                ++it;
+            } else
+            {
+                expired.push_back(std::move(it->second.callback));
+                callbacks_running_++;
+                stats_.timeout_cnt++;
+                it = pending_.erase(it);
+            }
+        }
+    }
+
+    for (auto &packet : resend)
+        send_packet(packet);
+
+    if (!expired.empty())
+        pending_cv_.notify_all();
+    for (auto &callback : expired)
+        run_callback(callback, CHANNEL_TIMEOUT, nullptr, 0);
+}
+
+// The caller counted the callback in callbacks_running_ when it took it out
+// of pending_, flush() only returns once that count is back to zero.
+void Channel::run_callback(ResponseCallback &callback, int status, const uint8_t* data, size_t length)
+{
+    callback(status, data, length);
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        callbacks_running_--;
+    }
+    pending_cv_.notify_all();
+}
+
+int Channel::send_packet(const Buffer &packet)
+{
+    int ret;
+    {
+        std::lock_guard<std::mutex> lock(tx_mutex_);
+        ret = transport_->send_packet(packet.data(), packet.size());
+    }
+    if (!ret)
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        stats_.tx_cnt++;
+    }
+    return ret;
+}
+
+const char* status_to_string(int status)
+{
+    switch (status)
+    {
+        case CHANNEL_TIMEOUT:
+            return "fibre: request timed out";
+        case CHANNEL_CLOSED:
+            return "fibre: channel closed";
+        case CHANNEL_SEND_FAILED:
+            return "fibre: transport failed to send";
+        case CHANNEL_PACKET_LOST:
+            return "fibre: an earlier packet of the same call was lost";
+        case CHANNEL_BAD_RESPONSE:
+            return "fibre: response too short for the endpoint type";
+        case CHANNEL_WOULD_BLOCK:
+            return "fibre: no request slot free and called from a callback";
+        default:
+            return "fibre: unknown error";
+    }
+}
+
+}
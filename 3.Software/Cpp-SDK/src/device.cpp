@@ -0,0 +1,212 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include "fibre_host/device.hpp"
+
+namespace fibre
+{
+
+/* Private defines -----------------------------------------------------------*/
+
+// The firmware answers with at most TX_BUF_SIZE - 2 payload bytes
+static constexpr size_t JSON_CHUNK_SIZE = TX_BUF_SIZE - 2;
+// Chunks of the descriptor requested ahead of the one being waited for
+static constexpr size_t JSON_PIPELINE_DEPTH = 8;
+
+/* Private function prototypes -----------------------------------------------*/
+
+static Codec_t codec_from_string(const std::string &type);
+static RemoteNode build_node(const JsonValue &json);
+
+/* Function implementations --------------------------------------------------*/
+
+size_t codec_size(Codec_t codec)
+{
+    switch (codec)
+    {
+        case CODEC_BOOL:
+        case CODEC_INT8:
+        case CODEC_UINT8:
+            return 1;
+        case CODEC_INT16:
+        case CODEC_UINT16:
+            return 2;
+        case CODEC_INT32:
+        case CODEC_UINT32:
+        case CODEC_FLOAT:
+        case CODEC_ENDPOINT_REF:
+            return 4;
+        case CODEC_INT64:
+        case CODEC_UINT64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+const RemoteNode* RemoteNode::find(const std::string &member_name) const
+{
+    for (auto &member : members)
+        if (member.name == member_name)
+            return &member;
+    return nullptr;
+}
+
+Device::Device(std::unique_ptr<Transport> transport) :
+    channel_(std::move(transport))
+{
+}
+
+void Device::connect()
+{
+    // Endpoint 0 takes a 32 bit offset and returns the next chunk of the
+    // descriptor; a short chunk marks the end. Keep several chunks in flight
+    // instead of paying one round trip per 30 bytes.
+    json_.clear();
+    std::vector<std::future<Buffer>> chunks;
+    uint32_t next_offset = 0;
+    bool done = false;
+
+    while (!done)
+    {
+        while (chunks.size() < JSON_PIPELINE_DEPTH)
+        {
+            Buffer offset(4);
+            write_le<uint32_t>(next_offset, offset.data());
+            chunks.push_back(channel_.request(0, offset, JSON_CHUNK_SIZE, PROTOCOL_VERSION));
+            next_offset += JSON_CHUNK_SIZE;
+        }
+
+        Buffer chunk = chunks.front().get();
+        chunks.erase(chunks.begin());
+        json_.append(chunk.begin(), chunk.end());
+        done = chunk.size() < JSON_CHUNK_SIZE;
+    }
+
+    // Drain what was requested past the end so no stale future is left behind
+    for (auto &chunk : chunks)
+        chunk.wait();
+
+    json_crc_ = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(PROTOCOL_VERSION,
+                                                       reinterpret_cast<const uint8_t*>(json_.data()),
+                                                       json_.size());
+
+    JsonValue descriptor = JsonValue::parse(json_);
+    if (descriptor.type != JsonValue::JSON_ARRAY)
+        throw std::invalid_argument("json: descriptor is not an array");
+
+    root_ = RemoteNode();
+    root_.type = "object";
+    for (auto &member : descriptor.array)
+    {
+        // Skip the descriptor endpoint itself
+        const JsonValue* type = member.get("type");
+        if (type && type->string == "json")
+            continue;
+        root_.members.push_back(build_node(member));
+    }
+}
+
+const RemoteNode &Device::at(const std::string &path) const
+{
+    const RemoteNode* node = &root_;
+    size_t begin = 0;
+    while (begin <= path.size())
+    {
+        size_t end = path.find('.', begin);
+        if (end == std::string::npos)
+            end = path.size();
+
+        node = node->find(path.substr(begin, end - begin));
+        if (!node)
+            throw std::out_of_range("no such endpoint: " + path);
+        begin = end + 1;
+    }
+
+    return *node;
+}
+
+const RemoteNode &Device::property_at(const std::string &path) const
+{
+    const RemoteNode &node = at(path);
+    if (node.codec == CODEC_NONE)
+        throw std::invalid_argument(path + " is not a property");
+    return node;
+}
+
+ResponseCallback Device::CallState_t::track()
+{
+    outstanding++;
+    auto self = shared_from_this();
+    return [self](int status, const uint8_t*, size_t)
+    {
+        if (status)
+        {
+            int expected = CHANNEL_OK;
+            self->status.compare_exchange_strong(expected, status);
+        }
+        self->outstanding--;
+    };
+}
+
+int Device::CallState_t::finish(int last_status)
+{
+    if (last_status)
+        return last_status;
+    if (status)
+        return status;
+    // Answered before one of the earlier packets: that one never made it.
+    if (outstanding)
+        return CHANNEL_PACKET_LOST;
+    return CHANNEL_OK;
+}
+
+Codec_t codec_from_string(const std::string &type)
+{
+    static const std::pair<const char*, Codec_t> codecs[] = {
+        {"bool",         CODEC_BOOL},
+        {"int8",         CODEC_INT8},
+        {"uint8",        CODEC_UINT8},
+        {"int16",        CODEC_INT16},
+        {"uint16",       CODEC_UINT16},
+        {"int32",        CODEC_INT32},
+        {"uint32",       CODEC_UINT32},
+        {"int64",        CODEC_INT64},
+        {"uint64",       CODEC_UINT64},
+        {"float",        CODEC_FLOAT},
+        {"endpoint_ref", CODEC_ENDPOINT_REF}
+    };
+
+    for (auto &codec : codecs)
+        if (type == codec.first)
+            return codec.second;
+    return CODEC_NONE;
+}
+
+RemoteNode build_node(const JsonValue &json)
+{
+    RemoteNode node;
+
+    if (const JsonValue* name = json.get("name"))
+        node.name = name->string;
+    if (const JsonValue* type = json.get("type"))
+        node.type = type->string;
+    if (const JsonValue* id = json.get("id"))
+        node.id = static_cast<uint16_t>(id->number);
+    if (const JsonValue* access = json.get("access"))
+        node.writable = access->string.find('w') != std::string::npos;
+    node.codec = codec_from_string(node.type);
+
+    if (const JsonValue* members = json.get("members"))
+        for (auto &member : members->array)
+            node.members.push_back(build_node(member));
+    if (const JsonValue* inputs = json.get("inputs"))
+        for (auto &input : inputs->array)
+            node.inputs.push_back(build_node(input));
+    if (const JsonValue* outputs = json.get("outputs"))
+        for (auto &output : outputs->array)
+            node.outputs.push_back(build_node(output));
+
+    return node;
+}
+
+}
@@ -0,0 +1,174 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include <cctype>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "fibre_host/json.hpp"
+
+namespace fibre
+{
+
+/* Private typedef -----------------------------------------------------------*/
+
+class JsonParser
+{
+public:
+    explicit JsonParser(const std::string &text) : text_(text)
+    {}
+
+    JsonValue parse_document()
+    {
+        JsonValue value = parse_value();
+        skip_whitespace();
+        if (pos_ != text_.size())
+            fail("trailing characters");
+        return value;
+    }
+
+private:
+    JsonValue parse_value()
+    {
+        skip_whitespace();
+        if (pos_ >= text_.size())
+            fail("unexpected end");
+
+        JsonValue value;
+        char c = text_[pos_];
+        if (c == '{')
+        {
+            value.type = JsonValue::JSON_OBJECT;
+            pos_++;
+            if (!consume('}'))
+            {
+                do
+                {
+                    skip_whitespace();
+                    std::string key = parse_string();
+                    skip_whitespace();
+                    if (!consume(':'))
+                        fail("expected ':'");
+                    value.object.emplace_back(std::move(key), parse_value());
+                } while (consume(','));
+                if (!consume('}'))
+                    fail("expected '}'");
+            }
+        } else if (c == '[')
+        {
+            value.type = JsonValue::JSON_ARRAY;
+            pos_++;
+            if (!consume(']'))
+            {
+                do
+                    value.array.push_back(parse_value());
+                while (consume(','));
+                if (!consume(']'))
+                    fail("expected ']'");
+            }
+        } else if (c == '"')
+        {
+            value.type = JsonValue::JSON_STRING;
+            value.string = parse_string();
+        } else if (text_.compare(pos_, 4, "true") == 0)
+        {
+            value.type = JsonValue::JSON_BOOL;
+            value.boolean = true;
+            pos_ += 4;
+        } else if (text_.compare(pos_, 5, "false") == 0)
+        {
+            value.type = JsonValue::JSON_BOOL;
+            pos_ += 5;
+        } else if (text_.compare(pos_, 4, "null") == 0)
+        {
+            pos_ += 4;
+        } else
+        {
+            const char* begin = text_.c_str() + pos_;
+            char* end = nullptr;
+            value.type = JsonValue::JSON_NUMBER;
+            value.number = strtod(begin, &end);
+            if (end == begin)
+                fail("unexpected character");
+            pos_ += end - begin;
+        }
+
+        return value;
+    }
+
+    std::string parse_string()
+    {
+        if (!consume('"'))
+            fail("expected string");
+
+        std::string result;
+        while (pos_ < text_.size() && text_[pos_] != '"')
+        {
+            char c = text_[pos_++];
+            if (c == '\\' && pos_ < text_.size())
+            {
+                c = text_[pos_++];
+                switch (c)
+                {
+                    case 'n':
+                        c = '\n';
+                        break;
+                    case 't':
+                        c = '\t';
+                        break;
+                    case 'r':
+                        c = '\r';
+                        break;
+                    default:
+                        break;
+                }
+            }
+            result += c;
+        }
+        if (!consume('"'))
+            fail("unterminated string");
+
+        return result;
+    }
+
+    void skip_whitespace()
+    {
+        while (pos_ < text_.size() && isspace(static_cast<unsigned char>(text_[pos_])))
+            pos_++;
+    }
+
+    bool consume(char c)
+    {
+        skip_whitespace();
+        if (pos_ < text_.size() && text_[pos_] == c)
+        {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+
+    [[noreturn]] void fail(const char* what)
+    {
+        throw std::invalid_argument(std::string("json: ") + what + " at offset " + std::to_string(pos_));
+    }
+
+    const std::string &text_;
+    size_t pos_ = 0;
+};
+
+/* Function implementations --------------------------------------------------*/
+
+const JsonValue* JsonValue::get(const std::string &key) const
+{
+    for (auto &member : object)
+        if (member.first == key)
+            return &member.second;
+    return nullptr;
+}
+
+JsonValue JsonValue::parse(const std::string &text)
+{
+    return JsonParser(text).parse_document();
+}
+
+}
@@ -0,0 +1,67 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <termios.h>
+#include <unistd.h>
+
+#include "fibre_host/transport.hpp"
+
+namespace fibre
+{
+
+/* Private function prototypes -----------------------------------------------*/
+
+static speed_t to_speed(int baudrate);
+
+/* Function implementations --------------------------------------------------*/
+
+SerialTransport::SerialTransport(const std::string &path, int baudrate)
+{
+    fd_ = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd_ < 0)
+        throw std::runtime_error("open " + path + ": " + strerror(errno));
+
+    termios tty = {};
+    if (tcgetattr(fd_, &tty) == 0)
+    {
+        // Raw 8N1, the ascii protocol shares the same port so never let the
+        // line discipline eat 0x0A/0x0D or the 0xAA sync byte.
+        cfmakeraw(&tty);
+        tty.c_cflag |= CLOCAL | CREAD;
+        tty.c_cflag &= ~CRTSCTS;
+        tty.c_cc[VMIN] = 0;
+        tty.c_cc[VTIME] = 0;
+        cfsetispeed(&tty, to_speed(baudrate));
+        cfsetospeed(&tty, to_speed(baudrate));
+        tcsetattr(fd_, TCSANOW, &tty);
+    }
+    tcflush(fd_, TCIOFLUSH);
+}
+
+speed_t to_speed(int baudrate)
+{
+    switch (baudrate)
+    {
+        case 9600:
+            return B9600;
+        case 19200:
+            return B19200;
+        case 38400:
+            return B38400;
+        case 57600:
+            return B57600;
+        case 230400:
+            return B230400;
+        case 460800:
+            return B460800;
+        case 921600:
+            return B921600;
+        default:
+            return B115200;
+    }
+}
+
+}
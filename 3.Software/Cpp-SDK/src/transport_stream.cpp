@@ -0,0 +1,84 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+
+#include "fibre_host/transport.hpp"
+
+namespace fibre
+{
+
+/* Function implementations --------------------------------------------------*/
+
+StreamTransport::StreamTransport(int fd) :
+    fd_(fd)
+{
+}
+
+StreamTransport::~StreamTransport()
+{
+    close();
+}
+
+int StreamTransport::send_packet(const uint8_t* buffer, size_t length)
+{
+    // Frame into one buffer so a packet costs a single write() instead of
+    // the three that StreamBasedPacketSink issues for header/payload/crc.
+    uint8_t frame[RX_BUF_SIZE + 5];
+    MemoryStreamSink frame_sink(frame, sizeof(frame));
+    StreamBasedPacketSink packet_sink(frame_sink);
+    if (packet_sink.process_packet(buffer, length))
+        return -1;
+
+    size_t frame_length = sizeof(frame) - frame_sink.get_free_space();
+    const uint8_t* ptr = frame;
+    while (frame_length)
+    {
+        ssize_t n = ::write(fd_, ptr, frame_length);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return -1;
+        }
+        ptr += n;
+        frame_length -= n;
+    }
+
+    return 0;
+}
+
+int StreamTransport::receive(PacketSink &output, int timeout_ms)
+{
+    if (fd_ < 0)
+        return -1;
+
+    pollfd pfd = {fd_, POLLIN, 0};
+    int ret = ::poll(&pfd, 1, timeout_ms);
+    if (ret == 0 || (ret < 0 && errno == EINTR))
+        return 0;
+    if (ret < 0 || (pfd.revents & (POLLERR | POLLNVAL)))
+        return -1;
+
+    uint8_t buf[512];
+    ssize_t n = ::read(fd_, buf, sizeof(buf));
+    if (n <= 0)
+        return (n < 0 && (errno == EINTR || errno == EAGAIN)) ? 0 : -1;
+
+    rx_forwarder_.target = &output;
+    rx_segmenter_.process_bytes(buf, n, nullptr);
+
+    return 0;
+}
+
+void StreamTransport::close()
+{
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+}
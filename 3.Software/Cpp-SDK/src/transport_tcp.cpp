@@ -0,0 +1,51 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "fibre_host/transport.hpp"
+
+namespace fibre
+{
+
+/* Function implementations --------------------------------------------------*/
+
+TcpTransport::TcpTransport(const std::string &host, uint16_t port)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* result = nullptr;
+    std::string service = std::to_string(port);
+    int err = getaddrinfo(host.c_str(), service.c_str(), &hints, &result);
+    if (err)
+        throw std::runtime_error("resolve " + host + ": " + gai_strerror(err));
+
+    for (addrinfo* ai = result; ai; ai = ai->ai_next)
+    {
+        fd_ = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd_ < 0)
+            continue;
+        if (::connect(fd_, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        ::close(fd_);
+        fd_ = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd_ < 0)
+        throw std::runtime_error("connect " + host + ":" + service + ": " + strerror(errno));
+
+    // Requests are small and pipelined, don't let Nagle hold them back.
+    int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+}
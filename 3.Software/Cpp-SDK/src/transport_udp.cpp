@@ -0,0 +1,97 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "fibre_host/transport.hpp"
+
+namespace fibre
+{
+
+/* Function implementations --------------------------------------------------*/
+
+UdpTransport::UdpTransport(const std::string &host, uint16_t port)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    addrinfo* result = nullptr;
+    std::string service = std::to_string(port);
+    int err = getaddrinfo(host.c_str(), service.c_str(), &hints, &result);
+    if (err)
+        throw std::runtime_error("resolve " + host + ": " + gai_strerror(err));
+
+    // A connected datagram socket, so send()/recv() only talk to the device.
+    for (addrinfo* ai = result; ai; ai = ai->ai_next)
+    {
+        fd_ = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd_ < 0)
+            continue;
+        if (::connect(fd_, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        ::close(fd_);
+        fd_ = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd_ < 0)
+        throw std::runtime_error("connect " + host + ":" + service + ": " + strerror(errno));
+}
+
+UdpTransport::~UdpTransport()
+{
+    close();
+}
+
+int UdpTransport::send_packet(const uint8_t* buffer, size_t length)
+{
+    ssize_t n;
+    do
+        n = ::send(fd_, buffer, length, 0);
+    while (n < 0 && errno == EINTR);
+
+    return n == static_cast<ssize_t>(length) ? 0 : -1;
+}
+
+int UdpTransport::receive(PacketSink &output, int timeout_ms)
+{
+    if (fd_ < 0)
+        return -1;
+
+    pollfd pfd = {fd_, POLLIN, 0};
+    int ret = ::poll(&pfd, 1, timeout_ms);
+    if (ret == 0 || (ret < 0 && errno == EINTR))
+        return 0;
+    if (ret < 0)
+        return -1;
+
+    // Drain everything that is queued, one datagram is one packet.
+    uint8_t buf[RX_BUF_SIZE];
+    ssize_t n;
+    while ((n = ::recv(fd_, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        output.process_packet(buf, n);
+
+    // ECONNREFUSED shows up when nothing listens on the other end yet,
+    // the channel timeouts take care of that.
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNREFUSED)
+        return -1;
+
+    return 0;
+}
+
+void UdpTransport::close()
+{
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+}
@@ -0,0 +1,68 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <sys/socket.h>
+#include <thread>
+
+#include "fibre_host/device.hpp"
+#include "fake_device.hpp"
+
+/* Private defines -----------------------------------------------------------*/
+
+static constexpr int ROUNDS = 20;
+static constexpr int READS_PER_ROUND = 2000;
+
+/* Function implementations --------------------------------------------------*/
+
+// flush() has to wait for the callbacks as well as the responses: a caller
+// that counts completions in its callbacks must see all of them once flush()
+// returns. The callbacks are slowed down so the last one is still running
+// when its response has long been matched, which is where flush() used to
+// return early.
+int main()
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+        return 1;
+    FakeDevicePublish();
+    std::thread deviceThread(FakeDeviceServeStream, fds[1]);
+
+    int failures = 0;
+    try
+    {
+        fibre::Device device(std::make_unique<fibre::StreamTransport>(fds[0]));
+        device.connect();
+        const fibre::RemoteNode &serial = device.at("serial_number");
+
+        for (int round = 0; round < ROUNDS; round++)
+        {
+            std::atomic<int> done{0};
+            for (int i = 0; i < READS_PER_ROUND; i++)
+                device.read_async<uint64_t>(serial, [&done](int status, uint64_t)
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(20));
+                    if (!status) done++;
+                });
+            device.get_channel().flush();
+
+            if (done != READS_PER_ROUND)
+            {
+                printf("[test] round %d: %d/%d callbacks ran before flush() returned\n",
+                       round, done.load(), READS_PER_ROUND);
+                failures++;
+            }
+        }
+    } catch (const std::exception &e)
+    {
+        printf("[test] error: %s\n", e.what());
+        failures++;
+    }
+
+    // Closing our end makes the fake device's read() return 0
+    deviceThread.join();
+
+    printf("[test] channel flush %s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
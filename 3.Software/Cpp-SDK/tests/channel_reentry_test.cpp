@@ -0,0 +1,61 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include <atomic>
+#include <cstdio>
+#include <sys/socket.h>
+#include <thread>
+
+#include "fibre_host/device.hpp"
+#include "fake_device.hpp"
+
+/* Function implementations --------------------------------------------------*/
+
+// A callback runs on the receive thread, the only thread that frees request
+// slots. With the window full, a request issued from a callback has to fail
+// with CHANNEL_WOULD_BLOCK instead of waiting for itself forever. ctest's
+// timeout catches the hang this used to be.
+int main()
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+        return 1;
+    FakeDevicePublish();
+    std::thread deviceThread(FakeDeviceServeStream, fds[1]);
+
+    int failures = 0;
+    try
+    {
+        fibre::Device device(std::make_unique<fibre::StreamTransport>(fds[0]));
+        device.connect();
+        const fibre::RemoteNode &serial = device.at("serial_number");
+        device.get_channel().max_in_flight = 1;
+
+        std::atomic<int> first{1}, second{1};
+        device.read_async<uint64_t>(serial, [&](int status, uint64_t)
+        {
+            if (status)
+                return;
+            // Its own slot is free again: the first one goes out, the second
+            // finds the window full
+            device.read_async<uint64_t>(serial, [&first](int status, uint64_t) { first = status; });
+            device.read_async<uint64_t>(serial, [&second](int status, uint64_t) { second = status; });
+        });
+        device.get_channel().flush();
+
+        if (first != fibre::CHANNEL_OK || second != fibre::CHANNEL_WOULD_BLOCK)
+        {
+            printf("[test] chained requests returned %d and %d\n", first.load(), second.load());
+            failures++;
+        }
+    } catch (const std::exception &e)
+    {
+        printf("[test] error: %s\n", e.what());
+        failures++;
+    }
+
+    // Closing our end makes the fake device's read() return 0
+    deviceThread.join();
+
+    printf("[test] channel reentry %s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
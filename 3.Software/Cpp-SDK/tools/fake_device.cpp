@@ -0,0 +1,211 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include <atomic>
+#include <cerrno>
+#include <new>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <fibre/protocol.hpp>
+#include "fake_device.hpp"
+
+/* Private typedef -----------------------------------------------------------*/
+
+static std::atomic<uint32_t> callCount{0};
+
+class FakeJoint
+{
+public:
+    bool SetAngle(float _angle)
+    {
+        angle = _angle;
+        callCount++;
+        return true;
+    }
+
+    auto MakeProtocolDefinitions()
+    {
+        return make_protocol_member_list(
+            make_protocol_ro_property("angle", &angle),
+            make_protocol_property("reduction", &reduction),
+            make_protocol_function("set_angle", *this, &FakeJoint::SetAngle, "angle")
+        );
+    }
+
+    float angle = 0;
+    float reduction = 50;
+};
+
+class FakeRobot
+{
+public:
+    bool MoveJ(float _j1, float _j2, float _j3, float _j4, float _j5, float _j6)
+    {
+        float targets[6] = {_j1, _j2, _j3, _j4, _j5, _j6};
+        for (int j = 0; j < 6; j++)
+            joint[j].angle = targets[j];
+        callCount++;
+        return true;
+    }
+
+    bool SetJointSpeed(float _speed)
+    {
+        if (_speed < 0 || _speed > 100)
+            return false;
+        jointSpeed = _speed;
+        callCount++;
+        return true;
+    }
+
+    auto MakeProtocolDefinitions()
+    {
+        return make_protocol_member_list(
+            make_protocol_property("joint_speed", &jointSpeed),
+            make_protocol_object("joint_1", joint[0].MakeProtocolDefinitions()),
+            make_protocol_object("joint_2", joint[1].MakeProtocolDefinitions()),
+            make_protocol_object("joint_3", joint[2].MakeProtocolDefinitions()),
+            make_protocol_object("joint_4", joint[3].MakeProtocolDefinitions()),
+            make_protocol_object("joint_5", joint[4].MakeProtocolDefinitions()),
+            make_protocol_object("joint_6", joint[5].MakeProtocolDefinitions()),
+            make_protocol_function("move_j", *this, &FakeRobot::MoveJ, "j1", "j2", "j3", "j4", "j5", "j6"),
+            make_protocol_function("set_joint_speed", *this, &FakeRobot::SetJointSpeed, "speed")
+        );
+    }
+
+    FakeJoint joint[6];
+    float jointSpeed = 30;
+};
+
+class HelperFunctions
+{
+public:
+    float GetTemperatureHelper()
+    { return 36.5f; }
+} staticFunctions;
+
+// Writes straight to a descriptor, what the UART/USB senders do on the board
+class FdStreamSink : public StreamSink
+{
+public:
+    explicit FdStreamSink(int _fd) : fd(_fd)
+    {}
+
+    int process_bytes(const uint8_t* buffer, size_t length, size_t* processed_bytes) override
+    {
+        while (length)
+        {
+            ssize_t n = write(fd, buffer, length);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return -1;
+            buffer += n;
+            length -= n;
+            if (processed_bytes)
+                *processed_bytes += n;
+        }
+        return 0;
+    }
+
+    size_t get_free_space() override
+    { return SIZE_MAX; }
+
+private:
+    int fd;
+};
+
+// Sends every response as one datagram back to whoever asked last
+class DatagramPacketSink : public PacketSink
+{
+public:
+    explicit DatagramPacketSink(int _fd) : fd(_fd)
+    {}
+
+    int process_packet(const uint8_t* buffer, size_t length) override
+    {
+        ssize_t n = sendto(fd, buffer, length, 0, reinterpret_cast<sockaddr*>(&peer), peerLength);
+        return n == static_cast<ssize_t>(length) ? 0 : -1;
+    }
+
+    sockaddr_storage peer = {};
+    socklen_t peerLength = 0;
+
+private:
+    int fd;
+};
+
+/* Private variables ---------------------------------------------------------*/
+
+static FakeRobot robot;
+static uint64_t serialNumber = 0x3276385B3338;
+
+static inline auto MakeObjTree()
+{
+    return make_protocol_member_list(
+        make_protocol_ro_property("serial_number", &serialNumber),
+        make_protocol_function("get_temperature", staticFunctions, &HelperFunctions::GetTemperatureHelper),
+        make_protocol_object("robot", robot.MakeProtocolDefinitions())
+    );
+}
+
+using treeType = decltype(MakeObjTree());
+alignas(treeType) static uint8_t treeBuffer[sizeof(treeType)];
+
+/* Function implementations --------------------------------------------------*/
+
+void FakeDevicePublish()
+{
+    auto treePtr = new(treeBuffer) treeType(MakeObjTree());
+    fibre_publish(*treePtr);
+}
+
+void FakeDeviceServeStream(int fd)
+{
+    FdStreamSink streamOutput(fd);
+    StreamBasedPacketSink packetOutput(streamOutput);
+    BidirectionalPacketBasedChannel channel(packetOutput);
+    StreamToPacketSegmenter streamInput(channel);
+
+    uint8_t buf[512];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        streamInput.process_bytes(buf, n, nullptr);
+    }
+
+    close(fd);
+}
+
+void FakeDeviceServeDatagram(int fd)
+{
+    DatagramPacketSink packetOutput(fd);
+    BidirectionalPacketBasedChannel channel(packetOutput);
+
+    uint8_t buf[RX_BUF_SIZE];
+    for (;;)
+    {
+        packetOutput.peerLength = sizeof(packetOutput.peer);
+        ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, reinterpret_cast<sockaddr*>(&packetOutput.peer),
+                             &packetOutput.peerLength);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (n == 0)
+            break;
+        channel.process_packet(buf, n);
+    }
+}
+
+uint32_t FakeDeviceGetCallCount()
+{
+    return callCount;
+}
@@ -0,0 +1,24 @@
+#ifndef FIBRE_HOST_FAKE_DEVICE_HPP
+#define FIBRE_HOST_FAKE_DEVICE_HPP
+
+#include <cstdint>
+
+// A stand-in for the REF board: a Dummy shaped object tree (serial_number,
+// get_temperature, robot.move_j, robot.joint_N ...) served by the firmware's
+// own BidirectionalPacketBasedChannel, so host code can be exercised and
+// benchmarked without hardware.
+
+// @brief Builds and publishes the object tree, call once before serving.
+void FakeDevicePublish();
+
+// @brief Serves one framed byte stream (what UART/USB-CDC/TCP carry) on fd
+// until the peer closes it.
+void FakeDeviceServeStream(int fd);
+
+// @brief Serves raw packets on a bound UDP socket until it is shut down.
+void FakeDeviceServeDatagram(int fd);
+
+// @brief Number of function calls the fake robot has executed so far.
+uint32_t FakeDeviceGetCallCount();
+
+#endif
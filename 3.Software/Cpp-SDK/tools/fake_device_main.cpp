@@ -0,0 +1,93 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "fake_device.hpp"
+
+/* Private function prototypes -----------------------------------------------*/
+
+static int OpenSocket(int type, uint16_t port);
+static void ServeTcp(int listenFd);
+
+/* Function implementations --------------------------------------------------*/
+
+// Usage: fake_device [--tcp PORT] [--udp PORT]   (default: --tcp 9910 --udp 9910)
+int main(int argc, char** argv)
+{
+    int tcpPort = 9910;
+    int udpPort = 9910;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "--tcp"))
+            tcpPort = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--udp"))
+            udpPort = atoi(argv[i + 1]);
+    }
+
+    FakeDevicePublish();
+
+    std::thread udpThread;
+    if (udpPort > 0)
+    {
+        int fd = OpenSocket(SOCK_DGRAM, udpPort);
+        if (fd < 0)
+            return 1;
+        udpThread = std::thread(FakeDeviceServeDatagram, fd);
+        printf("[fake_device] udp on port %d\n", udpPort);
+    }
+
+    if (tcpPort > 0)
+    {
+        int fd = OpenSocket(SOCK_STREAM, tcpPort);
+        if (fd < 0 || listen(fd, 4) < 0)
+            return 1;
+        printf("[fake_device] tcp on port %d\n", tcpPort);
+        ServeTcp(fd);
+    }
+
+    if (udpThread.joinable())
+        udpThread.join();
+
+    return 0;
+}
+
+int OpenSocket(int type, uint16_t port)
+{
+    int fd = socket(AF_INET, type, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+    {
+        perror("[fake_device] bind");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void ServeTcp(int listenFd)
+{
+    for (;;)
+    {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+        // The channel writes header, payload and crc separately
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        std::thread(FakeDeviceServeStream, fd).detach();
+    }
+}
@@ -0,0 +1,216 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+
+#include "fibre_host/device.hpp"
+#include "fake_device.hpp"
+
+/* Private typedef -----------------------------------------------------------*/
+
+using Clock = std::chrono::steady_clock;
+
+/* Private variables ---------------------------------------------------------*/
+
+static int failures = 0;
+
+/* Private function prototypes -----------------------------------------------*/
+
+static void Check(bool _ok, const char* _what);
+static double SecondsSince(Clock::time_point _start);
+static void SplitHostPort(const std::string &_arg, std::string* _host, uint16_t* _port);
+static void RunChecks(fibre::Device &_device, bool _allowWrites);
+static void RunBenchmark(fibre::Device &_device, bool _allowWrites, int _count);
+
+/* Function implementations --------------------------------------------------*/
+
+// Usage: fibre_bench [--tcp HOST:PORT | --udp HOST:PORT | --serial PATH [BAUD]] [--write] [-n COUNT]
+//
+// Without a transport argument the firmware side of the protocol runs on a
+// thread in this process and talks to the SDK over a socketpair, which is the
+// loopback check: the descriptor, property access, function calls and
+// pipelining are verified first, then timed. Against real hardware nothing is
+// written or called except get_temperature unless --write is given.
+int main(int argc, char** argv)
+{
+    std::unique_ptr<fibre::Transport> transport;
+    std::thread deviceThread;
+    bool allowWrites = false;
+    int count = 20000;
+
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string host;
+            uint16_t port;
+            if (!strcmp(argv[i], "--tcp") && i + 1 < argc)
+            {
+                SplitHostPort(argv[++i], &host, &port);
+                transport = std::make_unique<fibre::TcpTransport>(host, port);
+            } else if (!strcmp(argv[i], "--udp") && i + 1 < argc)
+            {
+                SplitHostPort(argv[++i], &host, &port);
+                transport = std::make_unique<fibre::UdpTransport>(host, port);
+            } else if (!strcmp(argv[i], "--serial") && i + 1 < argc)
+            {
+                const char* path = argv[++i];
+                int baud = (i + 1 < argc && argv[i + 1][0] != '-') ? atoi(argv[++i]) : 115200;
+                transport = std::make_unique<fibre::SerialTransport>(path, baud);
+            } else if (!strcmp(argv[i], "--write"))
+            {
+                allowWrites = true;
+            } else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            {
+                count = atoi(argv[++i]);
+            }
+        }
+
+        if (!transport)
+        {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+                return 1;
+            FakeDevicePublish();
+            deviceThread = std::thread(FakeDeviceServeStream, fds[1]);
+            transport = std::make_unique<fibre::StreamTransport>(fds[0]);
+            allowWrites = true;
+            printf("[bench] in-process fake device (loopback)\n");
+        }
+
+        {
+            fibre::Device device(std::move(transport));
+
+            auto start = Clock::now();
+            device.connect();
+            printf("[bench] descriptor: %zu bytes, crc 0x%04x, %.1f ms\n",
+                   device.get_json().size(), device.get_json_crc(), SecondsSince(start) * 1e3);
+
+            RunChecks(device, allowWrites);
+            RunBenchmark(device, allowWrites, count);
+
+            auto stats = device.get_channel().get_stats();
+            printf("[bench] tx %llu rx %llu timeouts %llu resends %llu unexpected %llu\n",
+                   (unsigned long long) stats.tx_cnt, (unsigned long long) stats.rx_cnt,
+                   (unsigned long long) stats.timeout_cnt, (unsigned long long) stats.resend_cnt,
+                   (unsigned long long) stats.unexpected_ack_cnt);
+        }
+    } catch (const std::exception &e)
+    {
+        printf("[bench] error: %s\n", e.what());
+        failures++;
+    }
+
+    // Closing our end makes the fake device's read() return 0
+    if (deviceThread.joinable())
+        deviceThread.join();
+
+    printf("[bench] %s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
+
+void RunChecks(fibre::Device &_device, bool _allowWrites)
+{
+    Check(_device.root().find("serial_number") != nullptr, "descriptor has serial_number");
+    uint64_t serial = _device.read<uint64_t>("serial_number").get();
+    printf("[check] serial_number = %llX\n", (unsigned long long) serial);
+
+    float temperature = _device.call<float>("get_temperature").get();
+    Check(temperature > -40 && temperature < 125, "get_temperature returns a sane value");
+
+    if (!_allowWrites)
+        return;
+
+    // Property write followed by read back
+    _device.write("robot.joint_speed", 42.5f).get();
+    Check(_device.read<float>("robot.joint_speed").get() == 42.5f, "property write/read back");
+
+    // Arguments are converted to the declared wire type
+    Check(_device.call<bool>("robot.move_j", 1, 2.5, 3.0f, -4, 5, 6).get(), "move_j returns true");
+    Check(_device.read<float>("robot.joint_2.angle").get() == 2.5f, "move_j argument 2 arrived");
+    Check(_device.read<float>("robot.joint_4.angle").get() == -4.0f, "move_j argument 4 arrived");
+    Check(!_device.call<bool>("robot.set_joint_speed", 1000).get(), "set_joint_speed rejects 1000");
+
+    // Pipelined calls must all execute, in order
+    std::vector<std::future<bool>> results;
+    for (int i = 0; i < 64; i++)
+        results.push_back(_device.call<bool>("robot.joint_1.set_angle", i));
+    bool allOk = true;
+    for (auto &r : results)
+        allOk &= r.get();
+    Check(allOk, "64 pipelined calls acknowledged");
+    Check(_device.read<float>("robot.joint_1.angle").get() == 63.0f, "pipelined calls executed in order");
+
+    // Unknown paths are rejected before anything is sent
+    bool threw = false;
+    try
+    { _device.read<float>("robot.no_such_thing"); }
+    catch (const std::out_of_range &)
+    { threw = true; }
+    Check(threw, "unknown path throws");
+}
+
+void RunBenchmark(fibre::Device &_device, bool _allowWrites, int _count)
+{
+    const fibre::RemoteNode &serial = _device.at("serial_number");
+
+    // One request at a time, what the python client does
+    int sequential = _count / 10 > 0 ? _count / 10 : 1;
+    auto start = Clock::now();
+    for (int i = 0; i < sequential; i++)
+        _device.read<uint64_t>("serial_number").get();
+    double t = SecondsSince(start);
+    printf("[bench] sequential reads : %8.0f /s, %7.1f us round trip\n", sequential / t, t / sequential * 1e6);
+
+    // Keep the window full and collect completions through callbacks
+    std::atomic<int> done{0};
+    start = Clock::now();
+    for (int i = 0; i < _count; i++)
+        _device.read_async<uint64_t>(serial, [&done](int status, uint64_t)
+        { if (!status) done++; });
+    _device.get_channel().flush();
+    t = SecondsSince(start);
+    printf("[bench] pipelined reads  : %8.0f /s (%d/%d ok)\n", _count / t, done.load(), _count);
+    Check(done == _count, "all pipelined reads completed");
+
+    if (!_allowWrites)
+        return;
+
+    // Each move_j is 6 input writes + trigger + output read on the wire
+    int calls = _count / 8 > 0 ? _count / 8 : 1;
+    std::vector<std::future<bool>> results;
+    results.reserve(calls);
+    start = Clock::now();
+    for (int i = 0; i < calls; i++)
+        results.push_back(_device.call<bool>("robot.move_j", i, 0, 90, 0, 0, 0));
+    int ok = 0;
+    for (auto &r : results)
+        ok += r.get();
+    t = SecondsSince(start);
+    printf("[bench] pipelined move_j : %8.0f /s (%d/%d ok)\n", calls / t, ok, calls);
+    Check(ok == calls, "all pipelined move_j calls completed");
+}
+
+void Check(bool _ok, const char* _what)
+{
+    printf("[check] %-40s %s\n", _what, _ok ? "ok" : "FAIL");
+    if (!_ok)
+        failures++;
+}
+
+double SecondsSince(Clock::time_point _start)
+{
+    return std::chrono::duration<double>(Clock::now() - _start).count();
+}
+
+void SplitHostPort(const std::string &_arg, std::string* _host, uint16_t* _port)
+{
+    size_t colon = _arg.rfind(':');
+    *_host = colon == std::string::npos ? _arg : _arg.substr(0, colon);
+    *_port = colon == std::string::npos ? 9910 : static_cast<uint16_t>(atoi(_arg.c_str() + colon + 1));
+}
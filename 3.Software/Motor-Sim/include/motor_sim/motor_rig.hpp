@@ -0,0 +1,234 @@
+#ifndef MOTOR_SIM_MOTOR_RIG_HPP
+#define MOTOR_SIM_MOTOR_RIG_HPP
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "configurations.h"
+#include "Driver/tb67h450_base.h"
+#include "Sensor/Encoder/mt6816_base.h"
+#include "Sensor/Encoder/encoder_calibrator_base.h"
+#include "stepper_plant.hpp"
+
+namespace motor_sim
+{
+
+struct EncoderParams_t
+{
+    double noise_lsb = 1.0;         // Gaussian, RMS in 14-bit counts
+    double offset = 1.2345;         // rad, magnet against the rotor's electrical zero
+    double eccentricity_lsb = 0;    // Once-per-turn error in counts, an off-centre magnet
+    bool reversed = false;          // Counts down when the motor turns forward
+    double spi_error_rate = 0;      // Chance of one flipped bit per SPI byte
+    uint32_t seed = 1;
+};
+
+// @brief TB67H450 whose bridges and current references drive a StepperPlant.
+class TB67H450Sim : public TB67H450Base
+{
+public:
+    explicit TB67H450Sim(StepperPlant &_plant) :
+        plant(_plant)
+    {}
+
+private:
+    StepperPlant &plant;
+    double currentA = 0;
+    double currentB = 0;
+
+    void InitGpio() override
+    {}
+
+    void InitPwm() override
+    {}
+
+    void DacOutputVoltage(uint16_t _voltageA_3300mVIn12bits, uint16_t _voltageB_3300mVIn12bits) override;
+
+    void SetInputA(bool _statusAp, bool _statusAm) override;
+
+    void SetInputB(bool _statusBp, bool _statusBm) override;
+};
+
+// @brief MT6816 on SPI, answering register reads with the plant's angle,
+// quantized to 14 bits, with noise and the parity bit the firmware checks.
+class MT6816Sim : public MT6816Base
+{
+public:
+    MT6816Sim(const StepperPlant &_plant, uint16_t* _quickCaliDataPtr, const EncoderParams_t &_params);
+
+    // Counts of the last sample, before the SPI errors
+    uint16_t lastSample = 0;
+    uint32_t spiErrorCount = 0;
+
+private:
+    const StepperPlant &plant;
+    EncoderParams_t params;
+    std::mt19937 rng;
+    std::normal_distribution<double> noise{0.0, 1.0};
+    std::uniform_real_distribution<double> uniform{0.0, 1.0};
+    uint8_t reg4 = 0;
+    uint16_t transferRx = 0;
+
+    void SpiInit() override
+    {}
+
+    uint16_t SpiTransmitAndRead16Bits(uint16_t _dataTx) override;
+
+    // No bus time: a started transfer is done by the time it's ended
+    void SpiStartTransfer16Bits(uint16_t _dataTx) override
+    { transferRx = SpiTransmitAndRead16Bits(_dataTx); }
+
+    uint16_t SpiEndTransfer16Bits() override
+    { return transferRx; }
+
+    uint8_t Corrupt(uint8_t _byte);
+};
+
+// @brief Calibrator whose "flash" is the rig's calibration table.
+class EncoderCalibratorSim : public EncoderCalibratorBase
+{
+public:
+    EncoderCalibratorSim(Motor* _motor, std::vector<uint16_t> &_flash) :
+        EncoderCalibratorBase(_motor), flash(_flash)
+    {}
+
+private:
+    std::vector<uint16_t> &flash;
+    size_t writeIndex = 0;
+
+    void BeginWriteFlash() override;
+    void EndWriteFlash() override;
+    void ClearFlash() override;
+    void WriteFlash16bitsAppend(uint16_t _data) override;
+};
+
+struct CaliError_t
+{
+    bool valid;         // The table was complete
+    double mean;        // steps, table minus true position
+    double max_abs;     // steps
+};
+
+// @brief One driver board in simulated time: the firmware's Motor,
+// calibrator, TB67H450 and MT6816 code on a simulated motor.
+//
+// tick() is one period of the 20kHz timer interrupt followed by the main
+// loop. The board can reboot (boot(), or the calibrator's reset), which
+// rebuilds the firmware objects from config while the motor, the encoder's
+// magnet and the calibration table stay as they are.
+class MotorRig
+{
+public:
+    static constexpr double TICK_S = 1.0 / 20000;
+    // How early the board's timer starts a pipelined encoder read
+    static constexpr double READ_LEAD_S = 8e-6;
+
+    explicit MotorRig(const StepperParams_t &plant_params = StepperParams_t(),
+                      const EncoderParams_t &encoder_params = EncoderParams_t());
+    ~MotorRig();
+
+    MotorRig(const MotorRig &) = delete;
+    MotorRig &operator=(const MotorRig &) = delete;
+
+    // What the EEPROM holds, the firmware defaults unless changed. Applied
+    // to boardConfig and the motor on boot(), like Main() does.
+    BoardConfig_t config;
+
+    // Read the encoder ahead of each tick like the board does, instead of
+    // inside it. Applied on boot().
+    bool pipelined_read = false;
+
+    // Calibrate with the constant-velocity sweep, or stop at every hard
+    // step. Applied on boot().
+    bool sweep_calibration = true;
+
+    void boot();
+
+    void tick();
+
+    void run(double seconds);
+
+    // @brief Runs the firmware's encoder calibration to completion and
+    // reboots, as if both buttons were held at power-up. True if the
+    // board came back calibrated.
+    bool calibrate(double timeout_s = 30);
+
+    // @brief Writes the table a perfect calibration would give, and reboots.
+    void load_ideal_calibration();
+
+    // @brief Compares the firmware's calibrated angle of every count, full
+    // or compact table, with the encoder's true mapping.
+    CaliError_t calibration_error() const;
+
+    // @brief The same comparison for the full table the firmware used to
+    // write, expanded from the compact table's hard steps like the old
+    // calibrator did. Invalid if flash holds no compact table.
+    CaliError_t full_table_error() const;
+
+    // @brief Called by the firmware's HAL_NVIC_SystemReset(), the reboot
+    // happens once the main loop returns.
+    void request_reset()
+    { reset_requested_ = true; }
+
+    // @brief Runs _fn as one of the board's interrupts outside the tick,
+    // so that a HAL_NVIC_SystemReset() from it reboots this rig.
+    template<typename F>
+    void interrupt(F &&_fn)
+    {
+        MotorRig* previous = set_active(this);
+        _fn();
+        set_active(previous);
+    }
+
+    Motor &motor()
+    { return *motor_; }
+
+    StepperPlant &plant()
+    { return plant_; }
+
+    MT6816Sim &encoder()
+    { return *encoder_; }
+
+    EncoderCalibratorSim &calibrator()
+    { return *calibrator_; }
+
+    double time() const
+    { return (double) ticks_ * TICK_S; }
+
+    uint64_t ticks() const
+    { return ticks_; }
+
+    uint32_t boot_count() const
+    { return boot_count_; }
+
+    // Plant angle in the firmware's subdivided steps
+    double true_steps() const;
+
+private:
+    // Returns the rig that was active before
+    static MotorRig* set_active(MotorRig* rig);
+
+    int32_t ideal_table_entry(uint32_t raw) const;
+
+    CaliError_t table_error(const std::vector<int32_t> &table) const;
+
+    StepperPlant plant_;
+    EncoderParams_t encoder_params_;
+    std::vector<uint16_t> flash_;
+
+    std::unique_ptr<Motor> motor_;
+    std::unique_ptr<TB67H450Sim> driver_;
+    std::unique_ptr<MT6816Sim> encoder_;
+    std::unique_ptr<EncoderCalibratorSim> calibrator_;
+    std::unique_ptr<EstimatorBase> estimator_;
+
+    uint64_t ticks_ = 0;
+    uint32_t boot_count_ = 0;
+    bool reset_requested_ = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef MOTOR_SIM_STEPPER_PLANT_HPP
+#define MOTOR_SIM_STEPPER_PLANT_HPP
+
+#include <cstdint>
+#include <limits>
+
+namespace motor_sim
+{
+
+// Defaults are a 42x40mm 1.8° motor like the ones on the Dummy's joints
+struct StepperParams_t
+{
+    uint32_t pole_pairs = 50;           // Electrical cycles per turn, 4 full steps each
+    double resistance = 1.5;            // Ohm, per phase
+    double inductance = 2.8e-3;         // H, per phase
+    double torque_constant = 0.3;       // Nm/A, equal to the back-EMF constant in V*s/rad
+    double detent_torque = 0.015;       // Nm, peak of the cogging torque
+    double rotor_inertia = 5.7e-6;      // kg*m^2
+    double viscous_friction = 2e-5;     // Nm*s/rad
+    double coulomb_friction = 4e-3;     // Nm
+    double supply_voltage = 24;         // V
+    // The TB67H450's chopper holds the reference as long as the supply
+    // allows, modelled as a current loop with this gain (V/A)
+    double chopper_gain = 60;
+};
+
+// What's coupled to the shaft, on top of the rotor itself
+struct Load_t
+{
+    double inertia = 0;                 // kg*m^2
+    double torque = 0;                  // Nm, constant, against the positive direction
+    // Something in the way going forward, pushing back like a spring once touched
+    double contact_angle = std::numeric_limits<double>::infinity();  // rad
+    double contact_stiffness = 0;       // Nm/rad
+};
+
+// @brief Two-phase hybrid stepper with its H-bridges, in simulated time.
+//
+// Per phase the bridge drives the coil current towards a reference, limited
+// by the supply against resistance and back-EMF. The torque is the
+// sinusoidal torque of both coils plus detent torque at the full-step
+// period, against load, viscous and Coulomb friction. A coil current
+// vector at electrical angle phi pulls the rotor to phi / pole_pairs.
+class StepperPlant
+{
+public:
+    enum Bridge
+    {
+        BRIDGE_OFF,         // All switches open, the current dies through the diodes
+        BRIDGE_FORWARD,
+        BRIDGE_REVERSE,
+        BRIDGE_BRAKE        // Coil shorted
+    };
+
+    // Integration step, far below the electrical time constant
+    static constexpr double MAX_STEP_S = 5e-6;
+
+    explicit StepperPlant(const StepperParams_t &params = StepperParams_t());
+
+    // @param phase: 0 for A, 1 for B
+    // @param current: reference magnitude in A, the bridge sets the sign
+    void set_phase(int phase, Bridge bridge, double current);
+
+    void set_load(const Load_t &load)
+    { load_ = load; }
+
+    // @brief Holds the rotor at rest at a mechanical angle, coils off.
+    void reset(double angle = 0);
+
+    void advance(double seconds);
+
+    // Mechanical angle in rad, not wrapped
+    double angle() const
+    { return angle_; }
+
+    // rad/s
+    double velocity() const
+    { return velocity_; }
+
+    // A, signed
+    double current(int phase) const
+    { return current_[phase]; }
+
+    // Nm produced by the coils at the last step
+    double torque() const
+    { return torque_; }
+
+    const StepperParams_t &params() const
+    { return params_; }
+
+    const Load_t &load() const
+    { return load_; }
+
+private:
+    void step(double dt);
+
+    StepperParams_t params_;
+    Load_t load_;
+
+    Bridge bridge_[2] = {BRIDGE_OFF, BRIDGE_OFF};
+    double current_ref_[2] = {};
+    double current_[2] = {};
+    double angle_ = 0;
+    double velocity_ = 0;
+    double torque_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef MOTOR_SIM_SHIM_EEPROM_INTERFACE_H
+#define MOTOR_SIM_SHIM_EEPROM_INTERFACE_H
+
+// Stands in for the driver firmware's EEPROM emulation, which configurations.h
+// includes. The simulation keeps boardConfig in RAM only.
+
+#endif
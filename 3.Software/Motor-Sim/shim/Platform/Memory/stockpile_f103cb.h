@@ -0,0 +1,19 @@
+#ifndef MOTOR_SIM_SHIM_STOCKPILE_F103CB_H
+#define MOTOR_SIM_SHIM_STOCKPILE_F103CB_H
+
+// Stands in for the driver firmware's flash layout header. The calibrator
+// writes its table through EncoderCalibratorBase's flash hooks, and only
+// needs the reset it does once the table is stored.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Reboots the simulated board, see MotorRig
+void HAL_NVIC_SystemReset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
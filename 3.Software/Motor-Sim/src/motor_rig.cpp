@@ -0,0 +1,422 @@
+#include "motor_sim/motor_rig.hpp"
+
+#include <cmath>
+#include <Platform/Memory/stockpile_f103cb.h>
+
+// Defined by the driver firmware's main.cpp on the board
+BoardConfig_t boardConfig;
+
+namespace motor_sim
+{
+
+// The rig whose main loop or interrupt is running, for HAL_NVIC_SystemReset()
+static MotorRig* activeRig = nullptr;
+
+static const double TWO_PI = 6.283185307179586;
+
+
+/* TB67H450Sim ---------------------------------------------------------------*/
+
+void TB67H450Sim::DacOutputVoltage(uint16_t _voltageA_3300mVIn12bits, uint16_t _voltageB_3300mVIn12bits)
+{
+    // 0.1 Ohm sense resistors: 1 mV of Vref is 1 mA of coil current
+    currentA = _voltageA_3300mVIn12bits * 3.3 / 4096;
+    currentB = _voltageB_3300mVIn12bits * 3.3 / 4096;
+}
+
+
+static StepperPlant::Bridge ToBridge(bool _statusP, bool _statusM)
+{
+    if (_statusP && _statusM)
+        return StepperPlant::BRIDGE_BRAKE;
+    if (_statusP)
+        return StepperPlant::BRIDGE_FORWARD;
+    if (_statusM)
+        return StepperPlant::BRIDGE_REVERSE;
+    return StepperPlant::BRIDGE_OFF;
+}
+
+
+void TB67H450Sim::SetInputA(bool _statusAp, bool _statusAm)
+{
+    plant.set_phase(0, ToBridge(_statusAp, _statusAm), currentA);
+}
+
+
+void TB67H450Sim::SetInputB(bool _statusBp, bool _statusBm)
+{
+    plant.set_phase(1, ToBridge(_statusBp, _statusBm), currentB);
+}
+
+
+/* MT6816Sim -----------------------------------------------------------------*/
+
+MT6816Sim::MT6816Sim(const StepperPlant &_plant, uint16_t* _quickCaliDataPtr, const EncoderParams_t &_params) :
+    MT6816Base(_quickCaliDataPtr), plant(_plant), params(_params), rng(_params.seed)
+{
+}
+
+
+uint16_t MT6816Sim::SpiTransmitAndRead16Bits(uint16_t _dataTx)
+{
+    uint8_t reg = (_dataTx >> 8) & 0x7F;
+
+    if (reg == 0x03)
+    {
+        // Register 3 latches a new sample, register 4 returns the rest of it
+        double angle = params.reversed ? -plant.angle() : plant.angle();
+        angle += params.offset;
+        double counts = (angle / TWO_PI - std::floor(angle / TWO_PI)) * RESOLUTION;
+        counts += params.eccentricity_lsb * std::sin(angle);
+        if (params.noise_lsb > 0)
+            counts += noise(rng) * params.noise_lsb;
+
+        auto sample = (int32_t) std::floor(counts);
+        sample = ((sample % RESOLUTION) + RESOLUTION) % RESOLUTION;
+        lastSample = (uint16_t) sample;
+
+        // Angle in bits 15~2, no-magnet flag 1, bit 0 makes the parity even
+        uint16_t word = (uint16_t) (sample << 2);
+        uint8_t ones = 0;
+        for (uint8_t i = 1; i < 16; i++)
+            ones += (word >> i) & 1;
+        word |= ones & 1;
+
+        reg4 = word & 0xFF;
+        return Corrupt(word >> 8);
+    }
+    if (reg == 0x04)
+        return Corrupt(reg4);
+
+    return 0;
+}
+
+
+uint8_t MT6816Sim::Corrupt(uint8_t _byte)
+{
+    if (params.spi_error_rate > 0 && uniform(rng) < params.spi_error_rate)
+    {
+        spiErrorCount++;
+        return _byte ^ (1 << (rng() % 8));
+    }
+    return _byte;
+}
+
+
+/* EncoderCalibratorSim ------------------------------------------------------*/
+
+void EncoderCalibratorSim::BeginWriteFlash()
+{
+    writeIndex = 0;
+}
+
+
+void EncoderCalibratorSim::EndWriteFlash()
+{
+}
+
+
+void EncoderCalibratorSim::ClearFlash()
+{
+    std::fill(flash.begin(), flash.end(), 0xFFFF);
+    writeIndex = 0;
+}
+
+
+void EncoderCalibratorSim::WriteFlash16bitsAppend(uint16_t _data)
+{
+    if (writeIndex < flash.size())
+        flash[writeIndex++] = _data;
+}
+
+
+/* MotorRig ------------------------------------------------------------------*/
+
+MotorRig::MotorRig(const StepperParams_t &plant_params, const EncoderParams_t &encoder_params) :
+    plant_(plant_params), encoder_params_(encoder_params)
+{
+    // Defaults from the driver firmware's Main()
+    Motor defaults;
+    config = BoardConfig_t{};
+    config.configStatus = CONFIG_OK;
+    config.canNodeId = 0;
+    config.encoderHomeOffset = 0;
+    config.defaultMode = Motor::MODE_COMMAND_POSITION;
+    config.currentLimit = 1 * 1000;
+    config.velocityLimit = 30 * defaults.MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS;
+    config.velocityAcc = 100 * defaults.MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS;
+    config.calibrationCurrent = 2000;
+    config.dce_kp = 200;
+    config.dce_kv = 80;
+    config.dce_ki = 300;
+    config.dce_kd = 250;
+    config.enableMotorOnBoot = false;
+    config.enableStallProtect = false;
+    config.stateBroadcastPeriod = 0;
+    config.estimator = ESTIMATOR_PLL;
+    config.velocityJerk = 0;
+    config.collisionThreshold = 0;
+    config.collisionTripTime = 1;
+    config.collisionErrorFloor = 1024;
+    config.collisionCurrentFloor = 300;
+
+    // Erased flash, one entry per 14-bit count, the board starts uncalibrated
+    flash_.assign(1 << 14, 0xFFFF);
+
+    boot();
+}
+
+
+MotorRig::~MotorRig()
+{
+    if (activeRig == this)
+        activeRig = nullptr;
+}
+
+
+void MotorRig::boot()
+{
+    reset_requested_ = false;
+    boot_count_++;
+
+    // The bridges are disabled while the MCU restarts
+    plant_.set_phase(0, StepperPlant::BRIDGE_OFF, 0);
+    plant_.set_phase(1, StepperPlant::BRIDGE_OFF, 0);
+
+    EncoderParams_t encoderParams = encoder_params_;
+    encoderParams.seed += boot_count_;
+
+    calibrator_.reset();
+    motor_ = std::make_unique<Motor>();
+    driver_ = std::make_unique<TB67H450Sim>(plant_);
+    encoder_ = std::make_unique<MT6816Sim>(plant_, flash_.data(), encoderParams);
+    calibrator_ = std::make_unique<EncoderCalibratorSim>(motor_.get(), flash_);
+    calibrator_->sweepMode = sweep_calibration;
+
+    boardConfig = config;
+    Motor &motor = *motor_;
+    motor.config.motionParams.encoderHomeOffset = boardConfig.encoderHomeOffset;
+    motor.config.motionParams.ratedCurrent = boardConfig.currentLimit;
+    motor.config.motionParams.ratedVelocity = boardConfig.velocityLimit;
+    motor.config.motionParams.ratedVelocityAcc = boardConfig.velocityAcc;
+    motor.motionPlanner.velocityTracker.SetVelocityAcc(boardConfig.velocityAcc);
+    motor.motionPlanner.positionTracker.SetVelocityAcc(boardConfig.velocityAcc);
+    motor.motionPlanner.positionTracker.SetJerk(boardConfig.velocityJerk);
+    motor.config.motionParams.caliCurrent = boardConfig.calibrationCurrent;
+    motor.config.ctrlParams.dce.kp = boardConfig.dce_kp;
+    motor.config.ctrlParams.dce.kv = boardConfig.dce_kv;
+    motor.config.ctrlParams.dce.ki = boardConfig.dce_ki;
+    motor.config.ctrlParams.dce.kd = boardConfig.dce_kd;
+    motor.config.ctrlParams.stallProtectSwitch = boardConfig.enableStallProtect;
+    motor.collisionDetector.SetConfig(CollisionDetector::Config_t{
+        .threshold = (int32_t) boardConfig.collisionThreshold,
+        .tripTime = (int32_t) boardConfig.collisionTripTime,
+        .errorFloor = (int32_t) boardConfig.collisionErrorFloor,
+        .currentFloor = (int32_t) boardConfig.collisionCurrentFloor
+    });
+
+    motor.AttachDriver(driver_.get());
+    motor.AttachEncoder(encoder_.get());
+    if (boardConfig.estimator == ESTIMATOR_PLL)
+        estimator_ = std::make_unique<PllEstimator>();
+    else
+        estimator_ = std::make_unique<FilterEstimator>();
+    motor.AttachEstimator(estimator_.get());
+    motor.controller->Init();
+    motor.driver->Init();
+    motor.encoder->Init();
+    encoder_->SetPipelinedRead(pipelined_read);
+}
+
+
+void MotorRig::tick()
+{
+    if (calibrator_->isTriggered)
+        calibrator_->Tick20kHz();
+    else
+        motor_->Tick20kHz();
+
+    if (pipelined_read)
+    {
+        plant_.advance(TICK_S - READ_LEAD_S);
+        encoder_->StartSampleRead();
+        // One call per word, two words for each of up to three attempts
+        for (int i = 0; i < 6; i++)
+            encoder_->OnSpiTransferComplete();
+        plant_.advance(READ_LEAD_S);
+    } else
+    {
+        plant_.advance(TICK_S);
+    }
+    ticks_++;
+
+    MotorRig* previous = set_active(this);
+    calibrator_->TickMainLoop();
+    set_active(previous);
+
+    // What Main()'s loop does with a finished auto-tune, the EEPROM write included
+    if (motor_->dceTuner.TickMainLoop())
+    {
+        const DceTuner::Result_t &result = motor_->dceTuner.result;
+        motor_->config.ctrlParams.dce.kp = boardConfig.dce_kp = result.kp;
+        motor_->config.ctrlParams.dce.ki = boardConfig.dce_ki = result.ki;
+        motor_->config.ctrlParams.dce.kd = boardConfig.dce_kd = result.kd;
+        config.dce_kp = result.kp;
+        config.dce_ki = result.ki;
+        config.dce_kd = result.kd;
+    }
+
+    if (reset_requested_)
+        boot();
+}
+
+
+void MotorRig::run(double seconds)
+{
+    auto count = (uint64_t) std::llround(seconds / TICK_S);
+    for (uint64_t i = 0; i < count; i++)
+        tick();
+}
+
+
+bool MotorRig::calibrate(double timeout_s)
+{
+    uint32_t boots = boot_count_;
+    calibrator_->sweepMode = sweep_calibration;
+    calibrator_->isTriggered = true;
+
+    auto limit = ticks_ + (uint64_t) std::llround(timeout_s / TICK_S);
+    while (ticks_ < limit && calibrator_->isTriggered)
+        tick();
+
+    // A failed calibration stops without a reset, stalled and uncalibrated
+    return boot_count_ != boots && encoder_->IsCalibrated();
+}
+
+
+int32_t MotorRig::ideal_table_entry(uint32_t raw) const
+{
+    const int32_t stepsPerTurn = motor_->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS;
+
+    // Centre of the count's span, without the eccentricity, back in the
+    // rotor's own frame
+    double counts = (double) raw + 0.5;
+    double angle = counts / encoder_->RESOLUTION * TWO_PI;
+    for (int i = 0; i < 8; i++)
+        angle = (counts - encoder_params_.eccentricity_lsb * std::sin(angle)) / encoder_->RESOLUTION * TWO_PI;
+    angle -= encoder_params_.offset;
+    if (encoder_params_.reversed)
+        angle = -angle;
+
+    auto steps = (int32_t) std::lround(angle / TWO_PI * stepsPerTurn);
+    return ((steps % stepsPerTurn) + stepsPerTurn) % stepsPerTurn;
+}
+
+
+void MotorRig::load_ideal_calibration()
+{
+    for (uint32_t raw = 0; raw < flash_.size(); raw++)
+        flash_[raw] = (uint16_t) ideal_table_entry(raw);
+
+    boot();
+}
+
+
+CaliError_t MotorRig::calibration_error() const
+{
+    if (!encoder_->IsCalibrated())
+        return CaliError_t{false, 0, 0};
+
+    std::vector<int32_t> table(encoder_->RESOLUTION);
+    for (uint32_t raw = 0; raw < table.size(); raw++)
+        table[raw] = encoder_->RectifyAngle(raw);
+
+    return table_error(table);
+}
+
+
+CaliError_t MotorRig::full_table_error() const
+{
+    const int32_t resolution = encoder_->RESOLUTION;
+    if (flash_[0] != EncoderBase::COMPACT_TABLE_MAGIC)
+        return CaliError_t{false, 0, 0};
+
+    const int32_t steps = flash_[1];
+    const int32_t stepSize = flash_[2];
+    const uint16_t* counts = flash_.data() + EncoderBase::COMPACT_TABLE_HEADER_SIZE;
+    const int32_t turn = steps * stepSize;
+    auto cycleMod = [](int32_t a, int32_t b) { return ((a % b) + b) % b; };
+    auto cycleSubtract = [&](int32_t a, int32_t b)
+    {
+        int32_t sub = cycleMod(a - b, resolution);
+        return sub > resolution / 2 ? sub - resolution : sub;
+    };
+
+    // The old calibrator's loops: every count between two hard steps gets
+    // the lower step plus its share of the span, truncated, counted from
+    // whichever end of the span has the lower count
+    std::vector<int32_t> table(resolution);
+    bool ascending = cycleSubtract(counts[1], counts[0]) > 0;
+    for (int32_t step = 0; step < steps; step++)
+    {
+        int32_t next = (step + 1) % steps;
+        int32_t low = ascending ? counts[step] : counts[next];
+        int32_t span = std::abs(cycleSubtract(counts[next], counts[step]));
+        for (int32_t y = 0; y < span; y++)
+        {
+            int32_t angle = ascending ? stepSize * step + stepSize * y / span
+                                      : stepSize * (step + 1) - stepSize * y / span;
+            table[cycleMod(low + y, resolution)] = cycleMod(angle, turn);
+        }
+    }
+
+    return table_error(table);
+}
+
+
+CaliError_t MotorRig::table_error(const std::vector<int32_t> &table) const
+{
+    CaliError_t result = {true, 0, 0};
+    // Both tables are aligned to the coils, but may differ by whole
+    // electrical cycles
+    const int32_t cycle = motor_->SOFT_DIVIDE_NUM * 4;
+
+    double sum = 0;
+    for (uint32_t raw = 0; raw < table.size(); raw++)
+    {
+        int32_t diff = (table[raw] - ideal_table_entry(raw)) % cycle;
+        if (diff >= cycle / 2)
+            diff -= cycle;
+        else if (diff < -cycle / 2)
+            diff += cycle;
+
+        sum += diff;
+        result.max_abs = std::max(result.max_abs, (double) std::abs(diff));
+    }
+    result.mean = sum / (double) table.size();
+
+    return result;
+}
+
+
+MotorRig* MotorRig::set_active(MotorRig* rig)
+{
+    MotorRig* previous = activeRig;
+    activeRig = rig;
+    return previous;
+}
+
+
+double MotorRig::true_steps() const
+{
+    return plant_.angle() / TWO_PI * motor_->MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS;
+}
+
+}
+
+
+extern "C" void HAL_NVIC_SystemReset(void)
+{
+    if (motor_sim::activeRig)
+        motor_sim::activeRig->request_reset();
+}
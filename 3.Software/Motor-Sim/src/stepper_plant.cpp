@@ -0,0 +1,115 @@
+#include "motor_sim/stepper_plant.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace motor_sim
+{
+
+StepperPlant::StepperPlant(const StepperParams_t &params) :
+    params_(params)
+{
+}
+
+
+void StepperPlant::set_phase(int phase, Bridge bridge, double current)
+{
+    bridge_[phase] = bridge;
+    current_ref_[phase] = current;
+}
+
+
+void StepperPlant::reset(double angle)
+{
+    bridge_[0] = bridge_[1] = BRIDGE_OFF;
+    current_ref_[0] = current_ref_[1] = 0;
+    current_[0] = current_[1] = 0;
+    angle_ = angle;
+    velocity_ = 0;
+    torque_ = 0;
+}
+
+
+void StepperPlant::advance(double seconds)
+{
+    int steps = (int) std::ceil(seconds / MAX_STEP_S - 1e-9);
+    if (steps < 1)
+        return;
+
+    double dt = seconds / steps;
+    for (int i = 0; i < steps; i++)
+        step(dt);
+}
+
+
+void StepperPlant::step(double dt)
+{
+    const StepperParams_t &p = params_;
+    double electrical = p.pole_pairs * angle_;
+    double sinE = std::sin(electrical);
+    double cosE = std::cos(electrical);
+
+    /*---------------------------- Coils ----------------------------*/
+    // Back-EMF of phase A follows -sin, of phase B cos, the same terms the
+    // torque has, so electrical and mechanical power match
+    double emf[2] = {-p.torque_constant * velocity_ * sinE,
+                     p.torque_constant * velocity_ * cosE};
+
+    for (int ph = 0; ph < 2; ph++)
+    {
+        double &i = current_[ph];
+        double voltage;
+
+        switch (bridge_[ph])
+        {
+            case BRIDGE_FORWARD:
+            case BRIDGE_REVERSE:
+            {
+                double ref = bridge_[ph] == BRIDGE_FORWARD ? current_ref_[ph] : -current_ref_[ph];
+                voltage = p.resistance * ref + emf[ph] + p.chopper_gain * (ref - i);
+                voltage = std::max(-p.supply_voltage, std::min(p.supply_voltage, voltage));
+                break;
+            }
+            case BRIDGE_BRAKE:
+                voltage = 0;
+                break;
+            case BRIDGE_OFF:
+            default:
+                // Freewheels against the supply until it's gone, then stays open
+                if (i == 0)
+                    continue;
+                voltage = i > 0 ? -p.supply_voltage : p.supply_voltage;
+                break;
+        }
+
+        double next = i + (voltage - p.resistance * i - emf[ph]) / p.inductance * dt;
+        if (bridge_[ph] == BRIDGE_OFF && next * i <= 0)
+            next = 0;
+        i = next;
+    }
+
+    /*--------------------------- Rotor -----------------------------*/
+    torque_ = p.torque_constant * (-current_[0] * sinE + current_[1] * cosE);
+    // sin(4x) from the double angle twice, cheaper than another sin()
+    double sin2E = 2 * sinE * cosE;
+    double cos2E = cosE * cosE - sinE * sinE;
+    double detent = -p.detent_torque * 2 * sin2E * cos2E;
+    double drive = torque_ + detent - load_.torque - p.viscous_friction * velocity_;
+    if (angle_ > load_.contact_angle)
+        drive -= load_.contact_stiffness * (angle_ - load_.contact_angle);
+    double inertia = p.rotor_inertia + load_.inertia;
+
+    if (velocity_ == 0 && std::fabs(drive) <= p.coulomb_friction)
+        return;  // Stiction holds
+
+    double friction = p.coulomb_friction * ((velocity_ != 0 ? velocity_ : drive) > 0 ? 1 : -1);
+    double next = velocity_ + (drive - friction) / inertia * dt;
+    // Friction stops the rotor, it doesn't reverse it
+    if (velocity_ != 0 && next * velocity_ < 0)
+        next = 0;
+
+    velocity_ = next;
+    angle_ += velocity_ * dt;
+}
+
+}
@@ -0,0 +1,816 @@
+/* Includes ------------------------------------------------------------------*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "motor_sim/motor_rig.hpp"
+
+/* Private typedef -----------------------------------------------------------*/
+
+using Clock = std::chrono::steady_clock;
+using motor_sim::MotorRig;
+
+struct Options_t
+{
+    motor_sim::EncoderParams_t encoder;
+    motor_sim::Load_t load{5.7e-6, 0.1};    // For the loaded scenarios
+    bool idealCalibration = false;
+    bool pipelinedRead = false;
+    bool stepwiseCalibration = false;
+    bool autoTune = false;
+    uint32_t estimator = ESTIMATOR_PLL;
+    double bandSteps = 14.2;    // Settled within 0.1°
+    std::string trace;
+    uint32_t traceEvery = 10;
+};
+
+struct Scenario_t
+{
+    const char* name;
+    Motor::Mode_t mode;
+    int32_t step;               // steps, or steps/s in velocity mode
+    bool loaded;
+    double seconds;
+};
+
+struct TrajectoryMetrics_t
+{
+    double delayMs;             // Streamed: the lag that fits best. Buffered: the lead.
+    double rmsError;            // steps, against the path that late
+    double maxError;            // steps
+};
+
+struct ProfileMetrics_t
+{
+    double moveMs;              // Until settled at the goal, -1 if never
+    double overshoot;           // steps
+    double peakCurrentA;        // Coil current vector
+    double maxFollowError;      // steps, motor against the planned position
+};
+
+struct CollisionMetrics_t
+{
+    double tripMs;              // From the contact, -1 if it never tripped
+    bool falseTrip;             // Tripped before the contact
+    double travel;              // steps, deepest into the obstacle until it tripped
+    double torque;              // Nm, the obstacle pushing back there
+    int32_t errorDeviation;     // steps, what the detector saw
+    int32_t currentDeviation;   // mA
+};
+
+struct EstimatorMetrics_t
+{
+    double stillNoise;          // steps/s RMS, holding still
+    double lagMs;               // Velocity delay that fits best while accelerating
+    double cruiseNoise;         // steps/s RMS around the true velocity at 10 r/s
+    double cruisePosition;      // steps, mean position error at 10 r/s
+};
+
+struct Metrics_t
+{
+    double riseMs;              // 10% to 90%, -1 if it never got there
+    double overshootPercent;
+    double settleMs;            // Last time outside the band (velocity: its mean), -1 if never settled
+    double steadyError;         // Position: mean |error| in steps. Velocity: RMS ripple in %
+    double peakCurrentA;        // Coil current vector
+    double simSeconds;
+    double wallSeconds;
+};
+
+/* Private variables ---------------------------------------------------------*/
+
+static const Scenario_t scenarios[] = {
+    {"pos 1 turn",         Motor::MODE_COMMAND_POSITION, 51200, false, 1.5},
+    {"pos 1.8 deg",        Motor::MODE_COMMAND_POSITION, 256,   false, 0.5},
+    {"pos 1 turn, load",   Motor::MODE_COMMAND_POSITION, 51200, true,  1.5},
+    {"pos 1.8 deg, load",  Motor::MODE_COMMAND_POSITION, 256,   true,  0.5},
+    {"vel 10 r/s",         Motor::MODE_COMMAND_VELOCITY, 512000, false, 1.0},
+    {"vel 10 r/s, load",   Motor::MODE_COMMAND_VELOCITY, 512000, true,  1.0},
+};
+
+// Time the controller gets to hold still before each step
+static const double HOLD_SECONDS = 0.3;
+
+// Velocity steps settle on the mean over this many ticks (5 ms), the
+// detent and encoder ripple alone reach the 2% band at 10 r/s
+static const uint32_t VELOCITY_SETTLE_TICKS = 100;
+
+// Trajectory runs: 1 - cos moves of one turn at 2 Hz, a point every 10 ms
+// that arrives up to 4 ms late, buffered points are due 20 ms after sending
+static const double TRAJECTORY_AMPLITUDE = 51200;
+static const double TRAJECTORY_HZ = 2;
+static const double TRAJECTORY_SECONDS = 1.0;
+static const uint32_t TRAJECTORY_PERIOD_TICKS = 200;
+static const uint32_t TRAJECTORY_JITTER_TICKS = 80;
+static const uint32_t TRAJECTORY_LEAD_TICKS = 400;
+
+// Estimator runs: hold still, then a velocity step to 10 r/s
+static const double ESTIMATOR_HOLD_SECONDS = 0.2;
+static const double ESTIMATOR_RUN_SECONDS = 0.5;
+static const int32_t ESTIMATOR_VELOCITY = 512000;
+
+// Profile runs: two turns, loaded, at each acceleration as a trapezoid and as
+// an S-curve that takes PROFILE_JERK_SECONDS to reach the acceleration. The
+// velocity stays below where the supply can't push the current any more.
+static const int32_t PROFILE_DISTANCE = 2 * 51200;
+static const double PROFILE_VELOCITY = 10;                  // r/s
+static const double PROFILE_SECONDS = 1.0;
+static const double PROFILE_ACC[] = {200, 1000, 2000};    // r/s^2
+static const double PROFILE_JERK_SECONDS = 0.01;
+
+// Collision runs: the profile move at 10 r/s runs into an obstacle one turn
+// in, in cruise, as stiff as COLLISION_STIFFNESS. Without one they check
+// that normal moves don't trip at the accelerations of the profiles.
+static const int32_t COLLISION_DISTANCE = 51200;
+static const double COLLISION_STIFFNESS[] = {0, 0.5, 2, 10};      // Nm/rad
+static const uint32_t COLLISION_THRESHOLD = 16;                   // 4 sigma
+static const double COLLISION_RUN_SECONDS = 0.5;
+
+// Longest the auto-tune may take, excitation and analysis
+static const double AUTO_TUNE_TIMEOUT_SECONDS = 5;
+
+/* Private function prototypes -----------------------------------------------*/
+
+static Metrics_t RunScenario(MotorRig &_rig, const Scenario_t &_scenario, const Options_t &_opt, FILE* _trace);
+static void RunScenarios(MotorRig &_rig, const Options_t &_opt, FILE* _trace, const char* _title,
+                         double &_simTotal, double &_wallTotal);
+static TrajectoryMetrics_t RunTrajectory(MotorRig &_rig, bool _buffered);
+static void RunEstimators(MotorRig &_rig, EstimatorBase* const* _estimators, EstimatorMetrics_t* _metrics,
+                          int _count);
+static bool RunAutoTune(MotorRig &_rig, const Options_t &_opt);
+static ProfileMetrics_t RunProfile(MotorRig &_rig, const Options_t &_opt, double _acc, double _jerk);
+static CollisionMetrics_t RunCollision(MotorRig &_rig, const Options_t &_opt, double _acc, double _stiffness);
+
+/* Function implementations --------------------------------------------------*/
+
+// Usage: motor_bench [--noise LSB] [--eccentricity LSB] [--spi-error-rate P] [--reversed]
+//                    [--load-torque NM] [--load-inertia KGM2]
+//                    [--ideal-cali] [--stepwise-cali] [--pipelined] [--band STEPS]
+//                    [--estimator filter|pll] [--auto-tune]
+//                    [--trace FILE.csv]
+//
+// Runs the driver firmware's real Motor, calibration and driver code at
+// 20kHz on a simulated stepper and MT6816: calibrates the encoder like the
+// board does at power-up, then takes position and velocity steps with and
+// without load. Each line gives the step response and how many simulated
+// seconds ran per wall-clock second. Last it follows a path from jittery
+// points, streamed as position setpoints like the group frames do, and
+// buffered with their timestamps. Two-turn moves compare the trapezoidal
+// and the S-curve profile as the acceleration goes up, then run into an
+// extra load torque for the collision detection. The estimators are
+// compared on the same
+// encoder readings, while the one chosen runs the controller. With
+// --auto-tune the driver first picks its own DCE gains with the load on,
+// the steps then run with the default gains and again with those.
+int main(int argc, char** argv)
+{
+    Options_t opt;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--noise") && i + 1 < argc)
+            opt.encoder.noise_lsb = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--eccentricity") && i + 1 < argc)
+            opt.encoder.eccentricity_lsb = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--spi-error-rate") && i + 1 < argc)
+            opt.encoder.spi_error_rate = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--reversed"))
+            opt.encoder.reversed = true;
+        else if (!strcmp(argv[i], "--load-torque") && i + 1 < argc)
+            opt.load.torque = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--load-inertia") && i + 1 < argc)
+            opt.load.inertia = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--ideal-cali"))
+            opt.idealCalibration = true;
+        else if (!strcmp(argv[i], "--stepwise-cali"))
+            opt.stepwiseCalibration = true;
+        else if (!strcmp(argv[i], "--pipelined"))
+            opt.pipelinedRead = true;
+        else if (!strcmp(argv[i], "--auto-tune"))
+            opt.autoTune = true;
+        else if (!strcmp(argv[i], "--estimator") && i + 1 < argc)
+        {
+            const char* name = argv[++i];
+            if (!strcmp(name, "filter"))
+                opt.estimator = ESTIMATOR_FILTER;
+            else if (!strcmp(name, "pll"))
+                opt.estimator = ESTIMATOR_PLL;
+            else
+            {
+                fprintf(stderr, "unknown estimator %s\n", name);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--band") && i + 1 < argc)
+            opt.bandSteps = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+            opt.trace = argv[++i];
+        else
+        {
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    FILE* trace = nullptr;
+    if (!opt.trace.empty())
+    {
+        trace = fopen(opt.trace.c_str(), "w");
+        if (!trace)
+        {
+            fprintf(stderr, "can't open %s\n", opt.trace.c_str());
+            return 1;
+        }
+        fprintf(trace, "scenario,t,goal,position,true_position,velocity,current_a\n");
+    }
+
+    MotorRig rig(motor_sim::StepperParams_t(), opt.encoder);
+    rig.pipelined_read = opt.pipelinedRead;
+    rig.sweep_calibration = !opt.stepwiseCalibration;
+    rig.config.estimator = opt.estimator;
+    rig.boot();
+    double simTotal = 0, wallTotal = 0;
+
+    printf("encoder noise %g LSB, eccentricity %g LSB, SPI error rate %g, %s reads, %s estimator, "
+           "load %g Nm + %g kg*m^2\n\n",
+           opt.encoder.noise_lsb, opt.encoder.eccentricity_lsb, opt.encoder.spi_error_rate,
+           opt.pipelinedRead ? "pipelined" : "blocking", opt.estimator == ESTIMATOR_PLL ? "PLL" : "filter",
+           opt.load.torque, opt.load.inertia);
+
+    auto wallStart = Clock::now();
+    double simStart = rig.time();
+    bool calibrated;
+    if (opt.idealCalibration)
+    {
+        rig.load_ideal_calibration();
+        calibrated = true;
+    } else
+    {
+        calibrated = rig.calibrate();
+    }
+    double caliWall = std::chrono::duration<double>(Clock::now() - wallStart).count();
+    simTotal += rig.time() - simStart;
+    wallTotal += caliWall;
+
+    motor_sim::CaliError_t caliError = rig.calibration_error();
+    if (!calibrated || !caliError.valid)
+    {
+        fprintf(stderr, "calibration failed after %.1f s\n", rig.time() - simStart);
+        return 1;
+    }
+    printf("calibration %s: %.1f s, table error mean %+.1f max %.0f steps\n",
+           opt.idealCalibration ? "ideal, full table" : opt.stepwiseCalibration ? "stepwise" : "sweep",
+           rig.time() - simStart,
+           caliError.mean, caliError.max_abs);
+    // What the old full table would have made of the same hard steps
+    motor_sim::CaliError_t fullError = rig.full_table_error();
+    if (fullError.valid)
+        printf("full table from the same hard steps: error mean %+.1f max %.0f steps\n",
+               fullError.mean, fullError.max_abs);
+    printf("\n");
+
+    if (opt.autoTune)
+    {
+        // The steps depend on where the rotor starts, both tables start here
+        double tableAngle = rig.plant().angle();
+        BoardConfig_t defaults = rig.config;
+        simStart = rig.time();
+        wallStart = Clock::now();
+        bool tuned = RunAutoTune(rig, opt);
+        simTotal += rig.time() - simStart;
+        wallTotal += std::chrono::duration<double>(Clock::now() - wallStart).count();
+        if (!tuned)
+        {
+            fprintf(stderr, "auto-tune failed\n");
+            return 1;
+        }
+
+        BoardConfig_t tunedConfig = rig.config;
+        rig.config = defaults;
+        rig.plant().reset(tableAngle);
+        RunScenarios(rig, opt, nullptr, "default gains", simTotal, wallTotal);
+        printf("\n");
+        rig.config = tunedConfig;
+        rig.plant().reset(tableAngle);
+    }
+
+    RunScenarios(rig, opt, trace, opt.autoTune ? "tuned gains" : "scenario", simTotal, wallTotal);
+
+    printf("\n%-20s %9s %10s %10s\n", "trajectory", "delay", "rms error", "max error");
+    for (bool buffered : {false, true})
+    {
+        TrajectoryMetrics_t m = RunTrajectory(rig, buffered);
+        printf("%-20s %6.1f ms %7.1f st %7.1f st\n", buffered ? "buffered points" : "streamed setpoints",
+               m.delayMs, m.rmsError, m.maxError);
+        simTotal += HOLD_SECONDS + TRAJECTORY_SECONDS;
+    }
+
+    printf("\n%-20s %9s %10s %10s %12s\n", "profile, load", "move", "overshoot", "peak", "follow error");
+    for (double acc : PROFILE_ACC)
+    {
+        for (bool sCurve : {false, true})
+        {
+            ProfileMetrics_t m = RunProfile(rig, opt, acc, sCurve ? acc / PROFILE_JERK_SECONDS : 0);
+            std::string name = std::string(sCurve ? "S-curve " : "trapezoid ") + std::to_string((int) acc) + " r/s2";
+            printf("%-20s %6.1f ms %7.1f st %7.2f A %9.1f st\n", name.c_str(), m.moveMs, m.overshoot,
+                   m.peakCurrentA, m.maxFollowError);
+            simTotal += HOLD_SECONDS + PROFILE_SECONDS;
+        }
+    }
+
+    printf("\n%-20s %9s %10s %10s %10s %12s\n", "collision, load", "trip", "travel", "push back",
+           "error dev", "current dev");
+    for (double stiffness : COLLISION_STIFFNESS)
+    {
+        for (double acc : PROFILE_ACC)
+        {
+            if (stiffness > 0 && acc != PROFILE_ACC[0])
+                continue;
+            CollisionMetrics_t m = RunCollision(rig, opt, acc, stiffness);
+            char name[32];
+            if (stiffness > 0)
+                snprintf(name, sizeof(name), "obstacle %g Nm/rad", stiffness);
+            else
+                snprintf(name, sizeof(name), "none, %d r/s2", (int) acc);
+            if (m.falseTrip)
+                printf("%-20s tripped before contact\n", name);
+            else if (m.tripMs < 0)
+                printf("%-20s %9s\n", name, "none");
+            else
+                printf("%-20s %6.2f ms %7.0f st %6.3f Nm %7d st %9d mA\n", name, m.tripMs, m.travel,
+                       m.torque, m.errorDeviation, m.currentDeviation);
+            simTotal += HOLD_SECONDS + COLLISION_RUN_SECONDS;
+        }
+    }
+
+    FilterEstimator filterEstimator;
+    PllEstimator pllEstimator;
+    EstimatorBase* estimators[] = {&filterEstimator, &pllEstimator};
+    const char* estimatorNames[] = {"filter", "PLL"};
+    EstimatorMetrics_t estimatorMetrics[2];
+    RunEstimators(rig, estimators, estimatorMetrics, 2);
+    simTotal += ESTIMATOR_HOLD_SECONDS + ESTIMATOR_RUN_SECONDS;
+    printf("\n%-20s %12s %10s %12s %12s\n", "estimator", "still noise", "vel lag", "10r/s noise", "10r/s error");
+    for (int i = 0; i < 2; i++)
+        printf("%-20s %8.0f st/s %7.2f ms %8.0f st/s %9.1f st\n", estimatorNames[i],
+               estimatorMetrics[i].stillNoise, estimatorMetrics[i].lagMs,
+               estimatorMetrics[i].cruiseNoise, estimatorMetrics[i].cruisePosition);
+
+    printf("\n%.1f simulated s in %.2f wall s, %.0f simulated s per wall s\n",
+           simTotal, wallTotal, wallTotal > 0 ? simTotal / wallTotal : 0);
+    if (opt.encoder.spi_error_rate > 0)
+        printf("SPI bytes corrupted on the last boot: %u, parity errors %u, stale samples %u\n",
+               rig.encoder().spiErrorCount, rig.encoder().parityErrorCount, rig.encoder().staleSampleCount);
+
+    if (trace)
+        fclose(trace);
+
+    return 0;
+}
+
+
+// Position and velocity steps, one table
+static void RunScenarios(MotorRig &_rig, const Options_t &_opt, FILE* _trace, const char* _title,
+                         double &_simTotal, double &_wallTotal)
+{
+    printf("%-20s %9s %10s %10s %10s %9s %10s\n",
+           _title, "rise", "overshoot", "settle", "ss error", "peak", "sim/wall");
+    for (const Scenario_t &scenario : scenarios)
+    {
+        Metrics_t m = RunScenario(_rig, scenario, _opt, _trace);
+        _simTotal += m.simSeconds;
+        _wallTotal += m.wallSeconds;
+
+        bool velocity = scenario.mode == Motor::MODE_COMMAND_VELOCITY;
+        printf("%-20s %6.1f ms %9.1f%% %7.1f ms %7.2f %-2s %7.2f A %9.0fx\n",
+               scenario.name, m.riseMs, m.overshootPercent, m.settleMs,
+               m.steadyError, velocity ? "%" : "st", m.peakCurrentA,
+               m.wallSeconds > 0 ? m.simSeconds / m.wallSeconds : 0);
+    }
+}
+
+
+static Metrics_t RunScenario(MotorRig &_rig, const Scenario_t &_scenario, const Options_t &_opt, FILE* _trace)
+{
+    Metrics_t m = {-1, 0, -1, 0, 0, 0, 0};
+    bool velocity = _scenario.mode == Motor::MODE_COMMAND_VELOCITY;
+
+    _rig.plant().set_load(_scenario.loaded ? _opt.load : motor_sim::Load_t());
+
+    auto wallStart = Clock::now();
+    double simStart = _rig.time();
+
+    // Hold where it is first, the controller starts with the goal at home
+    _rig.boot();
+    _rig.tick();
+    Motor::Controller* ctrl = _rig.motor().controller;
+    int32_t hold = ctrl->GetPositionSteps();
+    ctrl->SetPositionSetPoint(hold);
+    ctrl->SetCtrlMode(Motor::MODE_COMMAND_POSITION);
+    _rig.run(HOLD_SECONDS);
+
+    const double stepsPerTurn = _rig.motor().MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS;
+    const double twoPi = 6.283185307179586;
+    double start = _rig.true_steps();
+    int32_t goal = _scenario.step;
+    if (velocity)
+    {
+        ctrl->SetCtrlMode(Motor::MODE_COMMAND_VELOCITY);
+        ctrl->SetVelocitySetPoint(goal);
+    } else
+    {
+        // From the setpoint it settled at, a fresh reading would add its noise
+        ctrl->SetPositionSetPoint(hold + goal);
+    }
+
+    auto ticks = (uint64_t) std::llround(_scenario.seconds / MotorRig::TICK_S);
+    double t10 = -1, t90 = -1, peak = 0, lastOutside = 0;
+    double tailSum = 0, tailSquares = 0;
+    uint64_t tailCount = 0;
+    uint64_t tailStart = ticks - ticks / 5;
+    std::vector<double> window(velocity ? VELOCITY_SETTLE_TICKS : 1, 0.0);
+    double windowSum = 0;
+
+    for (uint64_t i = 0; i < ticks; i++)
+    {
+        _rig.tick();
+        double t = (double) (i + 1) * MotorRig::TICK_S;
+
+        // Measured on the motor itself, not by the firmware
+        double y = velocity ?
+                   _rig.plant().velocity() / twoPi * stepsPerTurn :
+                   _rig.true_steps() - start;
+        double ia = _rig.plant().current(0), ib = _rig.plant().current(1);
+        double current = std::sqrt(ia * ia + ib * ib);
+
+        if (t10 < 0 && y >= 0.1 * goal)
+            t10 = t;
+        if (t90 < 0 && y >= 0.9 * goal)
+            t90 = t;
+        peak = std::max(peak, y);
+        m.peakCurrentA = std::max(m.peakCurrentA, current);
+
+        double &oldest = window[i % window.size()];
+        windowSum += y - oldest;
+        oldest = y;
+        double band = velocity ? 0.02 * goal : _opt.bandSteps;
+        if (std::fabs(windowSum / (double) window.size() - goal) > band)
+            lastOutside = t;
+
+        if (i >= tailStart)
+        {
+            double e = y - goal;
+            tailSum += std::fabs(e);
+            tailSquares += e * e;
+            tailCount++;
+        }
+
+        if (_trace && i % _opt.traceEvery == 0)
+            fprintf(_trace, "\"%s\",%.5f,%d,%.1f,%.1f,%.0f,%.3f\n", _scenario.name, t, goal,
+                    velocity ? ctrl->GetVelocitySteps() : (double) ctrl->GetPositionSteps(),
+                    velocity ? y : _rig.true_steps(),
+                    _rig.plant().velocity() / twoPi * stepsPerTurn, current);
+    }
+
+    if (t10 >= 0 && t90 >= 0)
+        m.riseMs = (t90 - t10) * 1000;
+    m.overshootPercent = peak > goal ? (peak - goal) / goal * 100 : 0;
+    if (lastOutside < _scenario.seconds - 2 * MotorRig::TICK_S)
+        m.settleMs = lastOutside * 1000;
+    m.steadyError = velocity ?
+                    std::sqrt(tailSquares / tailCount) / goal * 100 :
+                    tailSum / tailCount;
+
+    m.simSeconds = _rig.time() - simStart;
+    m.wallSeconds = std::chrono::duration<double>(Clock::now() - wallStart).count();
+
+    return m;
+}
+
+
+static TrajectoryMetrics_t RunTrajectory(MotorRig &_rig, bool _buffered)
+{
+    TrajectoryMetrics_t m = {0, 0, 0};
+    const double omega = 6.283185307179586 * TRAJECTORY_HZ;
+    auto path = [omega](double _t, double* _vel) {
+        _t = std::max(0.0, std::min(TRAJECTORY_SECONDS, _t));
+        *_vel = TRAJECTORY_AMPLITUDE / 2 * omega * std::sin(omega * _t);
+        return TRAJECTORY_AMPLITUDE / 2 * (1 - std::cos(omega * _t));
+    };
+
+    _rig.plant().set_load(motor_sim::Load_t());
+    _rig.boot();
+    _rig.tick();
+    Motor::Controller* ctrl = _rig.motor().controller;
+    MotionPlanner::TrajectoryTracker &tracker = _rig.motor().motionPlanner.trajectoryTracker;
+    int32_t hold = ctrl->GetPositionSteps();
+    ctrl->SetPositionSetPoint(hold);
+    ctrl->SetCtrlMode(Motor::MODE_COMMAND_POSITION);
+    _rig.run(HOLD_SECONDS);
+
+    double start = _rig.true_steps();
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<uint32_t> jitter(0, TRAJECTORY_JITTER_TICKS);
+    tracker.SyncClock(0);
+    if (_buffered)
+        ctrl->SetCtrlMode(Motor::MODE_COMMAND_Trajectory);
+
+    auto ticks = (uint32_t) std::llround(TRAJECTORY_SECONDS / MotorRig::TICK_S);
+    uint32_t sent = 0, arrival = jitter(rng);
+    std::vector<double> position;
+    for (uint32_t i = 0; i < ticks + TRAJECTORY_LEAD_TICKS; i++)
+    {
+        // A point is handled between ticks, like the CAN interrupt does
+        if (i == arrival && sent <= ticks)
+        {
+            double vel;
+            double pos = path(sent * MotorRig::TICK_S, &vel);
+            if (_buffered)
+                ctrl->AddTrajectoryPoint(sent + TRAJECTORY_LEAD_TICKS, hold + (int32_t) std::lround(pos),
+                                         (int32_t) std::lround(vel));
+            else
+                ctrl->SetPositionSetPoint(hold + (int32_t) std::lround(pos));
+            sent += TRAJECTORY_PERIOD_TICKS;
+            arrival = sent + jitter(rng);
+        }
+        _rig.tick();
+        position.push_back(_rig.true_steps() - start);
+    }
+
+    // Buffered points are due exactly their lead late, streamed goals get the
+    // lag that suits them best
+    double bestRms = -1;
+    for (uint32_t delay = 0; delay <= 2 * TRAJECTORY_LEAD_TICKS; delay += 10)
+    {
+        if (_buffered && delay != TRAJECTORY_LEAD_TICKS)
+            continue;
+        double squares = 0, maxError = 0;
+        uint32_t count = 0;
+        for (uint32_t i = delay; i < delay + ticks; i++)
+        {
+            double vel;
+            double e = position[i] - path((i - delay) * MotorRig::TICK_S, &vel);
+            squares += e * e;
+            maxError = std::max(maxError, std::fabs(e));
+            count++;
+        }
+        double rms = std::sqrt(squares / count);
+        if (bestRms < 0 || rms < bestRms)
+        {
+            bestRms = rms;
+            m.delayMs = delay * MotorRig::TICK_S * 1000;
+            m.rmsError = rms;
+            m.maxError = maxError;
+        }
+    }
+
+    return m;
+}
+
+
+static void RunEstimators(MotorRig &_rig, EstimatorBase* const* _estimators, EstimatorMetrics_t* _metrics,
+                          int _count)
+{
+    const double stepsPerTurn = _rig.motor().MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS;
+    const double twoPi = 6.283185307179586;
+
+    _rig.plant().set_load(motor_sim::Load_t());
+    _rig.boot();
+    _rig.tick();
+    Motor::Controller* ctrl = _rig.motor().controller;
+    ctrl->SetPositionSetPoint(ctrl->GetPositionSteps());
+    ctrl->SetCtrlMode(Motor::MODE_COMMAND_POSITION);
+    _rig.run(HOLD_SECONDS);
+
+    // Fed the same readings as the controller's own estimator
+    int32_t reading = ctrl->GetPositionSteps();
+    for (int e = 0; e < _count; e++)
+    {
+        _estimators[e]->Init(_rig.motor().motionPlanner.CONTROL_FREQUENCY);
+        _estimators[e]->Reset(reading);
+    }
+    double start = _rig.true_steps();
+
+    auto holdTicks = (uint32_t) std::llround(ESTIMATOR_HOLD_SECONDS / MotorRig::TICK_S);
+    auto ticks = holdTicks + (uint32_t) std::llround(ESTIMATOR_RUN_SECONDS / MotorRig::TICK_S);
+    std::vector<double> truePosition, trueVelocity;
+    std::vector<std::vector<double>> position(_count), velocity(_count);
+    for (uint32_t i = 0; i < ticks; i++)
+    {
+        if (i == holdTicks)
+        {
+            ctrl->SetCtrlMode(Motor::MODE_COMMAND_VELOCITY);
+            ctrl->SetVelocitySetPoint(ESTIMATOR_VELOCITY);
+        }
+        // The reading is taken at the start of the tick
+        truePosition.push_back(_rig.true_steps() - start);
+        trueVelocity.push_back(_rig.plant().velocity() / twoPi * stepsPerTurn);
+        _rig.tick();
+        reading = ctrl->GetPositionSteps();
+        for (int e = 0; e < _count; e++)
+        {
+            _estimators[e]->Update(reading);
+            position[e].push_back(_estimators[e]->position);
+            velocity[e].push_back(_estimators[e]->velocity);
+        }
+    }
+
+    // Reaches 10 r/s within 0.1 s at the default 100 r/s^2, cruises after 0.2 s
+    uint32_t accelEnd = holdTicks + (uint32_t) (0.1 / MotorRig::TICK_S);
+    uint32_t cruiseStart = holdTicks + (uint32_t) (0.2 / MotorRig::TICK_S);
+    for (int e = 0; e < _count; e++)
+    {
+        EstimatorMetrics_t &m = _metrics[e];
+        double squares = 0;
+        for (uint32_t i = 0; i < holdTicks; i++)
+            squares += velocity[e][i] * velocity[e][i];
+        m.stillNoise = std::sqrt(squares / holdTicks);
+
+        double bestRms = -1;
+        for (uint32_t delay = 0; delay <= 100; delay++)
+        {
+            double sum = 0;
+            for (uint32_t i = holdTicks + delay; i < accelEnd; i++)
+            {
+                double err = velocity[e][i] - trueVelocity[i - delay];
+                sum += err * err;
+            }
+            double rms = std::sqrt(sum / (accelEnd - holdTicks - delay));
+            if (bestRms < 0 || rms < bestRms)
+            {
+                bestRms = rms;
+                m.lagMs = delay * MotorRig::TICK_S * 1000;
+            }
+        }
+
+        // Positions relative to where each started, the table has its own offset
+        double offset = position[e][holdTicks - 1] - truePosition[holdTicks - 1];
+        double velSquares = 0, posSum = 0;
+        for (uint32_t i = cruiseStart; i < ticks; i++)
+        {
+            double err = velocity[e][i] - trueVelocity[i];
+            velSquares += err * err;
+            posSum += position[e][i] - offset - truePosition[i];
+        }
+        m.cruiseNoise = std::sqrt(velSquares / (ticks - cruiseStart));
+        m.cruisePosition = posSum / (ticks - cruiseStart);
+    }
+}
+
+
+// Tuned with the load on, like the joint it sits in
+static bool RunAutoTune(MotorRig &_rig, const Options_t &_opt)
+{
+    _rig.plant().set_load(_opt.load);
+    _rig.boot();
+    _rig.tick();
+    Motor::Controller* ctrl = _rig.motor().controller;
+    ctrl->SetPositionSetPoint(ctrl->GetPositionSteps());
+    ctrl->SetCtrlMode(Motor::MODE_COMMAND_POSITION);
+    _rig.run(HOLD_SECONDS);
+
+    double start = _rig.time();
+    const DceTuner &tuner = _rig.motor().dceTuner;
+    if (!ctrl->StartDceTune())
+        return false;
+    while (_rig.time() - start < AUTO_TUNE_TIMEOUT_SECONDS &&
+           (tuner.state == DceTuner::STATE_RUNNING || tuner.state == DceTuner::STATE_ANALYZING))
+        _rig.tick();
+    if (tuner.state != DceTuner::STATE_DONE)
+        return false;
+
+    // What the plant's rotor would read as, mA per turn/s^2
+    const motor_sim::StepperParams_t &params = _rig.plant().params();
+    double inertia = params.rotor_inertia * 6.283185307179586 / params.torque_constant * 1000;
+
+    const DceTuner::Result_t &result = tuner.result;
+    printf("auto-tune: %.1f s, inertia %.3f mA/(r/s^2) (rotor %.3f), stiffness %.0f mA/r, "
+           "damping %.2f mA/(r/s), delay %.2f ms\n",
+           _rig.time() - start, result.inertia, inertia, result.stiffness, result.damping, result.delay * 1000);
+    printf("           bandwidth %.1f Hz, kp %d kv %d ki %d kd %d\n\n",
+           result.bandwidth, result.kp, result.kv, result.ki, result.kd);
+
+    return true;
+}
+
+
+static ProfileMetrics_t RunProfile(MotorRig &_rig, const Options_t &_opt, double _acc, double _jerk)
+{
+    ProfileMetrics_t m = {-1, 0, 0, 0};
+    const double stepsPerTurn = _rig.motor().MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS;
+
+    BoardConfig_t saved = _rig.config;
+    _rig.config.velocityLimit = (int32_t) (PROFILE_VELOCITY * stepsPerTurn);
+    _rig.config.velocityAcc = (int32_t) (_acc * stepsPerTurn);
+    _rig.config.velocityJerk = (int32_t) (_jerk * stepsPerTurn / 1000);
+    _rig.plant().set_load(_opt.load);
+    _rig.boot();
+    _rig.tick();
+    Motor::Controller* ctrl = _rig.motor().controller;
+    int32_t hold = ctrl->GetPositionSteps();
+    ctrl->SetPositionSetPoint(hold);
+    ctrl->SetCtrlMode(Motor::MODE_COMMAND_POSITION);
+    _rig.run(HOLD_SECONDS);
+
+    const MotionPlanner::PositionTracker &tracker = _rig.motor().motionPlanner.positionTracker;
+    int32_t offset = _rig.motor().config.motionParams.encoderHomeOffset;
+    double start = _rig.true_steps();
+    ctrl->SetPositionSetPoint(hold + PROFILE_DISTANCE);
+
+    auto ticks = (uint64_t) std::llround(PROFILE_SECONDS / MotorRig::TICK_S);
+    double lastOutside = 0;
+    for (uint64_t i = 0; i < ticks; i++)
+    {
+        _rig.tick();
+        double t = (double) (i + 1) * MotorRig::TICK_S;
+        double y = _rig.true_steps() - start;
+        double planned = tracker.go_location - offset - hold;
+        double ia = _rig.plant().current(0), ib = _rig.plant().current(1);
+
+        m.peakCurrentA = std::max(m.peakCurrentA, std::sqrt(ia * ia + ib * ib));
+        m.overshoot = std::max(m.overshoot, y - PROFILE_DISTANCE);
+        m.maxFollowError = std::max(m.maxFollowError, std::fabs(y - planned));
+        if (std::fabs(y - PROFILE_DISTANCE) > _opt.bandSteps)
+            lastOutside = t;
+    }
+    if (lastOutside < PROFILE_SECONDS - 2 * MotorRig::TICK_S)
+        m.moveMs = lastOutside * 1000;
+
+    _rig.config = saved;
+    return m;
+}
+
+
+static CollisionMetrics_t RunCollision(MotorRig &_rig, const Options_t &_opt, double _acc, double _stiffness)
+{
+    CollisionMetrics_t m = {-1, false, 0, 0, 0, 0};
+    const double stepsPerTurn = _rig.motor().MOTOR_ONE_CIRCLE_SUBDIVIDE_STEPS;
+
+    BoardConfig_t saved = _rig.config;
+    _rig.config.velocityLimit = (int32_t) (PROFILE_VELOCITY * stepsPerTurn);
+    _rig.config.velocityAcc = (int32_t) (_acc * stepsPerTurn);
+    _rig.config.collisionThreshold = COLLISION_THRESHOLD;
+    _rig.plant().set_load(_opt.load);
+    _rig.boot();
+    _rig.tick();
+    Motor::Controller* ctrl = _rig.motor().controller;
+    int32_t hold = ctrl->GetPositionSteps();
+    ctrl->SetPositionSetPoint(hold);
+    ctrl->SetCtrlMode(Motor::MODE_COMMAND_POSITION);
+    _rig.run(HOLD_SECONDS);
+
+    const CollisionDetector &detector = _rig.motor().collisionDetector;
+    if (detector.tripCount > 0)
+    {
+        m.falseTrip = true;
+        _rig.config = saved;
+        return m;
+    }
+
+    motor_sim::Load_t load = _opt.load;
+    if (_stiffness > 0)
+    {
+        load.contact_angle = _rig.plant().angle() + COLLISION_DISTANCE / stepsPerTurn * 6.283185307179586;
+        load.contact_stiffness = _stiffness;
+    }
+    _rig.plant().set_load(load);
+    double contact = load.contact_angle / 6.283185307179586 * stepsPerTurn;
+    ctrl->SetPositionSetPoint(hold + PROFILE_DISTANCE);
+
+    auto ticks = (uint64_t) std::llround(COLLISION_RUN_SECONDS / MotorRig::TICK_S);
+    int64_t contactTick = -1;
+    double deepest = 0;
+    for (uint64_t i = 0; i < ticks; i++)
+    {
+        _rig.tick();
+        double y = _rig.true_steps();
+        if (contactTick < 0 && y > contact)
+            contactTick = (int64_t) i;
+        if (contactTick >= 0)
+            deepest = std::max(deepest, y - contact);
+
+        if (detector.tripCount > 0)
+        {
+            if (contactTick < 0)
+            {
+                m.falseTrip = true;
+            } else
+            {
+                m.tripMs = (double) ((int64_t) i - contactTick) * MotorRig::TICK_S * 1000;
+                m.travel = deepest;
+                m.torque = _stiffness * m.travel / stepsPerTurn * 6.283185307179586;
+                m.errorDeviation = detector.tripErrorDeviation;
+                m.currentDeviation = detector.tripCurrentDeviation;
+            }
+            break;
+        }
+    }
+
+    _rig.config = saved;
+    return m;
+}